@@ -4,8 +4,13 @@
 #pragma once
 
 #include <cstdlib>
+#include <deque>
+#include <functional>
+#include <memory>
 #include <random>
+#include <span>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
@@ -30,10 +35,65 @@ class T_clean_relation {
   DistributionSpec distribution_spec;
 };
 
-template <typename T>
+// Owns the cluster distributions of a CleanRelation.  Distributions of a
+// concrete class D are stored by value in a std::deque, which keeps them in
+// contiguous blocks and never moves them, and the slots of removed
+// distributions are reused.  Otherwise each distribution is allocated on its
+// own.
+template <typename D, bool by_value = !std::is_abstract_v<D>>
+class ClusterStorage {
+ public:
+  // make_distribution() returns a new D*, which the storage then owns.
+  template <typename F>
+  D* add(F&& make_distribution) {
+    return make_distribution();
+  }
+
+  void remove(D* d) { delete d; }
+};
+
+template <typename D>
+class ClusterStorage<D, true> {
+ public:
+  // make_distribution() returns a D, which is constructed in place, so D
+  // needn't be copyable or movable.
+  template <typename F>
+  D* add(F&& make_distribution) {
+    if (free_slots.empty()) {
+      return &slots.emplace_back(make_distribution).d;
+    }
+    // A removed distribution is only destroyed when its slot is reused, so
+    // that every slot holds a live D when the deque destroys them.
+    D* d = free_slots.back();
+    free_slots.pop_back();
+    std::destroy_at(d);
+    ::new (static_cast<void*>(d)) D(make_distribution());
+    return d;
+  }
+
+  void remove(D* d) { free_slots.push_back(d); }
+
+ private:
+  struct Slot {
+    template <typename F>
+    explicit Slot(F&& make_distribution) : d(make_distribution()) {}
+    D d;
+  };
+  std::deque<Slot> slots;
+  std::vector<D*> free_slots;
+};
+
+// D is the type of the clusters' distributions.  With the default, clusters
+// may be any Distribution<T> or Emission made from prior_spec.  A concrete
+// (preferably final) class D, which prior_spec must always make (see
+// make_prior), stores the clusters by value and lets the compiler resolve
+// the calls into them.  See clean_relation_from_spec for the classes used by
+// the IRM.
+template <typename T, typename D = Distribution<T>>
 class CleanRelation : public Relation<T> {
  public:
   typedef T ValueType;
+  typedef D DistributionType;
 
   // human-readable name
   const std::string name;
@@ -41,10 +101,9 @@ class CleanRelation : public Relation<T> {
   const std::vector<Domain*> domains;
   // Distribution or Emission spec over the relation's codomain.
   const std::variant<DistributionSpec, EmissionSpec> prior_spec;
-  // map from cluster multi-index to Distribution pointer
-  std::unordered_map<const std::vector<int>, Distribution<ValueType>*,
-                     VectorIntHash>
-      clusters;
+  // map from cluster multi-index to Distribution pointer, owned by
+  // cluster_storage
+  std::unordered_map<const std::vector<int>, D*, VectorIntHash> clusters;
   // map from item to observed data
   std::unordered_map<const T_items, ValueType, H_items> data;
   // map from domain name to reverse map from item to
@@ -53,6 +112,9 @@ class CleanRelation : public Relation<T> {
       std::string,
       std::unordered_map<T_item, std::unordered_set<T_items, H_items>>>
       data_r;
+  // Index of the hyperparameter grid point used by every cluster when the
+  // spec asks for shared hyperparameters, or -1 before the first transition.
+  int shared_hparam_index = -1;
 
   CleanRelation(const std::string& name,
                 const std::variant<DistributionSpec, EmissionSpec>& prior_spec,
@@ -68,20 +130,73 @@ class CleanRelation : public Relation<T> {
 
   ~CleanRelation() {
     for (auto [z, cluster] : clusters) {
-      delete cluster;
+      cluster_storage.remove(cluster);
     }
   }
 
-  Distribution<ValueType>* make_new_distribution(std::mt19937* prng) const {
-    auto var_to_dist = [&](auto dist_variant) {
-      return std::visit(
-          [&](auto v) { return reinterpret_cast<Distribution<ValueType>*>(v); },
-          dist_variant);
-    };
-    auto spec_to_dist = [&](auto spec) {
-      return var_to_dist(get_prior(spec, prng));
-    };
-    return std::visit(spec_to_dist, prior_spec);
+  // A new distribution from the prior, which the caller owns.
+  D* make_new_distribution(std::mt19937* prng) const {
+    D* d;
+    if constexpr (kClustersByValue) {
+      d = new D(make_prior<D>(std::get<DistributionSpec>(prior_spec), prng));
+    } else {
+      auto var_to_dist = [&](auto dist_variant) {
+        return std::visit([&](auto v) { return reinterpret_cast<D*>(v); },
+                          dist_variant);
+      };
+      auto spec_to_dist = [&](auto spec) {
+        return var_to_dist(get_prior(spec, prng));
+      };
+      d = std::visit(spec_to_dist, prior_spec);
+    }
+    if (shared_hparam_index >= 0) {
+      d->set_hyperparameter_grid_point(shared_hparam_index);
+    }
+    return d;
+  }
+
+  // A new cluster distribution from the prior, owned by cluster_storage
+  // until it is passed to remove_cluster.
+  D* add_cluster(std::mt19937* prng) {
+    D* d;
+    if constexpr (kClustersByValue) {
+      d = cluster_storage.add([&]() {
+        return make_prior<D>(std::get<DistributionSpec>(prior_spec), prng);
+      });
+      if (shared_hparam_index >= 0) {
+        d->set_hyperparameter_grid_point(shared_hparam_index);
+      }
+    } else {
+      d = cluster_storage.add([&]() { return make_new_distribution(prng); });
+    }
+    return d;
+  }
+
+  void remove_cluster(const std::vector<int>& z) {
+    cluster_storage.remove(clusters.at(z));
+    clusters.erase(z);
+  }
+
+  // Returns f(prior) for a new distribution prior from the prior, which is
+  // on the stack if D is a concrete class.
+  template <typename F>
+  auto with_prior(std::mt19937* prng, F&& f) const {
+    if constexpr (kClustersByValue) {
+      D prior = make_prior<D>(std::get<DistributionSpec>(prior_spec), prng);
+      if (shared_hparam_index >= 0) {
+        prior.set_hyperparameter_grid_point(shared_hparam_index);
+      }
+      return f(&prior);
+    } else {
+      std::unique_ptr<D> prior(make_new_distribution(prng));
+      return f(prior.get());
+    }
+  }
+
+  // Whether the clusters share one set of hyperparameters.
+  bool shares_hyperparameters() const {
+    return std::holds_alternative<DistributionSpec>(prior_spec) &&
+           std::get<DistributionSpec>(prior_spec).shared_hyperparameters;
   }
 
   // Incorporates a new vector of items and returns their cluster assignments.
@@ -98,7 +213,7 @@ class CleanRelation : public Relation<T> {
     T_items z = get_cluster_assignment(items);
     if (!clusters.contains(z)) {
       assert(prng != nullptr);
-      clusters[z] = make_new_distribution(prng);
+      clusters[z] = add_cluster(prng);
     }
     return z;
   }
@@ -135,9 +250,10 @@ class CleanRelation : public Relation<T> {
   void cleanup_clusters() {
     for (auto it = clusters.cbegin(); it != clusters.cend();) {
       if (it->second->N == 0) {
-        delete it->second;
+        cluster_storage.remove(it->second);
         clusters.erase(it++);
       } else {
+        it->second->forget_unincorporated();
         ++it;
       }
     }
@@ -149,8 +265,7 @@ class CleanRelation : public Relation<T> {
     std::vector<int> z = get_cluster_assignment(items);
     clusters.at(z)->unincorporate(value);
     if (clusters.at(z)->N == 0) {
-      delete clusters.at(z);
-      clusters.erase(z);
+      remove_cluster(z);
     }
     cleanup_data(items);
   }
@@ -202,10 +317,7 @@ class CleanRelation : public Relation<T> {
 
   double prior_logp(std::mt19937* prng, const ValueType& value) const {
     assert(prng != nullptr);
-    Distribution<ValueType>* prior = make_new_distribution(prng);
-    double prior_logp = prior->logp(value);
-    delete prior;
-    return prior_logp;
+    return with_prior(prng, [&](D* prior) { return prior->logp(value); });
   }
 
   double cluster_or_prior_logp_from_items(std::mt19937* prng,
@@ -226,15 +338,20 @@ class CleanRelation : public Relation<T> {
     return prior_logp(prng, value);
   }
 
+  ValueType sample_at_cluster(std::mt19937* prng,
+                              const std::vector<int>& z) const {
+    if (clusters.contains(z)) {
+      return clusters.at(z)->sample(prng);
+    }
+    return with_prior(prng, [&](D* prior) { return prior->sample(prng); });
+  }
+
   ValueType sample_at_items(std::mt19937* prng, const T_items& items) const {
     if (clusters_contains(items)) {
       T_items z = get_cluster_assignment(items);
       return clusters.at(z)->sample(prng);
     }
-    Distribution<ValueType>* prior = make_new_distribution(prng);
-    ValueType prior_sample = prior->sample(prng);
-    delete prior;
-    return prior_sample;
+    return with_prior(prng, [&](D* prior) { return prior->sample(prng); });
   }
 
   std::vector<int> get_cluster_assignment_gibbs(const T_items& items,
@@ -280,9 +397,7 @@ class CleanRelation : public Relation<T> {
       T_items z = get_cluster_assignment_gibbs(items, domain, item, table);
       double lp;
       if (!clusters.contains(z)) {
-        Distribution<ValueType>* tmp_dist = make_new_distribution(prng);
-        lp = tmp_dist->logp(x);
-        delete tmp_dist;
+        lp = with_prior(prng, [&](D* prior) { return prior->logp(x); });
       } else {
         lp = clusters.at(z)->logp(x);
       }
@@ -314,21 +429,27 @@ class CleanRelation : public Relation<T> {
     return m;
   }
 
+  // Returns the values at items_list as a contiguous array (std::vector<bool>
+  // cannot be viewed as a span).
+  std::unique_ptr<ValueType[]> get_values(
+      const std::vector<T_items>& items_list) const {
+    std::unique_ptr<ValueType[]> values(new ValueType[items_list.size()]);
+    for (size_t i = 0; i < items_list.size(); ++i) {
+      values[i] = data.at(items_list[i]);
+    }
+    return values;
+  }
+
   double logp_gibbs_exact_current(const std::vector<T_items>& items_list) {
     assert(!items_list.empty());
     T_items z = get_cluster_assignment(items_list[0]);
     auto cluster = clusters.at(z);
+    std::unique_ptr<ValueType[]> values = get_values(items_list);
+    std::span<const ValueType> xs(values.get(), items_list.size());
     double logp0 = cluster->logp_score();
-    for (const T_items& items : items_list) {
-      ValueType x = data.at(items);
-      // assert(z == get_cluster_assignment(items));
-      cluster->unincorporate(x);
-    }
+    cluster->incorporate_many(xs, -1.0);
     double logp1 = cluster->logp_score();
-    for (const T_items& items : items_list) {
-      ValueType x = data.at(items);
-      cluster->incorporate(x);
-    }
+    cluster->incorporate_many(xs);
     // Approximate floating point equality.
     assert(abs(cluster->logp_score() - logp0) <=
            std::numeric_limits<double>::epsilon() * abs(logp0));
@@ -342,27 +463,13 @@ class CleanRelation : public Relation<T> {
     assert(!items_list.empty());
     T_items z =
         get_cluster_assignment_gibbs(items_list[0], domain, item, table);
-
-    Distribution<ValueType>* prior = make_new_distribution(prng);
-    Distribution<ValueType>* cluster =
-        clusters.contains(z) ? clusters.at(z) : prior;
-    double logp0 = cluster->logp_score();
-    for (const T_items& items : items_list) {
-      // assert(z == get_cluster_assignment_gibbs(items, domain, item, table));
-      ValueType x = data.at(items);
-      cluster->incorporate(x);
-    }
-    const double logp1 = cluster->logp_score();
-    for (const T_items& items : items_list) {
-      ValueType x = data.at(items);
-      cluster->unincorporate(x);
+    std::unique_ptr<ValueType[]> values = get_values(items_list);
+    std::span<const ValueType> xs(values.get(), items_list.size());
+    if (clusters.contains(z)) {
+      return clusters.at(z)->logp_score_delta(xs);
     }
-
-    // Approximate floating point equality.
-    assert(abs(cluster->logp_score() - logp0) <=
-           std::numeric_limits<double>::epsilon() * abs(logp0));
-    delete prior;
-    return logp1 - logp0;
+    return with_prior(prng,
+                      [&](D* prior) { return prior->logp_score_delta(xs); });
   }
 
   std::vector<double> logp_gibbs_exact(const Domain& domain, const T_item& item,
@@ -432,13 +539,9 @@ class CleanRelation : public Relation<T> {
         z.push_back(zi);
         logp_w += wi;
       }
-      Distribution<ValueType>* prior = make_new_distribution(prng);
-      Distribution<ValueType>* cluster =
-          clusters.contains(z) ? clusters.at(z) : prior;
-      double logp_z = cluster->logp(value);
+      double logp_z = cluster_or_prior_logp(prng, z, value);
       double logp_zw = logp_z + logp_w;
       logps.push_back(logp_zw);
-      delete prior;
     }
     return logsumexp(logps);
   }
@@ -452,7 +555,8 @@ class CleanRelation : public Relation<T> {
   }
 
   void set_cluster_assignment_gibbs(const Domain& domain, const T_item& item,
-                                    int table, std::mt19937* prng) {
+                                    int table, std::mt19937* prng,
+                                    bool keep_empty_clusters = false) {
     [[maybe_unused]] int table_current = domain.get_cluster_assignment(item);
     assert(table != table_current);
     for (const T_items& items : data_r.at(domain.name).at(item)) {
@@ -461,19 +565,18 @@ class CleanRelation : public Relation<T> {
       T_items z_prev = get_cluster_assignment(items);
       auto cluster_prev = clusters.at(z_prev);
       cluster_prev->unincorporate(x);
-      if (cluster_prev->N == 0) {
-        delete clusters.at(z_prev);
-        clusters.erase(z_prev);
+      if (cluster_prev->N == 0 && !keep_empty_clusters) {
+        remove_cluster(z_prev);
       }
       // Move to desired cluster.
       T_items z_new = get_cluster_assignment_gibbs(items, domain, item, table);
       if (!clusters.contains(z_new)) {
         // Move to fresh cluster.
-        clusters[z_new] = make_new_distribution(prng);
+        clusters[z_new] = add_cluster(prng);
         clusters.at(z_new)->incorporate(x);
       } else {
         // Move to existing cluster.
-        assert((clusters.at(z_new)->N > 0));
+        assert(keep_empty_clusters || clusters.at(z_new)->N > 0);
         clusters.at(z_new)->incorporate(x);
       }
     }
@@ -509,12 +612,87 @@ class CleanRelation : public Relation<T> {
     return data_r;
   }
 
-  void transition_cluster_hparams(std::mt19937* prng, int num_theta_steps) {
+  // Calls f(i, distribution, cluster_prng) for the i-th cluster, for every
+  // cluster, concurrently on the threads of pool if it is not null.  Each
+  // cluster gets its own PRNG, seeded from prng in the order of clusters, so
+  // the result does not depend on the number of threads.
+  void for_each_cluster(std::mt19937* prng, ThreadPool* pool,
+                        const std::function<void(size_t, D*, std::mt19937*)>& f) {
+    std::vector<D*> distributions;
+    std::vector<std::mt19937::result_type> seeds;
     for (const auto& [c, distribution] : clusters) {
-      for (int i = 0; i < num_theta_steps; ++i) {
-        distribution->transition_theta(prng);
+      distributions.push_back(distribution);
+      seeds.push_back((*prng)());
+    }
+    auto run = [&](size_t i) {
+      std::mt19937 cluster_prng(seeds[i]);
+      f(i, distributions[i], &cluster_prng);
+    };
+    if (pool == nullptr) {
+      for (size_t i = 0; i < distributions.size(); ++i) {
+        run(i);
       }
-      distribution->transition_hyperparameters(prng);
+    } else {
+      pool->parallel_for(distributions.size(), run);
+    }
+  }
+
+  void transition_cluster_hparams(std::mt19937* prng, int num_theta_steps,
+                                  ThreadPool* pool = nullptr) {
+    if (shares_hyperparameters()) {
+      transition_shared_hparams(prng, num_theta_steps, pool);
+      return;
+    }
+    for_each_cluster(
+        prng, pool,
+        [&](size_t, D* distribution, std::mt19937* cluster_prng) {
+          for (int i = 0; i < num_theta_steps; ++i) {
+            distribution->transition_theta(cluster_prng);
+          }
+          distribution->transition_hyperparameters(cluster_prng);
+        });
+  }
+
+  // Samples one hyperparameter grid point for all clusters, with the grid
+  // posterior given by the sum of the clusters' logp_scores.  The clusters'
+  // counts are pooled, so the grid is evaluated once for the relation rather
+  // than once per cluster.
+  void transition_shared_hparams(std::mt19937* prng, int num_theta_steps,
+                                 ThreadPool* pool = nullptr) {
+    if (clusters.empty()) {
+      return;
+    }
+    if (num_theta_steps > 0) {
+      for_each_cluster(
+          prng, pool,
+          [&](size_t, D* distribution, std::mt19937* cluster_prng) {
+            for (int i = 0; i < num_theta_steps; ++i) {
+              distribution->transition_theta(cluster_prng);
+            }
+          });
+    }
+    // DistributionSpec only allows shared hyperparameters for distributions
+    // with a grid.
+    const Distribution<ValueType>* first = clusters.begin()->second;
+    const int grid_size = first->hyperparameter_grid_size();
+    assert(grid_size > 0);
+    std::vector<const Distribution<ValueType>*> distributions;
+    distributions.reserve(clusters.size());
+    for (const auto& [c, distribution] : clusters) {
+      distributions.push_back(distribution);
+    }
+    std::vector<double> logps(grid_size);
+    first->logp_score_hyperparameter_grid_sum(distributions, logps);
+    int i = sample_from_logps_skipping_nans(logps, prng);
+    if (i < 0) {
+      // Keep the clusters at the current grid point.
+      printf("Warning!  All shared hyperparameters for relation %s give "
+             "nans; keeping the current ones.\n", name.c_str());
+      return;
+    }
+    shared_hparam_index = i;
+    for (const auto& [c, distribution] : clusters) {
+      distribution->set_hyperparameter_grid_point(i);
     }
   }
 
@@ -523,13 +701,27 @@ class CleanRelation : public Relation<T> {
     if (clusters.contains(z)) {
       return clusters.at(z)->nearest(x);
     }
-    Distribution<ValueType>* d = make_new_distribution(prng);
-    ValueType n = d->nearest(x);
-    delete d;
-    return n;
+    return with_prior(prng, [&](D* prior) { return prior->nearest(x); });
   };
 
   // Disable copying.
   CleanRelation& operator=(const CleanRelation&) = delete;
   CleanRelation(const CleanRelation&) = delete;
+
+ private:
+  static constexpr bool kClustersByValue = !std::is_abstract_v<D>;
+
+  ClusterStorage<D> cluster_storage;
 };
+
+// Returns rel as a CleanRelation whose clusters are D's, failing if it isn't
+// one (e.g. because clean_relation_from_spec chose a different D).
+template <typename D, typename T>
+CleanRelation<T, D>* as_clean_relation(Relation<T>* rel) {
+  auto clean_rel = dynamic_cast<CleanRelation<T, D>*>(rel);
+  if (clean_rel == nullptr) {
+    printf("Relation is not a CleanRelation with the requested distribution\n");
+    std::exit(1);
+  }
+  return clean_rel;
+}
@@ -9,6 +9,7 @@
 
 #include "distributions/beta_bernoulli.hh"
 #include "distributions/bigram.hh"
+#include "distributions/normal.hh"
 #include "domain.hh"
 
 namespace tt = boost::test_tools;
@@ -166,6 +167,36 @@ BOOST_AUTO_TEST_CASE(test_incorporate_cluster) {
   BOOST_TEST(init_data_size = R1.get_data().size());
 }
 
+BOOST_AUTO_TEST_CASE(test_shared_hparams) {
+  std::mt19937 prng;
+  Domain D1("D1");
+  DistributionSpec spec("bernoulli(shared_hparams=true)");
+  CleanRelation<bool> R1("R1", spec, {&D1});
+  for (int i = 0; i < 20; ++i) {
+    D1.incorporate(&prng, i, i % 4);
+    R1.incorporate(&prng, {i}, i % 3 == 0);
+  }
+  BOOST_TEST(R1.clusters.size() == 4);
+
+  R1.transition_cluster_hparams(&prng, 1);
+  BOOST_TEST(R1.shared_hparam_index >= 0);
+  BetaBernoulli expected;
+  expected.set_hyperparameter_grid_point(R1.shared_hparam_index);
+  for (const auto& [z, cluster] : R1.clusters) {
+    BetaBernoulli* bb = reinterpret_cast<BetaBernoulli*>(cluster);
+    BOOST_TEST(bb->alpha == expected.alpha);
+    BOOST_TEST(bb->beta == expected.beta);
+  }
+
+  // New clusters start from the shared hyperparameters.
+  D1.incorporate(&prng, 20, 7);
+  R1.incorporate(&prng, {20}, true);
+  BetaBernoulli* bb = reinterpret_cast<BetaBernoulli*>(
+      R1.clusters.at(R1.get_cluster_assignment({20})));
+  BOOST_TEST(bb->alpha == expected.alpha);
+  BOOST_TEST(bb->beta == expected.beta);
+}
+
 BOOST_AUTO_TEST_CASE(test_cluster_logp_sample) {
   std::mt19937 prng;
   Domain D1("D1");
@@ -276,4 +307,45 @@ BOOST_AUTO_TEST_CASE(test_cleanup_clusters) {
   BOOST_TEST(R1.clusters_contains({5, 1}));
   BOOST_TEST(!R1.clusters_contains({0, 2}));
   BOOST_TEST(!R1.clusters_contains({5, 2}));
-}
\ No newline at end of file
+}
+
+BOOST_AUTO_TEST_CASE(test_clusters_by_value) {
+  std::mt19937 prng;
+  Domain D1("D1");
+  Domain D2("D2");
+  for (int i = 0; i < 6; ++i) {
+    D1.incorporate(&prng, i, i % 2);
+    D2.incorporate(&prng, i, i % 3);
+  }
+  DistributionSpec spec("normal");
+  CleanRelation<double> R1("R1", spec, {&D1, &D2});
+  CleanRelation<double, Normal> R2("R2", spec, {&D1, &D2});
+  for (int i = 0; i < 6; ++i) {
+    for (int j = 0; j < 6; ++j) {
+      R1.incorporate(&prng, {i, j}, i - 0.5 * j);
+      R2.incorporate(&prng, {i, j}, i - 0.5 * j);
+    }
+  }
+  BOOST_TEST(R1.clusters.size() == 6);
+  BOOST_TEST(R2.clusters.size() == 6);
+  BOOST_TEST(R2.logp_score() == R1.logp_score(), tt::tolerance(1e-12));
+  BOOST_TEST(R2.logp_gibbs_exact(D1, 2, {0, 1, 2}, &prng) ==
+                 R1.logp_gibbs_exact(D1, 2, {0, 1, 2}, &prng),
+             tt::per_element());
+
+  // Emptying a cluster frees its slot, and the next new cluster reuses it
+  // with a distribution fresh from the prior.
+  for (int i = 1; i < 6; i += 2) {
+    for (int j = 2; j < 6; j += 3) {
+      R1.unincorporate({i, j});
+      R2.unincorporate({i, j});
+    }
+  }
+  BOOST_TEST(R2.clusters.size() == 5);
+  BOOST_TEST(R2.logp_score() == R1.logp_score(), tt::tolerance(1e-12));
+  D1.incorporate(&prng, 6, 7);
+  R1.incorporate(&prng, {6, 0}, 4.0);
+  R2.incorporate(&prng, {6, 0}, 4.0);
+  BOOST_TEST(R2.clusters.at({7, 0})->N == 1);
+  BOOST_TEST(R2.logp_score() == R1.logp_score(), tt::tolerance(1e-12));
+}
@@ -5,31 +5,113 @@
 // Distribution<string>'s.
 
 #pragma once
-#include <iostream>
-#include <sstream>
+#include <charconv>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 
 #include "distributions/base.hh"
 
+// Parses the number at the start of x, after any whitespace and a '+' sign.
+// Like std::istringstream, this gives S() when x does not start with a number,
+// including when it starts with "nan" or "inf", which std::from_chars accepts.
+template <typename S>
+S parse_number(std::string_view x) {
+  size_t i = x.find_first_not_of(" \t\n\v\f\r");
+  if (i == std::string_view::npos) {
+    return S();
+  }
+  x.remove_prefix(i);
+  if (x.front() == '+' && x.length() > 1 && x[1] != '-') {
+    x.remove_prefix(1);
+  }
+  S s;
+  if (std::from_chars(x.data(), x.data() + x.length(), s).ec != std::errc()) {
+    return S();
+  }
+  if constexpr (std::is_floating_point_v<S>) {
+    if (!std::isfinite(s)) {
+      return S();
+    }
+  }
+  return s;
+}
+
+// Formats s as std::ostringstream does with its default flags.
+template <typename S>
+std::string format_number(const S& s) {
+  char buf[64];
+  std::to_chars_result r;
+  if constexpr (std::is_floating_point_v<S>) {
+    r = std::to_chars(buf, buf + sizeof(buf), s, std::chars_format::general,
+                      6);
+  } else {
+    r = std::to_chars(buf, buf + sizeof(buf), s);
+  }
+  return std::string(buf, r.ptr);
+}
+
+// Remembers the strings that format_number has made, so that a value is
+// formatted once however often it is sampled.  The strings only depend on the
+// values, so one AdapterCache can be shared by all of the clusters of a
+// relation, and it may be used from several threads.
+template <typename S>
+class AdapterCache {
+ public:
+  // The cache stops growing at this many entries; later values are formatted
+  // without being remembered.
+  static constexpr size_t kMaxEntries = 1 << 16;
+
+  std::string to_string(const S& s) {
+    {
+      std::shared_lock lock(mutex);
+      auto it = strings.find(s);
+      if (it != strings.end()) {
+        return it->second;
+      }
+    }
+    std::string x = format_number(s);
+    std::unique_lock lock(mutex);
+    if (strings.size() < kMaxEntries) {
+      strings.emplace(s, x);
+    }
+    return x;
+  }
+
+  size_t size() const {
+    std::shared_lock lock(mutex);
+    return strings.size();
+  }
+
+ private:
+  mutable std::shared_mutex mutex;
+  std::unordered_map<S, std::string> strings;
+};
+
 template <typename S = double>
 class DistributionAdapter : public Distribution<std::string> {
  public:
   // The underlying distribution that is being adapted.  We own the
   // underlying Distribution.
   Distribution<S>* d;
+  // Formatted samples, which may be shared with other DistributionAdapters.
+  // May be null, in which case every sample is formatted afresh.
+  std::shared_ptr<AdapterCache<S>> cache;
 
-  DistributionAdapter(Distribution<S>* dd) : d(dd) {};
+  DistributionAdapter(Distribution<S>* dd,
+                      std::shared_ptr<AdapterCache<S>> c = nullptr)
+      : d(dd), cache(std::move(c)) {};
 
-  S from_string(const std::string& x) const {
-    S s;
-    std::istringstream(x) >> s;
-    return s;
-  }
+  S from_string(const std::string& x) const { return parse_number<S>(x); }
 
   std::string to_string(const S& s) const {
-    std::ostringstream os;
-    os << s;
-    return os.str();
+    return cache ? cache->to_string(s) : format_number(s);
   }
 
   void incorporate(const std::string& x, double weight = 1.0) {
@@ -6,8 +6,11 @@
 #include "distributions/adapter.hh"
 
 #include <boost/test/included/unit_test.hpp>
+#include <sstream>
+#include <string>
 
 #include "distributions/normal.hh"
+#include "distributions/skellam.hh"
 namespace tt = boost::test_tools;
 
 BOOST_AUTO_TEST_CASE(adapt_normal) {
@@ -32,3 +35,46 @@ BOOST_AUTO_TEST_CASE(adapt_normal) {
   std::string samp = ad.sample(&prng);
 }
 
+
+BOOST_AUTO_TEST_CASE(adapt_skellam_shared_cache) {
+  auto cache = std::make_shared<AdapterCache<int>>();
+  DistributionAdapter<int> ad1(new Skellam, cache);
+  DistributionAdapter<int> ad2(new Skellam, cache);
+  ad1.incorporate("3");
+  ad2.incorporate("3");
+  ad2.incorporate("-4");
+  BOOST_TEST(ad1.d->N == 1);
+  BOOST_TEST(ad2.d->N == 2);
+  BOOST_TEST(ad1.logp("3") == ad1.d->logp(3), tt::tolerance(1e-6));
+  BOOST_TEST(ad2.logp("-4") == ad2.d->logp(-4), tt::tolerance(1e-6));
+
+  BOOST_TEST(ad1.to_string(-4) == "-4");
+  BOOST_TEST(ad2.to_string(-4) == "-4");
+  BOOST_TEST(cache->size() == 1);
+}
+
+BOOST_AUTO_TEST_CASE(conversions_match_streams) {
+  for (const std::string x :
+       {"5.0", "-2.5", "  7", "+3.25", "1e3", "0.1", ".5", "12abc", "abc", "",
+        " ", "+", "-", "+-1", "3.7", "-0", "nan", "NaN", "inf", "-inf",
+        "Infinity"}) {
+    double d;
+    std::istringstream(x) >> d;
+    BOOST_TEST(parse_number<double>(x) == d);
+    int i;
+    std::istringstream(x) >> i;
+    BOOST_TEST(parse_number<int>(x) == i);
+  }
+  for (double d : {0.0, 1.0, -2.5, 0.1, 1.0 / 3.0, 123456789.0, 1e-7, -1e20}) {
+    std::ostringstream os;
+    os << d;
+    BOOST_TEST(format_number(d) == os.str());
+  }
+  AdapterCache<int> cache;
+  for (int i : {0, 7, -42, 2147483647, 7}) {
+    std::ostringstream os;
+    os << i;
+    BOOST_TEST(cache.to_string(i) == os.str());
+  }
+  BOOST_TEST(cache.size() == 4);
+}
@@ -1,6 +1,13 @@
 #pragma once
+#include <algorithm>
 #include <cassert>
 #include <random>
+#include <span>
+#include <vector>
+
+// Incorporating and unincorporating fractional weights leaves rounding
+// residue, so accumulated weights below this in magnitude count as zero.
+constexpr double kZeroWeightTolerance = 1e-9;
 
 template <typename T>
 class Distribution {
@@ -36,6 +43,31 @@ class Distribution {
   // = \integral_{theta} P(data | theta) P(theta | alpha) dtheta.
   virtual double logp_score() const = 0;
 
+  // Writes logp(xs[i]) to out[i]. xs and out must have the same size.
+  virtual void logp_many(std::span<const T> xs, std::span<double> out) const {
+    assert(xs.size() == out.size());
+    for (size_t i = 0; i < xs.size(); ++i) {
+      out[i] = logp(xs[i]);
+    }
+  }
+
+  // Incorporates every x in xs with the same weight.
+  virtual void incorporate_many(std::span<const T> xs, double weight = 1.0) {
+    for (const T& x : xs) {
+      incorporate(x, weight);
+    }
+  }
+
+  // The change in logp_score() from incorporating every x in xs. The
+  // distribution is left unchanged.
+  virtual double logp_score_delta(std::span<const T> xs) {
+    double logp0 = logp_score();
+    incorporate_many(xs);
+    double logp1 = logp_score();
+    incorporate_many(xs, -1.0);
+    return logp1 - logp0;
+  }
+
   // A sample from the predictive distribution.
   virtual T sample(std::mt19937* prng) = 0;
 
@@ -44,6 +76,37 @@ class Distribution {
   // e^logp_score() under those hyperparameters.
   virtual void transition_hyperparameters(std::mt19937* prng) = 0;
 
+  // Distributions whose hyperparameters range over a finite grid can expose
+  // it, so that a relation can choose one grid point shared by all of its
+  // clusters.  The default of 0 means the distribution has no such grid.
+  virtual int hyperparameter_grid_size() const { return 0; }
+
+  // Writes to out[i] the logp_score() the distribution would have at the i-th
+  // grid point.  out must have hyperparameter_grid_size() entries.
+  virtual void logp_score_hyperparameter_grid(std::span<double> out) const {
+    assert(out.empty());
+  }
+
+  // Writes to out[i] the sum of the logp_score()s that the distributions in
+  // ds, which must all have the same type and shape as this one, would have at
+  // the i-th grid point.  Distributions whose score depends only on counts
+  // override this to pool equal counts across ds, so that each term is
+  // evaluated once rather than once per distribution.
+  virtual void logp_score_hyperparameter_grid_sum(
+      std::span<const Distribution<T>* const> ds, std::span<double> out) const {
+    std::fill(out.begin(), out.end(), 0.0);
+    std::vector<double> logps(out.size());
+    for (const Distribution<T>* d : ds) {
+      d->logp_score_hyperparameter_grid(logps);
+      for (size_t i = 0; i < out.size(); ++i) {
+        out[i] += logps[i];
+      }
+    }
+  }
+
+  // Sets the hyperparameters to the i-th grid point.
+  virtual void set_hyperparameter_grid_point(int i) { assert(false); }
+
   // Set the current latent values to a sample from the parameter prior.
   // Only children of NonconjugateDistribution need define this.
   virtual void init_theta(std::mt19937* prng) {};
@@ -52,6 +115,10 @@ class Distribution {
   // NonconjugateDistribution need define this.
   virtual void transition_theta(std::mt19937* prng) {};
 
+  // Distributions may keep what they need to incorporate an unincorporated x
+  // again exactly as before (see BigramStringEmission).  Forget it.
+  virtual void forget_unincorporated() {}
+
   // Return the value nearest to x that is given non-zero probability by
   // this distribution.
   virtual T nearest(const T& x) const {
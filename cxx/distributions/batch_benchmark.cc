@@ -0,0 +1,121 @@
+// Copyright 2024
+// See LICENSE.txt
+
+// Compares the throughput of scoring and incorporating values one virtual call
+// at a time against the batch entry points of Distribution.
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "distributions/base.hh"
+#include "distributions/beta_bernoulli.hh"
+#include "distributions/dirichlet_categorical.hh"
+#include "distributions/normal.hh"
+#include "distributions/skellam.hh"
+#include "distributions/zero_mean_normal.hh"
+
+namespace {
+
+const int kBatchSize = 1000;
+const int kRepeats = 2000;
+
+template <typename F>
+double ns_per_value(F f) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kRepeats; ++i) {
+    f();
+  }
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / (kRepeats * kBatchSize);
+}
+
+template <typename T>
+void benchmark(const std::string& name, Distribution<T>* dist,
+               const std::unique_ptr<T[]>& values) {
+  std::span<const T> xs(values.get(), kBatchSize);
+  std::vector<double> out(kBatchSize);
+  double sink = 0.0;
+
+  double logp_scalar = ns_per_value([&]() {
+    for (size_t i = 0; i < xs.size(); ++i) {
+      out[i] = dist->logp(xs[i]);
+    }
+    sink += out[0];
+  });
+  double logp_batch = ns_per_value([&]() {
+    dist->logp_many(xs, out);
+    sink += out[0];
+  });
+
+  double incorporate_scalar = ns_per_value([&]() {
+    for (const T& x : xs) {
+      dist->incorporate(x);
+    }
+    for (const T& x : xs) {
+      dist->unincorporate(x);
+    }
+  });
+  double incorporate_batch = ns_per_value([&]() {
+    dist->incorporate_many(xs);
+    dist->incorporate_many(xs, -1.0);
+  });
+
+  double delta_scalar = ns_per_value([&]() {
+    double logp0 = dist->logp_score();
+    for (const T& x : xs) {
+      dist->incorporate(x);
+    }
+    sink += dist->logp_score() - logp0;
+    for (const T& x : xs) {
+      dist->unincorporate(x);
+    }
+  });
+  double delta_batch =
+      ns_per_value([&]() { sink += dist->logp_score_delta(xs); });
+
+  printf("%-22s %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f  (%g)\n", name.c_str(),
+         logp_scalar, logp_batch, incorporate_scalar, incorporate_batch,
+         delta_scalar, delta_batch, sink);
+}
+
+}  // namespace
+
+int main() {
+  std::mt19937 prng(0);
+  std::normal_distribution<double> normal(0.0, 3.0);
+  std::uniform_int_distribution<int> category(0, 9);
+  std::bernoulli_distribution coin(0.3);
+
+  std::unique_ptr<bool[]> bools(new bool[kBatchSize]);
+  std::unique_ptr<int[]> categories(new int[kBatchSize]);
+  std::unique_ptr<int[]> ints(new int[kBatchSize]);
+  std::unique_ptr<double[]> doubles(new double[kBatchSize]);
+  for (int i = 0; i < kBatchSize; ++i) {
+    bools[i] = coin(prng);
+    categories[i] = category(prng);
+    ints[i] = category(prng) - 5;
+    doubles[i] = normal(prng);
+  }
+
+  printf("ns per value; scalar vs batch\n");
+  printf("%-22s %8s %8s %8s %8s %8s %8s\n", "distribution", "logp", "many",
+         "incorp", "many", "delta", "batch");
+
+  BetaBernoulli beta_bernoulli;
+  benchmark<bool>("BetaBernoulli", &beta_bernoulli, bools);
+  DirichletCategorical dirichlet_categorical(10);
+  benchmark<int>("DirichletCategorical", &dirichlet_categorical, categories);
+  Normal normal_dist;
+  benchmark<double>("Normal", &normal_dist, doubles);
+  ZeroMeanNormal zero_mean_normal;
+  benchmark<double>("ZeroMeanNormal", &zero_mean_normal, doubles);
+  Skellam skellam;
+  benchmark<int>("Skellam", &skellam, ints);
+  return 0;
+}
@@ -3,10 +3,41 @@
 
 #include "distributions/beta_bernoulli.hh"
 
+#include <algorithm>
 #include <cassert>
+#include <map>
+#include <vector>
 
 #include "util_math.hh"
 
+namespace {
+
+// The hyperparameter grid, with lbeta(alpha, beta) at every grid point.  These
+// don't depend on the data, so they are computed once and shared by every
+// BetaBernoulli.
+struct BetaBernoulliGrid {
+  std::vector<double> alphas;
+  std::vector<double> betas;
+  // prior_lbeta[i * betas.size() + j] = lbeta(alphas[i], betas[j]).
+  std::vector<double> prior_lbeta;
+};
+
+const BetaBernoulliGrid& beta_bernoulli_grid() {
+  static const BetaBernoulliGrid grid = []() {
+    BetaBernoulliGrid g{log_linspace(1e-4, 1e4, 10, true),
+                        log_linspace(1e-4, 1e4, 10, true), {}};
+    for (double a : g.alphas) {
+      for (double b : g.betas) {
+        g.prior_lbeta.push_back(lbeta(a, b));
+      }
+    }
+    return g;
+  }();
+  return grid;
+}
+
+}  // namespace
+
 void BetaBernoulli::incorporate(const bool& x, double weight) {
   assert(x == 0 || x == 1);
   N += weight;
@@ -20,6 +51,30 @@ double BetaBernoulli::logp(const bool& x) const {
   return log_numer - log_denom;
 }
 
+void BetaBernoulli::logp_many(std::span<const bool> xs,
+                              std::span<double> out) const {
+  assert(xs.size() == out.size());
+  const double log_denom = log(N + alpha + beta);
+  const double logp_true = log(s + alpha) - log_denom;
+  const double logp_false = log(N - s + beta) - log_denom;
+  for (size_t i = 0; i < xs.size(); ++i) {
+    out[i] = xs[i] ? logp_true : logp_false;
+  }
+}
+
+void BetaBernoulli::incorporate_many(std::span<const bool> xs, double weight) {
+  int num_true = std::count(xs.begin(), xs.end(), true);
+  N += weight * xs.size();
+  s += weight * num_true;
+}
+
+double BetaBernoulli::logp_score_delta(std::span<const bool> xs) {
+  int num_true = std::count(xs.begin(), xs.end(), true);
+  int num_false = xs.size() - num_true;
+  return lbeta(s + num_true + alpha, N - s + num_false + beta) -
+         lbeta(s + alpha, N - s + beta);
+}
+
 double BetaBernoulli::logp_score() const {
   double v1 = lbeta(s + alpha, N - s + beta);
   double v2 = lbeta(alpha, beta);
@@ -35,26 +90,92 @@ bool BetaBernoulli::sample(std::mt19937* prng) {
 }
 
 void BetaBernoulli::transition_hyperparameters(std::mt19937* prng) {
-  std::vector<double> logps;
-  std::vector<std::pair<double, double>> hypers;
-  // C++ doesn't yet allow range for-loops over existing variables.  Sigh.
-  for (double alphat : alpha_grid) {
-    for (double betat : beta_grid) {
-      alpha = alphat;
-      beta = betat;
-      double lp = logp_score();
-      if (!std::isnan(lp)) {
-        logps.push_back(logp_score());
-        hypers.push_back(std::make_pair(alpha, beta));
-      }
-    }
-  }
-  if (logps.empty()) {
+  std::vector<double> logps(hyperparameter_grid_size());
+  logp_score_hyperparameter_grid(logps);
+  int i = sample_from_logps_skipping_nans(logps, prng);
+  if (i < 0) {
     printf("Warning! All hyperparameters for BetaBernoulli give nans!\n");
     assert(false);
   } else {
-    int i = sample_from_logps(logps, prng);
-    alpha = hypers[i].first;
-    beta = hypers[i].second;
+    set_hyperparameter_grid_point(i);
   }
 }
+
+int BetaBernoulli::hyperparameter_grid_size() const {
+  const BetaBernoulliGrid& grid = beta_bernoulli_grid();
+  return grid.alphas.size() * grid.betas.size();
+}
+
+void BetaBernoulli::logp_score_hyperparameter_grid(
+    std::span<double> out) const {
+  // logp_score = lgamma(s + alpha) + lgamma(N - s + beta)
+  //              - lgamma(N + alpha + beta) - lbeta(alpha, beta),
+  // so only the middle term needs to be computed for every pair in the grid.
+  assert(std::ssize(out) == hyperparameter_grid_size());
+  const BetaBernoulliGrid& grid = beta_bernoulli_grid();
+  std::vector<double> lgamma_s_alpha(grid.alphas.size());
+  for (size_t i = 0; i < grid.alphas.size(); ++i) {
+    lgamma_s_alpha[i] = log_gamma(s + grid.alphas[i]);
+  }
+  std::vector<double> lgamma_f_beta(grid.betas.size());
+  for (size_t j = 0; j < grid.betas.size(); ++j) {
+    lgamma_f_beta[j] = log_gamma(N - s + grid.betas[j]);
+  }
+  for (size_t i = 0; i < grid.alphas.size(); ++i) {
+    for (size_t j = 0; j < grid.betas.size(); ++j) {
+      const size_t k = i * grid.betas.size() + j;
+      out[k] = lgamma_s_alpha[i] + lgamma_f_beta[j] -
+               log_gamma(N + grid.alphas[i] + grid.betas[j]) -
+               grid.prior_lbeta[k];
+    }
+  }
+}
+
+void BetaBernoulli::logp_score_hyperparameter_grid_sum(
+    std::span<const Distribution<bool>* const> ds,
+    std::span<double> out) const {
+  // Summed over ds, each of the terms of logp_score depends on one of s, N - s
+  // and N, so each distinct value of them is evaluated once per grid point.
+  assert(std::ssize(out) == hyperparameter_grid_size());
+  const BetaBernoulliGrid& grid = beta_bernoulli_grid();
+  std::map<double, double> s_multiplicities;
+  std::map<double, double> f_multiplicities;
+  std::map<double, double> n_multiplicities;
+  for (const Distribution<bool>* d : ds) {
+    const auto* bb = static_cast<const BetaBernoulli*>(d);
+    s_multiplicities[bb->s] += 1.0;
+    f_multiplicities[bb->N - bb->s] += 1.0;
+    n_multiplicities[bb->N] += 1.0;
+  }
+  std::vector<double> lgamma_s_alpha(grid.alphas.size(), 0.0);
+  for (size_t i = 0; i < grid.alphas.size(); ++i) {
+    for (const auto& [s, m] : s_multiplicities) {
+      lgamma_s_alpha[i] += m * log_gamma(s + grid.alphas[i]);
+    }
+  }
+  std::vector<double> lgamma_f_beta(grid.betas.size(), 0.0);
+  for (size_t j = 0; j < grid.betas.size(); ++j) {
+    for (const auto& [f, m] : f_multiplicities) {
+      lgamma_f_beta[j] += m * log_gamma(f + grid.betas[j]);
+    }
+  }
+  const double num_ds = ds.size();
+  for (size_t i = 0; i < grid.alphas.size(); ++i) {
+    for (size_t j = 0; j < grid.betas.size(); ++j) {
+      const size_t k = i * grid.betas.size() + j;
+      double lp = lgamma_s_alpha[i] + lgamma_f_beta[j] -
+                  num_ds * grid.prior_lbeta[k];
+      for (const auto& [n, m] : n_multiplicities) {
+        lp -= m * log_gamma(n + grid.alphas[i] + grid.betas[j]);
+      }
+      out[k] = lp;
+    }
+  }
+}
+
+void BetaBernoulli::set_hyperparameter_grid_point(int i) {
+  assert(i >= 0 && i < hyperparameter_grid_size());
+  const BetaBernoulliGrid& grid = beta_bernoulli_grid();
+  alpha = grid.alphas[i / grid.betas.size()];
+  beta = grid.betas[i % grid.betas.size()];
+}
@@ -3,31 +3,42 @@
 
 #pragma once
 #include <cassert>
+#include <span>
 
 #include "distributions/base.hh"
 #include "util_math.hh"
 
-class BetaBernoulli : public Distribution<bool> {
+class BetaBernoulli final : public Distribution<bool> {
  public:
   double alpha = 1;  // hyperparameter
   double beta = 1;   // hyperparameter
   int s = 0;         // sum of observed values
 
-  std::vector<double> alpha_grid;
-  std::vector<double> beta_grid;
-
-  BetaBernoulli() {
-    alpha_grid = log_linspace(1e-4, 1e4, 10, true);
-    beta_grid = log_linspace(1e-4, 1e4, 10, true);
-  }
-
   void incorporate(const bool& x, double weight = 1.0);
 
   double logp(const bool& x) const;
 
+  void logp_many(std::span<const bool> xs, std::span<double> out) const;
+
+  void incorporate_many(std::span<const bool> xs, double weight = 1.0);
+
+  double logp_score_delta(std::span<const bool> xs);
+
   double logp_score() const;
 
   bool sample(std::mt19937* prng);
 
   void transition_hyperparameters(std::mt19937* prng);
+
+  // The grid is the product of 10 values of alpha and 10 values of beta, each
+  // log-spaced from 1e-4 to 1e4, with the index of beta varying fastest.
+  int hyperparameter_grid_size() const;
+
+  void logp_score_hyperparameter_grid(std::span<double> out) const;
+
+  void logp_score_hyperparameter_grid_sum(
+      std::span<const Distribution<bool>* const> ds,
+      std::span<double> out) const;
+
+  void set_hyperparameter_grid_point(int i);
 };
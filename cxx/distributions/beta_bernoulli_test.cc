@@ -141,3 +141,48 @@ BOOST_AUTO_TEST_CASE(test_sample_and_log_prob) {
   BOOST_TEST(abs(p - (1. * counts[0] / num_samples)) <= 3 * stddev);
   BOOST_TEST(abs((1- p) - (1. * counts[1] / num_samples)) <= 3 * stddev);
 }
+
+BOOST_AUTO_TEST_CASE(test_batch) {
+  BetaBernoulli bb, bb_batch;
+  bb.incorporate(true);
+  bb_batch.incorporate(true);
+  const bool xs[] = {true, false, false, true, true};
+
+  double out[2];
+  bb.logp_many(std::span<const bool>(xs, 2), out);
+  BOOST_TEST(out[0] == bb.logp(true), tt::tolerance(1e-12));
+  BOOST_TEST(out[1] == bb.logp(false), tt::tolerance(1e-12));
+
+  double score = bb.logp_score();
+  for (bool x : xs) {
+    bb.incorporate(x);
+  }
+  BOOST_TEST(bb_batch.logp_score_delta(xs) == bb.logp_score() - score,
+             tt::tolerance(1e-12));
+  bb_batch.incorporate_many(xs);
+  BOOST_TEST(bb_batch.N == bb.N);
+  BOOST_TEST(bb_batch.logp_score() == bb.logp_score(), tt::tolerance(1e-12));
+}
+
+BOOST_AUTO_TEST_CASE(test_logp_score_hyperparameter_grid_sum) {
+  std::vector<BetaBernoulli> bbs(4);
+  for (bool x : {true, false, true}) {
+    bbs[0].incorporate(x);
+    bbs[1].incorporate(x);
+  }
+  bbs[2].incorporate(false);
+  std::vector<const Distribution<bool>*> ds;
+  std::vector<double> expected(bbs[0].hyperparameter_grid_size(), 0.0);
+  std::vector<double> grid(expected.size());
+  for (const BetaBernoulli& bb : bbs) {
+    ds.push_back(&bb);
+    bb.logp_score_hyperparameter_grid(grid);
+    for (size_t i = 0; i < grid.size(); ++i) {
+      expected[i] += grid[i];
+    }
+  }
+  bbs[0].logp_score_hyperparameter_grid_sum(ds, grid);
+  for (size_t i = 0; i < grid.size(); ++i) {
+    BOOST_TEST(grid[i] == expected[i], tt::tolerance(1e-9));
+  }
+}
@@ -3,10 +3,101 @@
 
 #include "distributions/bigram.hh"
 
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <cmath>
 #include <cstdlib>
+#include <map>
+#include <utility>
 
 #include "distributions/base.hh"
+#include "util_math.hh"
+
+namespace {
+
+const std::vector<double> kAlphaGrid = ALPHA_GRID;
+
+// Returns the count of the transitions in row to index `next`.
+double cell_count(const Bigram::TransitionRow& row, size_t next) {
+  for (const auto& [n, count] : row.counts) {
+    if (n == next) {
+      return count;
+    }
+  }
+  return 0.0;
+}
+
+// The transitions of a single string seen so far, so that each transition of
+// the string can be conditioned on the earlier ones without touching the
+// stored rows.  The distinct transitions are kept in a fixed-size array, and
+// only spill onto the heap for strings longer than any in our data.  The
+// cells of each row are chained together, so that lookups only visit the
+// transitions from the same character.
+class LocalTransitions {
+ public:
+  // num_rows is the number of characters that transitions can start from.
+  explicit LocalTransitions(size_t num_rows) {
+    assert(num_rows <= kMaxRows);
+    std::fill_n(row_counts.begin(), num_rows, 0);
+  }
+
+  // Returns the number of earlier transitions from `current`, and the number
+  // of those that went to `next`, then records a transition from `current` to
+  // `next`.
+  std::pair<int, int> add(size_t current, size_t next) {
+    const int row_count = row_counts[current]++;
+    if (row_count > 0) {
+      for (int i = row_heads[current]; i >= 0; i = cell(i).next_in_row) {
+        if (cell(i).next == next) {
+          return {row_count, cell(i).count++};
+        }
+      }
+    }
+    const Cell c{next, 1, row_count > 0 ? row_heads[current] : -1};
+    if (num_cells < kCapacity) {
+      cells[num_cells] = c;
+    } else {
+      spilled_cells.push_back(c);
+    }
+    row_heads[current] = num_cells++;
+    return {row_count, 0};
+  }
+
+  // Calls f(next, count) for each recorded transition from `current`.
+  template <typename F>
+  void for_each_in_row(size_t current, F f) {
+    if (row_counts[current] == 0) {
+      return;
+    }
+    for (int i = row_heads[current]; i >= 0; i = cell(i).next_in_row) {
+      f(cell(i).next, cell(i).count);
+    }
+  }
+
+ private:
+  struct Cell {
+    size_t next;
+    int count;
+    int next_in_row;  // The index of the row's previous cell, or -1.
+  };
+
+  Cell& cell(int i) {
+    return i < kCapacity ? cells[i] : spilled_cells[i - kCapacity];
+  }
+
+  // Every char plus the start/stop symbol.
+  static constexpr size_t kMaxRows = 257;
+  static constexpr int kCapacity = 128;
+  // row_heads[i] is only valid while row_counts[i] > 0.
+  std::array<int, kMaxRows> row_counts;
+  std::array<int, kMaxRows> row_heads;
+  std::array<Cell, kCapacity> cells;
+  int num_cells = 0;
+  std::vector<Cell> spilled_cells;
+};
+
+}  // namespace
 
 void Bigram::assert_valid_char(const char c) const {
   assert(c >= min_char && c <= max_char);
@@ -34,6 +125,39 @@ std::vector<size_t> Bigram::string_to_indices(const std::string& str) const {
   return inds;
 }
 
+const Bigram::TransitionRow* Bigram::find_row(size_t current) const {
+  const int position = row_positions[current];
+  return position < 0 ? nullptr : &rows[position];
+}
+
+void Bigram::add_transition(size_t current, size_t next, double weight) {
+  if (row_positions[current] < 0) {
+    row_positions[current] = rows.size();
+    rows.push_back(TransitionRow{current});
+  }
+  TransitionRow& row = rows[row_positions[current]];
+  row.total += weight;
+  auto it = std::find_if(row.counts.begin(), row.counts.end(),
+                         [&](const auto& c) { return c.first == next; });
+  if (it == row.counts.end()) {
+    row.counts.emplace_back(next, weight);
+    return;
+  }
+  it->second += weight;
+  if (std::abs(it->second) < kZeroWeightTolerance) {
+    row.total -= it->second;
+    row.counts.erase(it);
+    if (row.counts.empty()) {
+      // Move the last row into this row's position.
+      const int position = row_positions[current];
+      row_positions[rows.back().current] = position;
+      row_positions[current] = -1;
+      rows[position] = std::move(rows.back());
+      rows.pop_back();
+    }
+  }
+}
+
 void Bigram::incorporate(const std::string& x, double weight) {
   if ((max_length > 0) && (x.length() > max_length)) {
     printf("String %s has length %ld, but max length is %ld.\n", x.c_str(),
@@ -42,34 +166,74 @@ void Bigram::incorporate(const std::string& x, double weight) {
   }
   const std::vector<size_t> indices = string_to_indices(x);
   for (size_t i = 0; i != indices.size() - 1; ++i) {
-    transition_dists[indices[i]].incorporate(indices[i + 1], weight);
+    add_transition(indices[i], indices[i + 1], weight);
   }
   N += weight;
 }
 
 double Bigram::logp(const std::string& s) const {
-  const std::vector<size_t> indices = string_to_indices(s);
+  const double row_alpha = alpha * (num_chars + 1);
   double total_logp = 0.0;
-  for (size_t i = 0; i != indices.size() - 1; ++i) {
-    total_logp += transition_dists[indices[i]].logp(indices[i + 1]);
-    // Incorporate each value so that subsequent probabilities are
-    // conditioned on it.
-    transition_dists[indices[i]].incorporate(indices[i + 1]);
-  }
-  for (size_t i = 0; i != indices.size() - 1; ++i) {
-    transition_dists[indices[i]].unincorporate(indices[i + 1]);
+  // The product of the probabilities since total_logp was last updated, so
+  // that most transitions cost a multiplication rather than two logs.
+  double prob = 1.0;
+  LocalTransitions earlier(num_chars + 1);
+  auto add_transition_prob = [&](size_t current, size_t next) {
+    // Condition on the earlier transitions of s as if they were incorporated.
+    auto [row_count, count] = earlier.add(current, next);
+    double row_total = row_count;
+    double cell_total = count;
+    if (const TransitionRow* row = find_row(current)) {
+      row_total += row->total;
+      cell_total += cell_count(*row, next);
+    }
+    prob *= (alpha + cell_total) / (row_total + row_alpha);
+    if (prob < 1e-250) {
+      total_logp += log(prob);
+      prob = 1.0;
+    }
+  };
+  // The string starts and ends with the start/stop symbol, index num_chars.
+  size_t current = num_chars;
+  for (const char c : s) {
+    const size_t next = char_to_index(c);
+    add_transition_prob(current, next);
+    current = next;
   }
-  return total_logp;
+  add_transition_prob(current, num_chars);
+  return total_logp + log(prob);
 }
 
 double Bigram::logp_score() const {
+  // Rows and cells with zero counts contribute nothing, so the score of each
+  // row, lgamma(K alpha) - lgamma(K alpha + n) + sum over its cells of
+  // lgamma(count + alpha) - lgamma(alpha), only needs the non-zero counts.
+  const double row_alpha = alpha * (num_chars + 1);
+  const double lgamma_alpha = log_gamma(alpha);
+  const double lgamma_row_alpha = log_gamma(row_alpha);
   double logp = 0;
-  for (const auto& d : transition_dists) {
-    logp += d.logp_score();
+  for (const TransitionRow& row : rows) {
+    logp += lgamma_row_alpha - log_gamma(row_alpha + row.total);
+    for (const auto& [next, count] : row.counts) {
+      logp += log_gamma(count + alpha) - lgamma_alpha;
+    }
   }
   return logp;
 }
 
+std::string Bigram::nearest(const std::string& x) const {
+  std::string s;
+  for (const char c : x) {
+    if (max_length > 0 && s.length() == max_length) {
+      break;
+    }
+    if (c >= min_char && c <= max_char) {
+      s += c;
+    }
+  }
+  return s;
+}
+
 std::string Bigram::sample(std::mt19937* prng) {
   std::string sampled_string;
   if (max_length > 0) {
@@ -77,53 +241,117 @@ std::string Bigram::sample(std::mt19937* prng) {
   } else {
     sampled_string.reserve(2 * num_chars);
   }
-  // Sample the first character conditioned on the stop/start symbol.
-  size_t current_ind = num_chars;
-  size_t next_ind = transition_dists[current_ind].sample(prng);
-  transition_dists[current_ind].incorporate(next_ind);
-  current_ind = next_ind;
+  // Each transition is sampled conditioned on the earlier sampled
+  // transitions as well as the incorporated ones.
+  LocalTransitions sampled(num_chars + 1);
+  std::vector<double> weights(num_chars + 1);
+  auto sample_next = [&](size_t current) {
+    std::fill(weights.begin(), weights.end(), alpha);
+    if (const TransitionRow* row = find_row(current)) {
+      for (const auto& [next, count] : row->counts) {
+        weights[next] += count;
+      }
+    }
+    sampled.for_each_in_row(
+        current, [&](size_t next, int count) { weights[next] += count; });
+    size_t next = choice(weights, prng);
+    sampled.add(current, next);
+    return next;
+  };
 
-  // Sample additional characters until the stop/start symbol is sampled.
-  // Incorporate the sampled character at each loop iteration so that
-  // subsequent samples are conditioned on its observation.
+  // Sample the first character conditioned on the stop/start symbol, then
+  // additional characters until the stop/start symbol is sampled.
+  size_t current_ind = sample_next(num_chars);
   while (current_ind != num_chars) {
     sampled_string += index_to_char(current_ind);
     if (sampled_string.length() == max_length) {
       break;
     }
-    next_ind = transition_dists[current_ind].sample(prng);
-    transition_dists[current_ind].incorporate(next_ind);
-    current_ind = next_ind;
+    current_ind = sample_next(current_ind);
   }
-  N += 1;  // Correct for calling unincorporate below.
-  unincorporate(sampled_string);
   return sampled_string;
 }
 
 void Bigram::set_alpha(double alphat) {
   alpha = alphat;
-  for (auto& trans_dist : transition_dists) {
-    trans_dist.alpha = alpha;
-  }
 }
 
 void Bigram::transition_hyperparameters(std::mt19937* prng) {
-  std::vector<double> logps;
-  std::vector<double> alphas;
-  // C++ doesn't yet allow range for-loops over existing variables.  Sigh.
-  for (double alphat : ALPHA_GRID) {
-    set_alpha(alphat);
-    double lp = logp_score();
-    if (!std::isnan(lp)) {
-      logps.push_back(logp_score());
-      alphas.push_back(alphat);
-    }
-  }
-  if (logps.empty()) {
+  std::vector<double> logps(hyperparameter_grid_size());
+  logp_score_hyperparameter_grid(logps);
+  int i = sample_from_logps_skipping_nans(logps, prng);
+  if (i < 0) {
     printf("Warning!  All hyperparameters for Bigram give nans!\n");
     assert(false);
   } else {
-    int i = sample_from_logps(logps, prng);
-    set_alpha(alphas[i]);
+    set_hyperparameter_grid_point(i);
+  }
+}
+
+int Bigram::hyperparameter_grid_size() const {
+  return kAlphaGrid.size();
+}
+
+void Bigram::logp_score_hyperparameter_grid(std::span<double> out) const {
+  assert(std::ssize(out) == hyperparameter_grid_size());
+  std::vector<double> cells;
+  std::vector<double> totals;
+  for (const TransitionRow& row : rows) {
+    totals.push_back(row.total);
+    for (const auto& [next, count] : row.counts) {
+      cells.push_back(count);
+    }
+  }
+  // Every row has num_chars + 1 categories.
+  const AlphaGridTerms& terms = *grid_terms;
+  for (size_t i = 0; i < kAlphaGrid.size(); ++i) {
+    const double a = kAlphaGrid[i];
+    const double row_alpha = a * (num_chars + 1);
+    double lp = 0.0;
+    for (double count : cells) {
+      lp += log_gamma(count + a) - terms.lgamma_alpha[i];
+    }
+    for (double total : totals) {
+      lp += terms.lgamma_k_alpha[i] - log_gamma(row_alpha + total);
+    }
+    out[i] = lp;
   }
 }
+
+void Bigram::logp_score_hyperparameter_grid_sum(
+    std::span<const Distribution<std::string>* const> ds,
+    std::span<double> out) const {
+  assert(std::ssize(out) == hyperparameter_grid_size());
+  // The number of times each cell count, and each row total, occurs across
+  // the rows of every distribution in ds.
+  std::map<double, double> cell_multiplicities;
+  std::map<double, double> total_multiplicities;
+  for (const Distribution<std::string>* d : ds) {
+    const auto* bg = static_cast<const Bigram*>(d);
+    assert(bg->num_chars == num_chars);
+    for (const TransitionRow& row : bg->rows) {
+      total_multiplicities[row.total] += 1.0;
+      for (const auto& [next, count] : row.counts) {
+        cell_multiplicities[count] += 1.0;
+      }
+    }
+  }
+  const AlphaGridTerms& terms = *grid_terms;
+  for (size_t i = 0; i < kAlphaGrid.size(); ++i) {
+    const double a = kAlphaGrid[i];
+    const double row_alpha = a * (num_chars + 1);
+    double lp = 0.0;
+    for (const auto& [count, m] : cell_multiplicities) {
+      lp += m * (log_gamma(count + a) - terms.lgamma_alpha[i]);
+    }
+    for (const auto& [total, m] : total_multiplicities) {
+      lp += m * (terms.lgamma_k_alpha[i] - log_gamma(row_alpha + total));
+    }
+    out[i] = lp;
+  }
+}
+
+void Bigram::set_hyperparameter_grid_point(int i) {
+  assert(i >= 0 && i < hyperparameter_grid_size());
+  set_alpha(kAlphaGrid[i]);
+}
@@ -3,6 +3,11 @@
 
 #pragma once
 
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "distributions/base.hh"
 #include "distributions/dirichlet_categorical.hh"
 
@@ -16,35 +21,72 @@ class Bigram : public Distribution<std::string> {
 
   std::vector<size_t> string_to_indices(const std::string& str) const;
 
+  // Adds weight to the count of transitions from index `current` to index
+  // `next`, dropping counts that reach zero (up to kZeroWeightTolerance).
+  void add_transition(size_t current, size_t next, double weight);
+
  public:
   double alpha = 1;       // hyperparameter for all transition distributions.
   size_t max_length = 0;  // 0 means no maximum length
   char min_char;          // Character with smallest ASCII value.
   char max_char;          // Character with largest ASCII value.
   size_t num_chars;
-  mutable std::vector<DirichletCategorical> transition_dists;
+  // Each row of the transition matrix, `p(X_{j+1} | X_j == char_i)`, is a
+  // Dirichlet-categorical over num_chars + 1 symbols (including a start/stop
+  // symbol with index num_chars).  Real strings use a small fraction of the
+  // cells, so rows only store their non-zero counts, and rows without any
+  // counts are not stored at all.
+  struct TransitionRow {
+    size_t current;  // The index of the character the row conditions on.
+    double total = 0.0;
+    // (next index, count) pairs, in the order they were first observed.
+    std::vector<std::pair<size_t, double>> counts;
+  };
+  // The rows with non-zero counts, in no particular order.
+  std::vector<TransitionRow> rows;
+  // row_positions[i] is the position in rows of the row for index i, or -1.
+  std::vector<int> row_positions;
+  // alpha_grid_terms(num_chars + 1), for the rows' hyperparameter grid.
+  const AlphaGridTerms* grid_terms;
+
+  // Returns the row of transitions from index `current`, or nullptr if it has
+  // no counts.
+  const TransitionRow* find_row(size_t current) const;
 
   Bigram(size_t _max_length = 80, char _min_char = ' ', char _max_char = '~')
       : max_length(_max_length), min_char(_min_char), max_char(_max_char) {
     num_chars = max_char - min_char + 1;
-    const size_t total_chars = num_chars + 1;  // Include a start/stop symbol.
-
-    // The distribution at index `i` represents `p(X_{j+1} | X_j == char_i)`.
-    transition_dists.reserve(total_chars);
-    for (size_t i = 0; i != total_chars; ++i) {
-      transition_dists.emplace_back(total_chars);
-    }
+    row_positions.assign(num_chars + 1, -1);
+    grid_terms = &alpha_grid_terms(num_chars + 1);
   }
 
   void incorporate(const std::string& x, double weight = 1.0);
 
+  // logp and sample condition each transition on the earlier transitions of
+  // the same string without incorporating them, so neither modifies the
+  // distribution and logp may be called concurrently.
   double logp(const std::string& s) const;
 
   double logp_score() const;
 
   std::string sample(std::mt19937* prng);
 
+  // x without the characters outside [min_char, max_char], truncated to
+  // max_length.
+  std::string nearest(const std::string& x) const;
+
   void set_alpha(double alphat);
 
   void transition_hyperparameters(std::mt19937* prng);
+
+  // The grid is ALPHA_GRID, shared by every row of the transition matrix.
+  int hyperparameter_grid_size() const;
+
+  void logp_score_hyperparameter_grid(std::span<double> out) const;
+
+  void logp_score_hyperparameter_grid_sum(
+      std::span<const Distribution<std::string>* const> ds,
+      std::span<double> out) const;
+
+  void set_hyperparameter_grid_point(int i);
 };
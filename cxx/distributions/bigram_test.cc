@@ -42,6 +42,14 @@ BOOST_AUTO_TEST_CASE(test_max_length) {
   }
 }
 
+BOOST_AUTO_TEST_CASE(test_nearest) {
+  Bigram bg(5, 'a', 'z');
+
+  BOOST_TEST(bg.nearest("abc") == "abc");
+  BOOST_TEST(bg.nearest("a-b C") == "ab");
+  BOOST_TEST(bg.nearest("abcdefgh") == "abcde");
+}
+
 BOOST_AUTO_TEST_CASE(test_max_length0) {
   std::mt19937 prng;
   Bigram bg(0);
@@ -60,9 +68,7 @@ BOOST_AUTO_TEST_CASE(test_set_alpha) {
   double first_lp = bg.logp_score();
 
   bg.set_alpha(2.0);
-  for (auto trans_dist : bg.transition_dists) {
-    BOOST_TEST(trans_dist.alpha == 2.0);
-  }
+  BOOST_TEST(bg.alpha == 2.0);
 
   BOOST_TEST(first_lp != bg.logp_score(), tt::tolerance(1e-6));
 }
@@ -80,3 +86,116 @@ BOOST_AUTO_TEST_CASE(transition_hyperparameters) {
 
   BOOST_TEST(bg.alpha < 1.0);
 }
+
+BOOST_AUTO_TEST_CASE(test_matches_dense_transitions) {
+  Bigram bg(80, 'a', 'e');
+  const size_t k = bg.num_chars + 1;
+  std::vector<DirichletCategorical> rows(k, DirichletCategorical(k));
+  for (const std::string s : {"abc", "bad", "", "eee", "cab"}) {
+    bg.incorporate(s);
+    std::vector<int> inds = {int(bg.num_chars)};
+    for (char c : s) {
+      inds.push_back(c - 'a');
+    }
+    inds.push_back(bg.num_chars);
+    for (size_t i = 0; i + 1 < inds.size(); ++i) {
+      rows[inds[i]].incorporate(inds[i + 1]);
+    }
+  }
+  bg.unincorporate("eee");
+  rows[bg.num_chars].incorporate(4, -1.0);
+  rows[4].incorporate(4, -1.0);
+  rows[4].incorporate(4, -1.0);
+  rows[4].incorporate(bg.num_chars, -1.0);
+
+  std::vector<double> alphas = ALPHA_GRID;
+  std::vector<double> grid(alphas.size());
+  bg.logp_score_hyperparameter_grid(grid);
+  for (size_t i = 0; i < alphas.size(); ++i) {
+    bg.set_alpha(alphas[i]);
+    double dense_score = 0.0;
+    for (auto& row : rows) {
+      row.alpha = alphas[i];
+      dense_score += row.logp_score();
+    }
+    BOOST_TEST(bg.logp_score() == dense_score, tt::tolerance(1e-9));
+    BOOST_TEST(grid[i] == dense_score, tt::tolerance(1e-9));
+  }
+  // Only the transitions of the incorporated strings are stored.
+  size_t num_cells = 0;
+  for (const auto& row : bg.rows) {
+    num_cells += row.counts.size();
+  }
+  BOOST_TEST(num_cells == 12);
+}
+
+BOOST_AUTO_TEST_CASE(test_logp_matches_score_delta) {
+  Bigram bg;
+  bg.incorporate("abab");
+  bg.incorporate("banana");
+  for (const std::string s : {"abababab", "nanana", "", "xyz"}) {
+    double score = bg.logp_score();
+    double lp = bg.logp(s);
+    BOOST_TEST(bg.logp_score() == score);
+    bg.incorporate(s);
+    BOOST_TEST(lp == bg.logp_score() - score, tt::tolerance(1e-9));
+    bg.unincorporate(s);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_fractional_weights_leave_no_residue) {
+  Bigram bg;
+  bg.incorporate("abc");
+  const double score = bg.logp_score();
+  // 0.1 + 0.2 - 0.1 - 0.2 is not exactly zero in floating point.
+  bg.incorporate("abd", 0.1);
+  bg.incorporate("xbd", 0.2);
+  bg.incorporate("abd", -0.1);
+  bg.incorporate("xbd", -0.2);
+  BOOST_TEST(bg.rows.size() == 4);
+  size_t num_cells = 0;
+  for (const auto& row : bg.rows) {
+    num_cells += row.counts.size();
+  }
+  BOOST_TEST(num_cells == 4);
+  BOOST_TEST(bg.find_row('x' - ' ') == nullptr);
+  BOOST_TEST(bg.logp_score() == score, tt::tolerance(1e-9));
+}
+
+BOOST_AUTO_TEST_CASE(test_logp_long_string) {
+  // Long enough to have more distinct transitions than logp keeps inline.
+  Bigram bg(0, 'a', 'z');
+  bg.incorporate("thequickbrownfox");
+  std::mt19937 prng;
+  std::uniform_int_distribution<int> letter(0, 25);
+  std::string s;
+  for (int i = 0; i < 1000; ++i) {
+    s += 'a' + letter(prng);
+  }
+  double score = bg.logp_score();
+  double lp = bg.logp(s);
+  bg.incorporate(s);
+  BOOST_TEST(lp == bg.logp_score() - score, tt::tolerance(1e-9));
+}
+
+BOOST_AUTO_TEST_CASE(test_logp_score_hyperparameter_grid_sum) {
+  std::vector<Bigram> bgs(3);
+  bgs[0].incorporate("hello");
+  bgs[0].incorporate("help");
+  bgs[1].incorporate("hello");
+  bgs[2].incorporate("");
+  std::vector<const Distribution<std::string>*> ds;
+  std::vector<double> expected(bgs[0].hyperparameter_grid_size(), 0.0);
+  std::vector<double> grid(expected.size());
+  for (const Bigram& bg : bgs) {
+    ds.push_back(&bg);
+    bg.logp_score_hyperparameter_grid(grid);
+    for (size_t i = 0; i < grid.size(); ++i) {
+      expected[i] += grid[i];
+    }
+  }
+  bgs[0].logp_score_hyperparameter_grid_sum(ds, grid);
+  for (size_t i = 0; i < grid.size(); ++i) {
+    BOOST_TEST(grid[i] == expected[i], tt::tolerance(1e-9));
+  }
+}
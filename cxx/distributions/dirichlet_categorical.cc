@@ -5,10 +5,66 @@
 
 #include <algorithm>
 #include <cassert>
+#include <map>
+#include <mutex>
 #include <random>
 
 #include "util_math.hh"
 
+namespace {
+
+const std::vector<double> kAlphaGrid = ALPHA_GRID;
+
+// The non-zero entries of counts.  As in logp_score, only the occupied
+// categories contribute to the score, so the grid visits only them.
+std::vector<double> occupied_counts(const std::vector<double>& counts) {
+  std::vector<double> occupied;
+  for (double c : counts) {
+    if (c != 0.0) {
+      occupied.push_back(c);
+    }
+  }
+  return occupied;
+}
+
+// The logp_score with hyperparameter alphas[i], with lgamma(alphas[i]) and
+// lgamma(k alphas[i]) given, for the occupied categories of a distribution
+// with k categories and N observations.
+void logp_score_grid_from_terms(const std::vector<double>& occupied, double N,
+                                std::span<const double> alphas,
+                                std::span<const double> lgamma_alpha,
+                                std::span<const double> lgamma_k_alpha,
+                                size_t k, std::span<double> out) {
+  if (N == 0.0) {
+    std::fill(out.begin(), out.end(), 0.0);
+    return;
+  }
+  for (size_t i = 0; i < alphas.size(); ++i) {
+    double lg = 0;
+    for (double c : occupied) {
+      lg += log_gamma(c + alphas[i]) - lgamma_alpha[i];
+    }
+    out[i] = lgamma_k_alpha[i] - log_gamma(alphas[i] * k + N) + lg;
+  }
+}
+
+}  // namespace
+
+const AlphaGridTerms& alpha_grid_terms(int k) {
+  static std::mutex mutex;
+  // std::map never moves its values, so the references handed out stay valid.
+  static std::map<int, AlphaGridTerms> terms;
+  std::lock_guard<std::mutex> lock(mutex);
+  auto [it, inserted] = terms.try_emplace(k);
+  if (inserted) {
+    for (double a : kAlphaGrid) {
+      it->second.lgamma_alpha.push_back(log_gamma(a));
+      it->second.lgamma_k_alpha.push_back(log_gamma(a * k));
+    }
+  }
+  return it->second;
+}
+
 void DirichletCategorical::incorporate(const int& x, double weight) {
   assert(x >= 0 && x < std::ssize(counts));
   counts[size_t(x)] += weight;
@@ -22,14 +78,73 @@ double DirichletCategorical::logp(const int& x) const {
   return numer - denom;
 }
 
+void DirichletCategorical::logp_many(std::span<const int> xs,
+                                     std::span<double> out) const {
+  assert(xs.size() == out.size());
+  const double denom = log(N + alpha * counts.size());
+  for (size_t i = 0; i < xs.size(); ++i) {
+    assert(xs[i] >= 0 && xs[i] < std::ssize(counts));
+    out[i] = log(alpha + counts[size_t(xs[i])]) - denom;
+  }
+}
+
+double DirichletCategorical::logp_score_delta(std::span<const int> xs) {
+  // Only the categories that appear in xs change their lgamma terms. Small
+  // batches (e.g. one item's values in a Gibbs step) are tallied sparsely so
+  // that the cost does not grow with the number of categories.
+  const double a = alpha * counts.size();
+  double delta = log_gamma(a + N) - log_gamma(a + N + xs.size());
+  auto add_category = [&](size_t x, double n) {
+    delta += log_gamma(counts[x] + n + alpha) - log_gamma(counts[x] + alpha);
+  };
+  if (xs.size() < counts.size()) {
+    std::map<int, double> added;
+    for (int x : xs) {
+      assert(x >= 0 && x < std::ssize(counts));
+      added[x] += 1.0;
+    }
+    for (const auto& [x, n] : added) {
+      add_category(size_t(x), n);
+    }
+  } else {
+    std::vector<double> added(counts.size(), 0.0);
+    for (int x : xs) {
+      assert(x >= 0 && x < std::ssize(counts));
+      added[size_t(x)] += 1.0;
+    }
+    for (size_t x = 0; x < added.size(); ++x) {
+      if (added[x] > 0.0) {
+        add_category(x, added[x]);
+      }
+    }
+  }
+  return delta;
+}
+
 double DirichletCategorical::logp_score() const {
-  const size_t k = counts.size();
-  const double a = alpha * k;
+  // Empty categories contribute lgamma(alpha) - lgamma(alpha) = 0.
+  const double a = alpha * counts.size();
+  const double lgamma_alpha = log_gamma(alpha);
   double lg = 0;
-  for (double x : counts) {
-    lg += lgamma(x + alpha);
+  for (double c : counts) {
+    if (c != 0.0) {
+      lg += log_gamma(c + alpha) - lgamma_alpha;
+    }
   }
-  return lgamma(a) - lgamma(a + N) + lg - k * lgamma(alpha);
+  return log_gamma(a) - log_gamma(a + N) + lg;
+}
+
+void DirichletCategorical::logp_score_grid(std::span<const double> alphas,
+                                           std::span<double> out) const {
+  assert(alphas.size() == out.size());
+  std::vector<double> lgamma_alpha;
+  std::vector<double> lgamma_k_alpha;
+  for (double a : alphas) {
+    lgamma_alpha.push_back(log_gamma(a));
+    lgamma_k_alpha.push_back(log_gamma(a * counts.size()));
+  }
+  logp_score_grid_from_terms(occupied_counts(counts), N, alphas, lgamma_alpha,
+                             lgamma_k_alpha, counts.size(), out);
 }
 
 int DirichletCategorical::sample(std::mt19937* prng) {
@@ -40,26 +155,70 @@ int DirichletCategorical::sample(std::mt19937* prng) {
 }
 
 void DirichletCategorical::transition_hyperparameters(std::mt19937* prng) {
-  std::vector<double> logps;
-  std::vector<double> alphas;
-  // C++ doesn't yet allow range for-loops over existing variables.  Sigh.
-  for (double alphat : ALPHA_GRID) {
-    alpha = alphat;
-    double lp = logp_score();
-    if (!std::isnan(lp)) {
-      logps.push_back(logp_score());
-      alphas.push_back(alpha);
-    }
-  }
-  if (alphas.empty()) {
+  std::vector<double> logps(hyperparameter_grid_size());
+  logp_score_hyperparameter_grid(logps);
+  int i = sample_from_logps_skipping_nans(logps, prng);
+  if (i < 0) {
     printf("Warning: all Dirichlet hyperparameters give nans!\n");
     assert(false);
   } else {
-    int i = sample_from_logps(logps, prng);
-    alpha = alphas[i];
+    set_hyperparameter_grid_point(i);
   }
 }
 
+int DirichletCategorical::hyperparameter_grid_size() const {
+  return kAlphaGrid.size();
+}
+
+void DirichletCategorical::logp_score_hyperparameter_grid(
+    std::span<double> out) const {
+  assert(std::ssize(out) == hyperparameter_grid_size());
+  logp_score_grid_from_terms(occupied_counts(counts), N, kAlphaGrid,
+                             grid_terms->lgamma_alpha,
+                             grid_terms->lgamma_k_alpha,
+                             counts.size(), out);
+}
+
+void DirichletCategorical::logp_score_hyperparameter_grid_sum(
+    std::span<const Distribution<int>* const> ds,
+    std::span<double> out) const {
+  assert(std::ssize(out) == hyperparameter_grid_size());
+  // The number of times each non-zero category count, and each non-zero
+  // total, occurs across ds.
+  std::map<double, double> count_multiplicities;
+  std::map<double, double> total_multiplicities;
+  for (const Distribution<int>* d : ds) {
+    const auto* dc = static_cast<const DirichletCategorical*>(d);
+    assert(dc->counts.size() == counts.size());
+    if (dc->N == 0.0) {
+      continue;
+    }
+    total_multiplicities[dc->N] += 1.0;
+    for (double c : dc->counts) {
+      if (c != 0.0) {
+        count_multiplicities[c] += 1.0;
+      }
+    }
+  }
+  const size_t k = counts.size();
+  for (size_t i = 0; i < kAlphaGrid.size(); ++i) {
+    const double a = kAlphaGrid[i];
+    double lp = 0.0;
+    for (const auto& [c, m] : count_multiplicities) {
+      lp += m * (log_gamma(c + a) - grid_terms->lgamma_alpha[i]);
+    }
+    for (const auto& [n, m] : total_multiplicities) {
+      lp += m * (grid_terms->lgamma_k_alpha[i] - log_gamma(a * k + n));
+    }
+    out[i] = lp;
+  }
+}
+
+void DirichletCategorical::set_hyperparameter_grid_point(int i) {
+  assert(i >= 0 && i < hyperparameter_grid_size());
+  alpha = kAlphaGrid[i];
+}
+
 int DirichletCategorical::nearest(const int& x) const {
   if (x < 0) {
     return 0;
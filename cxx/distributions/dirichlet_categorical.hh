@@ -3,6 +3,7 @@
 
 #pragma once
 #include <random>
+#include <span>
 
 #include "distributions/base.hh"
 #include "util_math.hh"
@@ -10,23 +11,57 @@
 #define ALPHA_GRID \
   { 1e-4, 1e-3, 1e-2, 1e-1, 1.0, 10.0, 100.0, 1000.0, 10000.0 }
 
-class DirichletCategorical : public Distribution<int> {
+// lgamma(alpha) and lgamma(k alpha) for every alpha in ALPHA_GRID.  They only
+// depend on the number of categories k, so they are computed once for each k
+// and shared by every distribution with k categories, such as the clusters of
+// a relation.  Safe to call from several threads at once, but it takes a
+// lock, so distributions look their table up once, when they are constructed.
+struct AlphaGridTerms {
+  std::vector<double> lgamma_alpha;
+  std::vector<double> lgamma_k_alpha;
+};
+
+const AlphaGridTerms& alpha_grid_terms(int k);
+
+class DirichletCategorical final : public Distribution<int> {
  public:
   double alpha = 1;         // hyperparameter (applies to all categories)
   std::vector<double> counts;  // counts of observed categories
+  const AlphaGridTerms* grid_terms;  // alpha_grid_terms(counts.size())
 
-  DirichletCategorical(int k) {  // k is number of categories
+  DirichletCategorical(int k)  // k is number of categories
+      : grid_terms(&alpha_grid_terms(k)) {
     counts = std::vector<double>(k, 0.0);
   }
   void incorporate(const int& x, double weight = 1.0);
 
   double logp(const int& x) const;
 
+  void logp_many(std::span<const int> xs, std::span<double> out) const;
+
+  double logp_score_delta(std::span<const int> xs);
+
   double logp_score() const;
 
+  // Writes to out[i] the logp_score the distribution would have with its
+  // hyperparameter set to alphas[i].
+  void logp_score_grid(std::span<const double> alphas,
+                       std::span<double> out) const;
+
   int sample(std::mt19937* prng);
 
   void transition_hyperparameters(std::mt19937* prng);
 
+  // The grid is ALPHA_GRID.
+  int hyperparameter_grid_size() const;
+
+  void logp_score_hyperparameter_grid(std::span<double> out) const;
+
+  void logp_score_hyperparameter_grid_sum(
+      std::span<const Distribution<int>* const> ds,
+      std::span<double> out) const;
+
+  void set_hyperparameter_grid_point(int i);
+
   int nearest(const int& x) const;
 };
@@ -170,3 +170,69 @@ BOOST_AUTO_TEST_CASE(test_nearest) {
   BOOST_TEST(dc.nearest(99) == 11);
   BOOST_TEST(dc.nearest(7) == 7);
 }
+
+BOOST_AUTO_TEST_CASE(test_batch) {
+  DirichletCategorical dc(4), dc_batch(4);
+  dc.incorporate(2);
+  dc_batch.incorporate(2);
+  const int xs[] = {0, 2, 2, 3, 0, 2};
+
+  double out[std::size(xs)];
+  dc.logp_many(xs, out);
+  for (size_t i = 0; i < std::size(xs); ++i) {
+    BOOST_TEST(out[i] == dc.logp(xs[i]), tt::tolerance(1e-12));
+  }
+
+  double score = dc.logp_score();
+  for (int x : xs) {
+    dc.incorporate(x);
+  }
+  BOOST_TEST(dc_batch.logp_score_delta(xs) == dc.logp_score() - score,
+             tt::tolerance(1e-12));
+  dc_batch.incorporate_many(xs);
+  BOOST_TEST(dc_batch.logp_score() == dc.logp_score(), tt::tolerance(1e-12));
+}
+
+BOOST_AUTO_TEST_CASE(test_logp_score_grid) {
+  DirichletCategorical dc(6);
+  const std::vector<double> alphas = ALPHA_GRID;
+  std::vector<double> out(alphas.size());
+  dc.logp_score_grid(alphas, out);
+  for (double lp : out) {
+    BOOST_TEST(lp == 0.0);
+  }
+
+  for (int x : {0, 3, 3, 5, 3, 0}) {
+    dc.incorporate(x);
+  }
+  dc.logp_score_grid(alphas, out);
+  for (size_t i = 0; i < alphas.size(); ++i) {
+    dc.alpha = alphas[i];
+    BOOST_TEST(out[i] == dc.logp_score(), tt::tolerance(1e-12));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_logp_score_hyperparameter_grid_sum) {
+  std::vector<DirichletCategorical> dcs(4, DirichletCategorical(5));
+  for (int x : {0, 3, 3, 4}) {
+    dcs[0].incorporate(x);
+  }
+  for (int x : {3, 3, 0, 4, 1}) {
+    dcs[1].incorporate(x);
+  }
+  dcs[3].incorporate(2);
+  std::vector<const Distribution<int>*> ds;
+  std::vector<double> expected(dcs[0].hyperparameter_grid_size(), 0.0);
+  std::vector<double> grid(expected.size());
+  for (const DirichletCategorical& dc : dcs) {
+    ds.push_back(&dc);
+    dc.logp_score_hyperparameter_grid(grid);
+    for (size_t i = 0; i < grid.size(); ++i) {
+      expected[i] += grid[i];
+    }
+  }
+  dcs[0].logp_score_hyperparameter_grid_sum(ds, grid);
+  for (size_t i = 0; i < grid.size(); ++i) {
+    BOOST_TEST(grid[i] == expected[i], tt::tolerance(1e-9));
+  }
+}
@@ -17,6 +17,24 @@
 #include "distributions/string_nat.hh"
 #include "util_observation.hh"
 
+namespace {
+
+std::vector<std::string> parse_stringcat_strings(
+    const std::map<std::string, std::string>& distribution_args) {
+  std::string delim = " ";  // Default deliminator
+  auto it = distribution_args.find("delim");
+  if (it != distribution_args.end()) {
+    delim = it->second;
+    assert(delim.length() == 1);
+  }
+  std::vector<std::string> strings;
+  boost::split(strings, distribution_args.at("strings"),
+               boost::is_any_of(delim));
+  return strings;
+}
+
+}  // namespace
+
 DistributionSpec::DistributionSpec(
     const std::string& dist_str,
     const std::map<std::string, std::string>& _distribution_args):
@@ -37,6 +55,17 @@ DistributionSpec::DistributionSpec(
       distribution_args[arg_name] = arg_val;
     }
   }
+  auto shared_it = distribution_args.find("shared_hparams");
+  if (shared_it != distribution_args.end()) {
+    if (shared_it->second == "true") {
+      shared_hyperparameters = true;
+    } else if (shared_it->second != "false") {
+      printf("Expected true or false for shared_hparams, got %s\n",
+             shared_it->second.c_str());
+      std::exit(1);
+    }
+    distribution_args.erase(shared_it);
+  }
   if (dist_name == "bernoulli") {
     distribution = DistributionEnum::bernoulli;
     observation_type = ObservationEnum::bool_type;
@@ -55,6 +84,10 @@ DistributionSpec::DistributionSpec(
   } else if (dist_name == "stringcat") {
     distribution = DistributionEnum::stringcat;
     observation_type = ObservationEnum::string_type;
+    if (distribution_args.contains("strings")) {
+      string_vocabulary = std::make_shared<const StringVocabulary>(
+          parse_stringcat_strings(distribution_args));
+    }
   } else if (dist_name == "string_nat") {
     distribution = DistributionEnum::string_nat;
     observation_type = ObservationEnum::string_type;
@@ -64,64 +97,118 @@ DistributionSpec::DistributionSpec(
   } else if (dist_name == "string_skellam") {
     distribution = DistributionEnum::string_skellam;
     observation_type = ObservationEnum::string_type;
+    int_adapter_cache = std::make_shared<AdapterCache<int>>();
   } else {
     printf("Unknown distribution name %s\n", dist_name.c_str());
     std::exit(1);
   }
+  if (shared_hyperparameters && !has_hyperparameter_grid(distribution)) {
+    printf("shared_hparams=true needs a distribution with a hyperparameter "
+           "grid, but %s has none\n", dist_name.c_str());
+    std::exit(1);
+  }
+}
+
+bool has_hyperparameter_grid(DistributionEnum distribution) {
+  switch (distribution) {
+    case DistributionEnum::bernoulli:
+    case DistributionEnum::bigram:
+    case DistributionEnum::categorical:
+    case DistributionEnum::normal:
+    case DistributionEnum::string_nat:
+      return true;
+    default:
+      return false;
+  }
 }
 
 DistributionVariant get_prior(const DistributionSpec& spec,
                               std::mt19937* prng) {
+  // The classes are constructed from the prvalues make_prior returns, which
+  // doesn't need them to be copyable.
   switch (spec.distribution) {
     case DistributionEnum::bernoulli:
-      return new BetaBernoulli;
-    case DistributionEnum::bigram: {
-      size_t max_length = 80;
-      if (spec.distribution_args.contains("maxlength")) {
-        max_length = std::stoul(spec.distribution_args.at("maxlength"));
-      }
-      return new Bigram(max_length);
-    }
-    case DistributionEnum::categorical: {
-      assert(spec.distribution_args.size() == 1);
-      int num_categories = std::stoi(spec.distribution_args.at("k"));
-      return new DirichletCategorical(num_categories);
-    }
+      return new BetaBernoulli(make_prior<BetaBernoulli>(spec, prng));
+    case DistributionEnum::bigram:
+      return new Bigram(make_prior<Bigram>(spec, prng));
+    case DistributionEnum::categorical:
+      return new DirichletCategorical(
+          make_prior<DirichletCategorical>(spec, prng));
     case DistributionEnum::normal:
-      return new Normal;
-    case DistributionEnum::skellam: {
-      Skellam* s = new Skellam;
-      s->init_theta(prng);
-      return s;
-    }
-    case DistributionEnum::stringcat: {
-      std::string delim = " ";  // Default deliminator
-      auto it = spec.distribution_args.find("delim");
-      if (it != spec.distribution_args.end()) {
-        delim = it->second;
-        assert(delim.length() == 1);
-      }
-      std::vector<std::string> strings;
-      boost::split(strings, spec.distribution_args.at("strings"),
-                   boost::is_any_of(delim));
-      return new StringCat(strings);
-    }
-    case DistributionEnum::string_nat: {
-      size_t max_length = 20;
-      if (spec.distribution_args.contains("maxlength")) {
-        max_length = std::stoul(spec.distribution_args.at("maxlength"));
-      }
-      return new StringNat(max_length);
-    }
+      return new Normal(make_prior<Normal>(spec, prng));
+    case DistributionEnum::skellam:
+      return new Skellam(make_prior<Skellam>(spec, prng));
+    case DistributionEnum::stringcat:
+      return new StringCat(make_prior<StringCat>(spec, prng));
+    case DistributionEnum::string_nat:
+      return new StringNat(make_prior<StringNat>(spec, prng));
     case DistributionEnum::string_normal:
       return new DistributionAdapter<double>(new Normal);
     case DistributionEnum::string_skellam: {
       Skellam* s = new Skellam;
       s->init_theta(prng);
-      return new DistributionAdapter<int>(s);
+      return new DistributionAdapter<int>(s, spec.int_adapter_cache);
     }
     default:
       printf("Unknown distribution enum value %d.\n", (int)(spec.distribution));
       std::exit(1);
   }
 }
+
+template <>
+BetaBernoulli make_prior(const DistributionSpec& spec, std::mt19937* prng) {
+  assert(spec.distribution == DistributionEnum::bernoulli);
+  return BetaBernoulli();
+}
+
+template <>
+Bigram make_prior(const DistributionSpec& spec, std::mt19937* prng) {
+  assert(spec.distribution == DistributionEnum::bigram);
+  size_t max_length = 80;
+  if (spec.distribution_args.contains("maxlength")) {
+    max_length = std::stoul(spec.distribution_args.at("maxlength"));
+  }
+  return Bigram(max_length);
+}
+
+template <>
+DirichletCategorical make_prior(const DistributionSpec& spec,
+                                std::mt19937* prng) {
+  assert(spec.distribution == DistributionEnum::categorical);
+  assert(spec.distribution_args.size() == 1);
+  int num_categories = std::stoi(spec.distribution_args.at("k"));
+  return DirichletCategorical(num_categories);
+}
+
+template <>
+Normal make_prior(const DistributionSpec& spec, std::mt19937* prng) {
+  assert(spec.distribution == DistributionEnum::normal);
+  return Normal();
+}
+
+template <>
+Skellam make_prior(const DistributionSpec& spec, std::mt19937* prng) {
+  assert(spec.distribution == DistributionEnum::skellam);
+  Skellam s;
+  s.init_theta(prng);
+  return s;
+}
+
+template <>
+StringCat make_prior(const DistributionSpec& spec, std::mt19937* prng) {
+  assert(spec.distribution == DistributionEnum::stringcat);
+  if (spec.string_vocabulary) {
+    return StringCat(spec.string_vocabulary);
+  }
+  return StringCat(parse_stringcat_strings(spec.distribution_args));
+}
+
+template <>
+StringNat make_prior(const DistributionSpec& spec, std::mt19937* prng) {
+  assert(spec.distribution == DistributionEnum::string_nat);
+  size_t max_length = 20;
+  if (spec.distribution_args.contains("maxlength")) {
+    max_length = std::stoul(spec.distribution_args.at("maxlength"));
+  }
+  return StringNat(max_length);
+}
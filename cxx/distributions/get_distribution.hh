@@ -7,6 +7,7 @@
 #pragma once
 
 #include <map>
+#include <memory>
 #include <random>
 #include <string>
 #include <variant>
@@ -15,6 +16,17 @@
 #include "util_observation.hh"
 #include "distributions/base.hh"
 
+class BetaBernoulli;
+class Bigram;
+class DirichletCategorical;
+class Normal;
+class Skellam;
+class StringCat;
+class StringNat;
+class StringVocabulary;
+template <typename S>
+class AdapterCache;
+
 enum class DistributionEnum {
   bernoulli,
   bigram,
@@ -31,12 +43,27 @@ struct DistributionSpec {
   DistributionEnum distribution;
   ObservationEnum observation_type;
   std::map<std::string, std::string> distribution_args;
+  // If true, every cluster of a relation with this spec uses the same
+  // hyperparameters, drawn from the grid posterior given all of the clusters'
+  // data.  Set by the argument "shared_hparams=true".
+  bool shared_hyperparameters = false;
+  // For stringcat, the strings parsed from the arguments.  Every StringCat
+  // made from this spec (or a copy of it) shares this one vocabulary.
+  std::shared_ptr<const StringVocabulary> string_vocabulary;
+  // For string_skellam, the formatted samples shared by every
+  // DistributionAdapter made from this spec (or a copy of it).
+  std::shared_ptr<AdapterCache<int>> int_adapter_cache;
 
   DistributionSpec(const std::string& dist_str,
                    const std::map<std::string, std::string>& _distribution_args = {});
   DistributionSpec() = default;
 };
 
+// Whether the distributions of type `distribution` have a hyperparameter
+// grid (see Distribution::hyperparameter_grid_size), and so can share their
+// hyperparameters across clusters.
+bool has_hyperparameter_grid(DistributionEnum distribution);
+
 // If you are adding a new Distribution type to DistributionVariant, you will
 // also need to update ObservationVariant and ObservationEnum in
 // util_observation.h.
@@ -50,3 +77,26 @@ using DistributionVariant =
 // DistributionVariant and one that returns EmissionVariant, for ease of use in
 // CleanRelation.
 DistributionVariant get_prior(const DistributionSpec& spec, std::mt19937* prng);
+
+// Returns the distribution that get_prior(spec, prng) would make, by value,
+// so that CleanRelations can store their clusters by value.  D must be the
+// class that get_prior makes for spec; the specializations below are the
+// classes with a make_prior.
+template <typename D>
+D make_prior(const DistributionSpec& spec, std::mt19937* prng);
+
+template <>
+BetaBernoulli make_prior(const DistributionSpec& spec, std::mt19937* prng);
+template <>
+Bigram make_prior(const DistributionSpec& spec, std::mt19937* prng);
+template <>
+DirichletCategorical make_prior(const DistributionSpec& spec,
+                                std::mt19937* prng);
+template <>
+Normal make_prior(const DistributionSpec& spec, std::mt19937* prng);
+template <>
+Skellam make_prior(const DistributionSpec& spec, std::mt19937* prng);
+template <>
+StringCat make_prior(const DistributionSpec& spec, std::mt19937* prng);
+template <>
+StringNat make_prior(const DistributionSpec& spec, std::mt19937* prng);
@@ -8,6 +8,9 @@
 #include <typeinfo>
 #include <boost/test/included/unit_test.hpp>
 
+#include "distributions/adapter.hh"
+#include "distributions/stringcat.hh"
+
 namespace tt = boost::test_tools;
 
 BOOST_AUTO_TEST_CASE(test_distribution_spec) {
@@ -69,6 +72,30 @@ BOOST_AUTO_TEST_CASE(test_distribution_spec) {
   DistributionSpec dss = DistributionSpec("string_skellam");
   BOOST_TEST((dss.distribution == DistributionEnum::string_skellam));
   BOOST_TEST(dss.distribution_args.empty());
+
+  BOOST_TEST(!dn.shared_hyperparameters);
+  DistributionSpec dcs("categorical(k=6,shared_hparams=true)");
+  BOOST_TEST(dcs.shared_hyperparameters);
+  BOOST_TEST((dcs.distribution_args.size() == 1));
+}
+
+BOOST_AUTO_TEST_CASE(test_has_hyperparameter_grid) {
+  // Specs with shared_hparams=true are rejected when has_hyperparameter_grid
+  // is false, so it must agree with the distributions get_prior makes.
+  std::mt19937 prng;
+  for (const std::string& s :
+       {"bernoulli", "bigram", "categorical(k=3)", "normal", "skellam",
+        "stringcat(strings=a b)", "string_nat", "string_normal",
+        "string_skellam"}) {
+    DistributionSpec spec(s);
+    std::visit(
+        [&](auto d) {
+          BOOST_TEST(has_hyperparameter_grid(spec.distribution) ==
+                     (d->hyperparameter_grid_size() > 0));
+          delete d;
+        },
+        get_prior(spec, &prng));
+  }
 }
 
 BOOST_AUTO_TEST_CASE(test_get_prior_bernoulli) {
@@ -142,6 +169,16 @@ BOOST_AUTO_TEST_CASE(test_get_prior_stringcat) {
   Distribution<std::string> *d = std::get<Distribution<std::string>*>(dv);
   std::string name = typeid(*d).name();
   BOOST_TEST(name.find("StringCat") != std::string::npos);
+
+  // Every StringCat from the same spec shares its vocabulary.
+  DistributionSpec ds_copy = ds;
+  StringCat* sc1 = dynamic_cast<StringCat*>(d);
+  StringCat* sc2 = dynamic_cast<StringCat*>(
+      std::get<Distribution<std::string>*>(get_prior(ds_copy, &prng)));
+  BOOST_TEST(sc1->vocabulary.get() == sc2->vocabulary.get());
+  BOOST_TEST(sc1->vocabulary->strings.size() == 2);
+  delete sc1;
+  delete sc2;
 }
 
 BOOST_AUTO_TEST_CASE(test_get_prior_string_nat) {
@@ -166,8 +203,19 @@ BOOST_AUTO_TEST_CASE(test_get_prior_string_normal) {
 BOOST_AUTO_TEST_CASE(test_get_prior_string_skellam) {
   std::mt19937 prng;
 
-  DistributionVariant dv = get_prior(DistributionSpec("string_skellam"), &prng);
+  DistributionSpec ds("string_skellam");
+  DistributionVariant dv = get_prior(ds, &prng);
   Distribution<std::string> *d = std::get<Distribution<std::string>*>(dv);
   std::string name = typeid(*d).name();
   BOOST_TEST(name.find("DistributionAdapter") != std::string::npos);
+
+  // Every DistributionAdapter from the same spec shares its cache.
+  DistributionSpec ds_copy = ds;
+  auto* da1 = dynamic_cast<DistributionAdapter<int>*>(d);
+  auto* da2 = dynamic_cast<DistributionAdapter<int>*>(
+      std::get<Distribution<std::string>*>(get_prior(ds_copy, &prng)));
+  BOOST_TEST(da1->cache != nullptr);
+  BOOST_TEST(da1->cache.get() == da2->cache.get());
+  delete da1;
+  delete da2;
 }
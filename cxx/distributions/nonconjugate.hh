@@ -1,7 +1,10 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
 #include <map>
 #include <random>
+#include <span>
 #include <vector>
 #include "distributions/base.hh"
 
@@ -9,7 +12,16 @@ template <typename T>
 class NonconjugateDistribution : public Distribution<T> {
  public:
   // Abstract base class for Distributions that don't have conjugate priors.
-  std::map<T, double> seen;
+
+  // The distinct incorporated values in increasing order, and their total
+  // weights.  Values whose weight returns to zero (up to
+  // kZeroWeightTolerance) are removed.
+  std::vector<T> seen_values;
+  std::vector<double> seen_weights;
+
+  // The scale of the random walk proposals in transition_theta, adapted
+  // towards kTargetThetaAcceptance.
+  double theta_proposal_scale = 0.5;
 
   // The log probability of x given the current latent values.
   virtual double logp(const T& x) const = 0;
@@ -29,36 +41,125 @@ class NonconjugateDistribution : public Distribution<T> {
   // Set the current latent values from a vector.
   virtual void set_latents(const std::vector<double>& v) = 0;
 
+  // The current latent values mapped to unconstrained real coordinates
+  // (for example, log rates), and the inverse of that map.
+  virtual std::vector<double> store_unconstrained_latents() const = 0;
+
+  virtual void set_unconstrained_latents(const std::vector<double>& v) = 0;
+
+  // The log prior density of the current latent values, with respect to
+  // the coordinates returned by store_unconstrained_latents.
+  virtual double logp_unconstrained_latents() const = 0;
+
   void incorporate(const T& x, double weight = 1.0) {
-    seen[x] += weight;
+    auto it = std::lower_bound(seen_values.begin(), seen_values.end(), x);
+    size_t i = it - seen_values.begin();
+    if (it == seen_values.end() || *it != x) {
+      seen_values.insert(it, x);
+      seen_weights.insert(seen_weights.begin() + i, weight);
+    } else {
+      seen_weights[i] += weight;
+      if (std::abs(seen_weights[i]) < kZeroWeightTolerance) {
+        seen_values.erase(it);
+        seen_weights.erase(seen_weights.begin() + i);
+      }
+    }
     this->N += weight;
+    theta_score_valid = false;
   };
 
   double logp_score() const {
+    std::vector<double> logps(seen_values.size());
+    this->logp_many(seen_values, logps);
     double score = 0.0;
-    for (const auto &it : seen) {
-      score += logp(it.first) * it.second;;
+    for (size_t i = 0; i < logps.size(); ++i) {
+      score += logps[i] * seen_weights[i];
     }
     return score;
   }
 
-  // Transition the current latent values using Metropolis-Hastings.
+  // Given the latent values, the data are independent, so the change in score
+  // is the sum of their log probabilities. Repeated values are scored once.
+  double logp_score_delta(std::span<const T> xs) {
+    std::map<T, double> counts;
+    for (const T& x : xs) {
+      counts[x] += 1.0;
+    }
+    std::vector<T> distinct;
+    distinct.reserve(counts.size());
+    for (const auto& [x, unused_count] : counts) {
+      distinct.push_back(x);
+    }
+    std::vector<double> logps(distinct.size());
+    this->logp_many(distinct, logps);
+    double delta = 0.0;
+    size_t i = 0;
+    for (const auto& [unused_x, count] : counts) {
+      delta += logps[i++] * count;
+    }
+    return delta;
+  }
+
+  // Transition the current latent values using random walk Metropolis-Hastings
+  // in the unconstrained coordinates.  The proposal scale is adapted with a
+  // diminishing step size towards kTargetThetaAcceptance, and when the
+  // measured acceptance rate is low, more than one proposal is made per call.
   // Children classes are welcome to replace this with something more
   // powerful (like Hamiltonian Monte Carlo) if they like.
   virtual void transition_theta(std::mt19937* prng) {
-    std::vector<double> old_latents = store_latents();
-    double old_logp_score = logp_score();
-    init_theta(prng);
-    double new_logp_score = logp_score();
-    double threshold = new_logp_score - old_logp_score;
+    std::vector<double> latents = store_latents();
+    if (!theta_score_valid || latents != theta_score_latents) {
+      theta_logp_score = logp_score();
+      theta_score_latents = latents;
+      theta_score_valid = true;
+    }
+    const int num_proposals =
+        std::clamp(static_cast<int>(
+                       std::lround(kTargetThetaAcceptance / theta_acceptance)),
+                   1, kMaxThetaProposals);
+    std::normal_distribution<double> step(0.0, 1.0);
     std::uniform_real_distribution rnd(0.0, 1.0);
-    double p = rnd(*prng);
-    if (log(p) <= threshold) {
-      // Accept
-      return;
+    for (int i = 0; i < num_proposals; ++i) {
+      std::vector<double> u = store_unconstrained_latents();
+      const double old_logp =
+          theta_logp_score + logp_unconstrained_latents();
+      for (double& ui : u) {
+        ui += theta_proposal_scale * step(*prng);
+      }
+      set_unconstrained_latents(u);
+      const double new_logp_score = logp_score();
+      const double threshold =
+          new_logp_score + logp_unconstrained_latents() - old_logp;
+      const bool accept = std::log(rnd(*prng)) <= threshold;
+      if (accept) {
+        theta_logp_score = new_logp_score;
+        theta_score_latents = store_latents();
+      } else {
+        set_latents(theta_score_latents);
+      }
+
+      ++num_theta_proposals;
+      const double rate = 1.0 / std::sqrt(num_theta_proposals);
+      theta_proposal_scale *=
+          std::exp(rate * ((accept ? 1.0 : 0.0) - kTargetThetaAcceptance));
+      theta_acceptance += 0.05 * ((accept ? 1.0 : 0.0) - theta_acceptance);
+      theta_acceptance = std::max(theta_acceptance, 0.05);
     }
-    // Reject
-    set_latents(old_latents);
   }
 
+ private:
+  // A standard target for random walk Metropolis in a few dimensions.
+  static constexpr double kTargetThetaAcceptance = 0.4;
+  static constexpr int kMaxThetaProposals = 5;
+
+  // logp_score at the latent values theta_score_latents, valid until the
+  // next incorporate.
+  bool theta_score_valid = false;
+  double theta_logp_score = 0.0;
+  std::vector<double> theta_score_latents;
+
+  // The number of proposals made so far, and a running estimate of the
+  // acceptance rate.
+  double num_theta_proposals = 0.0;
+  double theta_acceptance = kTargetThetaAcceptance;
 };
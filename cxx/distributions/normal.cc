@@ -6,54 +6,194 @@
 #include <cassert>
 #include <cmath>
 #include <numbers>
+#include <vector>
+
+namespace {
+
+// logZ in terms of log(r), log(s) and lgamma(v / 2), so that callers can share
+// them across hyperparameter values.
+double logZ_from_terms(double log_r, double v, double log_s,
+                       double lgamma_half_v) {
+  return (v + 1.0) / 2.0 * std::numbers::ln2 +
+         0.5 * std::log(std::numbers::pi) - 0.5 * log_r - 0.5 * v * log_s +
+         lgamma_half_v;
+}
+
+// Posterior hyperparameters m' and s' given prior hyperparameters r, m and s
+// and the count n, mean mu and variance sigma2 of the data.
+void posterior_hypers_at(double r, double m, double s, double n, double mu,
+                         double sigma2, double* mprime, double* sprime) {
+  // r' = r + N
+  // m' = (r m + N mean) / (r + N)
+  // C = N (var + mean^2)
+  // s' = s + C + r m^2 - r' m' m'
+  double mdelta = r * (m - mu) / (r + n);
+  *mprime = mu + mdelta;
+  *sprime = s + r * (m - *mprime) * (m + *mprime) +
+            n * (sigma2 - 2 * mu * mdelta - mdelta * mdelta);
+}
+
+// The hyperparameter grid of transition_hyperparameters, with the prior
+// normalizing constant logZ(r, v, s) of every grid point. These don't depend
+// on the data, so they are computed once.
+struct NormalGrid {
+  std::vector<double> rs;
+  std::vector<double> vs;
+  std::vector<double> ms;
+  std::vector<double> ss;
+  // prior_logZ[(ir * vs.size() + iv) * ss.size() + is]
+  std::vector<double> prior_logZ;
+};
+
+const NormalGrid& normal_grid() {
+  static const NormalGrid grid = []() {
+    NormalGrid g{R_GRID, V_GRID, M_GRID, S_GRID, {}};
+    for (double rt : g.rs) {
+      for (double vt : g.vs) {
+        for (double st : g.ss) {
+          g.prior_logZ.push_back(logZ(rt, vt, st));
+        }
+      }
+    }
+    return g;
+  }();
+  return grid;
+}
+
+}  // namespace
 
 double logZ(double r, double v, double s) {
-  return (v + 1.0) / 2.0 * log(2.0) + 0.5 * log(std::numbers::pi) -
-         0.5 * log(r) - 0.5 * v * log(s) + lgamma(0.5 * v);
+  return logZ_from_terms(log(r), v, log(s), log_gamma(0.5 * v));
 }
 
+namespace {
+
+// Merges the moments of xs, each with the given weight, into the count n, mean
+// mu and variance sigma2, using the pairwise update of Chan, Golub and LeVeque.
+// A negative weight removes previously merged values.
+void merge_moments(std::span<const double> xs, double weight, double* n,
+                   double* mu, double* sigma2) {
+  if (xs.empty()) {
+    return;
+  }
+  double sum = 0.0;
+  for (double x : xs) {
+    sum += x;
+  }
+  const double batch_mean = sum / xs.size();
+  double batch_m2 = 0.0;
+  for (double x : xs) {
+    double d = x - batch_mean;
+    batch_m2 += d * d;
+  }
+  const double batch_n = weight * xs.size();
+  const double new_n = *n + batch_n;
+  if (new_n == 0.0) {
+    *n = 0.0;
+    *mu = 0.0;
+    *sigma2 = 0.0;
+    return;
+  }
+  const double delta = batch_mean - *mu;
+  const double m2 = *n * *sigma2 + weight * batch_m2 +
+                    delta * delta * *n * batch_n / new_n;
+  *mu += delta * batch_n / new_n;
+  *sigma2 = m2 / new_n;
+  *n = new_n;
+}
+
+}  // namespace
+
 void Normal::incorporate(const double& x, double weight) {
   N += weight;
   if (N == 0.0) {
     mean = 0.0;
     var = 0.0;
+    update_predictive();
     return;
   }
   double old_mean = mean;
   mean += weight * (x - mean) / N;
   var += weight * ((x - mean) * (x - old_mean) - var) / N;
+  update_predictive();
 }
 
 void Normal::posterior_hypers(double* mprime, double* sprime) const {
-  // r' = r + N
-  // m' = (r m + N mean) / (r + N)
-  // C = N (var + mean^2)
-  // s' = s + C + r m^2 - r' m' m'
-  double mdelta = r * (m - mean) / (r + N);
-  *mprime = mean + mdelta;
-  *sprime = s + r * (m - *mprime) * (m + *mprime) +
-            N * (var - 2 * mean * mdelta - mdelta * mdelta);
+  posterior_hypers_from_moments(N, mean, var, mprime, sprime);
+}
+
+void Normal::posterior_hypers_from_moments(double n, double mu, double sigma2,
+                                           double* mprime,
+                                           double* sprime) const {
+  posterior_hypers_at(r, m, s, n, mu, sigma2, mprime, sprime);
+}
+
+void Normal::update_predictive() {
+  // Based on equation (13) of GaussianInverseGamma.pdf. Incorporating x adds
+  // rn / (rn + 1) * (x - m')^2 to s', so expanding the ratio of the logZ terms
+  // gives a Student-t density with nu degrees of freedom.
+  double rn = r + N;
+  double nu = v + N;
+  double sprime;
+  posterior_hypers(&pred_mean, &sprime);
+  pred_scale = rn / ((rn + 1.0) * sprime);
+  pred_power = 0.5 * (nu + 1.0);
+  // Unit-weight updates step the lgamma ratio with
+  // g(nu + 1) = log(nu / 2) - g(nu), which is much cheaper than lgamma.
+  if (nu == pred_nu + 1.0) {
+    pred_lgamma_ratio = log(0.5 * pred_nu) - pred_lgamma_ratio;
+  } else if (nu == pred_nu - 1.0) {
+    pred_lgamma_ratio = log(0.5 * nu) - pred_lgamma_ratio;
+  } else if (nu != pred_nu) {
+    pred_lgamma_ratio = log_gamma(0.5 * (nu + 1.0)) - log_gamma(0.5 * nu);
+  }
+  pred_nu = nu;
+  pred_logc = -0.5 * std::log(std::numbers::pi) + 0.5 * log(pred_scale) +
+              pred_lgamma_ratio;
 }
 
 double Normal::logp(const double& x) const {
-  // Based on equation (13) of GaussianInverseGamma.pdf
-  double unused_mprime, sprime;
-  posterior_hypers(&unused_mprime, &sprime);
+  double d = x - pred_mean;
+  return pred_logc - pred_power * log1p(pred_scale * d * d);
+}
 
-  double sprime2;
-  const_cast<Normal*>(this)->incorporate(x);
-  posterior_hypers(&unused_mprime, &sprime2);
-  const_cast<Normal*>(this)->unincorporate(x);
+void Normal::logp_many(std::span<const double> xs,
+                       std::span<double> out) const {
+  assert(xs.size() == out.size());
+  // Copy the constants to locals so that the loop has no loads through this.
+  const double mu = pred_mean;
+  const double scale = pred_scale;
+  const double power = pred_power;
+  const double logc = pred_logc;
+  for (size_t i = 0; i < xs.size(); ++i) {
+    double d = xs[i] - mu;
+    out[i] = logc - power * log1p(scale * d * d);
+  }
+}
+
+void Normal::incorporate_many(std::span<const double> xs, double weight) {
+  merge_moments(xs, weight, &N, &mean, &var);
+  update_predictive();
+}
 
-  return -0.5 * log(M_2PI) + logZ(r + N + 1, v + N + 1, sprime2) -
-         logZ(r + N, v + N, sprime);
+double Normal::logp_score_delta(std::span<const double> xs) {
+  double n = N;
+  double mu = mean;
+  double sigma2 = var;
+  merge_moments(xs, 1.0, &n, &mu, &sigma2);
+  return logp_score_from_moments(n, mu, sigma2) - logp_score();
 }
 
 double Normal::logp_score() const {
+  return logp_score_from_moments(N, mean, var);
+}
+
+double Normal::logp_score_from_moments(double n, double mu,
+                                       double sigma2) const {
   // Based on equation (11) of GaussianInverseGamma.pdf
   double unused_mprime, sprime;
-  posterior_hypers(&unused_mprime, &sprime);
-  return -0.5 * N * log(M_2PI) + logZ(r + N, v + N, sprime) - logZ(r, v, s);
+  posterior_hypers_from_moments(n, mu, sigma2, &unused_mprime, &sprime);
+  return -0.5 * n * log(M_2PI) + logZ(r + n, v + n, sprime) - logZ(r, v, s);
 }
 
 double Normal::sample(std::mt19937* prng) {
@@ -72,34 +212,75 @@ double Normal::sample(std::mt19937* prng) {
 }
 
 void Normal::transition_hyperparameters(std::mt19937* prng) {
-  std::vector<double> logps;
-  std::vector<std::tuple<double, double, double, double>> hypers;
-  for (double rt : R_GRID) {
-    for (double vt : V_GRID) {
-      for (double mt : M_GRID) {
-        for (double st : S_GRID) {
-          r = rt;
-          v = vt;
-          m = mt;
-          s = st;
-          double lp = logp_score();
-          if (!std::isnan(lp)) {
-            logps.push_back(logp_score());
-            hypers.push_back(std::make_tuple(r, v, m, s));
-          }
-        }
+  std::vector<double> logps(hyperparameter_grid_size());
+  logp_score_hyperparameter_grid(logps);
+  int i = sample_from_logps_skipping_nans(logps, prng);
+  if (i < 0) {
+    printf("Warning!  All hyperparameters for Normal give nans!\n");
+    assert(false);
+  } else {
+    set_hyperparameter_grid_point(i);
+  }
+}
+
+int Normal::hyperparameter_grid_size() const {
+  const NormalGrid& grid = normal_grid();
+  return grid.rs.size() * grid.vs.size() * grid.ms.size() * grid.ss.size();
+}
+
+void Normal::logp_score_hyperparameter_grid(std::span<double> out) const {
+  // Evaluates logp_score at every grid point, computing each term only for
+  // the hyperparameters it depends on: log(r + N) per r, lgamma((v + N) / 2)
+  // per v, log(s') per (r, m, s), and the prior logZ from the cached table.
+  assert(std::ssize(out) == hyperparameter_grid_size());
+  const NormalGrid& grid = normal_grid();
+  const size_t num_v = grid.vs.size();
+  const size_t num_m = grid.ms.size();
+  const size_t num_s = grid.ss.size();
+  std::vector<double> log_rn(grid.rs.size());
+  std::vector<double> log_sprime(grid.rs.size() * num_m * num_s);
+  for (size_t ir = 0; ir < grid.rs.size(); ++ir) {
+    log_rn[ir] = log(grid.rs[ir] + N);
+    for (size_t im = 0; im < num_m; ++im) {
+      for (size_t is = 0; is < num_s; ++is) {
+        double unused_mprime, sprime;
+        posterior_hypers_at(grid.rs[ir], grid.ms[im], grid.ss[is], N, mean,
+                            var, &unused_mprime, &sprime);
+        log_sprime[(ir * num_m + im) * num_s + is] = log(sprime);
       }
     }
   }
+  std::vector<double> lgamma_half_nu(num_v);
+  for (size_t iv = 0; iv < num_v; ++iv) {
+    lgamma_half_nu[iv] = log_gamma(0.5 * (grid.vs[iv] + N));
+  }
 
-  if (logps.empty()) {
-    printf("Warning!  All hyperparameters for Normal give nans!\n");
-    assert(false);
-  } else {
-    int i = sample_from_logps(logps, prng);
-    r = std::get<0>(hypers[i]);
-    v = std::get<1>(hypers[i]);
-    m = std::get<2>(hypers[i]);
-    s = std::get<3>(hypers[i]);
+  const double data_term = -0.5 * N * log(M_2PI);
+  size_t i = 0;
+  for (size_t ir = 0; ir < grid.rs.size(); ++ir) {
+    for (size_t iv = 0; iv < num_v; ++iv) {
+      for (size_t im = 0; im < num_m; ++im) {
+        for (size_t is = 0; is < num_s; ++is) {
+          out[i++] = data_term +
+                     logZ_from_terms(log_rn[ir], grid.vs[iv] + N,
+                                     log_sprime[(ir * num_m + im) * num_s + is],
+                                     lgamma_half_nu[iv]) -
+                     grid.prior_logZ[(ir * num_v + iv) * num_s + is];
+        }
+      }
+    }
   }
 }
+
+void Normal::set_hyperparameter_grid_point(int i) {
+  assert(i >= 0 && i < hyperparameter_grid_size());
+  const NormalGrid& grid = normal_grid();
+  s = grid.ss[i % grid.ss.size()];
+  i /= grid.ss.size();
+  m = grid.ms[i % grid.ms.size()];
+  i /= grid.ms.size();
+  v = grid.vs[i % grid.vs.size()];
+  i /= grid.vs.size();
+  r = grid.rs[i];
+  update_predictive();
+}
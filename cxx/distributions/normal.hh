@@ -3,6 +3,7 @@
 
 #pragma once
 #include <random>
+#include <span>
 #include <tuple>
 #include <variant>
 
@@ -24,7 +25,7 @@
 
 double logZ(double r, double v, double s);
 
-class Normal : public Distribution<double> {
+class Normal final : public Distribution<double> {
  public:
   // Hyperparameters:
   // The conjugate prior to a normal distribution is a
@@ -41,7 +42,7 @@ class Normal : public Distribution<double> {
   double mean = 0.0;  // Mean of observed values
   double var = 0.0;   // Variance of observed values
 
-  Normal() {}
+  Normal() { update_predictive(); }
 
   void incorporate(const double& x, double weight = 1.0);
 
@@ -49,13 +50,49 @@ class Normal : public Distribution<double> {
 
   double logp(const double& x) const;
 
+  // Writes logp(xs[i]) to out[i]. xs and out must have the same size.
+  void logp_many(std::span<const double> xs, std::span<double> out) const;
+
+  void incorporate_many(std::span<const double> xs, double weight = 1.0);
+
+  double logp_score_delta(std::span<const double> xs);
+
   double logp_score() const;
 
   double sample(std::mt19937* prng);
 
   void transition_hyperparameters(std::mt19937* prng);
 
+  // The grid is the product of R_GRID, V_GRID, M_GRID and S_GRID, with the
+  // index of S_GRID varying fastest.
+  int hyperparameter_grid_size() const;
+
+  void logp_score_hyperparameter_grid(std::span<double> out) const;
+
+  void set_hyperparameter_grid_point(int i);
+
+  // Recomputes the cached posterior predictive constants. Must be called after
+  // the hyperparameters are assigned directly.
+  void update_predictive();
+
   // Disable copying.
   Normal& operator=(const Normal&) = delete;
   Normal(const Normal&) = delete;
+
+ private:
+  // posterior_hypers and logp_score with the sufficient statistics N, mean and
+  // var replaced by n, mu and sigma2.
+  void posterior_hypers_from_moments(double n, double mu, double sigma2,
+                                     double* mprime, double* sprime) const;
+  double logp_score_from_moments(double n, double mu, double sigma2) const;
+
+  // The posterior predictive is a Student-t distribution, so that
+  // logp(x) = pred_logc - pred_power * log1p(pred_scale * (x - pred_mean)^2).
+  double pred_mean;
+  double pred_scale;
+  double pred_power;
+  double pred_logc;
+  // lgamma((nu + 1) / 2) - lgamma(nu / 2) at nu = pred_nu.
+  double pred_nu = -1.0;
+  double pred_lgamma_ratio;
 };
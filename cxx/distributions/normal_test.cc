@@ -110,6 +110,35 @@ BOOST_AUTO_TEST_CASE(test_posterior_pred) {
   BOOST_TEST(nd.N == 10);
 }
 
+BOOST_AUTO_TEST_CASE(logp_matches_logp_score_delta) {
+  std::mt19937 prng;
+  Normal nd;
+  for (double x : {1.5, -0.3, 4.2, 2.0, 7.7}) {
+    nd.incorporate(x);
+  }
+  nd.transition_hyperparameters(&prng);
+
+  for (double x : {-10., 0., 3.3, 25.}) {
+    double lp = nd.logp(x);
+    double score = nd.logp_score();
+    nd.incorporate(x);
+    BOOST_TEST(lp == nd.logp_score() - score, tt::tolerance(1e-9));
+    nd.unincorporate(x);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(logp_many) {
+  Normal nd;
+  nd.incorporate(2.0);
+  nd.incorporate(3.5);
+  std::vector<double> xs = {-1., 0., 2.5, 9., 100.};
+  std::vector<double> out(xs.size());
+  nd.logp_many(xs, out);
+  for (size_t i = 0; i < xs.size(); ++i) {
+    BOOST_TEST(out[i] == nd.logp(xs[i]), tt::tolerance(1e-12));
+  }
+}
+
 BOOST_AUTO_TEST_CASE(simple) {
   Normal nd;
 
@@ -245,3 +274,50 @@ BOOST_AUTO_TEST_CASE(sample_agrees) {
   BOOST_TEST(mean == mprime, tt::tolerance(4e-3));
   BOOST_TEST(stddev == actual_stddev, tt::tolerance(4e-3));
 }
+
+BOOST_AUTO_TEST_CASE(batch_incorporate) {
+  Normal nd, nd_batch;
+  nd.incorporate(1.0);
+  nd_batch.incorporate(1.0);
+  const double xs[] = {-2.0, 0.5, 4.0, 3.3, -7.1};
+
+  double score = nd.logp_score();
+  for (double x : xs) {
+    nd.incorporate(x);
+  }
+  BOOST_TEST(nd_batch.logp_score_delta(xs) == nd.logp_score() - score,
+             tt::tolerance(1e-9));
+
+  nd_batch.incorporate_many(xs);
+  BOOST_TEST(nd_batch.N == nd.N);
+  BOOST_TEST(nd_batch.mean == nd.mean, tt::tolerance(1e-9));
+  BOOST_TEST(nd_batch.var == nd.var, tt::tolerance(1e-9));
+  BOOST_TEST(nd_batch.logp(2.0) == nd.logp(2.0), tt::tolerance(1e-9));
+
+  nd_batch.incorporate_many(xs, -1.0);
+  BOOST_TEST(nd_batch.N == 1);
+  BOOST_TEST(nd_batch.mean == 1.0, tt::tolerance(1e-9));
+  BOOST_TEST(nd_batch.var == 0.0, tt::tolerance(1e-9));
+}
+
+BOOST_AUTO_TEST_CASE(predictive_cache_after_many_updates) {
+  std::mt19937 prng;
+  std::normal_distribution<double> d(3.0, 2.0);
+  std::vector<double> xs(5000);
+  for (double& x : xs) {
+    x = d(prng);
+  }
+  Normal nd, nd_fresh;
+  for (double x : xs) {
+    nd.incorporate(x);
+  }
+  for (size_t i = 10; i < xs.size(); ++i) {
+    nd.unincorporate(xs[i]);
+  }
+  for (size_t i = 0; i < 10; ++i) {
+    nd_fresh.incorporate(xs[i]);
+  }
+  for (double x : {-5., 0., 3., 10.}) {
+    BOOST_TEST(nd.logp(x) == nd_fresh.logp(x), tt::tolerance(1e-9));
+  }
+}
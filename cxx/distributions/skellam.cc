@@ -1,7 +1,11 @@
 #include "distributions/skellam.hh"
 
+#include <bit>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
+#include <vector>
+
 #include "util_math.hh"
 
 double lognormal_logp(double x, double mean, double stddev) {
@@ -10,10 +14,52 @@ double lognormal_logp(double x, double mean, double stddev) {
       - std::log(x * stddev) - 0.5 * std::log(2.0 * std::numbers::pi);
 }
 
+namespace {
+
+struct BesselMemoEntry {
+  double arg = -1.0;
+  int order = -1;
+  double value = 0.0;
+};
+
+// The memo has 2^kBesselMemoBits slots.
+const int kBesselMemoBits = 12;
+
+// Returns log_bessel_i(order, arg) through a direct-mapped memo keyed by both
+// arguments.  Each thread has its own memo, so const Skellam methods can be
+// called concurrently, and Skellams with different rates share it.
+double memoised_log_bessel(int order, double arg) {
+  thread_local std::vector<BesselMemoEntry> memo(size_t(1)
+                                                 << kBesselMemoBits);
+  uint64_t h = (std::bit_cast<uint64_t>(arg) ^ uint64_t(order)) *
+               0x9E3779B97F4A7C15ull;
+  BesselMemoEntry& e = memo[h >> (64 - kBesselMemoBits)];
+  if (e.arg != arg || e.order != order) {
+    e.arg = arg;
+    e.order = order;
+    e.value = log_bessel_i(order, arg);
+  }
+  return e.value;
+}
+
+}  // namespace
+
+double Skellam::log_bessel(int x) const {
+  return memoised_log_bessel(std::abs(x), 2.0 * std::sqrt(mu1 * mu2));
+}
+
 double Skellam::logp(const int&x) const {
-  return -mu1 - mu2 + (x / 2.0) * std::log(mu1 / mu2)
-      // TODO(thomaswc): Replace this with something more numerically stable.
-      + std::log(std::cyl_bessel_i(std::abs(x), 2.0 * std::sqrt(mu1 * mu2)));
+  return -mu1 - mu2 + (x / 2.0) * std::log(mu1 / mu2) + log_bessel(x);
+}
+
+void Skellam::logp_many(std::span<const int> xs,
+                        std::span<double> out) const {
+  assert(xs.size() == out.size());
+  const double logc = -mu1 - mu2;
+  const double half_log_ratio = 0.5 * std::log(mu1 / mu2);
+  for (size_t i = 0; i < xs.size(); ++i) {
+    out[i] = logc + xs[i] * half_log_ratio + log_bessel(xs[i]);
+  }
 }
 
 int Skellam::sample(std::mt19937* prng) {
@@ -70,3 +116,20 @@ void Skellam::set_latents(const std::vector<double>& v) {
   mu1 = v[0];
   mu2 = v[1];
 }
+
+std::vector<double> Skellam::store_unconstrained_latents() const {
+  return {std::log(mu1), std::log(mu2)};
+}
+
+void Skellam::set_unconstrained_latents(const std::vector<double>& v) {
+  assert(v.size() == 2);
+  mu1 = std::exp(v[0]);
+  mu2 = std::exp(v[1]);
+}
+
+double Skellam::logp_unconstrained_latents() const {
+  double y1 = (std::log(mu1) - mean1) / stddev1;
+  double y2 = (std::log(mu2) - mean2) / stddev2;
+  return -0.5 * (y1 * y1 + y2 * y2) - std::log(stddev1 * stddev2) -
+         std::log(2.0 * std::numbers::pi);
+}
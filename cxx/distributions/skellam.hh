@@ -1,11 +1,14 @@
 #pragma once
 
+#include <span>
+#include <vector>
+
 #include "distributions/nonconjugate.hh"
 
 #define MEAN_GRID { -10.0, 0.0, 10.0 }
 #define STDDEV_GRID { 0.1, 1.0, 10.0 }
 
-class Skellam : public NonconjugateDistribution<int> {
+class Skellam final : public NonconjugateDistribution<int> {
  public:
   // Skellam distribution with log Normal hyperprior of latent rates.
   double mean1, mean2, stddev1, stddev2;  // Hyperparameters
@@ -17,6 +20,8 @@ class Skellam : public NonconjugateDistribution<int> {
 
   double logp(const int& x) const;
 
+  void logp_many(std::span<const int> xs, std::span<double> out) const;
+
   int sample(std::mt19937* prng);
 
   void transition_hyperparameters(std::mt19937* prng);
@@ -26,4 +31,16 @@ class Skellam : public NonconjugateDistribution<int> {
   std::vector<double> store_latents() const;
 
   void set_latents(const std::vector<double>& v);
+
+  // The unconstrained latents are log(mu1) and log(mu2), which are normal
+  // under the prior.
+  std::vector<double> store_unconstrained_latents() const;
+
+  void set_unconstrained_latents(const std::vector<double>& v);
+
+  double logp_unconstrained_latents() const;
+
+ private:
+  // Returns log I_{|x|}(2 sqrt(mu1 mu2)).
+  double log_bessel(int x) const;
 };
@@ -5,6 +5,8 @@
 #include "distributions/skellam.hh"
 
 #include <boost/test/included/unit_test.hpp>
+#include <thread>
+#include <vector>
 
 namespace tt = boost::test_tools;
 
@@ -106,3 +108,120 @@ BOOST_AUTO_TEST_CASE(transition_theta) {
 //     BOOST_TEST(abs(probs[kv.first] - approx_p) <= 3 * stddev);
 //   }
 // }
+
+BOOST_AUTO_TEST_CASE(test_batch) {
+  Skellam sd;
+  sd.mu1 = 2.0;
+  sd.mu2 = 0.5;
+  const int xs[] = {-3, 0, 1, 4};
+
+  double out[std::size(xs)];
+  sd.logp_many(xs, out);
+  double expected_delta = 0.0;
+  for (size_t i = 0; i < std::size(xs); ++i) {
+    BOOST_TEST(out[i] == sd.logp(xs[i]), tt::tolerance(1e-12));
+    expected_delta += sd.logp(xs[i]);
+  }
+  BOOST_TEST(sd.logp_score_delta(xs) == expected_delta, tt::tolerance(1e-12));
+}
+
+BOOST_AUTO_TEST_CASE(test_logp_large_rates) {
+  Skellam sd;
+  sd.mu1 = 3.0;
+  sd.mu2 = 1.5;
+  for (int x : {-12, -1, 0, 2, 9}) {
+    double expected = -sd.mu1 - sd.mu2 + (x / 2.0) * std::log(sd.mu1 / sd.mu2) +
+        std::log(std::cyl_bessel_i(std::abs(x), 2.0 * std::sqrt(sd.mu1 * sd.mu2)));
+    BOOST_TEST(sd.logp(x) == expected, tt::tolerance(1e-9));
+  }
+
+  // Assigning the latents directly must not reuse memoised Bessel values.
+  sd.mu1 = 2000.0;
+  sd.mu2 = 1900.0;
+  double lp = sd.logp(100);
+  BOOST_TEST(std::isfinite(lp));
+  // The Skellam is approximately normal with mean mu1 - mu2 and variance
+  // mu1 + mu2 here.
+  BOOST_TEST(lp == -0.5 * std::log(2.0 * std::numbers::pi * 3900.0),
+             tt::tolerance(1e-3));
+}
+
+BOOST_AUTO_TEST_CASE(test_seen_values) {
+  Skellam sd;
+  for (int x : {4, -2, 4, 9, -2, 0}) {
+    sd.incorporate(x);
+  }
+  BOOST_TEST(sd.seen_values == std::vector<int>({-2, 0, 4, 9}),
+             tt::per_element());
+  BOOST_TEST(sd.seen_weights == std::vector<double>({2.0, 1.0, 2.0, 1.0}),
+             tt::per_element());
+
+  sd.unincorporate(9);
+  sd.unincorporate(-2);
+  BOOST_TEST(sd.seen_values == std::vector<int>({-2, 0, 4}),
+             tt::per_element());
+  BOOST_TEST(sd.seen_weights == std::vector<double>({1.0, 1.0, 2.0}),
+             tt::per_element());
+  BOOST_TEST(sd.N == 4.0);
+}
+
+BOOST_AUTO_TEST_CASE(test_seen_values_fractional_weights) {
+  Skellam sd;
+  sd.incorporate(3);
+  // 0.1 + 0.2 - 0.1 - 0.2 is not exactly zero in floating point.
+  sd.incorporate(5, 0.1);
+  sd.incorporate(5, 0.2);
+  sd.incorporate(5, -0.1);
+  sd.incorporate(5, -0.2);
+  BOOST_TEST(sd.seen_values == std::vector<int>({3}), tt::per_element());
+}
+
+BOOST_AUTO_TEST_CASE(test_transition_theta_recovers_rates) {
+  std::mt19937 prng;
+  std::poisson_distribution<int> d1(8.0);
+  std::poisson_distribution<int> d2(3.0);
+  Skellam sd;
+  sd.init_theta(&prng);
+  for (int i = 0; i < 2000; ++i) {
+    sd.incorporate(d1(prng) - d2(prng));
+  }
+
+  for (int i = 0; i < 300; ++i) {
+    sd.transition_theta(&prng);
+  }
+  // The mean and variance of the Skellam are mu1 - mu2 and mu1 + mu2.
+  BOOST_TEST(sd.mu1 - sd.mu2 == 5.0, tt::tolerance(0.05));
+  BOOST_TEST(sd.mu1 + sd.mu2 == 11.0, tt::tolerance(0.15));
+}
+
+BOOST_AUTO_TEST_CASE(test_concurrent_logp) {
+  Skellam sd;
+  sd.mu1 = 4.0;
+  sd.mu2 = 2.5;
+  std::vector<double> expected;
+  for (int x = -50; x <= 50; ++x) {
+    expected.push_back(sd.logp(x));
+  }
+  std::vector<int> mismatches(4, 0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t]() {
+      Skellam other;
+      other.mu1 = 1.0 + t;
+      other.mu2 = 0.5;
+      for (int rep = 0; rep < 20; ++rep) {
+        for (int x = -50; x <= 50; ++x) {
+          // Interleave another Skellam's orders with sd's.
+          other.logp(x);
+          mismatches[t] += sd.logp(x) != expected[x + 50];
+        }
+      }
+    });
+  }
+  for (std::thread& th : threads) {
+    th.join();
+  }
+  for (int m : mismatches) {
+    BOOST_TEST(m == 0);
+  }
+}
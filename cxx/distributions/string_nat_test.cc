@@ -21,4 +21,5 @@ BOOST_AUTO_TEST_CASE(test_nearest) {
 
   BOOST_TEST(sn.nearest("1234") == "1234");
   BOOST_TEST(sn.nearest("a77z99") == "7799");
+  BOOST_TEST(StringNat(3).nearest("12345") == "123");
 }
@@ -0,0 +1,86 @@
+// Copyright 2024
+// See LICENSE.txt
+
+#include "distributions/string_vocabulary.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+
+#include "emissions/string_alignment.hh"
+
+namespace {
+
+// The positions of the first occurrences of the distinct strings of vs.
+std::vector<int> first_positions(const std::vector<std::string>& vs) {
+  std::unordered_map<std::string, int> seen;
+  std::vector<int> positions;
+  for (size_t i = 0; i < vs.size(); ++i) {
+    if (seen.emplace(vs[i], i).second) {
+      positions.push_back(i);
+    }
+  }
+  return positions;
+}
+
+std::vector<std::string> strings_at(const std::vector<std::string>& vs,
+                                    const std::vector<int>& positions) {
+  std::vector<std::string> strings;
+  strings.reserve(positions.size());
+  for (int i : positions) {
+    strings.push_back(vs[i]);
+  }
+  return strings;
+}
+
+}  // namespace
+
+StringVocabulary::StringVocabulary(const std::vector<std::string>& vs)
+    : strings(vs),
+      distinct_positions(first_positions(vs)),
+      packed_strings(strings_at(vs, distinct_positions)) {
+  string_indices.reserve(distinct_positions.size());
+  for (int i : distinct_positions) {
+    string_indices.emplace(strings[i], i);
+  }
+}
+
+int StringVocabulary::index(const std::string& s) const {
+  auto it = string_indices.find(s);
+  return it == string_indices.end() ? -1 : it->second;
+}
+
+const std::string& StringVocabulary::nearest(const std::string& x) const {
+  assert(!strings.empty());
+  int i = index(x);
+  if (i >= 0) {
+    return strings[i];
+  }
+  std::vector<int> distances;
+  packed_strings.distances(x, &distances);
+  // The positions are increasing, so ties go to the first string.
+  return strings[distinct_positions[std::min_element(distances.begin(),
+                                                     distances.end()) -
+                                    distances.begin()]];
+}
+
+std::vector<int> StringVocabulary::nearest_k(const std::string& x,
+                                             int k) const {
+  if (strings.empty() || k <= 0) {
+    return {};
+  }
+  std::vector<int> distances;
+  packed_strings.distances(x, &distances);
+  std::vector<std::pair<int, int>> best;  // (distance, position)
+  best.reserve(distances.size());
+  for (size_t i = 0; i < distances.size(); ++i) {
+    best.emplace_back(distances[i], distinct_positions[i]);
+  }
+  const size_t num_best = std::min(best.size(), static_cast<size_t>(k));
+  std::partial_sort(best.begin(), best.begin() + num_best, best.end());
+  std::vector<int> indices;
+  for (size_t i = 0; i < num_best; ++i) {
+    indices.push_back(best[i].second);
+  }
+  return indices;
+}
@@ -0,0 +1,45 @@
+// Copyright 2024
+// See LICENSE.txt
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "emissions/string_alignment.hh"
+
+// The finite set of strings of a StringCat, with a hash index from string to
+// position, and the strings packed for bit-parallel edit distances for nearest
+// neighbor queries.
+// A vocabulary is immutable once built, so one can be shared by all of the
+// clusters of a relation.
+class StringVocabulary {
+ public:
+  const std::vector<std::string> strings;
+
+  // Each element of vs should be distinct.
+  StringVocabulary(const std::vector<std::string>& vs);
+
+  // The position of s in strings, or -1 if s is not in the vocabulary.
+  int index(const std::string& s) const;
+
+  // The first string in strings among those with the smallest edit distance
+  // to x.  The vocabulary must not be empty.
+  const std::string& nearest(const std::string& x) const;
+
+  // The positions in strings of the (up to) k distinct strings with the
+  // smallest edit distances to x, ordered by distance and then by position.
+  std::vector<int> nearest_k(const std::string& x, int k) const;
+
+ private:
+  std::unordered_map<std::string, int> string_indices;
+
+  // The positions of the distinct strings (the first of any duplicates), and
+  // the strings at those positions packed together.  A scan of the packed
+  // strings is faster than searching a BK-tree, which prunes few of the
+  // short strings in our data.
+  std::vector<int> distinct_positions;
+  PackedLevenshteinPatterns packed_strings;
+};
@@ -0,0 +1,104 @@
+// Apache License, Version 2.0, refer to LICENSE.txt
+
+#define BOOST_TEST_MODULE test StringVocabulary
+
+#include "distributions/string_vocabulary.hh"
+
+#include <algorithm>
+#include <boost/test/included/unit_test.hpp>
+#include <random>
+
+#include "emissions/string_alignment.hh"
+
+BOOST_AUTO_TEST_CASE(test_index) {
+  StringVocabulary v({"MD", "PT", "NP", "DO", "PHD"});
+  BOOST_TEST(v.index("MD") == 0);
+  BOOST_TEST(v.index("PHD") == 4);
+  BOOST_TEST(v.index("RN") == -1);
+  BOOST_TEST(v.nearest("DO") == "DO");
+  BOOST_TEST(v.nearest("PHDD") == "PHD");
+  // MD, PT, NP and DO are all at distance 2; the earliest one wins.
+  BOOST_TEST(v.nearest("XX") == "MD");
+}
+
+BOOST_AUTO_TEST_CASE(test_nearest_matches_linear_scan) {
+  std::mt19937 prng;
+  std::uniform_int_distribution<int> length(0, 8);
+  std::uniform_int_distribution<int> letter(0, 3);
+  auto random_string = [&]() {
+    std::string s(length(prng), 'a');
+    for (char& c : s) {
+      c = 'a' + letter(prng);
+    }
+    return s;
+  };
+
+  std::vector<std::string> strings;
+  for (int i = 0; i < 300; ++i) {
+    std::string s = random_string();
+    if (std::find(strings.begin(), strings.end(), s) == strings.end()) {
+      strings.push_back(s);
+    }
+  }
+  StringVocabulary v(strings);
+
+  for (int i = 0; i < 200; ++i) {
+    std::string x = random_string();
+    const std::string* expected = &strings[0];
+    int lowest_distance = levenshtein_distance(x, strings[0]);
+    for (const std::string& s : strings) {
+      int d = levenshtein_distance(x, s);
+      if (d < lowest_distance) {
+        lowest_distance = d;
+        expected = &s;
+      }
+    }
+    BOOST_TEST(v.nearest(x) == *expected);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_nearest_k) {
+  StringVocabulary v({"MD", "PT", "NP", "DO", "PHD", "MD"});
+  BOOST_TEST(v.nearest_k("PHDD", 1) == std::vector<int>({4}));
+  // PHD is at distance 3 from XX, and the rest at distance 2.  The
+  // duplicate MD is not returned.
+  BOOST_TEST(v.nearest_k("XX", 3) == std::vector<int>({0, 1, 2}));
+  BOOST_TEST(v.nearest_k("XX", 10) == std::vector<int>({0, 1, 2, 3, 4}));
+  BOOST_TEST(v.nearest_k("XX", 0).empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_nearest_k_matches_linear_scan) {
+  std::mt19937 prng;
+  std::uniform_int_distribution<int> length(0, 8);
+  std::uniform_int_distribution<int> letter(0, 3);
+  auto random_string = [&]() {
+    std::string s(length(prng), 'a');
+    for (char& c : s) {
+      c = 'a' + letter(prng);
+    }
+    return s;
+  };
+
+  std::vector<std::string> strings;
+  for (int i = 0; i < 300; ++i) {
+    std::string s = random_string();
+    if (std::find(strings.begin(), strings.end(), s) == strings.end()) {
+      strings.push_back(s);
+    }
+  }
+  StringVocabulary v(strings);
+
+  for (int i = 0; i < 100; ++i) {
+    std::string x = random_string();
+    std::vector<std::pair<int, int>> scan;
+    for (size_t j = 0; j < strings.size(); ++j) {
+      scan.emplace_back(levenshtein_distance(x, strings[j]), j);
+    }
+    std::sort(scan.begin(), scan.end());
+    std::vector<int> expected;
+    for (int j = 0; j < 7; ++j) {
+      expected.push_back(scan[j].second);
+    }
+    BOOST_TEST(v.nearest_k(x, 7) == expected);
+  }
+}
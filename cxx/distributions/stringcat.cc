@@ -1,20 +1,17 @@
 // Copyright 2024
 // See LICENSE.txt
 
-#include <algorithm>
 #include <cstdlib>
-#include <cassert>
-#include <limits>
+#include <cstdio>
 #include "distributions/stringcat.hh"
-#include "emissions/string_alignment.hh"
 
 int StringCat::string_to_index(const std::string& s) const {
-  auto it = std::find(strings.begin(), strings.end(), s);
-  if (it == strings.end()) {
+  int i = vocabulary->index(s);
+  if (i < 0) {
     printf("String %s not in StringCat's list of strings\n", s.c_str());
     std::exit(1);
   }
-  return it - strings.begin();
+  return i;
 }
 
 void StringCat::incorporate(const std::string& s, double weight) {
@@ -31,7 +28,7 @@ double StringCat::logp_score() const {
 }
 
 std::string StringCat::sample(std::mt19937* prng) {
-  return strings[dc.sample(prng)];
+  return vocabulary->strings[dc.sample(prng)];
 }
 
 void StringCat::transition_hyperparameters(std::mt19937* prng) {
@@ -39,21 +36,5 @@ void StringCat::transition_hyperparameters(std::mt19937* prng) {
 }
 
 std::string StringCat::nearest(const std::string& x) const {
-  if (std::find(strings.begin(), strings.end(), x) != strings.end()) {
-    return x;
-  }
-
-  const std::string *nearest = &(strings[0]);
-  double lowest_distance = std::numeric_limits<double>::max();
-  for (const std::string& s : strings) {
-    std::vector<StrAlignment> alignments;
-    topk_alignments(1, s, x, edit_distance, &alignments);
-    double d = alignments[0].cost;
-    if (d < lowest_distance) {
-      lowest_distance = d;
-      nearest = &s;
-    }
-  }
-
-  return *nearest;
+  return vocabulary->nearest(x);
 }
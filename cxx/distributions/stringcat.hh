@@ -3,20 +3,28 @@
 
 #pragma once
 
+#include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "distributions/base.hh"
 #include "distributions/dirichlet_categorical.hh"
+#include "distributions/string_vocabulary.hh"
 
 // A distribution over a finite set of strings.
-class StringCat : public Distribution<std::string> {
+class StringCat final : public Distribution<std::string> {
  public:
-  std::vector<std::string> strings;
+  // The set of strings, which may be shared with other StringCats.
+  std::shared_ptr<const StringVocabulary> vocabulary;
   DirichletCategorical dc;
 
   // Each element of vs should be distinct.
-  StringCat(const std::vector<std::string> &vs) : strings(vs), dc(vs.size()) {};
+  StringCat(const std::vector<std::string> &vs)
+      : StringCat(std::make_shared<const StringVocabulary>(vs)) {};
+
+  StringCat(std::shared_ptr<const StringVocabulary> v)
+      : vocabulary(std::move(v)), dc(vocabulary->strings.size()) {};
 
   int string_to_index(const std::string& s) const;
 
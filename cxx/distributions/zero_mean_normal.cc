@@ -6,14 +6,15 @@
 #include <cassert>
 #include <cmath>
 #include <numbers>
+#include <vector>
 
 // Return log density of location-scaled T distribution with zero mean.
 double log_t_distribution(const double& x, const double& v,
                           const double& variance) {
   // https://en.wikipedia.org/wiki/Student%27s_t-distribution#Density_and_first_two_moments
   double v_shift = (v + 1.0) / 2.0;
-  return lgamma(v_shift)
-      - lgamma(v / 2.0)
+  return log_gamma(v_shift)
+      - log_gamma(v / 2.0)
       - 0.5 * log(std::numbers::pi * v * variance)
       - v_shift * log1p(x * x / (variance * v));
 }
@@ -35,15 +36,59 @@ double ZeroMeanNormal::logp(const double& x) const {
   return log_t_distribution(x, 2.0 * alpha_n, t_variance);
 }
 
+void ZeroMeanNormal::logp_many(std::span<const double> xs,
+                               std::span<double> out) const {
+  assert(xs.size() == out.size());
+  // log_t_distribution with the terms that don't depend on x hoisted.
+  const double alpha_n = alpha + N / 2.0;
+  const double v = 2.0 * alpha_n;
+  const double t_variance = (beta + 0.5 * var * N) / alpha_n;
+  const double v_shift = (v + 1.0) / 2.0;
+  const double logc = log_gamma(v_shift) - log_gamma(v / 2.0) -
+                      0.5 * log(std::numbers::pi * v * t_variance);
+  const double scale = 1.0 / (t_variance * v);
+  for (size_t i = 0; i < xs.size(); ++i) {
+    out[i] = logc - v_shift * log1p(xs[i] * xs[i] * scale);
+  }
+}
+
+void ZeroMeanNormal::incorporate_many(std::span<const double> xs,
+                                      double weight) {
+  double sum_squares = 0.0;
+  for (double x : xs) {
+    sum_squares += x * x;
+  }
+  double new_n = N + weight * xs.size();
+  var = new_n == 0.0 ? 0.0 : (N * var + weight * sum_squares) / new_n;
+  N = new_n;
+}
+
+double ZeroMeanNormal::logp_score_delta(std::span<const double> xs) {
+  if (xs.empty()) {
+    return 0.0;
+  }
+  double sum_squares = 0.0;
+  for (double x : xs) {
+    sum_squares += x * x;
+  }
+  double n = N + xs.size();
+  return logp_score_from_moments(n, (N * var + sum_squares) / n) -
+         logp_score();
+}
+
 double ZeroMeanNormal::logp_score() const {
+  return logp_score_from_moments(N, var);
+}
+
+double ZeroMeanNormal::logp_score_from_moments(double n, double sigma2) const {
   // Marginal likelihood from Page 10 of
   // https://people.eecs.berkeley.edu/~jordan/courses/260-spring10/lectures/lecture5.pdf
-  double alpha_n = alpha + N / 2.0;
+  double alpha_n = alpha + n / 2.0;
   return alpha * log(beta)
-      - lgamma(alpha)
-      - (N / 2.0) * log(2.0 * std::numbers::pi)
-      + lgamma(alpha_n)
-      - alpha_n * log(beta + 0.5 * var * N);
+      - log_gamma(alpha)
+      - (n / 2.0) * log(2.0 * std::numbers::pi)
+      + log_gamma(alpha_n)
+      - alpha_n * log(beta + 0.5 * sigma2 * n);
 }
 
 double ZeroMeanNormal::sample(std::mt19937* prng) {
@@ -59,27 +104,70 @@ double ZeroMeanNormal::sample(std::mt19937* prng) {
 #define BETA_GRID \
   { 1e-4, 1e-3, 1e-2, 1e-1, 1.0, 10.0, 100.0, 1000.0, 10000.0 }
 
-void ZeroMeanNormal::transition_hyperparameters(std::mt19937* prng) {
-  std::vector<double> logps;
-  std::vector<std::pair<double, double>> hypers;
-  for (double a : ALPHA_GRID) {
-    for (double b : BETA_GRID) {
-      alpha = a;
-      beta = b;
-      double lp = logp_score();
-      if (!std::isnan(lp)) {
-        logps.push_back(logp_score());
-        hypers.push_back(std::make_pair(a, b));
+namespace {
+
+const std::vector<double> kAlphaGrid = ALPHA_GRID;
+const std::vector<double> kBetaGrid = BETA_GRID;
+
+// alpha * log(beta) - lgamma(alpha) for every (alpha, beta) in the grid, which
+// doesn't depend on the data.
+const std::vector<double>& prior_grid_terms() {
+  static const std::vector<double> terms = []() {
+    std::vector<double> t;
+    for (double a : kAlphaGrid) {
+      for (double b : kBetaGrid) {
+        t.push_back(a * log(b) - log_gamma(a));
       }
     }
-  }
+    return t;
+  }();
+  return terms;
+}
+
+}  // namespace
 
-  if (logps.empty()) {
+void ZeroMeanNormal::transition_hyperparameters(std::mt19937* prng) {
+  std::vector<double> logps(hyperparameter_grid_size());
+  logp_score_hyperparameter_grid(logps);
+  int i = sample_from_logps_skipping_nans(logps, prng);
+  if (i < 0) {
     printf("Warning!  All hyperparameters for ZeroMeanNormal gave nans!\n");
     assert(false);
   } else {
-    int i = sample_from_logps(logps, prng);
-    alpha = std::get<0>(hypers[i]);
-    beta = std::get<1>(hypers[i]);
+    set_hyperparameter_grid_point(i);
   }
 }
+
+int ZeroMeanNormal::hyperparameter_grid_size() const {
+  return kAlphaGrid.size() * kBetaGrid.size();
+}
+
+void ZeroMeanNormal::logp_score_hyperparameter_grid(
+    std::span<double> out) const {
+  // Splits logp_score_from_moments into terms that depend only on alpha or
+  // only on beta, so that each is computed once per grid value.
+  assert(std::ssize(out) == hyperparameter_grid_size());
+  const std::vector<double>& prior_terms = prior_grid_terms();
+  std::vector<double> lgamma_alpha_n(kAlphaGrid.size());
+  for (size_t i = 0; i < kAlphaGrid.size(); ++i) {
+    lgamma_alpha_n[i] = log_gamma(kAlphaGrid[i] + N / 2.0);
+  }
+  std::vector<double> log_beta_n(kBetaGrid.size());
+  for (size_t j = 0; j < kBetaGrid.size(); ++j) {
+    log_beta_n[j] = log(kBetaGrid[j] + 0.5 * var * N);
+  }
+  const double data_term = -(N / 2.0) * log(2.0 * std::numbers::pi);
+  for (size_t i = 0; i < kAlphaGrid.size(); ++i) {
+    for (size_t j = 0; j < kBetaGrid.size(); ++j) {
+      const size_t k = i * kBetaGrid.size() + j;
+      out[k] = prior_terms[k] + data_term + lgamma_alpha_n[i] -
+               (kAlphaGrid[i] + N / 2.0) * log_beta_n[j];
+    }
+  }
+}
+
+void ZeroMeanNormal::set_hyperparameter_grid_point(int i) {
+  assert(i >= 0 && i < hyperparameter_grid_size());
+  alpha = kAlphaGrid[i / kBetaGrid.size()];
+  beta = kBetaGrid[i % kBetaGrid.size()];
+}
@@ -3,6 +3,7 @@
 
 #pragma once
 #include <random>
+#include <span>
 #include <tuple>
 #include <variant>
 
@@ -29,13 +30,32 @@ class ZeroMeanNormal : public Distribution<double> {
 
   double logp(const double& x) const;
 
+  void logp_many(std::span<const double> xs, std::span<double> out) const;
+
+  void incorporate_many(std::span<const double> xs, double weight = 1.0);
+
+  double logp_score_delta(std::span<const double> xs);
+
   double logp_score() const;
 
   double sample(std::mt19937* prng);
 
   void transition_hyperparameters(std::mt19937* prng);
 
+  // The grid is the product of the alpha and beta grids, with the index of
+  // beta varying fastest.
+  int hyperparameter_grid_size() const;
+
+  void logp_score_hyperparameter_grid(std::span<double> out) const;
+
+  void set_hyperparameter_grid_point(int i);
+
   // Disable copying.
   ZeroMeanNormal& operator=(const ZeroMeanNormal&) = delete;
   ZeroMeanNormal(const ZeroMeanNormal&) = delete;
+
+ private:
+  // logp_score with the sufficient statistics N and var replaced by n and
+  // sigma2.
+  double logp_score_from_moments(double n, double sigma2) const;
 };
@@ -217,3 +217,28 @@ BOOST_AUTO_TEST_CASE(sample_agrees) {
   double t_variance = beta_n / alpha_n;
   BOOST_TEST(stddev == sqrt(alpha_n / (alpha_n - 1.) * t_variance), tt::tolerance(5e-3));
 }
+
+BOOST_AUTO_TEST_CASE(test_batch) {
+  ZeroMeanNormal nd, nd_batch;
+  nd.incorporate(0.5);
+  nd_batch.incorporate(0.5);
+  const double xs[] = {-1.2, 0.3, 2.5, -0.7};
+
+  double out[std::size(xs)];
+  nd.logp_many(xs, out);
+  for (size_t i = 0; i < std::size(xs); ++i) {
+    BOOST_TEST(out[i] == nd.logp(xs[i]), tt::tolerance(1e-12));
+  }
+
+  double score = nd.logp_score();
+  for (double x : xs) {
+    nd.incorporate(x);
+  }
+  BOOST_TEST(nd_batch.logp_score_delta(xs) == nd.logp_score() - score,
+             tt::tolerance(1e-9));
+  nd_batch.incorporate_many(xs);
+  BOOST_TEST(nd_batch.logp_score() == nd.logp_score(), tt::tolerance(1e-9));
+  nd_batch.incorporate_many(xs, -1.0);
+  BOOST_TEST(nd_batch.N == 1);
+  BOOST_TEST(nd_batch.var == 0.25, tt::tolerance(1e-9));
+}
@@ -0,0 +1,136 @@
+// Copyright 2024
+// See LICENSE.txt
+
+#include "emissions/alignment_cache.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+
+namespace {
+
+// The heap bytes of s, which are none if s is short enough to be stored in
+// the string itself.
+size_t string_heap_bytes(const std::string& s) {
+  const char* begin = reinterpret_cast<const char*>(&s);
+  if (s.data() >= begin && s.data() < begin + sizeof(s)) {
+    return 0;
+  }
+  return s.capacity() + 1;
+}
+
+// The heap bytes of one entry:  its list node, its index node and what its
+// strings and deltas point to.
+template <typename Entry, typename IndexNode>
+size_t heap_bytes(const Entry& e) {
+  return sizeof(Entry) + 2 * sizeof(void*) + sizeof(IndexNode) +
+         2 * sizeof(void*) + string_heap_bytes(e.clean) +
+         string_heap_bytes(e.corrupted) +
+         e.deltas.capacity() * sizeof(CountDelta);
+}
+
+}  // namespace
+
+size_t StringPairHash::operator()(
+    const std::pair<std::string_view, std::string_view>& k) const {
+  const size_t h1 = std::hash<std::string_view>{}(k.first);
+  const size_t h2 = std::hash<std::string_view>{}(k.second);
+  return h1 ^ (h2 + 0x9e3779b97f4a7c15 + (h1 << 6) + (h1 >> 2));
+}
+
+AlignmentCache::AlignmentCache(size_t capacity, int num_shards)
+    : shard_capacity(std::max<size_t>(1, capacity / num_shards)) {
+  assert(num_shards > 0);
+  for (int i = 0; i < num_shards; ++i) {
+    shards.push_back(std::make_unique<Shard>());
+  }
+}
+
+AlignmentCache::Shard& AlignmentCache::shard_for(const KeyView& k) {
+  // The high bits pick the shard, so that the low bits the shard's index
+  // buckets by still vary within a shard.
+  return *shards[(StringPairHash{}(k) >> 32) % shards.size()];
+}
+
+bool AlignmentCache::lookup(std::string_view clean,
+                            std::string_view corrupted,
+                            std::vector<CountDelta>* deltas) {
+  const KeyView k(clean, corrupted);
+  Shard& shard = shard_for(k);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.index.find(k);
+  if (it == shard.index.end()) {
+    ++shard.misses;
+    return false;
+  }
+  ++shard.hits;
+  shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+  *deltas = it->second->deltas;
+  return true;
+}
+
+void AlignmentCache::insert(std::string_view clean,
+                            std::string_view corrupted,
+                            const std::vector<CountDelta>& deltas) {
+  using IndexNode = decltype(Shard::index)::value_type;
+  const KeyView k(clean, corrupted);
+  Shard& shard = shard_for(k);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.index.find(k);
+  if (it != shard.index.end()) {
+    Entry& e = *it->second;
+    shard.entry_bytes -= heap_bytes<Entry, IndexNode>(e);
+    e.deltas = deltas;
+    shard.entry_bytes += heap_bytes<Entry, IndexNode>(e);
+    shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+    return;
+  }
+  if (shard.entries.size() >= shard_capacity) {
+    const Entry& last = shard.entries.back();
+    shard.entry_bytes -= heap_bytes<Entry, IndexNode>(last);
+    shard.index.erase(KeyView(last.clean, last.corrupted));
+    shard.entries.pop_back();
+  }
+  shard.entries.push_front(
+      Entry{std::string(clean), std::string(corrupted), deltas});
+  const Entry& e = shard.entries.front();
+  shard.entry_bytes += heap_bytes<Entry, IndexNode>(e);
+  shard.index.emplace(KeyView(e.clean, e.corrupted), shard.entries.begin());
+}
+
+size_t AlignmentCache::hits() const {
+  size_t total = 0;
+  for (const auto& shard : shards) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    total += shard->hits;
+  }
+  return total;
+}
+
+size_t AlignmentCache::misses() const {
+  size_t total = 0;
+  for (const auto& shard : shards) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    total += shard->misses;
+  }
+  return total;
+}
+
+size_t AlignmentCache::size() const {
+  size_t total = 0;
+  for (const auto& shard : shards) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    total += shard->entries.size();
+  }
+  return total;
+}
+
+size_t AlignmentCache::memory_bytes() const {
+  size_t total = 0;
+  for (const auto& shard : shards) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    total += sizeof(Shard) + shard->entry_bytes +
+             shard->index.bucket_count() * sizeof(void*);
+  }
+  return total;
+}
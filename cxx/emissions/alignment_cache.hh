@@ -0,0 +1,88 @@
+// Copyright 2024
+// See LICENSE.txt
+
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// One entry of the change to an emission's counts from incorporating a
+// <clean, corrupted> string pair with weight 1:  weight is added to count
+// category of the categorical distribution context of either the
+// substitution or the insertion table.
+struct CountDelta {
+  bool substitution;
+  int context;
+  int category;
+  double weight;
+};
+
+// Hashes a <clean, corrupted> string pair.
+struct StringPairHash {
+  size_t operator()(
+      const std::pair<std::string_view, std::string_view>& k) const;
+};
+
+// A bounded least recently used cache from <clean, corrupted> string pairs to
+// the count deltas of their alignment.  The entries are split into shards by
+// the hash of the pair, and each shard has its own mutex, so the cache can be
+// used from several threads at once.
+class AlignmentCache {
+ public:
+  // capacity is the total number of pairs to keep, split evenly between
+  // num_shards shards.
+  AlignmentCache(size_t capacity = 1024, int num_shards = 8);
+
+  // If the pair is in the cache, copy its count deltas to *deltas, mark it
+  // as most recently used, and return true.
+  bool lookup(std::string_view clean, std::string_view corrupted,
+              std::vector<CountDelta>* deltas);
+
+  // Add the pair to the cache, evicting the least recently used pair of its
+  // shard if the shard is full.
+  void insert(std::string_view clean, std::string_view corrupted,
+              const std::vector<CountDelta>& deltas);
+
+  // The number of calls to lookup that have found or not found their pair.
+  size_t hits() const;
+  size_t misses() const;
+
+  // The number of pairs in the cache.
+  size_t size() const;
+
+  // An estimate of the heap memory used by the cache, in bytes.
+  size_t memory_bytes() const;
+
+ private:
+  using KeyView = std::pair<std::string_view, std::string_view>;
+
+  struct Entry {
+    std::string clean;
+    std::string corrupted;
+    std::vector<CountDelta> deltas;
+  };
+
+  struct Shard {
+    mutable std::mutex mutex;
+    // Most recently used first.  The keys of index view the strings of
+    // entries, which don't move while they are in the list.
+    std::list<Entry> entries;
+    std::unordered_map<KeyView, std::list<Entry>::iterator, StringPairHash>
+        index;
+    size_t entry_bytes = 0;
+    size_t hits = 0;
+    size_t misses = 0;
+  };
+
+  Shard& shard_for(const KeyView& k);
+
+  size_t shard_capacity;
+  std::vector<std::unique_ptr<Shard>> shards;
+};
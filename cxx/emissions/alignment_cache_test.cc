@@ -0,0 +1,88 @@
+// Apache License, Version 2.0, refer to LICENSE.txt
+
+#define BOOST_TEST_MODULE test AlignmentCache
+
+#include "emissions/alignment_cache.hh"
+
+#include <atomic>
+#include <boost/test/included/unit_test.hpp>
+#include <thread>
+
+BOOST_AUTO_TEST_CASE(test_lookup_and_insert) {
+  AlignmentCache cache;
+  std::vector<CountDelta> deltas;
+  BOOST_TEST(!cache.lookup("clean", "dirty", &deltas));
+  cache.insert("clean", "dirty", {{true, 3, 4, 0.5}, {false, 0, 0, 1.0}});
+  BOOST_TEST(cache.lookup("clean", "dirty", &deltas));
+  BOOST_TEST(deltas.size() == 2);
+  BOOST_TEST(deltas[0].substitution);
+  BOOST_TEST(deltas[0].context == 3);
+  BOOST_TEST(deltas[0].category == 4);
+  BOOST_TEST(deltas[0].weight == 0.5);
+  // The pair is ordered.
+  BOOST_TEST(!cache.lookup("dirty", "clean", &deltas));
+  BOOST_TEST(cache.hits() == 1);
+  BOOST_TEST(cache.misses() == 2);
+  BOOST_TEST(cache.size() == 1);
+
+  // Inserting a pair again replaces its deltas.
+  cache.insert("clean", "dirty", {{false, 1, 2, 1.0}});
+  BOOST_TEST(cache.lookup("clean", "dirty", &deltas));
+  BOOST_TEST(deltas.size() == 1);
+  BOOST_TEST(cache.size() == 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_eviction) {
+  // With one shard of two pairs, the least recently used pair is evicted.
+  AlignmentCache cache(2, 1);
+  std::vector<CountDelta> deltas;
+  cache.insert("a", "a", {{true, 1, 1, 1.0}});
+  cache.insert("b", "b", {{true, 2, 2, 1.0}});
+  BOOST_TEST(cache.lookup("a", "a", &deltas));
+  cache.insert("c", "c", {{true, 3, 3, 1.0}});
+  BOOST_TEST(cache.size() == 2);
+  BOOST_TEST(cache.lookup("a", "a", &deltas));
+  BOOST_TEST(!cache.lookup("b", "b", &deltas));
+  BOOST_TEST(cache.lookup("c", "c", &deltas));
+  BOOST_TEST(deltas[0].context == 3);
+}
+
+BOOST_AUTO_TEST_CASE(test_capacity_and_memory) {
+  AlignmentCache cache(64, 4);
+  const size_t empty_bytes = cache.memory_bytes();
+  std::vector<CountDelta> deltas(10, {false, 0, 0, 1.0});
+  for (int i = 0; i < 1000; ++i) {
+    cache.insert(std::to_string(i), "a much longer corrupted string", deltas);
+  }
+  BOOST_TEST(cache.size() <= 64);
+  BOOST_TEST(cache.memory_bytes() > empty_bytes + 64 * 10 * sizeof(CountDelta));
+  BOOST_TEST(cache.memory_bytes() < empty_bytes + 64 * 1024);
+}
+
+BOOST_AUTO_TEST_CASE(test_threads) {
+  AlignmentCache cache(256);
+  // Boost.Test checks aren't thread safe, so count the wrong lookups.
+  std::atomic<int> wrong = 0;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&cache, &wrong, t]() {
+      std::vector<CountDelta> deltas;
+      for (int i = 0; i < 2000; ++i) {
+        std::string clean = std::to_string(i % 300);
+        if (cache.lookup(clean, "x", &deltas)) {
+          if (deltas.size() != 1 || deltas[0].category != i % 300) {
+            ++wrong;
+          }
+        } else {
+          cache.insert(clean, "x", {{true, t, i % 300, 1.0}});
+        }
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  BOOST_TEST(wrong == 0);
+  BOOST_TEST(cache.hits() + cache.misses() == 8000);
+  BOOST_TEST(cache.size() <= 256);
+}
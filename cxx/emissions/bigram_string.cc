@@ -1,9 +1,13 @@
 #include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <iterator>
+#include <map>
+#include <tuple>
 
 #include "emissions/bigram_string.hh"
 #include "emissions/string_alignment.hh"
+#include "util_math.hh"
 
 // Increasing this value theoretically increases the quality of the evidence
 // of the underlying categorical distributions that we use to model
@@ -13,6 +17,51 @@
 // so trying 2 for now.
 int NUMBER_OF_STRING_ALIGNMENTS_TO_CONSIDER_WHEN_INCORPORATING = 2;
 
+namespace {
+
+// The costs of log_prob_distance as a kbest_alignments cost model:  the
+// insertion context of a piece that starts after the first i characters of
+// clean is clean[i - 1], or the empty context when i == 0.
+struct BigramEmissionCost {
+  const BigramStringEmission& bse;
+  const std::string& clean;
+  const std::string& corrupted;
+
+  size_t context(size_t i) const {
+    return i == 0 ? 0 : bse.get_index(clean[i - 1]);
+  }
+
+  double deletion(size_t i, size_t j) const {
+    return -bse.insertions[context(i)].logp(0) -
+           bse.substitutions[bse.get_index(clean[i])].logp(0);
+  }
+
+  double insertion(size_t i, size_t j) const {
+    return -bse.insertions[context(i)].logp(bse.get_index(corrupted[j]));
+  }
+
+  double substitution(size_t i, size_t j) const {
+    return -bse.insertions[context(i)].logp(0) -
+           bse.substitutions[bse.get_index(clean[i])].logp(
+               bse.get_index(corrupted[j]));
+  }
+};
+
+// Weights of count deltas keyed by (substitution, context, category).
+using CountDeltaWeights = std::map<std::tuple<bool, int, int>, double>;
+
+std::vector<CountDelta> to_count_deltas(const CountDeltaWeights& weights) {
+  std::vector<CountDelta> deltas;
+  deltas.reserve(weights.size());
+  for (const auto& [key, w] : weights) {
+    const auto& [substitution, context, category] = key;
+    deltas.push_back({substitution, context, category, w});
+  }
+  return deltas;
+}
+
+}  // namespace
+
 BigramStringEmission::BigramStringEmission() {
   // We need a context for [lowest_char, highest_char] inclusive, plus one
   // for the empty context at the start of a string.
@@ -35,7 +84,7 @@ BigramStringEmission::BigramStringEmission() {
   }
 }
 
-size_t BigramStringEmission::get_index(std::string current_char) {
+size_t BigramStringEmission::get_index(std::string current_char) const {
   if (current_char == "") {
     return 0;
   }
@@ -43,7 +92,7 @@ size_t BigramStringEmission::get_index(std::string current_char) {
   return (current_char[0] - lowest_char) + 1;
 }
 
-size_t BigramStringEmission::get_index(char current_char) {
+size_t BigramStringEmission::get_index(char current_char) const {
   return (current_char - lowest_char) + 1;
 }
 
@@ -57,9 +106,11 @@ std::string BigramStringEmission::category_to_char(int category) {
 
 double BigramStringEmission::log_prob_distance(const StrAlignment& alignment, double old_cost) {
   assert(!alignment.align_pieces.empty());
+  // The insertion context is the clean character of the last piece before
+  // the final one that isn't an insertion.
   std::string insertion_context = "";
-  for (auto it = alignment.align_pieces.rbegin();
-       it != alignment.align_pieces.rend();
+  for (auto it = std::next(alignment.align_pieces.rbegin());
+       it != alignment.align_pieces.rend() && insertion_context.empty();
        ++it) {
     switch (it->index()) {
       case 0: // Deletion
@@ -115,81 +166,187 @@ double BigramStringEmission::log_prob_distance(const StrAlignment& alignment, do
   return old_cost - log_prob;
 }
 
-void BigramStringEmission::incorporate(
-    const std::pair<std::string, std::string>& x, double weight) {
-  N += weight;
+void BigramStringEmission::kbest_clean_alignments(
+    int k, const std::string& clean, const std::string& corrupted,
+    std::vector<StrAlignment>* alignments) const {
+  kbest_alignments(k, clean, corrupted,
+                   BigramEmissionCost{*this, clean, corrupted}, alignments);
+}
 
+std::vector<CountDelta> BigramStringEmission::alignment_count_deltas(
+    const std::pair<std::string, std::string>& x) const {
   std::vector<StrAlignment> alignments;
+  kbest_clean_alignments(
+      NUMBER_OF_STRING_ALIGNMENTS_TO_CONSIDER_WHEN_INCORPORATING, x.first,
+      x.second, &alignments);
 
-  topk_alignments(NUMBER_OF_STRING_ALIGNMENTS_TO_CONSIDER_WHEN_INCORPORATING,
-                  x.first, x.second,
-                  [&](const StrAlignment &a, double old_cost) {
-                    return log_prob_distance(a, old_cost);
-                  },
-                  &alignments);
-
+  // Turn all costs (negative log probabilities) into probabilities relative
+  // to the most probable alignment.
+  const double best_cost = alignments[0].cost;
   double total_prob = 0.0;
   for (auto& a : alignments) {
-    a.cost = exp(a.cost);  // Turn all costs into non-log probabilities
+    a.cost = exp(best_cost - a.cost);
     total_prob += a.cost;
   }
 
+  CountDeltaWeights weights;
   for (const auto& a : alignments) {
-    double w = weight * a.cost / total_prob;
-    std::string insertion_context = "";
-    for (auto it = a.align_pieces.begin();
-         it != a.align_pieces.end();
-         ++it) {
-      size_t icontext = get_index(insertion_context);
-      switch (it->index()) {
+    double w = a.cost / total_prob;
+    size_t icontext = 0;
+    for (const AlignPiece& p : a.align_pieces) {
+      switch (p.index()) {
         case 0:  // Deletion
           // which is actually no insertion, then a deletion.
           {
-            char deleted_char = std::get<Deletion>(*it).deleted_char;
-            insertions[icontext].incorporate(0, w);
-            substitutions[get_index(deleted_char)].incorporate(0, w);
-            insertion_context = std::string() + deleted_char;
+            char deleted_char = std::get<Deletion>(p).deleted_char;
+            weights[{false, icontext, 0}] += w;
+            weights[{true, get_index(deleted_char), 0}] += w;
+            icontext = get_index(deleted_char);
           }
           break;
         case 1:  // Insertion
           {
-            char inserted_char = std::get<Insertion>(*it).inserted_char;
-            insertions[icontext].incorporate(get_index(inserted_char), w);
+            char inserted_char = std::get<Insertion>(p).inserted_char;
+            weights[{false, icontext, get_index(inserted_char)}] += w;
           }
           break;
         case 2:  // Substitution
           // which is actually no insertion, then a substitution.
           {
-            char original_char = std::get<Substitution>(*it).original;
-            char replacement_char = std::get<Substitution>(*it).replacement;
-            insertions[icontext].incorporate(0, w);
-            substitutions[get_index(original_char)].incorporate(get_index(replacement_char), w);
-            insertion_context = std::string() + original_char;
+            char original_char = std::get<Substitution>(p).original;
+            char replacement_char = std::get<Substitution>(p).replacement;
+            weights[{false, icontext, 0}] += w;
+            weights[{true, get_index(original_char),
+                     get_index(replacement_char)}] += w;
+            icontext = get_index(original_char);
           }
           break;
         case 3:  // Match
           // which is actually no insertion, then a match.
           {
-            char c = std::get<Match>(*it).c;
-            insertions[icontext].incorporate(0, w);
-            substitutions[get_index(c)].incorporate(get_index(c), w);
-            insertion_context = std::string() + c;
+            char c = std::get<Match>(p).c;
+            weights[{false, icontext, 0}] += w;
+            weights[{true, get_index(c), get_index(c)}] += w;
+            icontext = get_index(c);
           }
           break;
       }
     }
   }
+
+  return to_count_deltas(weights);
 }
 
-double BigramStringEmission::logp(
+bool BigramStringEmission::lookup_count_deltas(
+    const std::pair<std::string, std::string>& x,
+    std::vector<CountDelta>* deltas) const {
+  auto it = incorporated_deltas.find(x);
+  if (it != incorporated_deltas.end()) {
+    *deltas = it->second.deltas;
+    return true;
+  }
+  return alignment_cache.lookup(x.first, x.second, deltas);
+}
+
+std::vector<CountDelta> BigramStringEmission::count_deltas(
     const std::pair<std::string, std::string>& x) const {
-  double orig_lp = logp_score();
+  std::vector<CountDelta> deltas;
+  if (!lookup_count_deltas(x, &deltas)) {
+    deltas = alignment_count_deltas(x);
+    alignment_cache.insert(x.first, x.second, deltas);
+  }
+  return deltas;
+}
+
+double BigramStringEmission::count_deltas_score(
+    const std::vector<CountDelta>& deltas) const {
+  // Only the touched categories and the totals of their distributions change,
+  // so the change in each DirichletCategorical's score is
+  //   lgamma(K alpha + N) - lgamma(K alpha + N + sum of w)
+  //   + sum over touched categories of lgamma(c + w + alpha) - lgamma(c + alpha)
+  double delta = 0.0;
+  size_t i = 0;
+  while (i < deltas.size()) {
+    const DirichletCategorical& dc = deltas[i].substitution
+                                         ? substitutions[deltas[i].context]
+                                         : insertions[deltas[i].context];
+    const double total_alpha = dc.alpha * dc.counts.size();
+    double added = 0.0;
+    size_t j = i;
+    for (; j < deltas.size() &&
+           deltas[j].substitution == deltas[i].substitution &&
+           deltas[j].context == deltas[i].context;
+         ++j) {
+      const double c = dc.counts[deltas[j].category];
+      delta += log_gamma(c + deltas[j].weight + dc.alpha) -
+               log_gamma(c + dc.alpha);
+      added += deltas[j].weight;
+    }
+    delta += log_gamma(total_alpha + dc.N) -
+             log_gamma(total_alpha + dc.N + added);
+    i = j;
+  }
+  return delta;
+}
+
+void BigramStringEmission::incorporate(
+    const std::pair<std::string, std::string>& x, double weight) {
+  incorporate_count_deltas(x, count_deltas(x), weight);
+}
+
+void BigramStringEmission::incorporate_count_deltas(
+    const std::pair<std::string, std::string>& x,
+    const std::vector<CountDelta>& deltas, double weight) {
+  N += weight;
+
+  // x keeps the deltas of its first incorporation until it is fully
+  // unincorporated and forgotten, so unincorporating x exactly reverses
+  // incorporating it.
+  auto [it, inserted] = incorporated_deltas.try_emplace(x);
+  if (inserted) {
+    it->second.deltas = deltas;
+  }
+  it->second.weight += weight;
+  for (const CountDelta& d : deltas) {
+    std::vector<DirichletCategorical>& table =
+        d.substitution ? substitutions : insertions;
+    table[d.context].incorporate(d.category, weight * d.weight);
+  }
+}
 
-  BigramStringEmission bse(*this);
-  bse.incorporate(x);
-  double new_lp = bse.logp_score();
+double BigramStringEmission::logp(
+    const std::pair<std::string, std::string>& x) const {
+  return count_deltas_score(count_deltas(x));
+}
 
-  return new_lp - orig_lp;
+double BigramStringEmission::logp_score_delta(
+    std::span<const std::pair<std::string, std::string>> xs) {
+  // Sum the deltas of the xs, finding those of each distinct x once, and
+  // score the touched categories.
+  std::vector<size_t> order(xs.size());
+  for (size_t i = 0; i < xs.size(); ++i) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(),
+            [&](size_t a, size_t b) { return xs[a] < xs[b]; });
+  CountDeltaWeights weights;
+  std::vector<CountDelta> deltas;
+  size_t i = 0;
+  while (i < order.size()) {
+    const auto& x = xs[order[i]];
+    size_t j = i + 1;
+    while (j < order.size() && xs[order[j]] == x) {
+      ++j;
+    }
+    if (!lookup_count_deltas(x, &deltas)) {
+      deltas = alignment_count_deltas(x);
+    }
+    for (const CountDelta& d : deltas) {
+      weights[{d.substitution, d.context, d.category}] += (j - i) * d.weight;
+    }
+    i = j;
+  }
+  return count_deltas_score(to_count_deltas(weights));
 }
 
 double BigramStringEmission::logp_score() const {
@@ -212,6 +369,12 @@ void BigramStringEmission::transition_hyperparameters(std::mt19937* prng) {
   }
 }
 
+void BigramStringEmission::forget_unincorporated() {
+  std::erase_if(incorporated_deltas, [](const auto& entry) {
+    return std::abs(entry.second.weight) < kZeroWeightTolerance;
+  });
+}
+
 std::string BigramStringEmission::sample_corrupted(
     const std::string& clean, std::mt19937* prng) {
   std::string s;
@@ -239,11 +402,7 @@ std::string BigramStringEmission::two_string_vote(
   double log_weight1 = log(weight1);
   double log_weight2 = log(weight2);
   std::vector<StrAlignment> alignments;
-  topk_alignments(1, s1, s2,
-                  [&](const StrAlignment &a, double old_cost) {
-                    return log_prob_distance(a, old_cost);
-                  },
-                  &alignments);
+  kbest_clean_alignments(1, s1, s2, &alignments);
   std::string clean = "";
   std::string left_context = "";
   for (const auto& p: alignments[0].align_pieces) {
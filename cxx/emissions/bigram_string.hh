@@ -1,9 +1,11 @@
 #pragma once
 
 #include <cstdio>
+#include <span>
 #include <unordered_map>
 #include <vector>
 
+#include "emissions/alignment_cache.hh"
 #include "string_alignment.hh"
 #include "distributions/dirichlet_categorical.hh"
 #include "emissions/base.hh"
@@ -19,6 +21,22 @@ class BigramStringEmission : public Emission<std::string> {
   std::vector<DirichletCategorical> insertions;
   // substitutions.sample() == 0 means deletion.
   std::vector<DirichletCategorical> substitutions;
+  // The count deltas and total weight of the incorporated <clean, corrupted>
+  // pairs, and of those unincorporated since the last forget_unincorporated,
+  // so that unincorporating a pair subtracts exactly what incorporating it
+  // added, and incorporating it again adds the same without a new alignment.
+  struct IncorporatedDeltas {
+    std::vector<CountDelta> deltas;
+    double weight = 0.0;
+  };
+  std::unordered_map<std::pair<std::string, std::string>, IncorporatedDeltas,
+                     StringPairHash>
+      incorporated_deltas;
+  // The count deltas of recently aligned pairs that are not in
+  // incorporated_deltas.  logp and incorporate add the pairs they align;
+  // logp_score_delta only looks pairs up.  Mutable because logp is const
+  // and the cache is safe to use from several threads.
+  mutable AlignmentCache alignment_cache;
 
   BigramStringEmission();
 
@@ -26,12 +44,27 @@ class BigramStringEmission : public Emission<std::string> {
   void incorporate(const std::pair<std::string, std::string>& x,
                    double weight = 1.0);
 
+  // The change in logp_score from incorporating x, computed from x's count
+  // deltas without modifying (or copying) the emission.  Like incorporate, it
+  // uses the deltas x was first incorporated with if x is in
+  // incorporated_deltas, or those in alignment_cache.  So logp depends on
+  // that history, not only on the counts.  Safe to call from several threads
+  // at once.
   double logp(const std::pair<std::string, std::string>& x) const;
 
+  // The change in logp_score from incorporating every x in xs, computed from
+  // the sum of their count deltas.  Each x's deltas are found as in logp,
+  // except that an x that has to be aligned is aligned with the current
+  // counts and not added to alignment_cache.  Leaves the emission unchanged.
+  double logp_score_delta(
+      std::span<const std::pair<std::string, std::string>> xs);
+
   double logp_score() const;
 
   void transition_hyperparameters(std::mt19937* prng);
 
+  void forget_unincorporated();
+
   std::string sample_corrupted(const std::string& clean, std::mt19937* prng);
 
   std::string propose_clean(const std::vector<std::string>& corrupted,
@@ -39,18 +72,42 @@ class BigramStringEmission : public Emission<std::string> {
 
   // The following methods are conceptually private, but actually public
   // for testing purposes.
-  size_t get_index(char current_char);
-  size_t get_index(std::string current_char);
+  size_t get_index(char current_char) const;
+  size_t get_index(std::string current_char) const;
   std::string category_to_char(int category);
   std::string two_string_vote(const std::string &s1, const std::string &s2,
                               double weight1, double weight2);
   double log_prob_distance(const StrAlignment& alignment, double old_cost);
+  // The changes to the counts of insertions and substitutions from
+  // incorporating x with weight 1, using the current counts to align it.
+  std::vector<CountDelta> alignment_count_deltas(
+      const std::pair<std::string, std::string>& x) const;
+  // If x is in incorporated_deltas or alignment_cache, copy its count deltas
+  // to *deltas and return true.
+  bool lookup_count_deltas(const std::pair<std::string, std::string>& x,
+                           std::vector<CountDelta>* deltas) const;
+  // The count deltas of x from lookup_count_deltas if it finds them, and
+  // otherwise from alignment_count_deltas, which are then added to
+  // alignment_cache.
+  std::vector<CountDelta> count_deltas(
+      const std::pair<std::string, std::string>& x) const;
+  // Incorporate x with weight by adding weight times deltas to the counts.
+  void incorporate_count_deltas(const std::pair<std::string, std::string>& x,
+                                const std::vector<CountDelta>& deltas,
+                                double weight);
+  // The change in logp_score from adding deltas to the counts.  deltas must
+  // be sorted by (substitution, context, category), without repeats.
+  double count_deltas_score(const std::vector<CountDelta>& deltas) const;
+  // Put the k most probable alignments of clean to corrupted into
+  // *alignments, with costs equal to their negative log probabilities.
+  void kbest_clean_alignments(int k, const std::string& clean,
+                              const std::string& corrupted,
+                              std::vector<StrAlignment>* alignments) const;
   std::string propose_clean_with_weights(
       const std::vector<std::string>& corrupted,
       const std::vector<double>& weights);
 
- private:
-  // This copy constructor is actually factually private, because it is only
-  // intended to be used in the logp(x) method.
-  BigramStringEmission(const BigramStringEmission& bse) = default;
+  // Disable copying.
+  BigramStringEmission& operator=(const BigramStringEmission&) = delete;
+  BigramStringEmission(const BigramStringEmission&) = delete;
 };
@@ -0,0 +1,111 @@
+// Copyright 2024
+// See LICENSE.txt
+
+// Measures the throughput of BigramStringEmission::logp and logp_score_delta
+// on <clean, dirty> string pairs from the flights assets.  The clean value of
+// each field of each flight is taken to be its most common value.
+//
+// Usage, from the cxx directory:
+//   ./bigram_string_benchmark [path to flights_dirty.csv]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "emissions/bigram_string.hh"
+#include "pclean/csv.hh"
+
+namespace {
+
+const int kRepeats = 20;
+
+template <typename F>
+double ns_per_call(int calls, F f) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kRepeats; ++i) {
+    f();
+  }
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / (kRepeats * calls);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string path = argc > 1 ? argv[1] : "assets/flights_dirty.csv";
+  DataFrame df = DataFrame::from_csv(path);
+  if (df.columns.empty()) {
+    printf("Could not read %s\n", path.c_str());
+    return 1;
+  }
+
+  // pairs_by_flight[flight] holds the <clean, dirty> pairs of one flight.
+  std::map<std::string, std::vector<std::pair<std::string, std::string>>>
+      pairs_by_flight;
+  const std::vector<std::string>& flights = df.data["flight"];
+  for (const std::string& col : {"sched_dep_time", "act_dep_time",
+                                 "sched_arr_time", "act_arr_time"}) {
+    const std::vector<std::string>& values = df.data[col];
+    std::map<std::string, std::map<std::string, int>> value_counts;
+    for (size_t i = 0; i < values.size(); ++i) {
+      if (!values[i].empty()) {
+        ++value_counts[flights[i]][values[i]];
+      }
+    }
+    for (const auto& [flight, counts] : value_counts) {
+      std::string clean;
+      int best = 0;
+      for (const auto& [v, n] : counts) {
+        if (n > best) {
+          clean = v;
+          best = n;
+        }
+      }
+      for (const auto& [v, n] : counts) {
+        for (int i = 0; i < n; ++i) {
+          pairs_by_flight[flight].emplace_back(clean, v);
+        }
+      }
+    }
+  }
+
+  std::vector<std::pair<std::string, std::string>> pairs;
+  for (const auto& [flight, ps] : pairs_by_flight) {
+    pairs.insert(pairs.end(), ps.begin(), ps.end());
+  }
+
+  // Train on every other pair.
+  BigramStringEmission bse;
+  for (size_t i = 0; i < pairs.size(); i += 2) {
+    bse.incorporate(pairs[i]);
+  }
+
+  double sink = 0.0;
+  double logp_ns = ns_per_call(pairs.size(), [&]() {
+    for (const auto& x : pairs) {
+      sink += bse.logp(x);
+    }
+  });
+  double delta_ns = ns_per_call(pairs_by_flight.size(), [&]() {
+    for (const auto& [flight, ps] : pairs_by_flight) {
+      sink += bse.logp_score_delta(ps);
+    }
+  });
+
+  printf("%zu pairs from %zu flights\n", pairs.size(), pairs_by_flight.size());
+  printf("logp:              %10.1f ns per pair\n", logp_ns);
+  printf("logp_score_delta:  %10.1f ns per flight\n", delta_ns);
+  const size_t hits = bse.alignment_cache.hits();
+  const size_t misses = bse.alignment_cache.misses();
+  printf("alignment cache:   %zu hits, %zu misses (%.1f%% hits)\n", hits,
+         misses, 100.0 * hits / std::max<size_t>(1, hits + misses));
+  printf("                   %zu pairs, %zu bytes\n",
+         bse.alignment_cache.size(), bse.alignment_cache.memory_bytes());
+  printf("(checksum %g)\n", sink);
+  return 0;
+}
@@ -104,3 +104,139 @@ BOOST_AUTO_TEST_CASE(test_propose_clean) {
       // Winner of ("clean", "lean") is "lean".
       == "lean");
 }
+
+BOOST_AUTO_TEST_CASE(test_kbest_clean_alignments) {
+  BigramStringEmission bse;
+  bse.incorporate({"hello", "hel1o"});
+  bse.incorporate({"world", "wrld"});
+
+  // The cost of each alignment is the sum of log_prob_distance over its
+  // pieces, and the best one agrees with topk_alignments.
+  std::vector<StrAlignment> alignments;
+  bse.kbest_clean_alignments(4, "hello", "he1lo!", &alignments);
+  BOOST_TEST(alignments.size() == 4);
+  for (const StrAlignment& a : alignments) {
+    StrAlignment prefix;
+    double cost = 0.0;
+    for (const AlignPiece& p : a.align_pieces) {
+      prefix.align_pieces.push_back(p);
+      cost = bse.log_prob_distance(prefix, cost);
+    }
+    BOOST_TEST(cost == a.cost, tt::tolerance(1e-9));
+  }
+
+  std::vector<StrAlignment> expected;
+  topk_alignments(1, "hello", "he1lo!",
+                  [&](const StrAlignment& a, double old_cost) {
+                    return bse.log_prob_distance(a, old_cost);
+                  },
+                  &expected);
+  BOOST_TEST(alignments[0].cost == expected[0].cost, tt::tolerance(1e-9));
+}
+
+BOOST_AUTO_TEST_CASE(test_alignment_cache) {
+  BigramStringEmission bse;
+  bse.incorporate({"hello", "hello"});
+  bse.incorporate({"world", "wrld"});
+  double score = bse.logp_score();
+
+  // Unincorporating a pair subtracts the deltas it was incorporated with, so
+  // the counts return to where they were, and incorporating it again adds
+  // them back without a new alignment.
+  for (int i = 0; i < 5; ++i) {
+    bse.incorporate({"clean", "c1ean!"});
+    bse.unincorporate({"clean", "c1ean!"});
+  }
+  BOOST_TEST(bse.logp_score() == score, tt::tolerance(1e-9));
+  BOOST_TEST(bse.alignment_cache.misses() == 3);
+  BOOST_TEST(bse.alignment_cache.hits() == 0);
+  BOOST_TEST(bse.incorporated_deltas.size() == 3);
+  bse.forget_unincorporated();
+  BOOST_TEST(bse.incorporated_deltas.size() == 2);
+
+  // The incorporated deltas are those of the alignment.
+  const std::vector<CountDelta>& incorporated =
+      bse.incorporated_deltas.at({"world", "wrld"}).deltas;
+  BigramStringEmission fresh;
+  fresh.incorporate({"hello", "hello"});
+  std::vector<CountDelta> deltas = fresh.alignment_count_deltas({"world", "wrld"});
+  BOOST_TEST(incorporated.size() == deltas.size());
+  double total = 0.0;
+  for (size_t i = 0; i < deltas.size(); ++i) {
+    BOOST_TEST(incorporated[i].weight == deltas[i].weight, tt::tolerance(1e-9));
+    total += deltas[i].weight;
+  }
+  // Each clean character has a substitution (or deletion) and is preceded
+  // by a decision not to insert.
+  BOOST_TEST(total == 10.0, tt::tolerance(1e-9));
+
+  // logp_score_delta doesn't add what it aligns to the cache, but logp does,
+  // and incorporate then reuses it.
+  const size_t size = bse.alignment_cache.size();
+  bse.logp_score_delta(std::vector<std::pair<std::string, std::string>>{
+      {"cat", "cot"}, {"cat", "cot"}});
+  BOOST_TEST(bse.alignment_cache.size() == size);
+  double lp = bse.logp({"cat", "cot"});
+  BOOST_TEST(bse.alignment_cache.size() == size + 1);
+  score = bse.logp_score();
+  bse.incorporate({"cat", "cot"});
+  BOOST_TEST(bse.alignment_cache.hits() == 1);
+  BOOST_TEST(lp == bse.logp_score() - score, tt::tolerance(1e-9));
+}
+
+BOOST_AUTO_TEST_CASE(test_unincorporate_after_many_pairs) {
+  // However many other pairs are incorporated in between, unincorporating a
+  // pair reverses incorporating it.
+  BigramStringEmission bse;
+  bse.incorporate({"hello", "hello"});
+  double score = bse.logp_score();
+  bse.incorporate({"world", "wrld"});
+  for (int i = 0; i < 2000; ++i) {
+    std::string s = std::to_string(i);
+    bse.incorporate({s, s + "x"});
+  }
+  for (int i = 0; i < 2000; ++i) {
+    std::string s = std::to_string(i);
+    bse.unincorporate({s, s + "x"});
+  }
+  bse.unincorporate({"world", "wrld"});
+  BOOST_TEST(bse.logp_score() == score, tt::tolerance(1e-9));
+  bse.forget_unincorporated();
+  BOOST_TEST(bse.incorporated_deltas.size() == 1);
+  // The cache keeps only the most recently aligned pairs.
+  BOOST_TEST(bse.alignment_cache.size() <= 1024);
+
+  // Once forgotten and evicted, a pair's logp is that of a new alignment.
+  BigramStringEmission fresh;
+  fresh.incorporate({"hello", "hello"});
+  BOOST_TEST(bse.logp({"world", "wrld"}) == fresh.logp({"world", "wrld"}),
+             tt::tolerance(1e-9));
+}
+
+BOOST_AUTO_TEST_CASE(test_logp_matches_incorporate) {
+  BigramStringEmission bse;
+  bse.incorporate({"hello", "hel1o"});
+  bse.incorporate({"world", "wrld"});
+
+  std::vector<std::pair<std::string, std::string>> xs = {
+      {"clean", "c1ean!"}, {"hello", "hello"}, {"", "abc"}, {"clean", "lean"}};
+  for (const auto& x : xs) {
+    double lp = bse.logp(x);
+    double score = bse.logp_score();
+    bse.incorporate(x);
+    BOOST_TEST(lp == bse.logp_score() - score, tt::tolerance(1e-9));
+    bse.unincorporate(x);
+    BOOST_TEST(bse.logp_score() == score, tt::tolerance(1e-9));
+  }
+
+  // logp_score_delta is the change from incorporating xs, and leaves the
+  // emission as it was.
+  double score = bse.logp_score();
+  bse.forget_unincorporated();
+  double delta = bse.logp_score_delta(xs);
+  BOOST_TEST(bse.logp_score() == score, tt::tolerance(1e-9));
+  for (const auto& x : xs) {
+    bse.incorporate(x);
+  }
+  BOOST_TEST(delta == bse.logp_score() - score, tt::tolerance(1e-9));
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <cassert>
 #include <limits>
 #include <utility>
@@ -11,22 +12,43 @@
 // clean categorical state.
 class CategoricalEmission : public Emission<int> {
  public:
-  mutable std::vector<DirichletCategorical> emission_dists;
+  // emission_dists[clean] is the distribution of dirty states given clean.
+  // Modify it only through the methods below, which keep the caches in sync.
+  std::vector<DirichletCategorical> emission_dists;
+  // log_numer[dirty * k + clean] = log(alpha + counts[dirty]) of
+  // emission_dists[clean].  It is stored by dirty state so that one dirty
+  // state is scored against every clean state in a contiguous pass.
+  std::vector<double> log_numer;
+  // log_denom[clean] = log(N + alpha * k) of emission_dists[clean].
+  std::vector<double> log_denom;
 
-  CategoricalEmission(int num_states) {
+  CategoricalEmission(int num_states)
+      : log_numer(size_t(num_states) * num_states),
+        log_denom(num_states) {
     emission_dists.reserve(num_states);
     for (int i = 0; i < num_states; ++i) {
       emission_dists.emplace_back(num_states);
     }
+    for (int i = 0; i < num_states; ++i) {
+      refresh_row(i);
+    }
   };
 
   void incorporate(const std::pair<int, int>& x, double weight = 1.0) {
     N += weight;
-    emission_dists[x.first].incorporate(x.second, weight);
+    DirichletCategorical& e = emission_dists[x.first];
+    e.incorporate(x.second, weight);
+    const size_t k = emission_dists.size();
+    log_numer[x.second * k + x.first] =
+        log(e.alpha + e.counts[size_t(x.second)]);
+    log_denom[x.first] = log(e.N + e.alpha * k);
   }
 
   double logp(const std::pair<int, int>& x) const {
-    return emission_dists[x.first].logp(x.second);
+    const size_t k = emission_dists.size();
+    assert(x.first >= 0 && size_t(x.first) < k);
+    assert(x.second >= 0 && size_t(x.second) < k);
+    return log_numer[x.second * k + x.first] - log_denom[x.first];
   }
 
   double logp_score() const {
@@ -38,8 +60,12 @@ class CategoricalEmission : public Emission<int> {
   }
 
   void transition_hyperparameters(std::mt19937* prng) {
-    for (auto& e : emission_dists) {
-      e.transition_hyperparameters(prng);
+    for (size_t i = 0; i < emission_dists.size(); ++i) {
+      double old_alpha = emission_dists[i].alpha;
+      emission_dists[i].transition_hyperparameters(prng);
+      if (emission_dists[i].alpha != old_alpha) {
+        refresh_row(i);
+      }
     }
   }
 
@@ -49,14 +75,28 @@ class CategoricalEmission : public Emission<int> {
 
   int propose_clean(const std::vector<int>& corrupted,
                      std::mt19937* unused_prng) {
-    // Brute force; compute log prob over all possible clean states.
+    // Compute the log prob of corrupted under every clean state as the
+    // product of its histogram with the log probability table.
+    const size_t k = emission_dists.size();
+    std::vector<int> sorted(corrupted);
+    std::sort(sorted.begin(), sorted.end());
+    std::vector<double> lps(k, 0.0);
+    for (size_t j = 0; j < sorted.size();) {
+      size_t n = 1;
+      while (j + n < sorted.size() && sorted[j + n] == sorted[j]) {
+        ++n;
+      }
+      assert(sorted[j] >= 0 && size_t(sorted[j]) < k);
+      const double* col = &log_numer[sorted[j] * k];
+      for (size_t i = 0; i < k; ++i) {
+        lps[i] += n * col[i];
+      }
+      j += n;
+    }
     int best_clean = 0;
     double best_clean_logp = std::numeric_limits<double>::lowest();
-    for (size_t i = 0; i < emission_dists.size(); ++i) {
-      double lp = 0.0;
-      for (const auto& c : corrupted) {
-        lp += emission_dists[i].logp(c);
-      }
+    for (size_t i = 0; i < k; ++i) {
+      double lp = lps[i] - corrupted.size() * log_denom[i];
       if (lp > best_clean_logp) {
         best_clean = i;
         best_clean_logp = lp;
@@ -65,4 +105,14 @@ class CategoricalEmission : public Emission<int> {
     return best_clean;
   }
 
+ private:
+  // Recomputes the cached log probabilities of emission_dists[clean].
+  void refresh_row(size_t clean) {
+    const DirichletCategorical& e = emission_dists[clean];
+    const size_t k = emission_dists.size();
+    for (size_t j = 0; j < k; ++j) {
+      log_numer[j * k + clean] = log(e.alpha + e.counts[j]);
+    }
+    log_denom[clean] = log(e.N + e.alpha * k);
+  }
 };
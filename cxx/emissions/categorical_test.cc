@@ -5,7 +5,9 @@
 #include "emissions/categorical.hh"
 
 #include <boost/test/included/unit_test.hpp>
+#include <limits>
 #include <random>
+#include <vector>
 namespace tt = boost::test_tools;
 
 BOOST_AUTO_TEST_CASE(test_simple) {
@@ -34,3 +36,50 @@ BOOST_AUTO_TEST_CASE(test_simple) {
   BOOST_TEST(clean < 5);
   BOOST_TEST(clean >= 0);
 }
+
+BOOST_AUTO_TEST_CASE(test_cached_log_probs) {
+  const int k = 7;
+  CategoricalEmission ce(k);
+  std::mt19937 prng(3);
+  std::uniform_int_distribution<int> state(0, k - 1);
+  std::uniform_real_distribution<double> weight(0.1, 1.0);
+
+  auto check = [&]() {
+    for (int clean = 0; clean < k; ++clean) {
+      for (int dirty = 0; dirty < k; ++dirty) {
+        BOOST_TEST(ce.logp({clean, dirty}) ==
+                       ce.emission_dists[clean].logp(dirty),
+                   tt::tolerance(1e-9));
+      }
+    }
+    std::vector<int> corrupted;
+    for (int i = 0; i < 6; ++i) {
+      corrupted.push_back(state(prng));
+    }
+    int best_clean = 0;
+    double best_clean_logp = std::numeric_limits<double>::lowest();
+    for (int clean = 0; clean < k; ++clean) {
+      double lp = 0.0;
+      for (int c : corrupted) {
+        lp += ce.emission_dists[clean].logp(c);
+      }
+      if (lp > best_clean_logp) {
+        best_clean = clean;
+        best_clean_logp = lp;
+      }
+    }
+    BOOST_TEST(ce.propose_clean(corrupted, &prng) == best_clean);
+  };
+
+  check();
+  for (int i = 0; i < 50; ++i) {
+    int clean = state(prng);
+    int dirty = std::uniform_real_distribution<double>(0.0, 1.0)(prng) < 0.7
+                    ? clean
+                    : state(prng);
+    ce.incorporate({clean, dirty}, weight(prng));
+    check();
+  }
+  ce.transition_hyperparameters(&prng);
+  check();
+}
@@ -1,10 +1,13 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdio>
+#include <string_view>
 #include <unordered_map>
 
 #include "distributions/beta_bernoulli.hh"
 #include "emissions/base.hh"
+#include "util_math.hh"
 
 // A simple string emission model that handles substitutions, insertions
 // and deletions of characters, all without context.  (I.e., their
@@ -27,91 +30,115 @@ class SimpleStringEmission : public Emission<std::string> {
     corporate(x.first, x.second, weight);
   }
 
+  // The number of false and true observations that a <clean, dirty> pair
+  // contributes to each of the BetaBernoulli models.
+  struct EditCounts {
+    int substitutions[2] = {0, 0};
+    int insertions[2] = {0, 0};
+    int deletions[2] = {0, 0};
+  };
+
   // Calculate the insertions, deletion and substitutions between clean and
-  // dirty through a greedy, recursive search.  Incorporate those diffs into
-  // the corresponding BetaBernoulli models if d is true; otherwise
-  // unincorporate them.
-  void corporate(const std::string& clean, const std::string& dirty,
-                 double weight) {
-    if (clean.empty() && dirty.empty()) {
-      // If both are empty, this is evidence of the lack of an insertion!
-      insertions.incorporate(0, weight);
-      return;
-    }
+  // dirty through a greedy search.  Matching characters at the front of both
+  // strings are consumed first, then matching characters at the back, and
+  // otherwise the string lengths decide whether the front character of dirty
+  // was inserted, the front character of clean was deleted or it was
+  // substituted.
+  static EditCounts count_edits(std::string_view clean,
+                                std::string_view dirty) {
+    EditCounts c;
+    while (!clean.empty() && !dirty.empty()) {
+      size_t n = std::min(clean.length(), dirty.length());
+      size_t prefix = 0;
+      while (prefix < n && clean[prefix] == dirty[prefix]) {
+        ++prefix;
+      }
+      size_t matches = prefix;
+      if (prefix == 0) {
+        size_t suffix = 0;
+        while (suffix < n && clean[clean.length() - 1 - suffix] ==
+                                 dirty[dirty.length() - 1 - suffix]) {
+          ++suffix;
+        }
+        clean.remove_suffix(suffix);
+        dirty.remove_suffix(suffix);
+        matches = suffix;
+      } else {
+        clean.remove_prefix(prefix);
+        dirty.remove_prefix(prefix);
+      }
+      if (matches > 0) {
+        // A match means there was no insertion, substitution or deletion.
+        c.substitutions[0] += matches;
+        c.insertions[0] += matches;
+        c.deletions[0] += matches;
+        continue;
+      }
 
-    if (clean.empty()) {
-      // All of dirty must be insertions.
-      insertions.incorporate(1, weight * dirty.length());
-      return;
+      // Here, the "right" thing to do would be to run a string alignment
+      // algorithm.  But that would require a cost model, which we don't have.
+      // Also, dealing with multiple alignments (which again, is the right
+      // thing to do).
+      // So instead, we just guess based on the string lengths.  Fun fact:
+      // this will never overcount insertions or deletions!  It will merely
+      // overcount substitutions by possibly putting the insertion or
+      // deletions in less than optimal places.
+      if (clean.length() < dirty.length()) {
+        // Probably an insertion.
+        ++c.insertions[1];
+        dirty.remove_prefix(1);
+      } else if (clean.length() > dirty.length()) {
+        // Probably a deletion, which means there (probably) wasn't an
+        // insertion.
+        ++c.deletions[1];
+        ++c.insertions[0];
+        clean.remove_prefix(1);
+      } else {
+        // Probably a substitution, which is evidence of no insertion or
+        // deletion.
+        ++c.substitutions[1];
+        ++c.insertions[0];
+        ++c.deletions[0];
+        clean.remove_prefix(1);
+        dirty.remove_prefix(1);
+      }
     }
 
-    if (dirty.empty()) {
+    if (clean.empty() && dirty.empty()) {
+      // If both are empty, this is evidence of the lack of an insertion!
+      ++c.insertions[0];
+    } else if (clean.empty()) {
+      // All of dirty must be insertions.
+      c.insertions[1] += dirty.length();
+    } else {
       // All of clean must have be deleted.
-      deletions.incorporate(1, weight * clean.length());
+      c.deletions[1] += clean.length();
       // This is also evidence that clean.length()+1 insertions didn't happen.
-      insertions.incorporate(0, weight * clean.length());
-      return;
-    }
-
-    if (clean[0] == dirty[0]) {
-      // A match means there was no insertion, substitution or deletion.
-      substitutions.incorporate(0, weight);
-      insertions.incorporate(0, weight);
-      deletions.incorporate(0, weight);
-      // Recurse on the rest of clean and dirty.
-      corporate(clean.substr(1, std::string::npos),
-                dirty.substr(1, std::string::npos), weight);
-      return;
-    }
-
-    if (clean.back() == dirty.back()) {
-      // Check if clean[-1] == dirty[-1].  This block might be removeable.
-      substitutions.incorporate(0, weight);
-      insertions.incorporate(0, weight);
-      deletions.incorporate(0, weight);
-      corporate(clean.substr(0, clean.length() - 1),
-                dirty.substr(0, dirty.length() - 1), weight);
-      return;
-    }
-
-    // Here, the "right" thing to do would be to run a std::string alignment
-    // algorithm.  But that would require a cost model, which we don't have.
-    // Also, dealing with multiple alignments (which again, is the right thing
-    // to do).
-    // So instead, we just guess based on the std::string lengths.  Fun fact:
-    // this will never overcount insertions or deletions!  It will merely
-    // overcount substitutions by possibly putting the insertion or deletions
-    // in less than optimal places.
-    if (clean.length() < dirty.length()) {
-      // Probably an insertion.
-      insertions.incorporate(1, weight);
-      corporate(clean, dirty.substr(1, std::string::npos), weight);
-      return;
+      c.insertions[0] += clean.length();
     }
+    return c;
+  }
 
-    if (clean.length() > dirty.length()) {
-      // Probably a deletion.
-      deletions.incorporate(1, weight);
-      // Which means there (probably) wasn't an insertion.
-      insertions.incorporate(0, weight);
-      corporate(clean.substr(1, std::string::npos), dirty, weight);
-      return;
+  // Incorporate the diffs between clean and dirty into the corresponding
+  // BetaBernoulli models with the given weight; a negative weight
+  // unincorporates them.
+  void corporate(std::string_view clean, std::string_view dirty,
+                 double weight) {
+    EditCounts c = count_edits(clean, dirty);
+    for (bool x : {false, true}) {
+      substitutions.incorporate(x, weight * c.substitutions[x]);
+      insertions.incorporate(x, weight * c.insertions[x]);
+      deletions.incorporate(x, weight * c.deletions[x]);
     }
-
-    // Probably a substitution.
-    substitutions.incorporate(1, weight);
-    // Which is evidence of no insertion or deletion.
-    insertions.incorporate(0, weight);
-    deletions.incorporate(0, weight);
-    corporate(clean.substr(1, std::string::npos),
-              dirty.substr(1, std::string::npos), weight);
   }
 
   double logp(const std::pair<std::string, std::string>& x) const {
-    const_cast<SimpleStringEmission*>(this)->incorporate(x);
-    double lp = logp_score();
-    const_cast<SimpleStringEmission*>(this)->unincorporate(x);
-    return lp - logp_score();
+    EditCounts c = count_edits(x.first, x.second);
+    return logp_score_delta_counts(substitutions, c.substitutions) +
+           logp_score_delta_counts(insertions, c.insertions) +
+           logp_score_delta_counts(deletions, c.deletions) +
+           (c.substitutions[1] + c.insertions[1]) *
+               log(highest_char + 1 - lowest_char);
   }
 
   double logp_score() const {
@@ -187,4 +214,13 @@ class SimpleStringEmission : public Emission<std::string> {
       ++i;
     }
   }
+
+ private:
+  // The change in bb.logp_score() from incorporating counts.
+  static double logp_score_delta_counts(const BetaBernoulli& bb,
+                                        const int counts[2]) {
+    return lbeta(bb.s + counts[1] + bb.alpha,
+                 bb.N - bb.s + counts[0] + bb.beta) -
+           lbeta(bb.s + bb.alpha, bb.N - bb.s + bb.beta);
+  }
 };
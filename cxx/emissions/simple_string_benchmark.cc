@@ -0,0 +1,94 @@
+// Copyright 2024
+// See LICENSE.txt
+
+// Measures the throughput of SimpleStringEmission::incorporate,
+// unincorporate and logp on random <clean, dirty> string pairs, where each
+// character of clean is substituted, deleted or followed by an insertion
+// with probability 0.05.
+//
+// Usage, from the cxx directory:
+//   ./simple_string_benchmark [string length] [number of pairs]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "emissions/simple_string.hh"
+
+namespace {
+
+const int kRepeats = 20;
+
+template <typename F>
+double ns_per_call(int calls, F f) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kRepeats; ++i) {
+    f();
+  }
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / (kRepeats * calls);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int length = argc > 1 ? std::atoi(argv[1]) : 64;
+  int num_pairs = argc > 2 ? std::atoi(argv[2]) : 1000;
+
+  std::mt19937 prng(10);
+  std::uniform_int_distribution<int> letter('a', 'z');
+  std::uniform_real_distribution<double> unif(0.0, 1.0);
+  std::vector<std::pair<std::string, std::string>> pairs;
+  for (int i = 0; i < num_pairs; ++i) {
+    std::string clean, dirty;
+    for (int j = 0; j < length; ++j) {
+      clean += letter(prng);
+    }
+    for (char c : clean) {
+      double u = unif(prng);
+      if (u < 0.05) {
+        dirty += letter(prng);
+      } else if (u < 0.10) {
+        continue;
+      } else if (u < 0.15) {
+        dirty += c;
+        dirty += letter(prng);
+      } else {
+        dirty += c;
+      }
+    }
+    pairs.emplace_back(clean, dirty);
+  }
+
+  SimpleStringEmission sse;
+  double incorporate_ns = ns_per_call(num_pairs, [&]() {
+    for (const auto& x : pairs) {
+      sse.incorporate(x);
+    }
+    for (const auto& x : pairs) {
+      sse.unincorporate(x);
+    }
+  });
+
+  // Train on every other pair.
+  for (size_t i = 0; i < pairs.size(); i += 2) {
+    sse.incorporate(pairs[i]);
+  }
+  double sink = 0.0;
+  double logp_ns = ns_per_call(num_pairs, [&]() {
+    for (const auto& x : pairs) {
+      sink += sse.logp(x);
+    }
+  });
+
+  printf("%d pairs of length %d\n", num_pairs, length);
+  printf("incorporate + unincorporate: %10.1f ns per pair\n", incorporate_ns);
+  printf("logp:                        %10.1f ns per pair\n", logp_ns);
+  printf("(checksum %g)\n", sink);
+  return 0;
+}
@@ -6,6 +6,7 @@
 
 #include <boost/test/included/unit_test.hpp>
 #include <random>
+#include <string>
 
 BOOST_AUTO_TEST_CASE(test_simple) {
   SimpleStringEmission ss;
@@ -62,3 +63,111 @@ BOOST_AUTO_TEST_CASE(test_simple) {
   BOOST_TEST(ss.propose_clean({"clean", "clean!", "cl5an", "lean"}, &prng) ==
              "clean");
 }
+
+namespace {
+
+// The recursive search that count_edits replaced, kept as a reference.
+void reference_edits(const std::string& clean, const std::string& dirty,
+                     SimpleStringEmission::EditCounts* c) {
+  if (clean.empty() && dirty.empty()) {
+    ++c->insertions[0];
+  } else if (clean.empty()) {
+    c->insertions[1] += dirty.length();
+  } else if (dirty.empty()) {
+    c->deletions[1] += clean.length();
+    c->insertions[0] += clean.length();
+  } else if (clean[0] == dirty[0]) {
+    ++c->substitutions[0];
+    ++c->insertions[0];
+    ++c->deletions[0];
+    reference_edits(clean.substr(1), dirty.substr(1), c);
+  } else if (clean.back() == dirty.back()) {
+    ++c->substitutions[0];
+    ++c->insertions[0];
+    ++c->deletions[0];
+    reference_edits(clean.substr(0, clean.length() - 1),
+                    dirty.substr(0, dirty.length() - 1), c);
+  } else if (clean.length() < dirty.length()) {
+    ++c->insertions[1];
+    reference_edits(clean, dirty.substr(1), c);
+  } else if (clean.length() > dirty.length()) {
+    ++c->deletions[1];
+    ++c->insertions[0];
+    reference_edits(clean.substr(1), dirty, c);
+  } else {
+    ++c->substitutions[1];
+    ++c->insertions[0];
+    ++c->deletions[0];
+    reference_edits(clean.substr(1), dirty.substr(1), c);
+  }
+}
+
+}  // namespace
+
+BOOST_AUTO_TEST_CASE(test_count_edits_matches_recursive_search) {
+  std::mt19937 prng(4);
+  std::uniform_int_distribution<int> length(0, 12);
+  std::uniform_int_distribution<int> letter('a', 'c');
+  std::uniform_int_distribution<int> edit(0, 5);
+  for (int i = 0; i < 2000; ++i) {
+    std::string clean, dirty;
+    int n = length(prng);
+    for (int j = 0; j < n; ++j) {
+      clean += letter(prng);
+    }
+    for (char ch : clean) {
+      switch (edit(prng)) {
+        case 0:
+          break;
+        case 1:
+          dirty += letter(prng);
+          break;
+        case 2:
+          dirty += ch;
+          dirty += letter(prng);
+          break;
+        default:
+          dirty += ch;
+      }
+    }
+    SimpleStringEmission::EditCounts expected;
+    reference_edits(clean, dirty, &expected);
+    SimpleStringEmission::EditCounts c =
+        SimpleStringEmission::count_edits(clean, dirty);
+    for (int x : {0, 1}) {
+      BOOST_TEST(c.substitutions[x] == expected.substitutions[x]);
+      BOOST_TEST(c.insertions[x] == expected.insertions[x]);
+      BOOST_TEST(c.deletions[x] == expected.deletions[x]);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_long_strings) {
+  SimpleStringEmission ss;
+  std::string clean(100000, 'a');
+  std::string dirty = clean;
+  dirty[50000] = 'b';
+  dirty.insert(dirty.begin() + 70000, 'c');
+
+  double orig_lp = ss.logp_score();
+  ss.incorporate({"hello", "help"});
+  double lp = ss.logp({clean, dirty});
+  double lp_before = ss.logp_score();
+  ss.incorporate({clean, dirty});
+  BOOST_TEST(lp == ss.logp_score() - lp_before,
+             boost::test_tools::tolerance(1e-6));
+  // "help" has one substitution and one deletion, and dirty has one
+  // substitution and one insertion.
+  BOOST_TEST(ss.substitutions.s == 2);
+  BOOST_TEST(ss.insertions.s == 1);
+  BOOST_TEST(ss.deletions.s == 1);
+  BOOST_TEST(ss.insertions.N == 6 + 100002);
+
+  ss.unincorporate({clean, dirty});
+  ss.unincorporate({"hello", "help"});
+  BOOST_TEST(ss.N == 0);
+  BOOST_TEST(ss.substitutions.N == 0);
+  BOOST_TEST(ss.insertions.N == 0);
+  BOOST_TEST(ss.deletions.N == 0);
+  BOOST_TEST(orig_lp == ss.logp_score());
+}
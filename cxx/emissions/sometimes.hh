@@ -59,6 +59,8 @@ class Sometimes : public Emission<SampleType> {
 
   double logp_score() const { return bb.logp_score() + be->logp_score(); }
 
+  void forget_unincorporated() { be->forget_unincorporated(); }
+
   void transition_hyperparameters(std::mt19937* prng) {
     be->transition_hyperparameters(prng);
     bb.transition_hyperparameters(prng);
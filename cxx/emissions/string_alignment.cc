@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <bit>
 #include <map>
 #include <utility>
 #include "emissions/string_alignment.hh"
@@ -92,3 +94,189 @@ double edit_distance(const StrAlignment& alignment, double old_cost) {
     return old_cost + 1;
   }
 }
+
+int levenshtein_distance(const std::string& s1, const std::string& s2) {
+  // The distance is symmetric, and the shorter pattern needs fewer words.
+  if (s1.length() < s2.length()) {
+    return LevenshteinPattern(s1).distance(s2);
+  }
+  return LevenshteinPattern(s2).distance(s1);
+}
+
+void levenshtein_distances(const std::string& query,
+                           const std::vector<std::string>& candidates,
+                           std::vector<int>* distances) {
+  const LevenshteinPattern pattern(query);
+  distances->resize(candidates.size());
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    (*distances)[i] = pattern.distance(candidates[i]);
+  }
+}
+
+LevenshteinPattern::LevenshteinPattern(const std::string& pattern)
+    : length(pattern.length()), num_words((pattern.length() + 63) / 64),
+      peq(256 * num_words, 0) {
+  for (size_t i = 0; i < pattern.length(); ++i) {
+    peq[static_cast<unsigned char>(pattern[i]) * num_words + i / 64] |=
+        uint64_t{1} << (i % 64);
+  }
+}
+
+int LevenshteinPattern::distance(const std::string& text) const {
+  if (length == 0) {
+    return text.length();
+  }
+  if (num_words == 1) {
+    return single_word_distance(text);
+  }
+  // Following Hyyrö's block version of Myers' algorithm, bit r of word w of
+  // pv (mv) is set when D[64w + r + 1][j] - D[64w + r][j] is +1 (-1), where
+  // D[i][j] is the distance between the first i characters of the pattern
+  // and the first j characters of text.  Each word passes the horizontal
+  // difference of its last row on to the next word.
+  std::vector<uint64_t> pv(num_words, ~uint64_t{0});
+  std::vector<uint64_t> mv(num_words, 0);
+  const int last_bit = (length - 1) % 64;
+  int score = length;
+  for (char c : text) {
+    const uint64_t* eqs = &peq[static_cast<unsigned char>(c) * num_words];
+    // The horizontal difference in row 0 is always +1.
+    int h_in = 1;
+    for (int w = 0; w < num_words; ++w) {
+      uint64_t eq = eqs[w];
+      const uint64_t xv = eq | mv[w];
+      const uint64_t h_in_neg = h_in < 0 ? 1 : 0;
+      eq |= h_in_neg;
+      const uint64_t xh = (((eq & pv[w]) + pv[w]) ^ pv[w]) | eq;
+      uint64_t ph = mv[w] | ~(xh | pv[w]);
+      uint64_t mh = pv[w] & xh;
+      if (w == num_words - 1) {
+        score += static_cast<int>((ph >> last_bit) & 1) -
+                 static_cast<int>((mh >> last_bit) & 1);
+      }
+      const int h_out = static_cast<int>(ph >> 63) - static_cast<int>(mh >> 63);
+      ph = (ph << 1) | (h_in > 0 ? 1 : 0);
+      mh = (mh << 1) | h_in_neg;
+      pv[w] = mh | ~(xv | ph);
+      mv[w] = ph & xv;
+      h_in = h_out;
+    }
+  }
+  return score;
+}
+
+int LevenshteinPattern::single_word_distance(const std::string& text) const {
+  // distance with one word, so the horizontal difference coming in is
+  // always +1 and the state fits in registers.
+  uint64_t pv = ~uint64_t{0};
+  uint64_t mv = 0;
+  const uint64_t last_bit = uint64_t{1} << (length - 1);
+  int score = length;
+  for (char c : text) {
+    const uint64_t eq = peq[static_cast<unsigned char>(c)];
+    const uint64_t xv = eq | mv;
+    const uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+    uint64_t ph = mv | ~(xh | pv);
+    uint64_t mh = pv & xh;
+    score += (ph & last_bit) ? 1 : 0;
+    score -= (mh & last_bit) ? 1 : 0;
+    ph = (ph << 1) | 1;
+    mh <<= 1;
+    pv = mh | ~(xv | ph);
+    mv = ph & xv;
+  }
+  return score;
+}
+
+PackedLevenshteinPatterns::PackedLevenshteinPatterns(
+    std::span<const std::string> patterns) {
+  // Assign each pattern its bits, starting a new word when it doesn't fit.
+  int used_bits = 64;
+  for (size_t i = 0; i < patterns.size(); ++i) {
+    const int length = patterns[i].length();
+    if (length == 0 || length > 64) {
+      lanes.push_back({-1, 0});
+      if (length > 64) {
+        long_patterns.emplace_back(i, LevenshteinPattern(patterns[i]));
+      }
+      continue;
+    }
+    if (used_bits + length > 64) {
+      first_bits.push_back(0);
+      last_bits.push_back(0);
+      used_bits = 0;
+    }
+    const uint64_t bits =
+        (length == 64 ? ~uint64_t{0} : (uint64_t{1} << length) - 1)
+        << used_bits;
+    lanes.push_back({static_cast<int>(first_bits.size()) - 1, bits});
+    first_bits.back() |= uint64_t{1} << used_bits;
+    last_bits.back() |= uint64_t{1} << (used_bits + length - 1);
+    used_bits += length;
+  }
+  num_words = first_bits.size();
+  int num_rows = 1;
+  for (size_t i = 0; i < patterns.size(); ++i) {
+    if (lanes[i].word >= 0) {
+      for (char c : patterns[i]) {
+        int& row = char_rows[static_cast<unsigned char>(c)];
+        if (row == 0) {
+          row = num_rows++;
+        }
+      }
+    }
+  }
+  peq.assign(num_rows * num_words, 0);
+  for (size_t i = 0; i < patterns.size(); ++i) {
+    if (lanes[i].word < 0) {
+      continue;
+    }
+    const int start = std::countr_zero(lanes[i].bits);
+    for (size_t k = 0; k < patterns[i].length(); ++k) {
+      const int row = char_rows[static_cast<unsigned char>(patterns[i][k])];
+      peq[row * num_words + lanes[i].word] |= uint64_t{1} << (start + k);
+    }
+  }
+}
+
+void PackedLevenshteinPatterns::distances(const std::string& text,
+                                          std::vector<int>* distances) const {
+  // As in LevenshteinPattern::single_word_distance, except that every
+  // pattern's row 0 takes the incoming horizontal difference of +1, and that
+  // the addition doesn't carry out of the last bit of a pattern.
+  std::vector<uint64_t> pv(num_words, ~uint64_t{0});
+  std::vector<uint64_t> mv(num_words, 0);
+  for (char c : text) {
+    const uint64_t* eqs =
+        &peq[char_rows[static_cast<unsigned char>(c)] * num_words];
+    for (size_t w = 0; w < num_words; ++w) {
+      const uint64_t eq = eqs[w];
+      const uint64_t xv = eq | mv[w];
+      const uint64_t x = eq & pv[w];
+      const uint64_t sum = ((x & ~last_bits[w]) + (pv[w] & ~last_bits[w])) ^
+                           ((x ^ pv[w]) & last_bits[w]);
+      const uint64_t xh = (sum ^ pv[w]) | eq;
+      const uint64_t ph = mv[w] | ~(xh | pv[w]);
+      const uint64_t mh = pv[w] & xh;
+      const uint64_t ph_shifted = ((ph << 1) & ~first_bits[w]) | first_bits[w];
+      const uint64_t mh_shifted = (mh << 1) & ~first_bits[w];
+      pv[w] = mh_shifted | ~(xv | ph_shifted);
+      mv[w] = ph_shifted & xv;
+    }
+  }
+  // pv and mv hold the vertical differences of the last column, whose first
+  // row is the length of text, so their sums over a pattern's bits give its
+  // distance.
+  distances->resize(lanes.size());
+  for (size_t i = 0; i < lanes.size(); ++i) {
+    const Lane& lane = lanes[i];
+    (*distances)[i] = lane.word < 0
+                          ? text.length()
+                          : text.length() + std::popcount(pv[lane.word] &
+                                                          lane.bits) -
+                                std::popcount(mv[lane.word] & lane.bits);
+  }
+  for (const auto& [i, pattern] : long_patterns) {
+    (*distances)[i] = pattern.distance(text);
+  }
+}
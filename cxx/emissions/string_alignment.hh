@@ -1,7 +1,14 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
 #include <functional>
+#include <span>
 #include <string>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -45,8 +52,221 @@ class StrAlignment {
 using CostFunction = std::function<double(const StrAlignment&, double)>;
 
 // Put the top-k lowest cost alignments between s1 and s2 into *alignments.
+// This is a best-first search that works for any CostFunction;  when the
+// cost of each piece only depends on where it starts, kbest_alignments below
+// is much faster.
 void topk_alignments(int k, const std::string& s1, const std::string& s2,
                      CostFunction cost_function,
                      std::vector<StrAlignment>* alignments);
 
 double edit_distance(const StrAlignment& alignment, double old_cost);
+
+// The cost of the lowest cost alignment between s1 and s2 under
+// edit_distance, i.e. their Levenshtein distance, computed without
+// enumerating alignments.
+int levenshtein_distance(const std::string& s1, const std::string& s2);
+
+// Writes the Levenshtein distance between query and candidates[i] to
+// (*distances)[i], reusing the preprocessing of query.  When the same
+// candidates are compared against several queries, PackedLevenshteinPatterns
+// is faster.
+void levenshtein_distances(const std::string& query,
+                           const std::vector<std::string>& candidates,
+                           std::vector<int>* distances);
+
+// A string preprocessed for Myers' bit-parallel Levenshtein distance, which
+// updates a whole column of the edit distance table with a few word
+// operations per 64 characters of the pattern.  Use this instead of
+// levenshtein_distance when one string is compared against many others.
+class LevenshteinPattern {
+ public:
+  LevenshteinPattern(const std::string& pattern);
+
+  // The Levenshtein distance between the pattern and text.
+  int distance(const std::string& text) const;
+
+ private:
+  int single_word_distance(const std::string& text) const;
+
+  int length;
+  int num_words;
+  // Bit i % 64 of peq[c * num_words + i / 64] is set when pattern[i] == c.
+  std::vector<uint64_t> peq;
+};
+
+// Many strings preprocessed together for Myers' algorithm.  Strings of up to
+// 64 characters are packed side by side into 64-bit words, and each
+// character of a text advances every word by the same few word operations,
+// with the additions and shifts masked so that nothing carries from one
+// string into the next.  The words are updated in one loop over contiguous
+// arrays, which the compiler vectorises, so short strings cost a fraction of
+// a LevenshteinPattern::distance each.  Use this when the same strings are
+// compared against several texts.
+class PackedLevenshteinPatterns {
+ public:
+  PackedLevenshteinPatterns(std::span<const std::string> patterns);
+
+  // Writes the Levenshtein distance between text and patterns[i] to
+  // (*distances)[i].
+  void distances(const std::string& text, std::vector<int>* distances) const;
+
+ private:
+  struct Lane {
+    int word;  // -1 for empty patterns and patterns in long_patterns.
+    uint64_t bits;
+  };
+
+  size_t num_words = 0;
+  // Each character of the patterns has a row of peq, and char_rows[c] is the
+  // row of c.  Row 0 is all zeros, for characters not in any pattern.
+  std::array<int, 256> char_rows{};
+  // Bit b of peq[r * num_words + w] is set when the character packed at bit b
+  // of word w has row r.
+  std::vector<uint64_t> peq;
+  // The first and last bits of every pattern in each word.
+  std::vector<uint64_t> first_bits;
+  std::vector<uint64_t> last_bits;
+  // lanes[i] is where patterns[i] is packed.
+  std::vector<Lane> lanes;
+  // The patterns longer than 64 characters, with their indices.
+  std::vector<std::pair<size_t, LevenshteinPattern>> long_patterns;
+};
+
+
+// A piece cost model for kbest_alignments that gives each piece cost 1,
+// except for matches, which are free.  The same costs as edit_distance.
+struct EditDistanceCost {
+  const std::string& s1;
+  const std::string& s2;
+
+  double deletion(size_t i, size_t j) const { return 1.0; }
+  double insertion(size_t i, size_t j) const { return 1.0; }
+  double substitution(size_t i, size_t j) const {
+    return s1[i] == s2[j] ? 0.0 : 1.0;
+  }
+};
+
+// Put the k lowest cost alignments between s1 and s2 into *alignments, in
+// order of increasing cost, like topk_alignments.  Unlike topk_alignments,
+// the cost of a piece may only depend on where it starts:  cost_model must
+// provide
+//   deletion(i, j):      the cost of deleting s1[i],
+//   insertion(i, j):     the cost of inserting s2[j], and
+//   substitution(i, j):  the cost of replacing s1[i] with s2[j] (or matching
+//                        it, if they are equal)
+// after the first i characters of s1 and j characters of s2 are aligned.
+// This allows a dynamic program over the (i, j) lattice that keeps the k best
+// partial alignments per cell, instead of a best-first search that copies
+// every partial alignment.  If band >= 0, only cells with
+// |i - j| <= max(band, |s1.length() - s2.length()|) are considered.
+template <typename CostModel>
+void kbest_alignments(int k, const std::string& s1, const std::string& s2,
+                      const CostModel& cost_model,
+                      std::vector<StrAlignment>* alignments, int band = -1) {
+  assert(k > 0);
+  const int n = s1.length();
+  const int m = s2.length();
+  if (band >= 0) {
+    band = std::max(band, std::abs(n - m));
+  }
+  auto in_band = [&](int i, int j) {
+    return band < 0 || std::abs(i - j) <= band;
+  };
+
+  // Cell (i, j) holds up to k partial alignments, sorted by cost, in
+  // entries[(i * (m + 1) + j) * k ...].  Each one records the piece that
+  // ends at (i, j) and the index of the entry it extends.
+  enum : unsigned char { kStart, kDeletion, kInsertion, kSubstitution };
+  static constexpr unsigned char pred_piece[3] = {kSubstitution, kDeletion,
+                                                  kInsertion};
+  struct Entry {
+    double cost;
+    int prev;
+    unsigned char piece;
+  };
+  std::vector<Entry> entries(static_cast<size_t>(n + 1) * (m + 1) * k);
+  std::vector<int> num_entries(static_cast<size_t>(n + 1) * (m + 1), 0);
+  entries[0] = {0.0, -1, kStart};
+  num_entries[0] = 1;
+
+  for (int i = 0; i <= n; ++i) {
+    for (int j = 0; j <= m; ++j) {
+      if ((i == 0 && j == 0) || !in_band(i, j)) {
+        continue;
+      }
+      const int cell = i * (m + 1) + j;
+      // The three predecessor cells, in the order that ties are broken.
+      int pred_cell[3] = {-1, -1, -1};
+      double pred_cost[3] = {0.0, 0.0, 0.0};
+      if (i > 0 && j > 0) {
+        pred_cell[0] = cell - m - 2;
+        pred_cost[0] = cost_model.substitution(i - 1, j - 1);
+      }
+      if (i > 0) {
+        pred_cell[1] = cell - m - 1;
+        pred_cost[1] = cost_model.deletion(i - 1, j);
+      }
+      if (j > 0) {
+        pred_cell[2] = cell - 1;
+        pred_cost[2] = cost_model.insertion(i, j - 1);
+      }
+      // Merge the predecessors' sorted lists, keeping the k cheapest.
+      int next[3] = {0, 0, 0};
+      int count = 0;
+      while (count < k) {
+        int best = -1;
+        double best_cost = 0.0;
+        for (int p = 0; p < 3; ++p) {
+          if (pred_cell[p] < 0 || next[p] >= num_entries[pred_cell[p]]) {
+            continue;
+          }
+          double c =
+              entries[pred_cell[p] * k + next[p]].cost + pred_cost[p];
+          if (best < 0 || c < best_cost) {
+            best = p;
+            best_cost = c;
+          }
+        }
+        if (best < 0) {
+          break;
+        }
+        entries[cell * k + count] = {
+            best_cost, pred_cell[best] * k + next[best], pred_piece[best]};
+        ++next[best];
+        ++count;
+      }
+      num_entries[cell] = count;
+    }
+  }
+
+  // Trace back each of the final cell's entries into a StrAlignment.
+  const int final_cell = n * (m + 1) + m;
+  for (int r = 0; r < num_entries[final_cell]; ++r) {
+    StrAlignment a;
+    a.cost = entries[final_cell * k + r].cost;
+    a.s1_position = n;
+    a.s2_position = m;
+    for (int e = final_cell * k + r; entries[e].piece != kStart;
+         e = entries[e].prev) {
+      const int cell = e / k;
+      const int i = cell / (m + 1);
+      const int j = cell % (m + 1);
+      switch (entries[e].piece) {
+        case kDeletion:
+          a.align_pieces.push_back(Deletion{s1[i - 1]});
+          break;
+        case kInsertion:
+          a.align_pieces.push_back(Insertion{s2[j - 1]});
+          break;
+        default:
+          if (s1[i - 1] == s2[j - 1]) {
+            a.align_pieces.push_back(Match{s1[i - 1]});
+          } else {
+            a.align_pieces.push_back(Substitution{s1[i - 1], s2[j - 1]});
+          }
+      }
+    }
+    std::reverse(a.align_pieces.begin(), a.align_pieces.end());
+    alignments->push_back(std::move(a));
+  }
+}
@@ -5,6 +5,7 @@
 #include "emissions/string_alignment.hh"
 
 #include <boost/test/included/unit_test.hpp>
+#include <random>
 
 BOOST_AUTO_TEST_CASE(test_simple) {
   std::vector<StrAlignment> alignments;
@@ -102,3 +103,147 @@ BOOST_AUTO_TEST_CASE(test_long_strings_and_bad_distance) {
       bad_edit_distance, &alignments);
   BOOST_TEST(alignments.size() == 10);
 }
+
+BOOST_AUTO_TEST_CASE(test_levenshtein_distance) {
+  BOOST_TEST(levenshtein_distance("", "") == 0);
+  BOOST_TEST(levenshtein_distance("", "abc") == 3);
+  BOOST_TEST(levenshtein_distance("abc", "") == 3);
+  BOOST_TEST(levenshtein_distance("hello", "world") == 4);
+  BOOST_TEST(levenshtein_distance("world", "w0rld!") == 2);
+  BOOST_TEST(levenshtein_distance("kitten", "sitting") == 3);
+
+  for (const auto& [s1, s2] : std::vector<std::pair<std::string, std::string>>{
+           {"AACAGTTACC", "TAAGGTCA"}, {"otter", "other"}, {"ab", "ba"}}) {
+    std::vector<StrAlignment> alignments;
+    topk_alignments(1, s1, s2, edit_distance, &alignments);
+    BOOST_TEST(levenshtein_distance(s1, s2) == alignments[0].cost);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_kbest_alignments) {
+  std::vector<StrAlignment> alignments;
+  kbest_alignments(1, "hello", "world", EditDistanceCost{"hello", "world"},
+                   &alignments);
+  BOOST_TEST(alignments.size() == 1);
+  BOOST_TEST(alignments[0].cost == 4);
+  BOOST_TEST(alignments[0].s1_position == 5);
+  BOOST_TEST(alignments[0].s2_position == 5);
+  BOOST_TEST(alignments[0].align_pieces.size() == 5);
+  BOOST_TEST(alignments[0].align_pieces[3].index() == 3);  // Match
+
+  // The costs of the k best alignments agree with topk_alignments.
+  for (const auto& [s1, s2] : std::vector<std::pair<std::string, std::string>>{
+           {"world", "w0rld!"}, {"AACAGTTACC", "TAAGGTCA"}, {"", "abc"},
+           {"otter", "other"}}) {
+    std::vector<StrAlignment> expected, actual;
+    topk_alignments(5, s1, s2, edit_distance, &expected);
+    kbest_alignments(5, s1, s2, EditDistanceCost{s1, s2}, &actual);
+    BOOST_TEST(actual.size() == expected.size());
+    for (size_t i = 0; i < actual.size(); ++i) {
+      BOOST_TEST(actual[i].cost == expected[i].cost);
+      // The pieces are consistent with the strings and the cost.
+      std::string r1, r2;
+      double cost = 0.0;
+      for (const AlignPiece& p : actual[i].align_pieces) {
+        if (const Deletion* d = std::get_if<Deletion>(&p)) {
+          r1 += d->deleted_char;
+          cost += 1;
+        } else if (const Insertion* n = std::get_if<Insertion>(&p)) {
+          r2 += n->inserted_char;
+          cost += 1;
+        } else if (const Substitution* s = std::get_if<Substitution>(&p)) {
+          r1 += s->original;
+          r2 += s->replacement;
+          cost += 1;
+        } else {
+          r1 += std::get<Match>(p).c;
+          r2 += std::get<Match>(p).c;
+        }
+      }
+      BOOST_TEST(r1 == s1);
+      BOOST_TEST(r2 == s2);
+      BOOST_TEST(cost == actual[i].cost);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_kbest_alignments_band) {
+  const std::string s1 = "abcdefghij";
+  const std::string s2 = "abcdefghijkl";
+  std::vector<StrAlignment> unbanded, banded;
+  kbest_alignments(3, s1, s2, EditDistanceCost{s1, s2}, &unbanded);
+  // The band is widened to the difference in lengths.
+  kbest_alignments(3, s1, s2, EditDistanceCost{s1, s2}, &banded, 0);
+  BOOST_TEST(banded.size() == 3);
+  BOOST_TEST(banded[0].cost == 2);
+  BOOST_TEST(banded[0].align_pieces == unbanded[0].align_pieces);
+
+  // Asking for more alignments than exist returns all of them: "a" -> "" can
+  // only be a deletion, and "a" -> "b" is a substitution, a deletion then an
+  // insertion, or an insertion then a deletion.
+  std::vector<StrAlignment> all;
+  kbest_alignments(10, "a", "", EditDistanceCost{"a", ""}, &all);
+  BOOST_TEST(all.size() == 1);
+  all.clear();
+  kbest_alignments(10, "a", "b", EditDistanceCost{"a", "b"}, &all);
+  BOOST_TEST(all.size() == 3);
+}
+
+BOOST_AUTO_TEST_CASE(test_levenshtein_long_strings) {
+  // Compare against the cost of the best alignment for strings that need
+  // one, two and three words of the bit-parallel kernel.
+  std::mt19937 prng;
+  std::uniform_int_distribution<int> char_dist(0, 3);
+  for (int length : {10, 63, 64, 65, 100, 130, 190}) {
+    std::string s1, s2;
+    for (int i = 0; i < length; ++i) {
+      s1 += "acgt"[char_dist(prng)];
+      s2 += "acgt"[char_dist(prng)];
+    }
+    std::string s3 = s1.substr(3) + "gattaca";
+    std::vector<StrAlignment> alignments;
+    kbest_alignments(1, s1, s2, EditDistanceCost{s1, s2}, &alignments);
+    BOOST_TEST(levenshtein_distance(s1, s2) == alignments[0].cost);
+    BOOST_TEST(levenshtein_distance(s2, s1) == alignments[0].cost);
+    alignments.clear();
+    kbest_alignments(1, s1, s3, EditDistanceCost{s1, s3}, &alignments);
+    BOOST_TEST(levenshtein_distance(s1, s3) == alignments[0].cost);
+
+    std::vector<int> distances;
+    levenshtein_distances(s1, {s2, s3, s1, ""}, &distances);
+    BOOST_TEST(distances.size() == 4);
+    BOOST_TEST(distances[0] == levenshtein_distance(s1, s2));
+    BOOST_TEST(distances[1] == levenshtein_distance(s1, s3));
+    BOOST_TEST(distances[2] == 0);
+    BOOST_TEST(distances[3] == length);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_packed_levenshtein_patterns) {
+  // Enough patterns of mixed lengths to fill several words, including ones
+  // that exactly fill a word and ones too long to be packed.
+  std::mt19937 prng;
+  std::uniform_int_distribution<int> char_dist(0, 4);
+  auto random_string = [&](int length) {
+    std::string s;
+    for (int i = 0; i < length; ++i) {
+      s += "abcde"[char_dist(prng)];
+    }
+    return s;
+  };
+  std::vector<std::string> patterns;
+  for (int length : {1, 5, 0, 64, 9, 30, 33, 2, 70, 63, 1, 12, 40, 8}) {
+    patterns.push_back(random_string(length));
+  }
+  const PackedLevenshteinPatterns packed(patterns);
+  for (const std::string& text :
+       {std::string(""), std::string("xyz"), random_string(7),
+        random_string(64), random_string(90), patterns[5]}) {
+    std::vector<int> distances;
+    packed.distances(text, &distances);
+    BOOST_TEST(distances.size() == patterns.size());
+    for (size_t i = 0; i < patterns.size(); ++i) {
+      BOOST_TEST(distances[i] == levenshtein_distance(text, patterns[i]));
+    }
+  }
+}
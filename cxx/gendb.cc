@@ -3,10 +3,15 @@
 
 #include "gendb.hh"
 
+#include <cassert>
+#include <cmath>
 #include <map>
 #include <random>
+#include <set>
 #include <string>
+#include <tuple>
 #include <variant>
+#include <vector>
 
 #include "distributions/crp.hh"
 #include "hirm.hh"
@@ -14,6 +19,7 @@
 #include "observations.hh"
 #include "pclean/get_joint_relations.hh"
 #include "pclean/schema.hh"
+#include "util_math.hh"
 
 GenDB::GenDB(std::mt19937* prng, const PCleanSchema& schema_,
              bool _only_final_emissions, bool _record_class_is_clean)
@@ -32,6 +38,7 @@ GenDB::GenDB(std::mt19937* prng, const PCleanSchema& schema_,
     entity_crps[class_name] = CRP();
     reference_values[class_name];
   }
+  compute_reference_plans();
   for (const auto& [rel_name, trel] : hirm->schema) {
     const std::vector<std::string>& domains =
         std::visit([&](auto tr) { return tr.domains; }, trel);
@@ -47,6 +54,198 @@ double GenDB::logp_score() const {
   return entity_crps_logp + hirm->logp_score();
 }
 
+namespace {
+
+// Samples a table from the predictive distribution of crp without modifying
+// it. extra_counts holds the customers seated by earlier calls (including
+// customers at tables that are not in crp). A new table gets the id
+// *next_new_table, which is then decremented; callers start it at -1 so that
+// new tables never collide with existing ones.
+int sample_table_without_incorporating(const CRP& crp,
+                                       std::map<int, int>* extra_counts,
+                                       int* next_new_table,
+                                       std::mt19937* prng) {
+  std::map<int, double> table_weights;
+  for (const auto& [table, customers] : crp.tables) {
+    table_weights[table] = customers.size();
+  }
+  for (const auto& [table, count] : *extra_counts) {
+    table_weights[table] += count;
+  }
+  table_weights[*next_new_table] = crp.alpha;
+  std::vector<int> tables;
+  std::vector<double> weights;
+  for (const auto& [table, weight] : table_weights) {
+    tables.push_back(table);
+    weights.push_back(weight);
+  }
+  int table = tables[choice(weights, prng)];
+  if (table == *next_new_table) {
+    --(*next_new_table);
+  }
+  ++(*extra_counts)[table];
+  return table;
+}
+
+// One draw of the latent state that a held-out row depends on. Entity
+// references, IRM cluster assignments and latent values that the GenDB does
+// not already contain are sampled lazily and remembered, so that every
+// observation in the row sees the same draw. New entities and new clusters get
+// negative ids.
+class HeldoutSample {
+ public:
+  HeldoutSample(const GenDB& gendb, std::mt19937* prng)
+      : gendb(gendb), prng(prng) {}
+
+  int new_entity() { return next_entity--; }
+
+  // Mirrors GenDB::sample_entities_relation.
+  T_items sample_entities_relation(const std::string& rel_name,
+                                   int class_item) {
+    const ReferencePlan& plan = gendb.relation_plans.at(rel_name);
+    T_items items(plan.num_items);
+    items.back() = class_item;
+    for (const ReferenceStep& step : plan.steps) {
+      items[step.ref_ind] = get_reference(step, items[step.ind]);
+    }
+    return items;
+  }
+
+  // Returns the log probability of value in query relation rel_name at items.
+  double logp_query(const std::string& rel_name, const T_items& items,
+                    const ObservationVariant& value) {
+    auto f_logp = [&](auto rel) {
+      using T = typename std::remove_pointer_t<decltype(rel)>::ValueType;
+      std::vector<int> z = get_cluster_assignment(rel->get_domains(), items);
+      if (const T_noisy_relation* t_rel = std::get_if<T_noisy_relation>(
+              &gendb.hirm->schema.at(rel_name))) {
+        auto noisy_rel = reinterpret_cast<NoisyRelation<T>*>(rel);
+        T base_value = get_value<T>(t_rel->base_relation,
+                                    noisy_rel->get_base_items(items));
+        return noisy_rel->cluster_or_prior_logp_from_base(
+            prng, z, base_value, std::get<T>(value));
+      }
+      return rel->cluster_or_prior_logp(prng, z, std::get<T>(value));
+    };
+    return std::visit(f_logp, gendb.hirm->get_relation(rel_name));
+  }
+
+ private:
+  int get_reference(const ReferenceStep& step, int class_item) {
+    auto it = step.references->find({step.ref_field, class_item});
+    if (it != step.references->end()) {
+      return it->second;
+    }
+    std::tuple<std::string, std::string, int> key = {
+        step.class_name, step.ref_field, class_item};
+    if (!references.contains(key)) {
+      references[key] = sample_table_without_incorporating(
+          gendb.entity_crps.at(step.ref_class),
+          &entity_counts[step.ref_class], &next_entity, prng);
+    }
+    return references.at(key);
+  }
+
+  std::vector<int> get_cluster_assignment(const std::vector<Domain*>& domains,
+                                          const T_items& items) {
+    std::vector<int> z(domains.size());
+    for (size_t i = 0; i < domains.size(); ++i) {
+      const Domain* domain = domains[i];
+      if (domain->items.contains(items[i])) {
+        z[i] = domain->get_cluster_assignment(items[i]);
+        continue;
+      }
+      std::pair<const Domain*, T_item> key = {domain, items[i]};
+      if (!cluster_assignments.contains(key)) {
+        next_cluster.try_emplace(domain, -1);
+        cluster_assignments[key] = sample_table_without_incorporating(
+            domain->crp, &cluster_counts[domain], &next_cluster.at(domain),
+            prng);
+      }
+      z[i] = cluster_assignments.at(key);
+    }
+    return z;
+  }
+
+  // Returns the value of relation rel_name at items, sampling it (and,
+  // recursively, its base values) if the relation doesn't contain items.
+  template <typename T>
+  T get_value(const std::string& rel_name, const T_items& items) {
+    Relation<T>* rel =
+        std::get<Relation<T>*>(gendb.hirm->get_relation(rel_name));
+    if (rel->get_data().contains(items)) {
+      return rel->get_value(items);
+    }
+    std::pair<std::string, T_items> key = {rel_name, items};
+    if (!latent_values.contains(key)) {
+      std::vector<int> z = get_cluster_assignment(rel->get_domains(), items);
+      if (const T_noisy_relation* t_rel = std::get_if<T_noisy_relation>(
+              &gendb.hirm->schema.at(rel_name))) {
+        auto noisy_rel = reinterpret_cast<NoisyRelation<T>*>(rel);
+        T base_value = get_value<T>(t_rel->base_relation,
+                                    noisy_rel->get_base_items(items));
+        latent_values[key] =
+            noisy_rel->sample_at_cluster_from_base(prng, z, base_value);
+      } else {
+        latent_values[key] = rel->sample_at_cluster(prng, z);
+      }
+    }
+    return std::get<T>(latent_values.at(key));
+  }
+
+  const GenDB& gendb;
+  std::mt19937* prng;
+
+  // Sampled reference values, keyed by (class, reference field, class item).
+  std::map<std::tuple<std::string, std::string, int>, int> references;
+  // Extra customers seated in each class' entity CRP by the sampled
+  // references.
+  std::map<std::string, std::map<int, int>> entity_counts;
+  int next_entity = -1;
+
+  // Sampled cluster assignments of entities that are not in an IRM domain.
+  std::map<std::pair<const Domain*, T_item>, int> cluster_assignments;
+  std::map<const Domain*, std::map<int, int>> cluster_counts;
+  std::map<const Domain*, int> next_cluster;
+
+  // Sampled values of relations that don't contain the items.
+  std::map<std::pair<std::string, T_items>, ObservationVariant> latent_values;
+};
+
+}  // namespace
+
+double GenDB::logp(
+    std::mt19937* prng,
+    const std::vector<std::map<std::string, ObservationVariant>>& rows,
+    int num_samples) const {
+  assert(num_samples > 0);
+  // Each row gets its own PRNG, seeded from prng in row order, so the result
+  // doesn't depend on how the rows are shared among the threads.
+  std::vector<std::mt19937::result_type> seeds(rows.size());
+  for (auto& seed : seeds) {
+    seed = (*prng)();
+  }
+  std::vector<double> row_logps(rows.size());
+  hirm->thread_pool->parallel_for(rows.size(), [&](size_t r) {
+    std::mt19937 row_prng(seeds[r]);
+    std::vector<double> sample_logps(num_samples);
+    for (int i = 0; i < num_samples; ++i) {
+      HeldoutSample sample(*this, &row_prng);
+      int record_item = sample.new_entity();
+      for (const auto& [query_rel, val] : rows[r]) {
+        T_items items = sample.sample_entities_relation(query_rel, record_item);
+        sample_logps[i] += sample.logp_query(query_rel, items, val);
+      }
+    }
+    row_logps[r] = logsumexp(sample_logps) - log(num_samples);
+  });
+  double logp = 0.0;
+  for (double row_logp : row_logps) {
+    logp += row_logp;
+  }
+  return logp;
+}
+
 void GenDB::incorporate(
     std::mt19937* prng,
     const std::pair<int, std::map<std::string, ObservationVariant>>& row,
@@ -59,88 +258,54 @@ void GenDB::incorporate(
   // Loop over the values in the row, and their query relation names.
   for (const auto& [query_rel, val] : vals) {
     // Sample a set of items to be incorporated into the query relation.
-    const std::vector<std::string>& class_path =
-        schema.query.fields.at(query_rel).class_path;
-
-    T_items items;
-    if (new_rows_have_unique_entities) {
-      const std::vector<std::string>& domains = std::visit(
-          [&](auto tr) { return tr.domains; }, hirm->schema.at(query_rel));
-      items.resize(domains.size());
-      get_unique_entities_relation(query_rel, items.size() - 1, id, items);
-    } else {
-      items =
-          sample_entities_relation(prng, schema.query.record_class,
-                                   class_path.cbegin(), class_path.cend(), id);
-    }
+    T_items items = new_rows_have_unique_entities
+                        ? get_unique_entities_relation(query_rel, id)
+                        : sample_entities_relation(prng, query_rel, id);
 
     // Incorporate the items/value into the query relation.
     incorporate_query_relation(prng, query_rel, items, val);
   }
 }
 
-void GenDB::get_unique_entities_relation(const std::string& rel_name,
-                                         const int ind, const int class_item,
-                                         T_items& items) {
-  const std::vector<std::string>& domains = std::visit(
-      [&](auto tr) { return tr.domains; }, hirm->schema.at(rel_name));
-  items[ind] = class_item;
-  auto& ref_indices = relation_reference_indices;
-  if (ref_indices.contains(rel_name)) {
-    if (ref_indices.at(rel_name).contains(ind)) {
-      for (const auto& [rf_name, rf_ind] : ref_indices.at(rel_name).at(ind)) {
-        if (!reference_values.at(domains[ind])
-                 .contains({rf_name, class_item})) {
-          const std::string& ref_class = domains.at(rf_ind);
-          int new_val = entity_crps.at(ref_class).max_table() + 1;
-          int new_id = get_reference_id(domains[ind], rf_name, class_item);
-          reference_values.at(domains[ind])[{rf_name, class_item}] = new_val;
-          entity_crps.at(ref_class).incorporate(new_id, new_val);
-        }
-        int refval =
-            reference_values.at(domains[ind]).at({rf_name, class_item});
-        get_unique_entities_relation(rel_name, rf_ind, refval, items);
+T_items GenDB::get_unique_entities_relation(const std::string& rel_name,
+                                            const int class_item) {
+  return walk_reference_plan(nullptr, relation_plans.at(rel_name), class_item,
+                             true);
+}
+
+T_items GenDB::sample_entities_relation(std::mt19937* prng,
+                                        const std::string& rel_name,
+                                        int class_item) {
+  return walk_reference_plan(prng, relation_plans.at(rel_name), class_item,
+                             false);
+}
+
+// Fills the items of plan, populating the global reference_values table and
+// entity CRPs if necessary.
+T_items GenDB::walk_reference_plan(std::mt19937* prng,
+                                   const ReferencePlan& plan, int class_item,
+                                   bool new_entities) {
+  T_items items(plan.num_items);
+  items.back() = class_item;
+  for (const ReferenceStep& step : plan.steps) {
+    std::pair<std::string, int> ref_key = {step.ref_field, items[step.ind]};
+    auto it = step.references->find(ref_key);
+    if (it == step.references->end()) {
+      if (new_entities) {
+        int new_val = entity_crps.at(step.ref_class).max_table() + 1;
+        int new_id =
+            get_reference_id(step.class_name, step.ref_field, items[step.ind]);
+        (*step.references)[ref_key] = new_val;
+        entity_crps.at(step.ref_class).incorporate(new_id, new_val);
+      } else {
+        assert(prng != nullptr);
+        sample_and_incorporate_reference(prng, step.class_name, ref_key,
+                                         step.ref_class);
       }
+      it = step.references->find(ref_key);
     }
+    items[step.ref_ind] = it->second;
   }
-}
-
-// This function walks the class_path of the query, populates the global
-// reference_values table if necessary, and returns a sampled set of items
-// for the query relation that corresponds to the class path. class_path_start
-// is an attribute of the Class named class_name.
-T_items GenDB::sample_entities_relation(
-    std::mt19937* prng, const std::string& class_name,
-    std::vector<std::string>::const_iterator class_path_start,
-    std::vector<std::string>::const_iterator class_path_end, int class_item) {
-  if (class_path_end - class_path_start == 1) {
-    // The last item in class_path is the class from which the queried attribute
-    // is observed (for which there's a corresponding clean relation, observing
-    // the attribute from the class). We need to DFS-traverse the class's
-    // parents, similar to PCleanSchemaHelper::compute_domains_for.
-    return sample_class_ancestors(prng, class_name, class_item);
-  }
-
-  // These are noisy relation domains along the path from the latent cleanly-
-  // observed class to the record class.
-  const std::string& ref_field = *class_path_start;
-
-  // If the reference field isn't populated, sample a value from a CRP and
-  // add it to reference_values.
-  const std::string& ref_class =
-      std::get<ClassVar>(schema.classes.at(class_name).vars.at(ref_field).spec)
-          .class_name;
-  std::pair<std::string, int> ref_key = {ref_field, class_item};
-  if (!reference_values.at(class_name).contains(ref_key)) {
-    sample_and_incorporate_reference(prng, class_name, ref_key, ref_class);
-  }
-  T_items items = sample_entities_relation(
-      prng, ref_class, ++class_path_start, class_path_end,
-      reference_values.at(class_name).at(ref_key));
-  // The order of the items corresponds to the order of the relation's domains,
-  // with the class (domain) corresponding to the primary key placed last on the
-  // list.
-  items.push_back(class_item);
   return items;
 }
 
@@ -202,11 +367,7 @@ void GenDB::sample_and_incorporate_for_class(std::mt19937* prng,
                                              const std::string& class_name,
                                              const T_item& item) {
   for (const std::string& rel_name : class_to_relations.at(class_name)) {
-    sample_class_ancestors(prng, class_name, item);
-    const std::vector<std::string>& domains = std::visit(
-        [&](auto tr) { return tr.domains; }, hirm->schema.at(rel_name));
-    T_items rel_items(domains.size());
-    get_relation_items(rel_name, domains.size() - 1, item, rel_items);
+    T_items rel_items = sample_entities_relation(prng, rel_name, item);
     if (const T_noisy_relation* t_rel =
             std::get_if<T_noisy_relation>(&hirm->schema.at(rel_name))) {
       RelationVariant rel = hirm->get_relation(rel_name);
@@ -239,49 +400,22 @@ void GenDB::sample_and_incorporate_for_class(std::mt19937* prng,
 T_items GenDB::sample_class_ancestors(std::mt19937* prng,
                                       const std::string& class_name,
                                       int class_item) {
-  T_items items;
-  assert(schema.classes.contains(class_name));
-  PCleanClass c = schema.classes.at(class_name);
-
-  for (const auto& [name, var] : c.vars) {
-    if (const ClassVar* cv = std::get_if<ClassVar>(&(var.spec))) {
-      // If the reference field isn't populated, sample a value from a CRP and
-      // add it to reference_values.
-      std::pair<std::string, int> ref_key = {name, class_item};
-      if (!reference_values.at(class_name).contains(ref_key)) {
-        assert(prng != nullptr);
-        sample_and_incorporate_reference(prng, class_name, ref_key,
-                                         cv->class_name);
-      }
-      T_items ref_items = sample_class_ancestors(
-          prng, cv->class_name, reference_values.at(class_name).at(ref_key));
-      items.insert(items.end(), ref_items.begin(), ref_items.end());
-    }
-  }
-
-  items.push_back(class_item);
-  return items;
+  return walk_reference_plan(prng, class_plans.at(class_name), class_item,
+                             false);
 }
 
-// This function recursively walks the tree of reference indices to populate the
-// "items" vector. The top-level call should pass ind = items.size() - 1 and
-// class_item equal to a primary key value (which goes in the last element of
-// items and determines the rest of the values).
-void GenDB::get_relation_items(const std::string& rel_name, const int ind,
-                               const int class_item, T_items& items) const {
-  const std::vector<std::string>& domains = std::visit(
-      [&](auto tr) { return tr.domains; }, hirm->schema.at(rel_name));
-  items[ind] = class_item;
-  auto& ref_indices = relation_reference_indices;
-  if (ref_indices.contains(rel_name)) {
-    if (ref_indices.at(rel_name).contains(ind)) {
-      for (const auto& [rf_name, rf_ind] : ref_indices.at(rel_name).at(ind)) {
-        int rf_item =
-            reference_values.at(domains.at(ind)).at({rf_name, class_item});
-        get_relation_items(rel_name, rf_ind, rf_item, items);
-      }
-    }
+// Looks up the items of rel_name in the global reference_values table by
+// walking the relation's ReferencePlan from the primary key class_item.
+T_items GenDB::get_relation_items(const std::string& rel_name,
+                                  const int class_item) const {
+  const ReferencePlan& plan = relation_plans.at(rel_name);
+  T_items items(plan.num_items);
+  items.back() = class_item;
+  for (const ReferenceStep& step : plan.steps) {
+    items[step.ref_ind] =
+        step.references->at({step.ref_field, items[step.ind]});
   }
+  return items;
 }
 
 // Returns a map of relation name to the indices (in the items vector) where
@@ -289,16 +423,23 @@ void GenDB::get_relation_items(const std::string& rel_name, const int ind,
 std::map<std::string, std::vector<size_t>> GenDB::get_domain_inds(
     const std::string& class_name, const std::string& ref_field) {
   std::map<std::string, std::vector<size_t>> domain_inds;
-  for (const auto& [rel_name, query_field] : schema.query.fields) {
+  // Besides the query relations, this includes the relations along their
+  // noisy observation paths, whose rows for an entity need not come with any
+  // query row (e.g. the attributes of an entity sampled by a split).
+  for (const auto& [rel_name, trel] : hirm->schema) {
+    auto ref_indices = relation_reference_indices.find(rel_name);
+    if (ref_indices == relation_reference_indices.end()) {
+      continue;
+    }
     // Find relations that involve both the class and its reference field
     // (exclude relations that include the class only because it's a node in
     // a noisy observation path of something otherwise unrelated to the
     // observed attribute.)
-    std::vector<std::string> domains = std::visit(
-        [&](auto& trel) { return trel.domains; }, hirm->schema.at(rel_name));
+    std::vector<std::string> domains =
+        std::visit([&](auto& tr) { return tr.domains; }, trel);
     for (size_t i = 0; i < domains.size(); ++i) {
-      if (domains[i] == class_name &&
-          relation_reference_indices.at(rel_name).at(i).contains(ref_field)) {
+      if (domains[i] == class_name && ref_indices->second.contains(i) &&
+          ref_indices->second.at(i).contains(ref_field)) {
         domain_inds[rel_name].push_back(i);
       }
     }
@@ -316,8 +457,7 @@ double GenDB::unincorporate_reference(
     std::map<std::string,
              std::unordered_map<T_items, ObservationVariant, H_items>>&
         stored_value_map,
-    std::map<std::tuple<int, std::string, T_item>, int>&
-        unincorporated_from_domains) {
+    DomainUndoLog& unincorporated_from_domains) {
   double logp_relations = 0.;
   for (auto [rel_name, inds] : domain_inds) {
     RelationVariant r = hirm->get_relation(rel_name);
@@ -422,9 +562,8 @@ GenDB::update_reference_items(
 
   for (const auto& [relname, data] : stored_values) {
     for (const auto& [items, val] : data) {
-      T_items new_items(items.size());
-      get_relation_items(relname, items.size() - 1, items.back(), new_items);
-      new_stored_values[relname][new_items] = val;
+      new_stored_values[relname][get_relation_items(relname, items.back())] =
+          val;
     }
   }
   // Return reference_values to its original state.
@@ -474,28 +613,25 @@ void GenDB::incorporate_reference_relation(
 
 // After data has been unincorporated from relations, entities that no longer
 // appear in the data may still be incorporated into IRM domain clusters. This
-// method detects and unincorporates the entities, and stores their domain
+// method detects and unincorporates the entities, and logs their domain
 // cluster IDs (so that the entities can later be incorporated into the same
 // clusters, if sampled by transition_reference). It returns the CRP logp of any
 // unincorporated entities.
 double GenDB::unincorporate_from_domain_cluster_relation(
     const std::string& r, const int item, const int ind,
-    std::map<std::tuple<int, std::string, T_item>, int>& unincorporated) {
+    DomainUndoLog& unincorporated) {
   double logp_adj = 0.;
-  int irm_code = hirm->relation_to_table(r);
-  IRM* irm = hirm->irms.at(irm_code);
-  const std::vector<std::string>& domains =
-      std::visit([&](auto trel) { return trel.domains; }, hirm->schema.at(r));
-  const std::string& ref_class = domains.at(ind);
-  Domain* domain = irm->domains.at(ref_class);
+  IRM* irm = hirm->relation_to_irm(r);
+  Domain* domain = std::visit(
+      [&](auto rel) { return rel->get_domains().at(ind); },
+      irm->relations.at(r));
+  const std::string& ref_class = domain->name;
 
   // Return if:
-  //   - we have already unincorporated this entity from the IRM domain cluster
   //   - we shouldn't unincorporate it because it still exists in the data.
-  //   - we can't because it wasn't ever in the data and is therefore not in the
-  //   cluster.
-  if (unincorporated.contains({irm_code, ref_class, item}) ||
-      irm->has_observation(ref_class, item) || !domain->items.contains(item)) {
+  //   - it isn't in the cluster, either because it wasn't ever in the data or
+  //   because we have already unincorporated it.
+  if (irm->has_observation(ref_class, item) || !domain->items.contains(item)) {
     return logp_adj;
   }
 
@@ -507,7 +643,7 @@ double GenDB::unincorporate_from_domain_cluster_relation(
   } else {
     logp_adj += crp.logp_new_table();
   }
-  unincorporated[{irm_code, ref_class, item}] = cluster_id;
+  unincorporated.push_back({domain, item, cluster_id});
 
   // Recursively check and unincorporate the entity's ancestors.
   if (relation_reference_indices.contains(r) &&
@@ -534,20 +670,23 @@ double GenDB::unincorporate_from_domain_cluster_relation(
 double GenDB::unincorporate_from_entity_cluster(
     const std::string& class_name, const std::string& ref_field,
     const int class_item,
-    std::map<std::tuple<std::string, std::string, int>, int>& unincorporated,
-    const bool is_ancestor_reference) {
+    EntityUndoLog& unincorporated, const bool is_ancestor_reference) {
   double logp_adj = 0.;
 
   int ref_id = get_reference_id(class_name, ref_field, class_item);
-  int ref_item = reference_values.at(class_name).at({ref_field, class_item});
-
-  const std::string& ref_class =
-      std::get<ClassVar>(schema.classes.at(class_name).vars.at(ref_field).spec)
-          .class_name;
+  auto& class_references = reference_values.at(class_name);
+  int ref_item = class_references.at({ref_field, class_item});
+
+  // Keep a pointer to the field name owned by the schema, since ref_field may
+  // not outlive the undo log.
+  const auto& [schema_ref_field, ref_var] =
+      *schema.classes.at(class_name).vars.find(ref_field);
+  const std::string& ref_class = std::get<ClassVar>(ref_var.spec).class_name;
   CRP& crp = entity_crps.at(ref_class);
   if (is_ancestor_reference) {
     crp.unincorporate(ref_id);
-    unincorporated[{class_name, ref_field, class_item}] = ref_item;
+    unincorporated.push_back({&crp, &class_references, &schema_ref_field,
+                              class_item, ref_id, ref_item});
   }
 
   if (crp.tables.contains(ref_item)) {
@@ -622,10 +761,8 @@ double GenDB::unincorporate_singleton(
     std::map<std::string,
              std::unordered_map<T_items, ObservationVariant, H_items>>&
         stored_value_map,
-    std::map<std::tuple<int, std::string, T_item>, int>&
-        unincorporated_from_domains,
-    std::map<std::tuple<std::string, std::string, int>, int>&
-        unincorporated_from_entity_crps) {
+    DomainUndoLog& unincorporated_from_domains,
+    EntityUndoLog& unincorporated_from_entity_crps) {
   double logp_refclass = 0.;
 
   int ref_val = reference_values.at(class_name).at({ref_field, class_item});
@@ -634,10 +771,7 @@ double GenDB::unincorporate_singleton(
                                         unincorporated_from_entity_crps, false);
 
   for (auto& rel : class_to_relations.at(ref_class)) {
-    const std::vector<std::string>& domains =
-        std::visit([&](auto tr) { return tr.domains; }, hirm->schema.at(rel));
-    T_items base_items(domains.size());
-    get_relation_items(rel, base_items.size() - 1, ref_val, base_items);
+    T_items base_items = get_relation_items(rel, ref_val);
     logp_refclass += std::visit(
         [&](auto r) {
           return unincorporate_reference_relation_singleton(r, rel, base_items,
@@ -646,10 +780,7 @@ double GenDB::unincorporate_singleton(
         hirm->get_relation(rel));
   }
   for (auto& rel : class_to_relations.at(ref_class)) {
-    const std::vector<std::string>& domains =
-        std::visit([&](auto tr) { return tr.domains; }, hirm->schema.at(rel));
-    T_items base_items(domains.size());
-    get_relation_items(rel, base_items.size() - 1, ref_val, base_items);
+    T_items base_items = get_relation_items(rel, ref_val);
     logp_refclass += unincorporate_from_domain_cluster_relation(
         rel, base_items.back(), base_items.size() - 1,
         unincorporated_from_domains);
@@ -685,24 +816,39 @@ void GenDB::transition_reference(std::mt19937* prng,
   std::map<std::string,
            std::unordered_map<T_items, ObservationVariant, H_items>>
       stored_values;  // Stores relation items and values.
-  std::map<int, std::map<std::tuple<int, std::string, T_item>, int>>
-      unincorporated_from_domains;  // Stores IRM domain cluster IDs.
-  double logp_current = unincorporate_reference(
-      domain_inds, class_name, ref_field, class_item, stored_values,
-      unincorporated_from_domains[init_refval]);
 
   std::vector<int> entities(crp_dist.size());
   std::vector<double> logps(crp_dist.size(), 0.);
 
   // Find which entity represents the singleton CRP table -- this is either
-  // init_refval or a previously-unseen entity.
+  // init_refval or a previously-unseen entity -- and the index of
+  // init_refval among the candidates.
   int singleton_entity = init_refval;
+  size_t init_ind = 0;
   for (const auto [t, w] : crp_dist) {
     if (!entity_crps.at(ref_class).tables.contains(t)) {
       singleton_entity = t;
     }
+    if (t < init_refval) {
+      ++init_ind;
+    }
   }
 
+  // Clear the undo logs, keeping their storage for reuse. The domain undo log
+  // for each candidate stores the IRM domain cluster IDs of the entities it
+  // unincorporated.
+  if (domain_undo_logs.size() < crp_dist.size()) {
+    domain_undo_logs.resize(crp_dist.size());
+  }
+  for (DomainUndoLog& log : domain_undo_logs) {
+    log.clear();
+  }
+  entity_undo_log.clear();
+
+  double logp_current =
+      unincorporate_reference(domain_inds, class_name, ref_field, class_item,
+                              stored_values, domain_undo_logs[init_ind]);
+
   // Unincorporate the reference value from its entity CRP. It is important that
   // this is done before the call to unincorporate_singleton.
   int ref_id = get_reference_id(class_name, ref_field, class_item);
@@ -717,14 +863,11 @@ void GenDB::transition_reference(std::mt19937* prng,
            std::unordered_map<T_items, ObservationVariant, H_items>>
       ref_class_relation_stored_values;  // Stores data unincorporated from
                                          // relations.
-  std::map<std::tuple<std::string, std::string, int>, int>
-      unincorporated_from_entity_crps;
   if (singleton_entity == init_refval) {
-    logp_current +=
-        unincorporate_singleton(class_name, ref_field, class_item, ref_class,
-                                ref_class_relation_stored_values,
-                                unincorporated_from_domains[init_refval],
-                                unincorporated_from_entity_crps);
+    logp_current += unincorporate_singleton(
+        class_name, ref_field, class_item, ref_class,
+        ref_class_relation_stored_values, domain_undo_logs[init_ind],
+        entity_undo_log);
   }
 
   // Loop over the candidate reference values and compute the logp of each.
@@ -743,26 +886,7 @@ void GenDB::transition_reference(std::mt19937* prng,
     // Handle the singleton entity, if it was not init_refval (i.e. it is
     // previously unseen).
     if (table == singleton_entity) {
-      // Sample and incorporate a new row into the ref_class table. Update
-      // reference_values and entity_crps.
-      T_items unused_base_items =
-          sample_class_ancestors(prng, ref_class, table);
-
-      // Sample and incorporate values into the relations corresponding to
-      // the reference class. This may also incorporate new values into the IRM
-      // domain clusters.
-      for (auto& rel : class_to_relations.at(ref_class)) {
-        const std::vector<std::string>& domains = std::visit(
-            [&](auto tr) { return tr.domains; }, hirm->schema.at(rel));
-        T_items base_items(domains.size());
-        get_relation_items(rel, base_items.size() - 1, table, base_items);
-        bool c = std::visit(
-            [&](auto r) { return r->get_data().contains(base_items); },
-            hirm->get_relation(rel));
-        if (!c) {
-          hirm->sample_and_incorporate_relation(prng, rel, base_items);
-        }
-      }
+      sample_and_incorporate_entity(prng, ref_class, table);
     }
 
     // Get items and values with new entity linkages.
@@ -780,7 +904,7 @@ void GenDB::transition_reference(std::mt19937* prng,
     // (so they can be re-incorporated if this table is chosen).
     logps[i] += unincorporate_reference(domain_inds, class_name, ref_field,
                                         class_item, updated_values_i,
-                                        unincorporated_from_domains[table]);
+                                        domain_undo_logs[i]);
 
     // If table is the singleton, unincorporate and store its references from
     // the entity CRPs. Unincorporate and store the items/values corresponding
@@ -788,8 +912,8 @@ void GenDB::transition_reference(std::mt19937* prng,
     if (table == singleton_entity) {
       logps[i] += unincorporate_singleton(
           class_name, ref_field, class_item, ref_class,
-          ref_class_relation_stored_values, unincorporated_from_domains[table],
-          unincorporated_from_entity_crps);
+          ref_class_relation_stored_values, domain_undo_logs[i],
+          entity_undo_log);
     }
 
     ++i;
@@ -806,8 +930,7 @@ void GenDB::transition_reference(std::mt19937* prng,
   }
   reincorporate_new_refval(class_name, ref_field, class_item, new_refval,
                            ref_class, updated_values_new,
-                           unincorporated_from_domains.at(new_refval),
-                           unincorporated_from_entity_crps);
+                           domain_undo_logs[new_ind], entity_undo_log);
 }
 
 void GenDB::reincorporate_new_refval(
@@ -816,20 +939,17 @@ void GenDB::reincorporate_new_refval(
     std::map<std::string,
              std::unordered_map<T_items, ObservationVariant, H_items>>&
         stored_value_map,
-    std::map<std::tuple<int, std::string, T_item>, int>&
-        unincorporated_from_domains,
-    std::map<std::tuple<std::string, std::string, int>, int>&
-        unincorporated_from_entity_crps) {
+    const DomainUndoLog& unincorporated_from_domains,
+    const EntityUndoLog& unincorporated_from_entity_crps) {
   // Nothing is sampled anew in this method so prng is unused.
   // std::mt19937* prng = nullptr;
   std::mt19937 prng;  // Debug why empty clusters sometimes get cleaned up.
 
   // Incorporate the chosen entities back into their previous domain CRPs.
-  for (auto [k, v] : unincorporated_from_domains) {
-    auto [irm_code, r_class, item] = k;
+  for (const DomainUndoRecord& record : unincorporated_from_domains) {
     // TODO: Debug. This check shouldn't be necessary.
-    if (!hirm->irms.at(irm_code)->domains.at(r_class)->items.contains(item)) {
-      hirm->irms.at(irm_code)->domains.at(r_class)->incorporate(&prng, item, v);
+    if (!record.domain->items.contains(record.item)) {
+      record.domain->incorporate(&prng, record.item, record.table);
     }
   }
 
@@ -841,19 +961,13 @@ void GenDB::reincorporate_new_refval(
   if (is_singleton) {
     // Re-incorporate the references populating the new row in the reference's
     // parent class.
-    for (auto [k, v] : unincorporated_from_entity_crps) {
-      auto [ref_class, field, item] = k;
-      const std::string& subref_class =
-          std::get<ClassVar>(schema.classes.at(ref_class).vars.at(field).spec)
-              .class_name;
-      int ref_id = get_reference_id(ref_class, field, item);
-      entity_crps.at(subref_class).incorporate(ref_id, v);
+    for (const EntityUndoRecord& record : unincorporated_from_entity_crps) {
+      record.crp->incorporate(record.ref_id, record.ref_item);
     }
   } else {
     // Remove the singleton from reference_values if it was not selected.
-    for (auto [k, v] : unincorporated_from_entity_crps) {
-      auto [ref_class, field, item] = k;
-      reference_values.at(ref_class).erase({field, item});
+    for (const EntityUndoRecord& record : unincorporated_from_entity_crps) {
+      record.references->erase({*record.ref_field, record.class_item});
     }
   }
   int ref_id = get_reference_id(class_name, ref_field, class_item);
@@ -882,6 +996,386 @@ void GenDB::transition_reference_class_and_ancestors(
   }
 }
 
+void GenDB::sample_and_incorporate_entity(std::mt19937* prng,
+                                          const std::string& class_name,
+                                          const int entity) {
+  // Sample and incorporate a new row into the class_name table. Update
+  // reference_values and entity_crps.
+  T_items unused_items = sample_class_ancestors(prng, class_name, entity);
+
+  // Sample and incorporate values into the relations corresponding to the
+  // class. This may also incorporate new values into the IRM domain clusters.
+  for (auto& rel : class_to_relations.at(class_name)) {
+    T_items items = get_relation_items(rel, entity);
+    bool c = std::visit([&](auto r) { return r->get_data().contains(items); },
+                        hirm->get_relation(rel));
+    if (!c) {
+      hirm->sample_and_incorporate_relation(prng, rel, items);
+    }
+  }
+}
+
+void GenDB::unincorporate_entity(const std::string& class_name,
+                                 const int entity) {
+  assert(!entity_crps.at(class_name).tables.contains(entity));
+  for (auto& rel : class_to_relations.at(class_name)) {
+    T_items items = get_relation_items(rel, entity);
+    bool c = std::visit([&](auto r) { return r->get_data().contains(items); },
+                        hirm->get_relation(rel));
+    if (c) {
+      hirm->unincorporate(rel, items);
+    }
+  }
+  auto& class_references = reference_values.at(class_name);
+  for (const auto& [name, var] : schema.classes.at(class_name).vars) {
+    if (const ClassVar* cv = std::get_if<ClassVar>(&(var.spec))) {
+      auto it = class_references.find({name, entity});
+      if (it == class_references.end()) {
+        continue;
+      }
+      int ref_item = it->second;
+      class_references.erase(it);
+      CRP& crp = entity_crps.at(cv->class_name);
+      crp.unincorporate(get_reference_id(class_name, name, entity));
+      if (!crp.tables.contains(ref_item)) {
+        unincorporate_entity(cv->class_name, ref_item);
+      }
+    }
+  }
+}
+
+int GenDB::new_entity_id(const std::string& class_name) const {
+  // Entities that nothing refers to may still have incorporated attributes
+  // (e.g. in the middle of a split-merge proposal), so skip their ids.
+  auto is_used = [&](int entity) {
+    for (const auto& rel : class_to_relations.at(class_name)) {
+      bool has_data = std::visit(
+          [&](auto r) { return r->get_data_r().at(class_name).contains(entity); },
+          hirm->get_relation(rel));
+      if (has_data) {
+        return true;
+      }
+    }
+    for (const auto& [name, var] : schema.classes.at(class_name).vars) {
+      if (reference_values.at(class_name).contains({name, entity})) {
+        return true;
+      }
+    }
+    return false;
+  };
+  int entity = entity_crps.at(class_name).max_table() + 1;
+  while (is_used(entity)) {
+    ++entity;
+  }
+  return entity;
+}
+
+void GenDB::relink_reference(std::mt19937* prng, const std::string& class_name,
+                             const std::string& ref_field, const int class_item,
+                             const int new_refval,
+                             DomainUndoLog& removed_from_domains,
+                             const DomainUndoLog& restore_to_domains,
+                             MovedRows* moved_rows) {
+  std::map<std::string,
+           std::unordered_map<T_items, ObservationVariant, H_items>>
+      updated_values =
+          unlink_reference(class_name, ref_field, class_item, new_refval,
+                           removed_from_domains, moved_rows);
+  for (const DomainUndoRecord& record : restore_to_domains) {
+    if (!record.domain->items.contains(record.item)) {
+      record.domain->incorporate(prng, record.item, record.table);
+    }
+  }
+  incorporate_reference(prng, updated_values);
+}
+
+std::map<std::string, std::unordered_map<T_items, ObservationVariant, H_items>>
+GenDB::unlink_reference(const std::string& class_name,
+                        const std::string& ref_field, const int class_item,
+                        const int new_refval,
+                        DomainUndoLog& removed_from_domains,
+                        MovedRows* moved_rows) {
+  const std::string& ref_class =
+      std::get<ClassVar>(schema.classes.at(class_name).vars.at(ref_field).spec)
+          .class_name;
+  std::map<std::string,
+           std::unordered_map<T_items, ObservationVariant, H_items>>
+      stored_values;
+  unincorporate_reference(get_domain_inds(class_name, ref_field), class_name,
+                          ref_field, class_item, stored_values,
+                          removed_from_domains);
+  decltype(stored_values) updated_values = update_reference_items(
+      stored_values, class_name, ref_field, class_item, new_refval);
+  if (moved_rows != nullptr) {
+    for (const auto& [rel_name, data] : stored_values) {
+      for (const auto& [items, unused_val] : data) {
+        moved_rows->emplace_back(rel_name, items);
+      }
+    }
+  }
+
+  int ref_id = get_reference_id(class_name, ref_field, class_item);
+  entity_crps.at(ref_class).unincorporate(ref_id);
+  entity_crps.at(ref_class).incorporate(ref_id, new_refval);
+  reference_values.at(class_name).at({ref_field, class_item}) = new_refval;
+  return updated_values;
+}
+
+void GenDB::unincorporate_unobserved_entities(const MovedRows& moved_rows,
+                                               DomainUndoLog& unincorporated,
+                                               const MovedRows* kept_rows) {
+  auto row_domains = [&](const std::string& rel_name)
+      -> const std::vector<Domain*>& {
+    return std::visit(
+        [&](auto rel) -> const std::vector<Domain*>& {
+          return rel->get_domains();
+        },
+        hirm->relation_to_irm(rel_name)->relations.at(rel_name));
+  };
+  std::set<std::pair<const Domain*, T_item>> kept;
+  if (kept_rows != nullptr) {
+    for (const auto& [rel_name, items] : *kept_rows) {
+      const std::vector<Domain*>& domains = row_domains(rel_name);
+      for (size_t i = 0; i < domains.size(); ++i) {
+        kept.emplace(domains[i], items[i]);
+      }
+    }
+  }
+  for (const auto& [rel_name, items] : moved_rows) {
+    IRM* irm = hirm->relation_to_irm(rel_name);
+    const std::vector<Domain*>& domains = row_domains(rel_name);
+    for (size_t i = 0; i < domains.size(); ++i) {
+      Domain* domain = domains[i];
+      if (domain->items.contains(items[i]) &&
+          !irm->has_observation(domain->name, items[i]) &&
+          !kept.contains({domain, items[i]})) {
+        unincorporated.push_back(
+            {domain, items[i], domain->get_cluster_assignment(items[i])});
+        domain->unincorporate(items[i]);
+      }
+    }
+  }
+}
+
+std::set<std::string> GenDB::relinked_relations(const std::string& class_name,
+                                                const std::string& ref_field) {
+  std::set<std::string> rel_names;
+  for (const auto& [rel_name, unused_inds] :
+       get_domain_inds(class_name, ref_field)) {
+    std::string name = rel_name;
+    while (rel_names.insert(name).second) {
+      const T_noisy_relation* trel =
+          std::get_if<T_noisy_relation>(&hirm->schema.at(name));
+      if (trel == nullptr) {
+        break;
+      }
+      name = trel->base_relation;
+    }
+  }
+  return rel_names;
+}
+
+double GenDB::logp_score_relations(const std::set<std::string>& rel_names,
+                                   const std::string& ref_class) const {
+  double logp = entity_crps.at(ref_class).logp_score();
+  for (const std::string& rel_name : rel_names) {
+    std::visit([&](auto rel) { logp += rel->logp_score(); },
+               hirm->get_relation(rel_name));
+  }
+  return logp + logp_score_domains(rel_names);
+}
+
+double GenDB::logp_score_domains(const std::set<std::string>& rel_names) const {
+  std::set<const Domain*> domains;
+  for (const std::string& rel_name : rel_names) {
+    std::visit(
+        [&](auto rel) {
+          domains.insert(rel->get_domains().begin(), rel->get_domains().end());
+        },
+        hirm->get_relation(rel_name));
+  }
+  double logp = 0.;
+  for (const Domain* domain : domains) {
+    logp += domain->crp.logp_score();
+  }
+  return logp;
+}
+
+bool GenDB::transition_split_merge(std::mt19937* prng,
+                                   const std::string& ref_class) {
+  // Collect the references to ref_class, as (class name, reference field,
+  // class item). The strings are owned by the schema.
+  std::vector<std::tuple<const std::string*, const std::string*, int>> refs;
+  for (const auto& [class_name, c] : schema.classes) {
+    for (const auto& [name, var] : c.vars) {
+      const ClassVar* cv = std::get_if<ClassVar>(&(var.spec));
+      if (cv == nullptr || cv->class_name != ref_class) {
+        continue;
+      }
+      for (const auto& [key, unused_val] : reference_values.at(class_name)) {
+        if (key.first == name) {
+          refs.emplace_back(&class_name, &name, key.second);
+        }
+      }
+    }
+  }
+  if (refs.size() < 2) {
+    return false;
+  }
+  auto get_refval = [&](size_t i) {
+    auto [class_name, ref_field, class_item] = refs[i];
+    return reference_values.at(*class_name).at({*ref_field, class_item});
+  };
+
+  std::uniform_int_distribution<size_t> pick(0, refs.size() - 1);
+  size_t i1 = pick(*prng);
+  size_t i2 = pick(*prng);
+  while (i2 == i1) {
+    i2 = pick(*prng);
+  }
+  int e1 = get_refval(i1);
+  int e2 = get_refval(i2);
+  bool is_split = e1 == e2;
+
+  // The references to move from entity `from` to entity `to`, and the log of
+  // the ratio of reverse to forward proposal probabilities. The references
+  // other than the two chosen ones are allocated uniformly at random by a
+  // split, so a split of n references has probability 2^-(n-2) and the
+  // reverse merge has probability one.
+  std::vector<size_t> moved;
+  int from = e2;
+  int to = e1;
+  double log_proposal_ratio = 0.;
+  std::bernoulli_distribution coin(0.5);
+  for (size_t i = 0; i < refs.size(); ++i) {
+    if (i == i1 || i == i2) {
+      continue;
+    }
+    int refval = get_refval(i);
+    if (is_split && refval == e1) {
+      log_proposal_ratio += log(2.);
+      if (coin(*prng)) {
+        moved.push_back(i);
+      }
+    } else if (!is_split && (refval == e1 || refval == e2)) {
+      log_proposal_ratio -= log(2.);
+      if (refval == e2) {
+        moved.push_back(i);
+      }
+    }
+  }
+  moved.push_back(i2);
+
+  // Only the relations whose rows move, their IRM domains and the entity CRP
+  // of ref_class change between the two states, so the rest of the model
+  // cancels in the acceptance ratio.
+  std::set<std::string> rel_names;
+  for (size_t k : moved) {
+    auto [class_name, ref_field, class_item] = refs[k];
+    rel_names.merge(relinked_relations(*class_name, *ref_field));
+  }
+
+  // A split moves the references to a new entity whose attributes are
+  // sampled from the model. Scoring the split against the state that already
+  // contains the new entity cancels the proposal density of its attributes,
+  // and likewise a merge is scored against the state that still contains the
+  // merged entity's attributes.
+  if (is_split) {
+    from = e1;
+    to = new_entity_id(ref_class);
+    sample_and_incorporate_entity(prng, ref_class, to);
+  }
+  double logp_before = logp_score_relations(rel_names, ref_class);
+
+  // Unlink every moved reference before incorporating any moved row, so that
+  // the entities that leave IRM domains are removed before the entities that
+  // enter them are drawn.  Entities that only lose their observations until
+  // the moved rows come back stay in their clusters.  Both directions then
+  // start their draws from the same state, and since the CRP is exchangeable
+  // the log probability of a sequence of draws is the change in its score.
+  double logp_domains_before = logp_score_domains(rel_names);
+  if (domain_undo_logs.size() < moved.size()) {
+    domain_undo_logs.resize(moved.size());
+  }
+  MovedRows moved_rows;
+  MovedRows new_rows;
+  std::vector<std::map<std::string, std::unordered_map<T_items,
+                                                       ObservationVariant,
+                                                       H_items>>>
+      updated_values(moved.size());
+  for (size_t k = 0; k < moved.size(); ++k) {
+    auto [class_name, ref_field, class_item] = refs[moved[k]];
+    domain_undo_logs[k].clear();
+    updated_values[k] = unlink_reference(*class_name, *ref_field, class_item,
+                                         to, domain_undo_logs[k], &moved_rows);
+    for (const auto& [rel_name, data] : updated_values[k]) {
+      for (const auto& [items, unused_val] : data) {
+        new_rows.emplace_back(rel_name, items);
+      }
+    }
+  }
+  DomainUndoLog unobserved;
+  unincorporate_unobserved_entities(moved_rows, unobserved, &new_rows);
+  double logp_domains_unlinked = logp_score_domains(rel_names);
+  for (auto& values : updated_values) {
+    incorporate_reference(prng, values);
+  }
+  double logp_after = logp_score_relations(rel_names, ref_class);
+  // The log probabilities of the domain cluster draws of the proposal, and of
+  // those of the reverse proposal that restore the current state.
+  double log_q_draws = logp_score_domains(rel_names) - logp_domains_unlinked;
+  double log_q_reverse_draws = logp_domains_before - logp_domains_unlinked;
+  log_proposal_ratio += log_q_reverse_draws - log_q_draws;
+
+  // The relation clusters emptied by the moves are kept until the decision,
+  // so that a rejected proposal moves the data back into the same clusters,
+  // with the same hyperparameters, and the state is restored exactly.
+  std::uniform_real_distribution<double> u(0., 1.);
+  bool accept = log(u(*prng)) < logp_after - logp_before + log_proposal_ratio;
+  if (accept) {
+    if (!is_split) {
+      unincorporate_entity(ref_class, from);
+    }
+  } else {
+    for (const DomainUndoRecord& record : unobserved) {
+      record.domain->incorporate(prng, record.item, record.table);
+    }
+    DomainUndoLog unused_log;
+    MovedRows moved_back_rows;
+    for (int k = std::ssize(moved) - 1; k >= 0; --k) {
+      auto [class_name, ref_field, class_item] = refs[moved[k]];
+      relink_reference(prng, *class_name, *ref_field, class_item, from,
+                       unused_log, domain_undo_logs[k], &moved_back_rows);
+    }
+    // The entities drawn into IRM domains by the proposal leave them again.
+    unincorporate_unobserved_entities(moved_back_rows, unused_log);
+    if (is_split) {
+      unincorporate_entity(ref_class, to);
+    }
+  }
+  for (const std::string& rel_name : rel_names) {
+    std::visit([](auto rel) { rel->cleanup_clusters(); },
+               hirm->get_relation(rel_name));
+  }
+  return accept;
+}
+
+void GenDB::transition_split_merge_all(std::mt19937* prng, int num_proposals) {
+  std::set<std::string> ref_classes;
+  for (const auto& [class_name, c] : schema.classes) {
+    for (const auto& [name, var] : c.vars) {
+      if (const ClassVar* cv = std::get_if<ClassVar>(&(var.spec))) {
+        ref_classes.insert(cv->class_name);
+      }
+    }
+  }
+  for (const std::string& ref_class : ref_classes) {
+    for (int i = 0; i < num_proposals; ++i) {
+      transition_split_merge(prng, ref_class);
+    }
+  }
+}
+
 GenDB::~GenDB() { delete hirm; }
 
 void GenDB::compute_domains_cache() {
@@ -900,6 +1394,47 @@ void GenDB::compute_reference_indices_cache() {
   }
 }
 
+void GenDB::compute_reference_plans() {
+  for (const auto& [rel_name, trel] : hirm->schema) {
+    const std::vector<std::string>& rel_domains =
+        std::visit([&](auto tr) { return tr.domains; }, trel);
+    auto it = relation_reference_indices.find(rel_name);
+    relation_plans[rel_name] = make_reference_plan(
+        rel_domains,
+        it == relation_reference_indices.end() ? nullptr : &it->second);
+  }
+  for (const auto& [class_name, class_domains] : domains) {
+    auto it = class_reference_indices.find(class_name);
+    class_plans[class_name] = make_reference_plan(
+        class_domains,
+        it == class_reference_indices.end() ? nullptr : &it->second);
+  }
+}
+
+ReferencePlan GenDB::make_reference_plan(
+    const std::vector<std::string>& plan_domains,
+    const std::map<int, std::map<std::string, int>>* ref_indices) {
+  ReferencePlan plan;
+  plan.num_items = plan_domains.size();
+  if (ref_indices == nullptr) {
+    return plan;
+  }
+  // A referenced entity always appears before the entity that refers to it,
+  // so visiting the indices in decreasing order fills items[ind] before any
+  // step reads it.
+  for (auto it = ref_indices->rbegin(); it != ref_indices->rend(); ++it) {
+    const auto& [ind, ref_fields] = *it;
+    const std::string& class_name = plan_domains.at(ind);
+    for (const auto& [ref_field, ref_ind] : ref_fields) {
+      assert(ref_ind < ind);
+      plan.steps.push_back({ind, ref_ind, class_name, ref_field,
+                            plan_domains.at(ref_ind),
+                            &reference_values.at(class_name)});
+    }
+  }
+  return plan;
+}
+
 void GenDB::compute_domains_for(const std::string& name) {
   std::vector<std::string> ds;
   assert(schema.classes.contains(name));
@@ -1000,6 +1535,10 @@ void GenDB::make_relations_for_queryfield(const QueryField& f,
       cr.is_observed = true;
       (*tschema)[f.name] = cr;
       tschema->erase(base_relation_name);
+      if (relation_reference_indices.contains(base_relation_name)) {
+        relation_reference_indices[f.name] =
+            relation_reference_indices.at(base_relation_name);
+      }
     } else {
       T_noisy_relation tnr =
           get_emission_relation(std::get<ScalarVar>(last_var.spec),
@@ -1028,11 +1567,12 @@ void GenDB::make_relations_for_queryfield(const QueryField& f,
         std::get<ScalarVar>(last_var.spec), noisy_domains, base_relation_name);
     tnr.is_observed = true;
     (*tschema)[f.name] = tnr;
-    // If the record class is the only class in the schema, there will be
-    // no entries in `relation_reference_indices`.
+    // The query relation shares the reference indices of its base relation,
+    // in addition to the reference fields along the class path.
     if (relation_reference_indices.contains(base_relation_name)) {
-      relation_reference_indices[f.name] =
+      std::map<int, std::map<std::string, int>> base_indices =
           relation_reference_indices.at(base_relation_name);
+      relation_reference_indices[f.name].merge(base_indices);
     }
     return;
   }
@@ -4,13 +4,64 @@
 #pragma once
 #include <map>
 #include <random>
+#include <set>
 #include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "distributions/crp.hh"
 #include "hirm.hh"
 #include "observations.hh"
 #include "pclean/schema.hh"
 
+// One step of a ReferencePlan: items[ref_ind] is the entity that the
+// reference field ref_field of items[ind] (an entity of class_name) points to.
+struct ReferenceStep {
+  int ind;
+  int ref_ind;
+  std::string class_name;
+  std::string ref_field;
+  std::string ref_class;
+  // Points to GenDB::reference_values.at(class_name).
+  std::map<std::pair<std::string, int>, int>* references;
+};
+
+// The reference fields that determine a relation's (or class's) items from
+// its primary key, flattened into a list of steps. Steps are ordered so that
+// items[step.ind] is always filled before it is read.
+struct ReferencePlan {
+  size_t num_items;
+  std::vector<ReferenceStep> steps;
+};
+
+// A record of an entity unincorporated from an IRM domain cluster while
+// transitioning a reference, so that it can be reincorporated into the same
+// cluster.
+struct DomainUndoRecord {
+  Domain* domain;
+  T_item item;
+  int table;
+};
+typedef std::vector<DomainUndoRecord> DomainUndoLog;
+
+// The rows moved by relink_reference, as (relation name, items before the
+// move).
+typedef std::vector<std::pair<std::string, T_items>> MovedRows;
+
+// A record of a reference unincorporated from its entity CRP while
+// transitioning a reference: (*references)[{*ref_field, class_item}] held
+// ref_item, and was incorporated into *crp with id ref_id.
+struct EntityUndoRecord {
+  CRP* crp;
+  std::map<std::pair<std::string, int>, int>* references;
+  const std::string* ref_field;
+  int class_item;
+  int ref_id;
+  int ref_item;
+};
+typedef std::vector<EntityUndoRecord> EntityUndoLog;
+
 class GenDB {
  public:
   GenDB(std::mt19937* prng, const PCleanSchema& schema,
@@ -19,6 +70,19 @@ class GenDB {
   // Return the log probability of the data incorporated into the GenDB so far.
   double logp_score() const;
 
+  // Returns the log probability of held-out rows (maps from query field name
+  // to observed value) without modifying the GenDB. Each row is scored as a
+  // new record: its entity references, the IRM clusters of new entities and
+  // any latent attribute values it depends on are drawn from their predictive
+  // distributions, and the row's probability is estimated by averaging the
+  // likelihood of its observed values over num_samples such draws. Rows are
+  // scored independently of each other, concurrently on the threads of
+  // hirm->thread_pool; the result does not depend on the number of threads.
+  double logp(
+      std::mt19937* prng,
+      const std::vector<std::map<std::string, ObservationVariant>>& rows,
+      int num_samples = 10) const;
+
   // Incorporates a row of observed data into the GenDB instance.
   // When new_rows_have_unique_entities = True, each part of the row is assumed
   // to correspond to a new entity.  In particular, if two entities are added
@@ -45,15 +109,16 @@ class GenDB {
       const std::pair<std::string, int>& ref_key,
       const std::string& ref_class);
 
-  void get_unique_entities_relation(const std::string& rel_name, const int ind,
-                                    const int class_item, T_items& items);
+  // Returns the items of relation rel_name with primary key class_item,
+  // creating a new entity for every reference that isn't populated yet.
+  T_items get_unique_entities_relation(const std::string& rel_name,
+                                       const int class_item);
 
-  // Samples a set of entities in the domains of the relation corresponding to
-  // class_path.
-  T_items sample_entities_relation(
-      std::mt19937* prng, const std::string& class_name,
-      std::vector<std::string>::const_iterator class_path_start,
-      std::vector<std::string>::const_iterator class_path_end, int class_item);
+  // Returns the items of relation rel_name with primary key class_item,
+  // sampling every reference that isn't populated yet from its entity CRP.
+  T_items sample_entities_relation(std::mt19937* prng,
+                                   const std::string& rel_name,
+                                   int class_item);
 
   // Samples and incorporates a value into all relations belonging to class_name
   // (including class attributes and noisy observations of ancestor class
@@ -66,10 +131,10 @@ class GenDB {
   T_items sample_class_ancestors(std::mt19937* prng,
                                  const std::string& class_name, int class_item);
 
-  // Populates "items" with entities by walking the DAG of reference indices,
-  // starting with "ind".
-  void get_relation_items(const std::string& rel_name, const int ind,
-                          const int class_item, T_items& items) const;
+  // Returns the items of relation rel_name with primary key class_item. All
+  // of the references involved must already be populated.
+  T_items get_relation_items(const std::string& rel_name,
+                             const int class_item) const;
 
   // Returns a map of relation name to the indices (in the items vector) where
   // the reference field appears.
@@ -85,8 +150,7 @@ class GenDB {
       std::map<std::string,
                std::unordered_map<T_items, ObservationVariant, H_items>>&
           stored_value_map,
-      std::map<std::tuple<int, std::string, T_item>, int>&
-          unincorporated_from_domains);
+      DomainUndoLog& unincorporated_from_domains);
 
   // Unincorporates and stores items/values from a relation.
   template <typename T>
@@ -147,14 +211,14 @@ class GenDB {
   // unincorporated entities.
   double unincorporate_from_domain_cluster_relation(
       const std::string& r, int item, const int ind,
-      std::map<std::tuple<int, std::string, T_item>, int>& unincorporated);
+      DomainUndoLog& unincorporated);
 
   // Unincorporates reference values from their entity clusters and returns the
   // logp of the unincorporated values.
   double unincorporate_from_entity_cluster(
       const std::string& class_name, const std::string& ref_field,
       const int class_item,
-      std::map<std::tuple<std::string, std::string, int>, int>& unincorporated,
+      EntityUndoLog& unincorporated,
       const bool is_ancestor_reference = true);
 
   // Unincorporates a singleton reference (including, recursively, the
@@ -165,10 +229,8 @@ class GenDB {
       std::map<std::string,
                std::unordered_map<T_items, ObservationVariant, H_items>>&
           stored_value_map,
-      std::map<std::tuple<int, std::string, T_item>, int>&
-          unincorporated_from_domains,
-      std::map<std::tuple<std::string, std::string, int>, int>&
-          unincorporated_from_entity_crps);
+      DomainUndoLog& unincorporated_from_domains,
+      EntityUndoLog& unincorporated_from_entity_crps);
 
   // Reincorporates a newly-sampled reference value before returning from the
   // Gibbs kernel.
@@ -178,10 +240,8 @@ class GenDB {
       std::map<std::string,
                std::unordered_map<T_items, ObservationVariant, H_items>>&
           stored_value_map,
-      std::map<std::tuple<int, std::string, T_item>, int>&
-          unincorporated_from_domains,
-      std::map<std::tuple<std::string, std::string, int>, int>&
-          unincorporated_from_entity_crps);
+      const DomainUndoLog& unincorporated_from_domains,
+      const EntityUndoLog& unincorporated_from_entity_crps);
 
   // Gibbs kernel for transitioning a reference value.
   void transition_reference(std::mt19937* prng, const std::string& class_name,
@@ -191,6 +251,92 @@ class GenDB {
   void transition_reference_class_and_ancestors(std::mt19937* prng,
                                                 const std::string& class_name);
 
+  // Moves class_name.ref_field at class_item to new_refval, an entity whose
+  // attributes are already incorporated. Unlike transition_reference, the
+  // previous entity's attributes stay incorporated even if nothing refers to
+  // it anymore. Entities unincorporated from IRM domain clusters are appended
+  // to removed_from_domains, and the entities in restore_to_domains are put
+  // back into their clusters before the data is reincorporated, so that a move
+  // can be undone exactly by moving back with its log. The rows it moves are
+  // appended to moved_rows, if it isn't null.
+  void relink_reference(std::mt19937* prng, const std::string& class_name,
+                        const std::string& ref_field, const int class_item,
+                        const int new_refval,
+                        DomainUndoLog& removed_from_domains,
+                        const DomainUndoLog& restore_to_domains,
+                        MovedRows* moved_rows = nullptr);
+
+  // The first half of relink_reference: unincorporates the rows of
+  // class_name.ref_field at class_item and points the reference at
+  // new_refval, and returns the rows with their new items, to be passed to
+  // incorporate_reference.
+  std::map<std::string,
+           std::unordered_map<T_items, ObservationVariant, H_items>>
+  unlink_reference(const std::string& class_name, const std::string& ref_field,
+                   const int class_item, const int new_refval,
+                   DomainUndoLog& removed_from_domains,
+                   MovedRows* moved_rows = nullptr);
+
+  // Unincorporates the entities of moved_rows that are still in an IRM domain
+  // cluster but have no observations left in that IRM, appending them to
+  // unincorporated. Moving a reference changes the items of the relations
+  // below it, so it can leave entities other than the previous reference
+  // value without observations. The entities of kept_rows are left in their
+  // clusters, if it isn't null.
+  void unincorporate_unobserved_entities(const MovedRows& moved_rows,
+                                         DomainUndoLog& unincorporated,
+                                         const MovedRows* kept_rows = nullptr);
+
+  // Returns the relations whose rows move when class_name.ref_field is
+  // relinked: those of get_domain_inds and, recursively, their base relations.
+  std::set<std::string> relinked_relations(const std::string& class_name,
+                                           const std::string& ref_field);
+
+  // Returns the part of logp_score that depends on the rows of rel_names and
+  // on the references to ref_class: the scores of the relations, the CRPs of
+  // their IRM domains, and entity_crps.at(ref_class).
+  double logp_score_relations(const std::set<std::string>& rel_names,
+                              const std::string& ref_class) const;
+
+  // Returns the sum of the scores of the CRPs of the IRM domains of
+  // rel_names.
+  double logp_score_domains(const std::set<std::string>& rel_names) const;
+
+  // Returns an unused entity id for class_name.
+  int new_entity_id(const std::string& class_name) const;
+
+  // Samples and incorporates the references and attributes of a new entity of
+  // class_name that nothing refers to yet.
+  void sample_and_incorporate_entity(std::mt19937* prng,
+                                     const std::string& class_name,
+                                     const int entity);
+
+  // Unincorporates the references and attributes of an entity of class_name
+  // that nothing refers to. Entities that are left without references as a
+  // result are unincorporated as well.
+  void unincorporate_entity(const std::string& class_name, const int entity);
+
+  // Split-merge Metropolis-Hastings kernel over the entities of ref_class.
+  // Picks two references to ref_class at random. If they point to the same
+  // entity, proposes moving the second one, and each of the entity's other
+  // references with probability 1/2, to a new entity whose attributes are
+  // sampled from the model; otherwise, proposes moving all references of the
+  // second entity to the first. Only the relations along the moved references
+  // and the entity CRP of ref_class are scored, and only the entities of the
+  // moved rows are checked for lost observations. The relation clusters and
+  // IRM domain entities that the moves empty are kept or logged until the
+  // decision, so a rejected proposal leaves the GenDB exactly as it was.
+  // The moves first unlink every moved reference and remove the entities
+  // left without observations from their IRM domains, and then incorporate
+  // the moved rows, drawing IRM domain clusters for the entities that enter
+  // a domain. The draws of the proposal and of its reverse are part of the
+  // proposal density. Returns true if the proposal was accepted.
+  bool transition_split_merge(std::mt19937* prng, const std::string& ref_class);
+
+  // Runs num_proposals split-merge proposals for every class that is
+  // referenced by another class.
+  void transition_split_merge_all(std::mt19937* prng, int num_proposals);
+
   ~GenDB();
 
   // Disable copying.
@@ -221,6 +367,22 @@ class GenDB {
   // depends on.
   void compute_reference_indices_for(const std::string& name);
 
+  // Compile relation_plans and class_plans. Must be called after the
+  // reference indices caches and the HIRM schema are populated.
+  void compute_reference_plans();
+
+  // Returns the ReferencePlan for items with the given domains, whose
+  // reference fields are described by ref_indices (which may be null).
+  ReferencePlan make_reference_plan(
+      const std::vector<std::string>& plan_domains,
+      const std::map<int, std::map<std::string, int>>* ref_indices);
+
+  // Fills the items of plan for primary key class_item. References that
+  // aren't populated yet are given a new entity if new_entities is true, and
+  // are otherwise sampled from their entity CRP.
+  T_items walk_reference_plan(std::mt19937* prng, const ReferencePlan& plan,
+                              int class_item, bool new_entities);
+
   // Make the relations associated with QueryField f and put them into
   // schema.
   void make_relations_for_queryfield(const QueryField& f,
@@ -261,4 +423,17 @@ class GenDB {
   // class. (See tests for more intuition.)
   std::map<std::string, std::map<int, std::map<std::string, int>>>
       class_reference_indices;
+
+  // Undo logs for transition_reference. domain_undo_logs[i] holds the
+  // entities unincorporated from IRM domain clusters for the i-th candidate
+  // reference value, and entity_undo_log holds the references unincorporated
+  // from entity CRPs. The logs are cleared, keeping their storage, at the
+  // start of every transition.
+  std::vector<DomainUndoLog> domain_undo_logs;
+  EntityUndoLog entity_undo_log;
+
+  // relation_reference_indices and class_reference_indices, compiled into
+  // ReferencePlans keyed by relation and class name respectively.
+  std::unordered_map<std::string, ReferencePlan> relation_plans;
+  std::unordered_map<std::string, ReferencePlan> class_plans;
 };
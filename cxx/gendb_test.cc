@@ -9,6 +9,7 @@
 #include <iostream>
 
 #include "pclean/io.hh"
+#include "util_math.hh"
 
 namespace tt = boost::test_tools;
 
@@ -108,8 +109,7 @@ void test_unincorporate_reference_helper(GenDB& gendb,
   std::map<std::string,
            std::unordered_map<T_items, ObservationVariant, H_items>>
       stored_value_map;
-  std::map<std::tuple<int, std::string, T_item>, int>
-      unincorporated_from_domains;
+  DomainUndoLog unincorporated_from_domains;
   gendb.unincorporate_reference(domain_inds, class_name, ref_field, class_item,
                                 stored_value_map, unincorporated_from_domains);
 
@@ -300,9 +300,7 @@ BOOST_AUTO_TEST_CASE(test_get_relation_items) {
       auto data = rel->get_data();
       for (auto [items, unused_value] : data) {
         size_t num_domains = rel->get_domains().size();
-        T_items expected_items(num_domains);
-        gendb.get_relation_items(name, num_domains - 1, items.back(),
-                                 expected_items);
+        T_items expected_items = gendb.get_relation_items(name, items.back());
         BOOST_TEST(items.size() == expected_items.size());
         for (size_t i = 0; i < num_domains; ++i) {
           BOOST_TEST(items[i] == expected_items[i]);
@@ -341,6 +339,81 @@ BOOST_AUTO_TEST_CASE(test_logp_score) {
   BOOST_TEST(gendb.logp_score() < 0.0);
 }
 
+BOOST_AUTO_TEST_CASE(test_logp_heldout) {
+  std::mt19937 prng;
+  GenDB gendb(&prng, schema);
+  setup_gendb(&prng, gendb);
+
+  double logp_score = gendb.logp_score();
+  std::map<std::string, int> num_references;
+  for (const auto& [class_name, refs] : gendb.reference_values) {
+    num_references[class_name] = refs.size();
+  }
+
+  std::vector<std::map<std::string, ObservationVariant>> rows = {
+      {{"Specialty", "Family Med"},
+       {"School", 0.5},
+       {"Degree", "PHD"},
+       {"City", -0.3},
+       {"State", 1.2}},
+      {{"Degree", "MD"}, {"City", 0.1}}};
+  std::mt19937 prng_copy = prng;
+  double logp = gendb.logp(&prng, rows);
+  BOOST_TEST(std::isfinite(logp));
+
+  // The rows are scored the same way on several threads.
+  gendb.hirm->set_num_threads(3);
+  BOOST_TEST(gendb.logp(&prng_copy, rows) == logp);
+
+  // The GenDB is unchanged.
+  BOOST_TEST(gendb.logp_score() == logp_score);
+  for (const auto& [class_name, refs] : gendb.reference_values) {
+    BOOST_TEST(std::ssize(refs) == num_references.at(class_name));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_logp_heldout_matches_incorporate) {
+  std::stringstream ss(R"""(
+class Record
+  x ~ real
+
+observe
+  x as X
+  from Record
+)""");
+  PCleanSchema schema;
+  [[maybe_unused]] bool ok = read_schema(ss, &schema);
+  assert(ok);
+  std::mt19937 prng;
+  GenDB gendb(&prng, schema);
+  std::normal_distribution<double> d(0., 1.);
+  for (int i = 0; i < 20; ++i) {
+    std::map<std::string, ObservationVariant> obs = {
+        {"X", d(prng) + (i % 2 ? 3.0 : -3.0)}};
+    gendb.incorporate(&prng, {i, obs}, true);
+  }
+  std::map<std::string, ObservationVariant> row = {{"X", 0.5}};
+  double logp = gendb.logp(&prng, {row}, 20000);
+
+  // The only latent state the row depends on is the cluster of its record,
+  // so its exact log probability is the logsumexp, over the tables that the
+  // record could join, of the change in logp_score from incorporating the row
+  // at that table.
+  Relation<double>* rel =
+      std::get<Relation<double>*>(gendb.hirm->get_relation("X"));
+  const std::string& d_name = rel->get_domains()[0]->name;
+  IRM* irm = gendb.hirm->relation_to_irm("X");
+  std::map<int, double> tables = irm->domains.at(d_name)->tables_weights();
+  double baseline_logp = gendb.logp_score();
+  gendb.incorporate(&prng, {20, row}, true);
+  std::vector<double> table_logps;
+  for (const auto& [table, unused_weight] : tables) {
+    irm->set_cluster_assignment_item(&prng, d_name, 20, table);
+    table_logps.push_back(gendb.logp_score() - baseline_logp);
+  }
+  BOOST_TEST(logp == logsumexp(table_logps), tt::tolerance(1e-2));
+}
+
 BOOST_AUTO_TEST_CASE(test_update_reference_items) {
   std::mt19937 prng;
   GenDB gendb(&prng, schema);
@@ -358,8 +431,7 @@ BOOST_AUTO_TEST_CASE(test_update_reference_items) {
   std::map<std::string,
            std::unordered_map<T_items, ObservationVariant, H_items>>
       stored_value_map;
-  std::map<std::tuple<int, std::string, T_item>, int>
-      unincorporated_from_domains;
+  DomainUndoLog unincorporated_from_domains;
   gendb.unincorporate_reference(domain_inds, class_name, ref_field, class_item,
                                 stored_value_map, unincorporated_from_domains);
   BOOST_TEST(stored_value_map.size() > 0);
@@ -760,8 +832,7 @@ BOOST_AUTO_TEST_CASE(test_incorporate_stored_items) {
       stored_value_map;
   std::map<std::string, std::vector<size_t>> domain_inds =
       gendb.get_domain_inds(class_name, ref_field);
-  std::map<std::tuple<int, std::string, T_item>, int>
-      unincorporated_from_domains;
+  DomainUndoLog unincorporated_from_domains;
 
   gendb.unincorporate_reference(domain_inds, class_name, ref_field, class_item,
                                 stored_value_map, unincorporated_from_domains);
@@ -839,10 +910,8 @@ BOOST_AUTO_TEST_CASE(test_unincorporate_reincorporate_existing) {
   std::map<std::string,
            std::unordered_map<T_items, ObservationVariant, H_items>>
       stored_values;
-  std::map<std::tuple<int, std::string, T_item>, int>
-      unincorporated_from_domains;
-  std::map<std::tuple<std::string, std::string, int>, int>
-      unincorporated_from_entity_crps;
+  DomainUndoLog unincorporated_from_domains;
+  EntityUndoLog unincorporated_from_entity_crps;
   gendb.unincorporate_reference(domain_inds, class_name, ref_field, class_item,
                                 stored_values, unincorporated_from_domains);
   int ref_id = gendb.get_reference_id(class_name, ref_field, class_item);
@@ -914,20 +983,18 @@ BOOST_AUTO_TEST_CASE(test_unincorporate_reincorporate_new) {
     }
   }
   assert(refval != -1);
-
-  double init_logp = gendb.logp_score();
+  size_t non_singleton_size =
+      gendb.entity_crps.at(ref_class).tables.at(non_singleton_refval).size();
 
   auto domain_inds = gendb.get_domain_inds(class_name, ref_field);
   std::map<std::string,
            std::unordered_map<T_items, ObservationVariant, H_items>>
       stored_values;
-  std::map<std::tuple<int, std::string, T_item>, int>
-      unincorporated_from_domains;
+  DomainUndoLog unincorporated_from_domains;
   std::map<std::string,
            std::unordered_map<T_items, ObservationVariant, H_items>>
       ref_class_relation_stored_values;
-  std::map<std::tuple<std::string, std::string, int>, int>
-      unincorporated_from_entity_crps;
+  EntityUndoLog unincorporated_from_entity_crps;
   int ref_id = gendb.get_reference_id(class_name, ref_field, class_item);
   gendb.entity_crps.at(ref_class).unincorporate(ref_id);
   gendb.unincorporate_reference(domain_inds, class_name, ref_field, class_item,
@@ -937,8 +1004,6 @@ BOOST_AUTO_TEST_CASE(test_unincorporate_reincorporate_new) {
                                 unincorporated_from_domains,
                                 unincorporated_from_entity_crps);
 
-  double baseline_logp = gendb.logp_score();
-
   // The entity CRP doesn't contain the reference value.
   BOOST_TEST(!gendb.entity_crps.at(ref_class).tables.contains(refval));
 
@@ -954,9 +1019,14 @@ BOOST_AUTO_TEST_CASE(test_unincorporate_reincorporate_new) {
   gendb.reincorporate_new_refval(
       class_name, ref_field, class_item, refval, ref_class, stored_values,
       unincorporated_from_domains, unincorporated_from_entity_crps);
-  // Logp score should be different.
-  BOOST_TEST(gendb.logp_score() - baseline_logp != init_logp - baseline_logp,
-             tt::tolerance(1e-3));
+  // The reference now points to the new singleton entity.
+  BOOST_TEST(gendb.reference_values.at(class_name).at({ref_field, class_item}) ==
+             refval);
+  BOOST_TEST(gendb.entity_crps.at(ref_class).assignments.at(ref_id) == refval);
+  BOOST_TEST(gendb.entity_crps.at(ref_class).tables.at(refval).size() == 1);
+  BOOST_TEST(
+      gendb.entity_crps.at(ref_class).tables.at(non_singleton_refval).size() ==
+      non_singleton_size - 1);
 }
 
 BOOST_AUTO_TEST_CASE(test_transition_reference_class) {
@@ -984,6 +1054,115 @@ BOOST_AUTO_TEST_CASE(test_transition_reference_class) {
   BOOST_TEST(!is_same);
 }
 
+BOOST_AUTO_TEST_CASE(test_transition_split_merge) {
+  std::mt19937 prng;
+  GenDB gendb(&prng, schema);
+  setup_gendb(&prng, gendb, 20);
+
+  int num_accepted = 0;
+  for (int i = 0; i < 50; ++i) {
+    for (const std::string ref_class : {"Physician", "Practice", "City"}) {
+      num_accepted += gendb.transition_split_merge(&prng, ref_class);
+    }
+  }
+  BOOST_TEST(num_accepted > 0);
+
+  // Every reference points to an entity with a CRP table, and every entity
+  // CRP seats exactly the references to its class.
+  std::map<std::string, int> num_references;
+  for (const auto& [class_name, refs] : gendb.reference_values) {
+    for (const auto& [key, ref_val] : refs) {
+      const std::string& ref_class =
+          std::get<ClassVar>(
+              gendb.schema.classes.at(class_name).vars.at(key.first).spec)
+              .class_name;
+      BOOST_TEST(gendb.entity_crps.at(ref_class).tables.contains(ref_val));
+      ++num_references[ref_class];
+    }
+  }
+  for (const auto& [class_name, crp] : gendb.entity_crps) {
+    BOOST_TEST(crp.N == num_references[class_name]);
+  }
+
+  // Every entity in an IRM domain has observations in that IRM, so the
+  // domain clusters drawn by the proposals are only kept with their rows.
+  for (const auto& [unused_id, irm] : gendb.hirm->irms) {
+    for (const auto& [d, domain] : irm->domains) {
+      for (const T_item item : domain->items) {
+        BOOST_TEST(irm->has_observation(d, item));
+      }
+    }
+  }
+
+  // The relation data is keyed by the current references, and no attributes
+  // of unreferenced entities are left behind.
+  for (const auto& [rel_name, trel] : gendb.hirm->schema) {
+    const std::string& class_name =
+        std::visit([&](auto tr) { return tr.domains.back(); }, trel);
+    std::visit(
+        [&](auto rel) {
+          for (const auto& [items, unused_value] : rel->get_data()) {
+            BOOST_TEST(gendb.get_relation_items(rel_name, items.back()) ==
+                       items);
+            if (class_name != "Record") {
+              BOOST_TEST(gendb.entity_crps.at(class_name).tables.contains(
+                  items.back()));
+            }
+          }
+        },
+        gendb.hirm->get_relation(rel_name));
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_transition_split_merge_rejected) {
+  // Two references to the same class, and string attributes observed through
+  // bigram emissions.
+  std::stringstream ss_flights(R"""(
+class Time
+  time ~ string(maxlength=20)
+
+class Flight
+  sdt ~ Time
+  adt ~ Time
+
+class Obs
+  flight ~ Flight
+
+observe
+  flight.sdt.time as sched_dep_time
+  flight.adt.time as act_dep_time
+  from Obs
+)""");
+  PCleanSchema flights_schema;
+  [[maybe_unused]] bool ok = read_schema(ss_flights, &flights_schema);
+  assert(ok);
+
+  std::mt19937 prng;
+  GenDB gendb(&prng, flights_schema);
+  std::vector<std::string> times = {"7:10 a.m.", "7:10 am", "7:15 a.m.",
+                                    "8:05 p.m.", "8:05 pm", "8:50 p.m."};
+  std::uniform_int_distribution<size_t> pick(0, times.size() - 1);
+  for (int i = 0; i < 40; ++i) {
+    std::map<std::string, ObservationVariant> obs = {
+        {"sched_dep_time", times[pick(prng)]},
+        {"act_dep_time", times[pick(prng)]}};
+    gendb.incorporate(&prng, {i, obs}, true);
+  }
+
+  // A rejected proposal leaves the model exactly as it was.
+  int num_rejected = 0;
+  for (int i = 0; i < 30; ++i) {
+    for (const std::string ref_class : {"Flight", "Time"}) {
+      double logp_before = gendb.logp_score();
+      if (!gendb.transition_split_merge(&prng, ref_class)) {
+        ++num_rejected;
+        BOOST_TEST(gendb.logp_score() == logp_before, tt::tolerance(1e-12));
+      }
+    }
+  }
+  BOOST_TEST(num_rejected > 0);
+}
+
 BOOST_AUTO_TEST_CASE(test_transition_reference_complex_schema) {
   std::stringstream ss_complex(R"""(
 class A
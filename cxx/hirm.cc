@@ -112,6 +112,7 @@ void HIRM::transition_cluster_assignment_relation(std::mt19937* prng,
     IRM* irm;
     if (!irms.contains(table)) {
       irm = new IRM({});
+      irm->thread_pool = thread_pool;
       assert(table_aux == nullptr);
       assert(irm_aux == nullptr);
       table_aux = (int*)malloc(sizeof(*table_aux));
@@ -213,6 +214,7 @@ void HIRM::set_cluster_assignment_gibbs(std::mt19937* prng,
     // Add to target IRM.
     if (!irms.contains(table)) {
       irm = new IRM({});
+      irm->thread_pool = thread_pool;
       irms[table] = irm;
     }
     irm = irms.at(table);
@@ -248,6 +250,7 @@ void HIRM::add_relation(std::mt19937* prng, const std::string& name,
   crp.incorporate(rc, table);
   if (!irms.contains(table)) {
     irms[table] = new IRM({});
+    irms.at(table)->thread_pool = thread_pool;
   }
   std::visit(
       [&](const auto& trel) {
@@ -298,13 +301,29 @@ void HIRM::transition_latent_values_relation(std::mt19937* prng,
       noisy_rels[name] = reinterpret_cast<NoisyRelation<T>*>(
           std::get<Relation<T>*>(get_relation(name)));
     }
+    std::vector<T_items> base_items_list;
     for (const auto& [items, value] : base_rel->get_data()) {
-      transition_latent_value(prng, items, base_rel, noisy_rels);
+      base_items_list.push_back(items);
+    }
+    std::sort(base_items_list.begin(), base_items_list.end());
+    transition_latent_values(prng, base_items_list, base_rel, noisy_rels,
+                             thread_pool.get(), latent_value_proposal_options);
+    // Once the values are chosen, the emissions needn't keep what they would
+    // need to incorporate the other candidates again.
+    for (const auto& [name, noisy_rel] : noisy_rels) {
+      noisy_rel->cleanup_clusters();
     }
   };
   std::visit(transition_values, get_relation(r));
 }
 
+void HIRM::set_num_threads(int num_threads) {
+  thread_pool = std::make_shared<ThreadPool>(num_threads);
+  for (auto& [table, irm] : irms) {
+    irm->thread_pool = thread_pool;
+  }
+}
+
 double HIRM::logp(
     const std::vector<std::tuple<std::string, T_items, ObservationVariant>>&
         observations,
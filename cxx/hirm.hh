@@ -4,6 +4,7 @@
 #pragma once
 #include <functional>
 #include <map>
+#include <memory>
 #include <unordered_map>
 #include <unordered_set>
 #include <variant>
@@ -26,6 +27,10 @@ class HIRM {
       base_to_noisy_relations;  // map from relation to the noisy relation that
                                 // has it as a base
   CRP crp;                      // clustering model for relations
+  // candidates proposed by transition_latent_values_relation
+  LatentValueProposalOptions latent_value_proposal_options;
+  // threads used by transition_latent_values_relation, shared with irms
+  std::shared_ptr<ThreadPool> thread_pool = std::make_shared<ThreadPool>(1);
 
   HIRM(const T_schema& schema, std::mt19937* prng);
 
@@ -46,10 +51,16 @@ class HIRM {
                                               const std::string& r);
 
   // Updates the latent values contained in relation `r` using Gibbs sampling.
-  // `r` must be the base relation of at least one noisy relation.
+  // `r` must be the base relation of at least one noisy relation.  Values
+  // whose clusters are disjoint are updated concurrently on the threads of
+  // thread_pool; the result does not depend on their number.
   void transition_latent_values_relation(std::mt19937* prng,
                                          const std::string& r);
 
+  // Replaces thread_pool, and that of every IRM, with one of num_threads
+  // threads.
+  void set_num_threads(int num_threads);
+
   void set_cluster_assignment_gibbs(std::mt19937* prng, const std::string& r,
                                     int table);
   void update_base_relation(const std::string& r);
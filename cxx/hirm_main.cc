@@ -24,6 +24,9 @@ int main(int argc, char** argv) {
       cxxopts::value<bool>()->default_value("false"))(
       "timeout", "number of seconds of inference",
       cxxopts::value<int>()->default_value("0"))(
+      "split_merge_proposals",
+      "number of split-merge proposals per domain per iteration",
+      cxxopts::value<int>()->default_value("0"))(
       "samples", "number of samples to write to disk",
       cxxopts::value<int>()->default_value("0"))(
       "load", "path to .[h]irm file with initial clusters",
@@ -50,6 +53,7 @@ int main(int argc, char** argv) {
   int seed = result["seed"].as<int>();
   int iters = result["iters"].as<int>();
   int timeout = result["timeout"].as<int>();
+  int split_merge_proposals = result["split_merge_proposals"].as<int>();
   bool verbose = result["verbose"].as<bool>();
   int num_samples = result["samples"].as<int>();
   std::string path_clusters = result["load"].as<std::string>();
@@ -104,7 +108,7 @@ int main(int argc, char** argv) {
     // Infer
     std::cout << "inferring " << iters << " iters; timeout " << timeout
               << std::endl;
-    inference_irm(&prng, irm, iters, timeout, verbose);
+    inference_irm(&prng, irm, iters, timeout, verbose, split_merge_proposals);
     // Save
     path_save += ".irm";
     std::cout << "saving to " << path_save << std::endl;
@@ -140,7 +144,8 @@ int main(int argc, char** argv) {
     // Infer
     std::cout << "inferring " << iters << " iters; timeout " << timeout
               << std::endl;
-    inference_hirm(&prng, hirm, iters, timeout, verbose);
+    inference_hirm(&prng, hirm, iters, timeout, verbose,
+                   split_merge_proposals);
     // Save
     path_save += ".hirm";
     std::cout << "saving to " << path_save << std::endl;
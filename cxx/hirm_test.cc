@@ -6,8 +6,10 @@
 
 #include <boost/test/included/unit_test.hpp>
 #include <random>
+#include <set>
 
 #include "distributions/get_distribution.hh"
+#include "emissions/bigram_string.hh"
 
 namespace tt = boost::test_tools;
 
@@ -122,3 +124,38 @@ BOOST_AUTO_TEST_CASE(test_hirm_relation_names) {
   HIRM hirm(schema1, &prng);
   hirm.transition_cluster_assignments_all(&prng);
 }
+
+BOOST_AUTO_TEST_CASE(test_transition_latent_values_forgets_candidates) {
+  std::mt19937 prng;
+  std::map<std::string, T_relation> schema1{
+      {"a", T_noisy_relation{{"D1", "D2"}, true, EmissionSpec("bigram"), "b"}},
+      {"b", T_clean_relation{{"D1"}, false, DistributionSpec("bigram")}}};
+  HIRM hirm(schema1, &prng);
+  std::vector<std::string> words = {"hello", "helo", "hallo", "world", "wrld"};
+  for (int i = 0; i < 4; ++i) {
+    hirm.incorporate(&prng, "b", {i}, words[i]);
+    for (int j = 0; j < 3; ++j) {
+      hirm.incorporate(&prng, "a", {i, j}, words[(i + j) % words.size()]);
+    }
+  }
+  for (int i = 0; i < 3; ++i) {
+    hirm.transition_latent_values_relation(&prng, "b");
+  }
+
+  // Each emission keeps the deltas of the pairs it has incorporated, and
+  // nothing for the values that were replaced.
+  auto noisy_rel = reinterpret_cast<NoisyRelation<std::string>*>(
+      std::get<Relation<std::string>*>(hirm.get_relation("a")));
+  const auto& emission_relation = noisy_rel->emission_relation;
+  std::unordered_map<std::vector<int>,
+                     std::set<std::pair<std::string, std::string>>,
+                     VectorIntHash>
+      pairs;
+  for (const auto& [items, x] : emission_relation.data) {
+    pairs[emission_relation.get_cluster_assignment(items)].insert(x);
+  }
+  for (const auto& [z, cluster] : emission_relation.clusters) {
+    auto bse = reinterpret_cast<BigramStringEmission*>(cluster);
+    BOOST_TEST(bse->incorporated_deltas.size() == pairs.at(z).size());
+  }
+}
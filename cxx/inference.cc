@@ -29,19 +29,20 @@
   }
 
 void inference_irm(std::mt19937* prng, IRM* irm, int iters, int timeout,
-                   bool verbose) {
+                   bool verbose, int split_merge_proposals) {
   clock_t t_begin = clock();
   double t_total = 0;
   for (int i = 0; i < iters; ++i) {
     printf("Starting iteration %d, model score = %f\n", i + 1,
            irm->logp_score());
     CHECK_TIMEOUT(timeout, t_begin);
-    single_step_irm_inference(prng, irm, t_total, verbose, 10, true);
+    single_step_irm_inference(prng, irm, t_total, verbose, 10, true,
+                              split_merge_proposals);
   }
 }
 
 void inference_hirm(std::mt19937* prng, HIRM* hirm, int iters, int timeout,
-                    bool verbose) {
+                    bool verbose, int split_merge_proposals) {
   clock_t t_begin = clock();
   double t_total = 0;
   for (int i = 0; i < iters; ++i) {
@@ -65,14 +66,15 @@ void inference_hirm(std::mt19937* prng, HIRM* hirm, int iters, int timeout,
     }
     // TRANSITION IRMs.
     for (const auto& [t, irm] : hirm->irms) {
-      single_step_irm_inference(prng, irm, t_total, verbose, 10, false);
+      single_step_irm_inference(prng, irm, t_total, verbose, 10, false,
+                                split_merge_proposals);
     }
   }
 }
 
 void inference_gendb(std::mt19937* prng, GenDB* gendb, int iters,
                      int hirm_iters_per_entity_iter, int timeout,
-                     bool verbose) {
+                     bool verbose, int split_merge_proposals) {
   clock_t t_begin = clock();
   for (int i = 0; i < iters; ++i) {
     // TRANSITION HIRM
@@ -84,6 +86,7 @@ void inference_gendb(std::mt19937* prng, GenDB* gendb, int iters,
     // TRANSITION ENTITIES
     gendb->transition_reference_class_and_ancestors(
         prng, gendb->schema.query.record_class);
+    gendb->transition_split_merge_all(prng, split_merge_proposals);
     CHECK_TIMEOUT(timeout, t_begin);
   }
 }
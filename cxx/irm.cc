@@ -3,6 +3,8 @@
 
 #include "irm.hh"
 
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <ctime>
@@ -10,9 +12,37 @@
 #include <set>
 #include <variant>
 
+#include "distributions/beta_bernoulli.hh"
+#include "distributions/bigram.hh"
+#include "distributions/dirichlet_categorical.hh"
+#include "distributions/normal.hh"
+#include "distributions/skellam.hh"
+#include "distributions/string_nat.hh"
+#include "distributions/stringcat.hh"
+
 RelationVariant clean_relation_from_spec(const std::string& name,
                                          const DistributionSpec& spec,
                                          const std::vector<Domain*>& doms) {
+  // Distributions with a make_prior get a CleanRelation that stores its
+  // clusters by value as that class.
+  switch (spec.distribution) {
+    case DistributionEnum::bernoulli:
+      return new CleanRelation<bool, BetaBernoulli>(name, spec, doms);
+    case DistributionEnum::bigram:
+      return new CleanRelation<std::string, Bigram>(name, spec, doms);
+    case DistributionEnum::categorical:
+      return new CleanRelation<int, DirichletCategorical>(name, spec, doms);
+    case DistributionEnum::normal:
+      return new CleanRelation<double, Normal>(name, spec, doms);
+    case DistributionEnum::skellam:
+      return new CleanRelation<int, Skellam>(name, spec, doms);
+    case DistributionEnum::stringcat:
+      return new CleanRelation<std::string, StringCat>(name, spec, doms);
+    case DistributionEnum::string_nat:
+      return new CleanRelation<std::string, StringNat>(name, spec, doms);
+    default:
+      break;
+  }
   switch (spec.observation_type) {
     case ObservationEnum::bool_type:
       return new CleanRelation<bool>(name, spec, doms);
@@ -149,16 +179,163 @@ void IRM::transition_cluster_assignment_item(std::mt19937* prng,
   T_item choice = tables[idx];
   // Move to new table (if necessary).
   if (choice != domain->get_cluster_assignment(item)) {
-    auto set_cluster_r = [&](auto rel) {
+    set_cluster_assignment_item(prng, d, item, choice);
+  }
+}
+
+void IRM::set_cluster_assignment_item(std::mt19937* prng, const std::string& d,
+                                      const T_item& item, int table,
+                                      bool keep_empty_clusters) {
+  Domain* domain = domains.at(d);
+  auto set_cluster_r = [&](auto rel) {
+    if (rel->has_observation(*domain, item)) {
+      rel->set_cluster_assignment_gibbs(*domain, item, table, prng,
+                                        keep_empty_clusters);
+    }
+  };
+  for (const std::string& r : domain_to_relations.at(d)) {
+    std::visit(set_cluster_r, relations.at(r));
+  }
+  domain->set_cluster_assignment_gibbs(item, table);
+}
+
+double IRM::logp_score_domain(const std::string& d) const {
+  double logp = domains.at(d)->crp.logp_score();
+  for (const std::string& r : domain_to_relations.at(d)) {
+    logp += std::visit([](auto rel) { return rel->logp_score(); },
+                       relations.at(r));
+  }
+  return logp;
+}
+
+bool IRM::transition_split_merge(std::mt19937* prng, const std::string& d) {
+  Domain* domain = domains.at(d);
+  if (domain->items.size() < 2) {
+    return false;
+  }
+  std::vector<T_item> items(domain->items.begin(), domain->items.end());
+  std::uniform_int_distribution<size_t> pick(0, items.size() - 1);
+  size_t i1 = pick(*prng);
+  size_t i2 = pick(*prng);
+  while (i2 == i1) {
+    i2 = pick(*prng);
+  }
+  const T_item anchor1 = items[i1];
+  const T_item anchor2 = items[i2];
+  const int table1 = domain->get_cluster_assignment(anchor1);
+  const int table2 = domain->get_cluster_assignment(anchor2);
+  const bool is_split = table1 == table2;
+
+  // The relation clusters emptied by the moves are kept until the proposal is
+  // accepted or rejected, so that the restricted Gibbs scan below scores
+  // against them and a rejected proposal moves the data back into the same
+  // clusters, with the same hyperparameters and latent values.
+  auto move = [&](const T_item& item, int table) {
+    set_cluster_assignment_item(prng, d, item, table, true);
+  };
+  auto cleanup = [&]() {
+    for (const std::string& r : domain_to_relations.at(d)) {
+      std::visit([](auto rel) { rel->cleanup_clusters(); }, relations.at(r));
+    }
+  };
+
+  // Returns the log probability that the restricted Gibbs allocation puts item
+  // (currently at table1) at target (table1 or table_new), given the items
+  // allocated so far, and moves it there.
+  auto allocate = [&](const T_item& item, int table_new, bool sample,
+                      int target) {
+    std::vector<int> tables = {table1, table_new};
+    std::vector<double> logps = {log(domain->crp.tables.at(table1).size() - 1),
+                                 log(domain->crp.tables.at(table_new).size())};
+    auto accumulate_logps = [&](auto rel) {
       if (rel->has_observation(*domain, item)) {
-        rel->set_cluster_assignment_gibbs(*domain, item, choice, prng);
+        std::vector<double> lp_relation =
+            rel->logp_gibbs_exact(*domain, item, tables, prng);
+        logps[0] += lp_relation[0];
+        logps[1] += lp_relation[1];
       }
     };
     for (const std::string& r : domain_to_relations.at(d)) {
-      std::visit(set_cluster_r, relations.at(r));
+      std::visit(accumulate_logps, relations.at(r));
+    }
+    int idx = sample ? log_choice(logps, prng) : (target == table1 ? 0 : 1);
+    if (idx == 1) {
+      move(item, table_new);
     }
-    domain->set_cluster_assignment_gibbs(item, choice);
+    return logps[idx] - logsumexp(logps);
+  };
+
+  // The items other than the anchors, allocated in a random order. The order
+  // is drawn uniformly in both directions, so it cancels in the acceptance
+  // ratio.
+  std::vector<T_item> others;
+  for (const T_item& item : domain->crp.tables.at(table1)) {
+    if (item != anchor1 && item != anchor2) {
+      others.push_back(item);
+    }
+  }
+  if (!is_split) {
+    for (const T_item& item : domain->crp.tables.at(table2)) {
+      if (item != anchor2) {
+        others.push_back(item);
+      }
+    }
+  }
+  std::shuffle(others.begin(), others.end(), *prng);
+
+  double logp_before = logp_score_domain(d);
+  double log_q_split = 0.;
+  std::uniform_real_distribution<double> u(0., 1.);
+  if (is_split) {
+    int table_new = domain->crp.max_table() + 1;
+    move(anchor2, table_new);
+    for (const T_item& item : others) {
+      log_q_split += allocate(item, table_new, true, -1);
+    }
+    double logp_after = logp_score_domain(d);
+    bool accept = log(u(*prng)) < logp_after - logp_before - log_q_split;
+    if (!accept) {
+      std::vector<T_item> moved(domain->crp.tables.at(table_new).begin(),
+                                domain->crp.tables.at(table_new).end());
+      for (const T_item& item : moved) {
+        move(item, table1);
+      }
+    }
+    cleanup();
+    return accept;
+  }
+
+  // Compute the probability of the split that recovers the current state by
+  // replaying its allocation, then merge.  The replay starts anchor2 at a new
+  // table, as the split does, so its items are scored against new clusters
+  // drawn from the prior.  The clusters of table2 are emptied but kept, and
+  // are only used to restore the current state if the merge is rejected.
+  std::vector<T_item> moved(domain->crp.tables.at(table2).begin(),
+                            domain->crp.tables.at(table2).end());
+  int table_new = domain->crp.max_table() + 1;
+  for (const T_item& item : moved) {
+    if (item != anchor2) {
+      move(item, table1);
+    }
+  }
+  move(anchor2, table_new);
+  std::unordered_set<T_item> in_table2(moved.begin(), moved.end());
+  for (const T_item& item : others) {
+    log_q_split += allocate(item, table_new, false,
+                            in_table2.contains(item) ? table_new : table1);
   }
+  for (const T_item& item : moved) {
+    move(item, table1);
+  }
+  double logp_after = logp_score_domain(d);
+  bool accept = log(u(*prng)) < logp_after - logp_before + log_q_split;
+  if (!accept) {
+    for (const T_item& item : moved) {
+      move(item, table2);
+    }
+  }
+  cleanup();
+  return accept;
 }
 
 void IRM::transition_latent_values_relation(std::mt19937* prng,
@@ -171,13 +348,26 @@ void IRM::transition_latent_values_relation(std::mt19937* prng,
       noisy_rels[name] = reinterpret_cast<NoisyRelation<T>*>(
           std::get<Relation<T>*>(relations.at(name)));
     }
+    std::vector<T_items> base_items_list;
     for (const auto& [items, value] : base_rel->get_data()) {
-      transition_latent_value(prng, items, base_rel, noisy_rels);
+      base_items_list.push_back(items);
+    }
+    std::sort(base_items_list.begin(), base_items_list.end());
+    transition_latent_values(prng, base_items_list, base_rel, noisy_rels,
+                             thread_pool.get(), latent_value_proposal_options);
+    // Once the values are chosen, the emissions needn't keep what they would
+    // need to incorporate the other candidates again.
+    for (const auto& [name, noisy_rel] : noisy_rels) {
+      noisy_rel->cleanup_clusters();
     }
   };
   std::visit(transition_values, relations.at(r));
 }
 
+void IRM::set_num_threads(int num_threads) {
+  thread_pool = std::make_shared<ThreadPool>(num_threads);
+}
+
 // This method is currently unsupported for IRMs that include NoisyRelations
 // since cluster_or_prior_logp is not implemented for NoisyRelation.
 double IRM::logp(
@@ -427,7 +617,8 @@ RelationVariant IRM::get_relation(const std::string& name) {
 
 void single_step_irm_inference(std::mt19937* prng, IRM* irm, double& t_total,
                                bool verbose, int num_theta_steps,
-                               bool transition_latents) {
+                               bool transition_latents,
+                               int split_merge_proposals) {
   // If this function is called during HIRM inference, we do not want
   // the IRM to transition the latents. Some latent relations may have noisy
   // relations in other IRMs, so HIRM needs to handle the transitioning of
@@ -451,12 +642,21 @@ void single_step_irm_inference(std::mt19937* prng, IRM* irm, double& t_total,
       REPORT_SCORE(verbose, t, t_total, irm);
     }
   }
+  // SPLIT-MERGE CLUSTER ASSIGNMENTS.
+  for (const auto& [d, domain] : irm->domains) {
+    for (int i = 0; i < split_merge_proposals; ++i) {
+      clock_t t = clock();
+      irm->transition_split_merge(prng, d);
+      REPORT_SCORE(verbose, t, t_total, irm);
+    }
+  }
   // TRANSITION DISTRIBUTION HYPERPARAMETERS.
   for (const auto& [r, relation] : irm->relations) {
     std::visit(
         [&](auto r) {
           clock_t t = clock();
-          r->transition_cluster_hparams(prng, num_theta_steps);
+          r->transition_cluster_hparams(prng, num_theta_steps,
+                                        irm->thread_pool.get());
           REPORT_SCORE(verbose, t, t_total, irm);
         },
         relation);
@@ -3,6 +3,7 @@
 
 #pragma once
 #include <map>
+#include <memory>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -28,6 +29,11 @@ class IRM {
       domain_to_relations;  // reverse map
   std::unordered_map<std::string, std::vector<std::string>>
       base_to_noisy_relations;
+  // candidates proposed by transition_latent_values_relation
+  LatentValueProposalOptions latent_value_proposal_options;
+  // threads used by transition_latent_values_relation and to transition
+  // cluster hyperparameters; an IRM in a HIRM shares the HIRM's
+  std::shared_ptr<ThreadPool> thread_pool = std::make_shared<ThreadPool>(1);
 
   IRM(const T_schema& init_schema);
 
@@ -50,11 +56,38 @@ class IRM {
                                           const std::string& d,
                                           const T_item& item);
 
+  // Moves item to table in domain d, updating the clusters of every relation
+  // that observes it.  See Relation::set_cluster_assignment_gibbs for
+  // keep_empty_clusters.
+  void set_cluster_assignment_item(std::mt19937* prng, const std::string& d,
+                                   const T_item& item, int table,
+                                   bool keep_empty_clusters = false);
+
+  // Restricted Gibbs split-merge kernel for the clustering of domain d. Picks
+  // two items at random; if they share a table, proposes splitting it by
+  // sequentially allocating the table's other items between the two anchors,
+  // and otherwise proposes merging their tables. The proposal is scored
+  // against every relation in domain_to_relations. A merge is scored by
+  // replaying the split that would recover the current state, starting from
+  // a new table as the split does. The relation clusters emptied by the
+  // proposal are kept until it is accepted or rejected, so a rejected
+  // proposal moves the data back into the same clusters and leaves the model
+  // exactly as it was. Returns true if the proposal was accepted.
+  bool transition_split_merge(std::mt19937* prng, const std::string& d);
+
+  // Returns the part of logp_score that depends on the clustering of domain d.
+  double logp_score_domain(const std::string& d) const;
+
   // Updates the latent values contained in relation `r` using Gibbs sampling.
-  // `r` must be the base relation of at least one noisy relation.
+  // `r` must be the base relation of at least one noisy relation.  Values
+  // whose clusters are disjoint are updated concurrently on the threads of
+  // thread_pool; the result does not depend on their number.
   void transition_latent_values_relation(std::mt19937* prng,
                                          const std::string& r);
 
+  // Replaces thread_pool with one of num_threads threads.
+  void set_num_threads(int num_threads);
+
   double logp(
       const std::vector<std::tuple<std::string, T_items, ObservationVariant>>&
           observations,
@@ -84,6 +117,9 @@ class IRM {
 };
 
 // Run a single step of inference on an IRM model.
+// If split_merge_proposals is positive, that many split-merge proposals are
+// made for each domain after the Gibbs sweep over cluster assignments.
 void single_step_irm_inference(std::mt19937* prng, IRM* irm, double& t_total,
                                bool verbose, int num_theta_steps = 10,
-                               bool transition_latents = true);
+                               bool transition_latents = true,
+                               int split_merge_proposals = 0);
@@ -5,8 +5,14 @@
 #include "irm.hh"
 
 #include <boost/test/included/unit_test.hpp>
+#include <cmath>
+#include <functional>
 
+#include "distributions/beta_bernoulli.hh"
 #include "distributions/get_distribution.hh"
+#include "distributions/normal.hh"
+#include "distributions/skellam.hh"
+#include "util_math.hh"
 
 namespace tt = boost::test_tools;
 
@@ -62,6 +68,186 @@ BOOST_AUTO_TEST_CASE(test_irm) {
   BOOST_TEST(R2->get_data().at({0, 3}) != 1.);
 }
 
+BOOST_AUTO_TEST_CASE(test_transition_split_merge) {
+  std::map<std::string, T_relation> schema1{
+      {"R1", T_clean_relation{{"D1"}, false, DistributionSpec("normal")}},
+      {"R2", T_clean_relation{{"D1", "D2"}, false,
+                              DistributionSpec("bernoulli")}}};
+  IRM irm(schema1);
+  std::mt19937 prng;
+  std::normal_distribution<double> noise(0., 1.);
+  for (int i = 0; i < 20; ++i) {
+    irm.incorporate(&prng, "R1", {i}, (i < 10 ? -10. : 10.) + noise(prng));
+    irm.incorporate(&prng, "R2", {i, 0}, i < 10);
+  }
+
+  // Put every item of D1 at the same table.
+  Domain* domain = irm.domains.at("D1");
+  int table = domain->get_cluster_assignment(0);
+  for (int i = 1; i < 20; ++i) {
+    if (domain->get_cluster_assignment(i) != table) {
+      irm.set_cluster_assignment_item(&prng, "D1", i, table);
+    }
+  }
+  BOOST_TEST(domain->crp.tables.size() == 1);
+  double merged_score = irm.logp_score();
+
+  for (int i = 0; i < 100; ++i) {
+    irm.transition_split_merge(&prng, "D1");
+    BOOST_TEST(domain->crp.N == 20);
+  }
+  BOOST_TEST(irm.logp_score() > merged_score);
+  BOOST_TEST(domain->get_cluster_assignment(0) !=
+             domain->get_cluster_assignment(10));
+  int r1_obs = std::visit([](auto r) { return r->get_data().size(); },
+                          irm.relations.at("R1"));
+  BOOST_TEST(r1_obs == 20);
+}
+
+BOOST_AUTO_TEST_CASE(test_transition_split_merge_rejected) {
+  std::map<std::string, T_relation> schema1{
+      {"R1", T_clean_relation{{"D1", "D2"}, false,
+                              DistributionSpec("bernoulli")}},
+      {"R2", T_clean_relation{{"D1"}, false, DistributionSpec("skellam")}}};
+  IRM irm(schema1);
+  std::mt19937 prng;
+  for (int i = 0; i < 20; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      irm.incorporate(&prng, "R1", {i, j}, (i < 10) == (j < 2));
+    }
+    irm.incorporate(&prng, "R2", {i}, i < 10 ? -5 : 5);
+  }
+
+  // The hyperparameters and latent values of every cluster, and its score.
+  auto cluster_states = [&]() {
+    std::map<std::vector<int>, std::vector<double>> states;
+    auto r1 = as_clean_relation<BetaBernoulli>(
+        std::get<Relation<bool>*>(irm.relations.at("R1")));
+    for (const auto& [z, bb] : r1->clusters) {
+      states[z] = {bb->alpha, bb->beta, bb->logp_score()};
+    }
+    auto r2 = as_clean_relation<Skellam>(
+        std::get<Relation<int>*>(irm.relations.at("R2")));
+    for (const auto& [z, sk] : r2->clusters) {
+      states[z] = {sk->mean1, sk->mean2, sk->stddev1, sk->stddev2,
+                   sk->mu1,   sk->mu2,   sk->logp_score()};
+    }
+    return states;
+  };
+
+  // A rejected proposal leaves the model exactly as it was, including the
+  // hyperparameters of the clusters it emptied.
+  int num_rejected = 0;
+  for (int i = 0; i < 50; ++i) {
+    irm.transition_cluster_assignments_all(&prng);
+    for (const auto& [r, rel] : irm.relations) {
+      std::visit([&](auto rel) { rel->transition_cluster_hparams(&prng, 10); },
+                 rel);
+    }
+    for (const std::string d : {"D1", "D2"}) {
+      double logp_before = irm.logp_score();
+      auto states_before = cluster_states();
+      if (!irm.transition_split_merge(&prng, d)) {
+        ++num_rejected;
+        BOOST_TEST(irm.logp_score() == logp_before);
+        BOOST_TEST((cluster_states() == states_before));
+      }
+    }
+  }
+  BOOST_TEST(num_rejected > 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_transition_split_merge_detailed_balance) {
+  // On a domain of four items, the split-merge kernel is reversible with
+  // respect to the posterior over the 15 partitions, which is computed
+  // exactly by enumerating them.
+  std::map<std::string, T_relation> schema1{
+      {"R1", T_clean_relation{{"D1"}, false, DistributionSpec("normal")}},
+      {"R2", T_clean_relation{{"D1", "D2"}, false,
+                              DistributionSpec("bernoulli")}}};
+  IRM irm(schema1);
+  std::mt19937 prng;
+  const std::vector<double> r1_values = {-1., -0.5, 1., 2.};
+  for (int i = 0; i < 4; ++i) {
+    irm.incorporate(&prng, "R1", {i}, r1_values[i]);
+    irm.incorporate(&prng, "R2", {i, 0}, i != 2);
+    irm.incorporate(&prng, "R2", {i, 1}, i < 2);
+  }
+  Domain* domain = irm.domains.at("D1");
+
+  // The partition of D1 as the restricted growth string of its tables.
+  auto partition = [&]() {
+    std::map<int, int> labels;
+    std::string key;
+    for (int i = 0; i < 4; ++i) {
+      auto [it, unused] = labels.try_emplace(
+          domain->get_cluster_assignment(i), labels.size());
+      key += std::to_string(it->second);
+    }
+    return key;
+  };
+
+  // Enumerate the partitions by their restricted growth strings.
+  std::map<std::string, double> logps;
+  std::vector<int> rgs(4, 0);
+  std::function<void(int, int)> enumerate = [&](int i, int num_tables) {
+    if (i == 4) {
+      for (int j = 0; j < 4; ++j) {
+        int table = 100 + rgs[j];
+        if (domain->get_cluster_assignment(j) != table) {
+          irm.set_cluster_assignment_item(&prng, "D1", j, table);
+        }
+      }
+      logps[partition()] = irm.logp_score();
+      return;
+    }
+    for (int t = 0; t <= num_tables; ++t) {
+      rgs[i] = t;
+      enumerate(i + 1, std::max(num_tables, t + 1));
+    }
+  };
+  enumerate(0, 0);
+  BOOST_TEST(logps.size() == 15);
+  std::vector<double> lps;
+  for (const auto& [unused_key, lp] : logps) {
+    lps.push_back(lp);
+  }
+  const double log_z = logsumexp(lps);
+
+  // Run the kernel and count the visits to and transitions between the
+  // partitions.
+  const int num_steps = 40000;
+  std::map<std::string, int> visits;
+  std::map<std::pair<std::string, std::string>, int> transitions;
+  std::string current = partition();
+  for (int i = 0; i < num_steps; ++i) {
+    irm.transition_split_merge(&prng, "D1");
+    std::string next = partition();
+    ++visits[next];
+    ++transitions[{current, next}];
+    current = next;
+  }
+
+  // The visits follow the posterior.
+  double total_variation = 0.0;
+  for (const auto& [key, lp] : logps) {
+    total_variation +=
+        std::abs(visits[key] / double(num_steps) - std::exp(lp - log_z)) / 2;
+  }
+  BOOST_TEST(total_variation < 0.02);
+
+  // The kernel is reversible, so the number of transitions from x to y
+  // matches that from y to x up to sampling noise.
+  for (const auto& [xy, n_xy] : transitions) {
+    const auto& [x, y] = xy;
+    if (x < y) {
+      const int n_yx = transitions[{y, x}];
+      BOOST_TEST(std::abs(n_xy - n_yx) < 4 * std::sqrt(n_xy + n_yx) + 5,
+                 x << " <-> " << y << ": " << n_xy << " vs " << n_yx);
+    }
+  }
+}
+
 BOOST_AUTO_TEST_CASE(test_irm_one_data_point) {
   // We have one data point {1, 1}, for which we compute different relations
   // against. Because each domain (D1, D2) has only one point, there is only one
@@ -104,12 +290,13 @@ BOOST_AUTO_TEST_CASE(test_irm_one_data_point) {
   irm.incorporate(&prng, "R2", {23,}, obs1);
   double two_obs_score = irm.logp_score();
   BOOST_TEST(two_obs_score < 0.0);
-  BOOST_TEST(two_obs_score == (logp_x + logp_y));
+  BOOST_TEST(two_obs_score == (logp_x + logp_y), tt::tolerance(1e-12));
 
   irm.incorporate(&prng, "R3", {1, 23}, obs2);
   double three_obs_score = irm.logp_score();
   BOOST_TEST(three_obs_score < 0.0);
-  BOOST_TEST(three_obs_score == (logp_x + logp_y + logp_z));
+  BOOST_TEST(three_obs_score == (logp_x + logp_y + logp_z),
+             tt::tolerance(1e-12));
 }
 
 void construct_test_irm(std::mt19937* prng, IRM* irm) {
@@ -168,3 +355,23 @@ BOOST_AUTO_TEST_CASE(test_irm_logp_logp_score_agreement) {
   }
   BOOST_TEST(logsumexp(logps) == logp_x, tt::tolerance(1e-6));
 }
+
+BOOST_AUTO_TEST_CASE(test_clusters_by_value) {
+  std::map<std::string, T_relation> schema{
+      {"R1", T_clean_relation{{"D1"}, true, DistributionSpec("bernoulli")}},
+      {"R2", T_clean_relation{{"D1"}, true, DistributionSpec("normal")}},
+      {"R3", T_clean_relation{{"D1"}, true,
+                              DistributionSpec("string_normal")}}};
+  IRM irm(schema);
+  BOOST_TEST((dynamic_cast<CleanRelation<bool, BetaBernoulli>*>(
+                  std::get<Relation<bool>*>(irm.get_relation("R1"))) !=
+              nullptr));
+  BOOST_TEST((dynamic_cast<CleanRelation<double, Normal>*>(
+                  std::get<Relation<double>*>(irm.get_relation("R2"))) !=
+              nullptr));
+  // string_normal clusters are DistributionAdapters, so R3 keeps the
+  // generic cluster type.
+  BOOST_TEST((dynamic_cast<CleanRelation<std::string>*>(
+                  std::get<Relation<std::string>*>(irm.get_relation("R3"))) !=
+              nullptr));
+}
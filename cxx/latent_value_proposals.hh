@@ -0,0 +1,139 @@
+// Copyright 2024
+// Apache License, Version 2.0, refer to LICENSE.txt
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <set>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "distributions/string_vocabulary.hh"
+#include "emissions/string_alignment.hh"
+#include "relation.hh"
+
+// Options for the candidate latent values made by propose_latent_values.
+struct LatentValueProposalOptions {
+  // Whether to propose the consensus of the noisy observations.
+  bool consensus = false;
+  // The number of values of the base relation nearest to the consensus, in
+  // the base items' cluster, to propose.
+  int num_nearest = 0;
+  // The maximum number of distinct candidates, or 0 for no maximum.
+  int max_candidates = 0;
+};
+
+// The distance between latent values used to find consensus and nearest
+// values: the edit distance for strings, and the absolute difference for
+// numbers.
+inline double latent_value_distance(const std::string& a,
+                                    const std::string& b) {
+  return levenshtein_distance(a, b);
+}
+
+template <typename ValueType>
+double latent_value_distance(const ValueType& a, const ValueType& b) {
+  return std::abs(static_cast<double>(a) - static_cast<double>(b));
+}
+
+// The weighted median of values: the distinct value with the smallest total
+// distance to all of values, counting repeats, with ties going to the
+// smallest value.  For strings this is the set median string.  values must
+// not be empty.
+template <typename ValueType>
+ValueType consensus_value(const std::vector<ValueType>& values) {
+  std::map<ValueType, double> weights;
+  for (const ValueType& v : values) {
+    weights[v] += 1.0;
+  }
+  std::vector<ValueType> distinct;
+  std::vector<double> counts;
+  for (const auto& [v, w] : weights) {
+    distinct.push_back(v);
+    counts.push_back(w);
+  }
+  // Each distance is computed once and added to the costs of both values.
+  std::vector<double> costs(distinct.size(), 0.0);
+  for (size_t i = 0; i < distinct.size(); ++i) {
+    auto add_distance = [&](size_t j, double d) {
+      costs[i] += counts[j] * d;
+      costs[j] += counts[i] * d;
+    };
+    if constexpr (std::is_same_v<ValueType, std::string>) {
+      LevenshteinPattern pattern(distinct[i]);
+      for (size_t j = i + 1; j < distinct.size(); ++j) {
+        add_distance(j, pattern.distance(distinct[j]));
+      }
+    } else {
+      for (size_t j = i + 1; j < distinct.size(); ++j) {
+        add_distance(j, latent_value_distance(distinct[i], distinct[j]));
+      }
+    }
+  }
+  return distinct[std::min_element(costs.begin(), costs.end()) -
+                  costs.begin()];
+}
+
+// The distinct values of a base relation in each of its clusters, indexed for
+// nearest value queries.  The index is a snapshot of the relation when it was
+// built, and is safe to query from several threads at once.
+template <typename ValueType>
+class BaseClusterValues {
+ public:
+  BaseClusterValues(const Relation<ValueType>& base_relation) {
+    std::map<std::vector<int>, std::set<ValueType>> cluster_values;
+    for (const auto& [items, value] : base_relation.get_data()) {
+      cluster_values[base_relation.get_cluster_assignment(items)].insert(
+          value);
+    }
+    for (const auto& [z, vs] : cluster_values) {
+      if constexpr (std::is_same_v<ValueType, std::string>) {
+        vocabularies.emplace(z, std::vector<std::string>(vs.begin(), vs.end()));
+      } else {
+        values.emplace(z, std::vector<ValueType>(vs.begin(), vs.end()));
+      }
+    }
+  }
+
+  // Appends to *out the (up to) k values in cluster z nearest to x, nearest
+  // first.
+  void nearest(const std::vector<int>& z, const ValueType& x, int k,
+               std::vector<ValueType>* out) const {
+    if constexpr (std::is_same_v<ValueType, std::string>) {
+      auto it = vocabularies.find(z);
+      if (it == vocabularies.end()) {
+        return;
+      }
+      for (int i : it->second.nearest_k(x, k)) {
+        out->push_back(it->second.strings[i]);
+      }
+    } else {
+      auto it = values.find(z);
+      if (it == values.end()) {
+        return;
+      }
+      // Merge outwards from x through the sorted values.
+      const std::vector<ValueType>& vs = it->second;
+      size_t hi = std::lower_bound(vs.begin(), vs.end(), x) - vs.begin();
+      size_t lo = hi;
+      for (int n = 0; n < k && (lo > 0 || hi < vs.size()); ++n) {
+        if (hi == vs.size() ||
+            (lo > 0 && latent_value_distance(vs[lo - 1], x) <=
+                           latent_value_distance(vs[hi], x))) {
+          out->push_back(vs[--lo]);
+        } else {
+          out->push_back(vs[hi++]);
+        }
+      }
+    }
+  }
+
+ private:
+  // The values of each cluster; vocabularies is used for strings, and values
+  // (sorted) for everything else.
+  std::map<std::vector<int>, StringVocabulary> vocabularies;
+  std::map<std::vector<int>, std::vector<ValueType>> values;
+};
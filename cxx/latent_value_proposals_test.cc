@@ -0,0 +1,79 @@
+// Apache License, Version 2.0, refer to LICENSE.txt
+
+#define BOOST_TEST_MODULE test LatentValueProposals
+
+#include "latent_value_proposals.hh"
+
+#include <boost/test/included/unit_test.hpp>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "clean_relation.hh"
+#include "distributions/get_distribution.hh"
+#include "domain.hh"
+
+BOOST_AUTO_TEST_CASE(test_consensus_value) {
+  // The set median string.
+  BOOST_TEST(consensus_value<std::string>(
+                 {"aple", "apple", "applle", "pear", "apple"}) == "apple");
+  // A single value is its own consensus.
+  BOOST_TEST(consensus_value<std::string>({"pear"}) == "pear");
+  // Ties go to the smallest value.
+  BOOST_TEST(consensus_value<std::string>({"b", "a"}) == "a");
+
+  // For numbers, the weighted median of the values.
+  BOOST_TEST(consensus_value<double>({5.0, 1.0, 1.5, 100.0, 1.5}) == 1.5);
+  BOOST_TEST(consensus_value<int>({3, 3, 7}) == 3);
+  BOOST_TEST(consensus_value<bool>({true, false, true}) == true);
+}
+
+BOOST_AUTO_TEST_CASE(test_base_cluster_values_strings) {
+  std::mt19937 prng;
+  Domain D1("D1");
+  CleanRelation<std::string> base("base", DistributionSpec("bigram"), {&D1});
+  std::vector<std::string> values = {"apple", "apples", "pear",
+                                     "peach", "apple", "banana"};
+  // Put every item in the same cluster.
+  for (size_t i = 0; i < values.size(); ++i) {
+    D1.incorporate(&prng, i, 0);
+    base.incorporate(&prng, {int(i)}, values[i]);
+  }
+
+  BaseClusterValues<std::string> index(base);
+  std::vector<int> z = base.get_cluster_assignment({0});
+  std::vector<std::string> nearest;
+  index.nearest(z, "appel", 2, &nearest);
+  BOOST_TEST(nearest == std::vector<std::string>({"apple", "apples"}));
+
+  // Values are distinct, and there are only five of them.
+  nearest.clear();
+  index.nearest(z, "appel", 10, &nearest);
+  BOOST_TEST(nearest.size() == 5);
+
+  // A cluster with no values has no nearest values.
+  nearest.clear();
+  index.nearest({z[0] + 1}, "appel", 2, &nearest);
+  BOOST_TEST(nearest.empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_base_cluster_values_numbers) {
+  std::mt19937 prng;
+  Domain D1("D1");
+  CleanRelation<double> base("base", DistributionSpec("normal"), {&D1});
+  std::vector<double> values = {0.5, 3.0, 1.0, 2.5, 1.0, 10.0};
+  for (size_t i = 0; i < values.size(); ++i) {
+    D1.incorporate(&prng, i, 0);
+    base.incorporate(&prng, {int(i)}, values[i]);
+  }
+
+  BaseClusterValues<double> index(base);
+  std::vector<int> z = base.get_cluster_assignment({0});
+  std::vector<double> nearest;
+  index.nearest(z, 2.0, 3, &nearest);
+  BOOST_TEST(nearest == std::vector<double>({2.5, 1.0, 3.0}));
+
+  nearest.clear();
+  index.nearest(z, 20.0, 2, &nearest);
+  BOOST_TEST(nearest == std::vector<double>({10.0, 3.0}));
+}
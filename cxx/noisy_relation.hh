@@ -4,6 +4,7 @@
 #pragma once
 
 #include <random>
+#include <span>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -139,8 +140,10 @@ class NoisyRelation : public Relation<T> {
   double logp_score() const { return emission_relation.logp_score(); }
 
   void set_cluster_assignment_gibbs(const Domain& domain, const T_item& item,
-                                    int table, std::mt19937* prng) {
-    emission_relation.set_cluster_assignment_gibbs(domain, item, table, prng);
+                                    int table, std::mt19937* prng,
+                                    bool keep_empty_clusters = false) {
+    emission_relation.set_cluster_assignment_gibbs(domain, item, table, prng,
+                                                   keep_empty_clusters);
   }
 
   bool has_observation(const Domain& domain, const T_item& item) const {
@@ -172,7 +175,7 @@ class NoisyRelation : public Relation<T> {
     assert(data.contains(items));
     data.at(items) = value;
     const ValueType& base_value = get_base_value(items);
-    emission_relation.update_value(items, std::make_pair(value, base_value));
+    emission_relation.update_value(items, std::make_pair(base_value, value));
   }
 
   const std::vector<Domain*>& get_domains() const { return domains; }
@@ -200,14 +203,29 @@ class NoisyRelation : public Relation<T> {
     return emission_clusters;
   }
 
-  void transition_cluster_hparams(std::mt19937* prng, int num_theta_steps) {
-    emission_relation.transition_cluster_hparams(prng, num_theta_steps);
+  // The emission of cluster z, which must exist.
+  Emission<ValueType>* get_emission_cluster(const std::vector<int>& z) const {
+    return reinterpret_cast<Emission<ValueType>*>(
+        emission_relation.clusters.at(z));
+  }
+
+  void transition_cluster_hparams(std::mt19937* prng, int num_theta_steps,
+                                  ThreadPool* pool = nullptr) {
+    emission_relation.transition_cluster_hparams(prng, num_theta_steps, pool);
   }
 
   std::vector<int> get_cluster_assignment(const T_items& items) const {
     return emission_relation.get_cluster_assignment(items);
   }
 
+  // The change in the score of emission cluster z from incorporating the
+  // <base value, noisy value> pairs xs.
+  double emission_cluster_logp_score_delta(
+      const std::vector<int>& z,
+      std::span<const std::pair<ValueType, ValueType>> xs) {
+    return emission_relation.clusters.at(z)->logp_score_delta(xs);
+  }
+
   double cluster_or_prior_logp(std::mt19937* prng, const std::vector<int>& z,
                                const ValueType& value) const {
     // This method can't be implemented with the current API since it requires
@@ -216,6 +234,16 @@ class NoisyRelation : public Relation<T> {
     std::exit(1);
   }
 
+  // Like cluster_or_prior_logp, but with the base value supplied by the
+  // caller (e.g. when the base value is not incorporated in base_relation).
+  double cluster_or_prior_logp_from_base(std::mt19937* prng,
+                                         const std::vector<int>& z,
+                                         const ValueType& base_value,
+                                         const ValueType& value) const {
+    return emission_relation.cluster_or_prior_logp(
+        prng, z, std::make_pair(base_value, value));
+  }
+
   double cluster_or_prior_logp_from_items(std::mt19937* prng,
                                           const T_items& items,
                                           const ValueType& value) const {
@@ -237,6 +265,32 @@ class NoisyRelation : public Relation<T> {
     return emission_logp;
   }
 
+  ValueType sample_at_cluster(std::mt19937* prng,
+                              const std::vector<int>& z) const {
+    // This method can't be implemented with the current API since it requires
+    // the value of the base relation.
+    printf("sample_at_cluster is unimplemented for NoisyRelation\n");
+    std::exit(1);
+  }
+
+  // Samples a noisy value of base_value from the emission cluster indexed by z
+  // (or the emission prior, if there is no cluster at z).
+  ValueType sample_at_cluster_from_base(std::mt19937* prng,
+                                        const std::vector<int>& z,
+                                        const ValueType& base_value) const {
+    if (emission_relation.clusters.contains(z)) {
+      return reinterpret_cast<Emission<ValueType>*>(
+                 emission_relation.clusters.at(z))
+          ->sample_corrupted(base_value, prng);
+    }
+    auto emission_prior = reinterpret_cast<Emission<ValueType>*>(
+        emission_relation.make_new_distribution(prng));
+    ValueType emission_sample =
+        emission_prior->sample_corrupted(base_value, prng);
+    delete emission_prior;
+    return emission_sample;
+  }
+
   ValueType sample_at_items(std::mt19937* prng, const T_items& items) const {
     const ValueType& base_value = get_base_value(items);
     if (emission_relation.clusters_contains(items)) {
@@ -0,0 +1,86 @@
+// Copyright 2024
+// Apache License, Version 2.0, refer to LICENSE.txt
+
+// Measures the throughput of transitioning the latent values of a PClean
+// model, as in the first step of inference_hirm.
+//
+// Usage, from the cxx directory:
+//   ./latent_value_benchmark [schema] [observations] [sweeps] [threads]
+//       [max_candidates] [num_nearest] [consensus]
+// which defaults to the flights assets with 100 rows, 3 sweeps, 1 thread and
+// the default LatentValueProposalOptions.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <variant>
+
+#include "gendb.hh"
+#include "hirm.hh"
+#include "pclean/csv.hh"
+#include "pclean/io.hh"
+#include "pclean/pclean_lib.hh"
+#include "pclean/schema.hh"
+
+int main(int argc, char** argv) {
+  std::string schema_fn = argc > 1 ? argv[1] : "assets/flights.schema";
+  std::string obs_fn = argc > 2 ? argv[2] : "assets/flights_dirty.100.csv";
+  int sweeps = argc > 3 ? std::atoi(argv[3]) : 3;
+  int threads = argc > 4 ? std::atoi(argv[4]) : 1;
+
+  std::mt19937 prng(10);
+  PCleanSchema pclean_schema;
+  if (!read_schema_file(schema_fn, &pclean_schema)) {
+    printf("Error reading schema file %s\n", schema_fn.c_str());
+    return 1;
+  }
+  GenDB gendb(&prng, pclean_schema);
+  DataFrame df = DataFrame::from_csv(obs_fn);
+  incorporate_observations(&prng, &gendb, df);
+  HIRM* hirm = gendb.hirm;
+  hirm->set_num_threads(threads);
+  if (argc > 5) {
+    hirm->latent_value_proposal_options.max_candidates = std::atoi(argv[5]);
+  }
+  if (argc > 6) {
+    hirm->latent_value_proposal_options.num_nearest = std::atoi(argv[6]);
+  }
+  if (argc > 7) {
+    hirm->latent_value_proposal_options.consensus = std::atoi(argv[7]) != 0;
+  }
+
+  size_t num_values = 0;
+  size_t num_changed = 0;
+  double elapsed_ms = 0.0;
+  for (int i = 0; i < sweeps; ++i) {
+    for (const auto& [rel, nrels] : hirm->base_to_noisy_relations) {
+      if (!std::visit([](const auto& s) { return !s.is_observed; },
+                      hirm->schema.at(rel))) {
+        continue;
+      }
+      auto transition_values = [&](auto r) {
+        auto old_data = r->get_data();
+        auto start = std::chrono::steady_clock::now();
+        hirm->transition_latent_values_relation(&prng, rel);
+        std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+        elapsed_ms += elapsed.count();
+        num_values += old_data.size();
+        for (const auto& [items, value] : old_data) {
+          num_changed += r->get_value(items) != value;
+        }
+      };
+      std::visit(transition_values, hirm->get_relation(rel));
+    }
+  }
+
+  printf("%zu latent values in %d sweeps on %d threads: %.1f ms, "
+         "%.1f us per value\n",
+         num_values, sweeps, threads, elapsed_ms,
+         1000.0 * elapsed_ms / num_values);
+  printf("%zu latent values changed\n", num_changed);
+  printf("final model score = %f\n", hirm->logp_score());
+  return 0;
+}
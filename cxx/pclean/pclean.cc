@@ -30,12 +30,30 @@ int main(int argc, char** argv) {
        cxxopts::value<std::string>())
       ("heldout", "Filename of heldout observations",
        cxxopts::value<std::string>()->default_value(""))
+      ("heldout_samples",
+       "Number of importance samples per held out row",
+       cxxopts::value<int>()->default_value("10"))
       ("i,iters", "Number of GenDB iterations",
        cxxopts::value<int>()->default_value("10"))
       ("inference_iters",
        "Number of HIRM inference iterations per GenDB iteration",
        cxxopts::value<int>()->default_value("1"))
+      ("split_merge_proposals",
+       "Number of entity split-merge proposals per class per GenDB iteration",
+       cxxopts::value<int>()->default_value("0"))
       ("seed", "Random seed", cxxopts::value<int>()->default_value("10"))
+      ("threads", "Number of threads used to transition latent values",
+       cxxopts::value<int>()->default_value("1"))
+      ("latent_candidates",
+       "Maximum number of candidates per latent value, or 0 for no maximum",
+       cxxopts::value<int>()->default_value("0"))
+      ("latent_nearest",
+       "Number of nearby values in the base cluster to propose as latent "
+       "values",
+       cxxopts::value<int>()->default_value("0"))
+      ("latent_consensus",
+       "Propose the consensus of the noisy observations as a latent value",
+       cxxopts::value<bool>()->default_value("false"))
       ("samples", "Number of samples to generate",
        cxxopts::value<int>()->default_value("0"))
       ("transition_entities",
@@ -99,10 +117,18 @@ int main(int argc, char** argv) {
   int iters = result["iters"].as<int>();
   int timeout = result["timeout"].as<int>();
   bool verbose = result["verbose"].as<bool>();
+  gendb.hirm->latent_value_proposal_options.max_candidates =
+      result["latent_candidates"].as<int>();
+  gendb.hirm->latent_value_proposal_options.num_nearest =
+      result["latent_nearest"].as<int>();
+  gendb.hirm->latent_value_proposal_options.consensus =
+      result["latent_consensus"].as<bool>();
+  gendb.hirm->set_num_threads(result["threads"].as<int>());
   if (result["transition_entities"].as<bool>()) {
     inference_gendb(&prng, &gendb, iters,
                     result["inference_iters"].as<int>(),
-                    timeout, verbose);
+                    timeout, verbose,
+                    result["split_merge_proposals"].as<int>());
   } else {
     inference_hirm(&prng, gendb.hirm, iters, timeout, verbose);
   }
@@ -119,11 +145,10 @@ int main(int argc, char** argv) {
   if (!heldout_fn.empty()) {
     std::cout << "Loading held out observations from " << heldout_fn << std::endl;
     DataFrame heldout_df = DataFrame::from_csv(heldout_fn);
-    std::cout << "Incorporating held out observations ...\n";
-    double lp1 = gendb.logp_score();
-    incorporate_observations(&prng, &gendb, heldout_df);
-    double lp2 = gendb.logp_score();
-    std::cout << "Log likelihood of held out data is " << (lp2 - lp1) << std::endl;
+    std::cout << "Scoring held out observations ...\n";
+    double lp = logp_observations(&prng, gendb, heldout_df,
+                                  result["heldout_samples"].as<int>());
+    std::cout << "Log likelihood of held out data is " << lp << std::endl;
   }
 
   int num_samples = result["samples"].as<int>();
@@ -9,43 +9,57 @@
 #include "pclean/pclean_lib.hh"
 #include "pclean/schema.hh"
 
+namespace {
+
+// Converts row i of df into a map from query field names to observed values.
+// Missing values are skipped, as are columns that don't name query fields.
+std::map<std::string, ObservationVariant> make_row(const GenDB& gendb,
+                                                   const DataFrame& df,
+                                                   int i) {
+  std::map<std::string, ObservationVariant> row_values;
+  for (const auto& col : df.data) {
+    const std::string& col_name = col.first;
+    if (!gendb.schema.query.fields.contains(col_name)) {
+      if (i == 0) {
+        printf("Schema does not contain %s, skipping ...\n", col_name.c_str());
+      }
+      continue;
+    }
+    const std::string& val = col.second[i];
+    if (val.empty()) {
+      // Don't incorporate missing values.
+      // TODO(thomaswc): Allow the user to specify other values that mean
+      // missing data.  ("missing", "NA", "nan", etc.).
+      continue;
+    }
+
+    // Don't allow non-printable characters in val.
+    for (const char c: val) {
+      if (!std::isprint(c)) {
+        printf("Found non-printable character with ascii value %d on line "
+               "%d of column %s in value `%s`.\n",
+               (int) c, i + 2, col_name.c_str(), val.c_str());
+        std::exit(1);
+      }
+    }
+
+    const RelationVariant& rv = gendb.hirm->get_relation(col_name);
+    ObservationVariant ov;
+    std::visit([&](const auto &r) { ov = r->from_string(val); }, rv);
+    row_values[col_name] = ov;
+  }
+  return row_values;
+}
+
+}  // namespace
+
 void incorporate_observations(std::mt19937* prng,
                               GenDB *gendb,
                               const DataFrame& df) {
   int num_rows = df.data.begin()->second.size();
   for (int i = 0; i < num_rows; i++) {
-    std::map<std::string, ObservationVariant> row_values;
-    for (const auto& col : df.data) {
-      const std::string& col_name = col.first;
-      if (!gendb->schema.query.fields.contains(col_name)) {
-        if (i == 0) {
-          printf("Schema does not contain %s, skipping ...\n", col_name.c_str());
-        }
-        continue;
-      }
-      const std::string& val = col.second[i];
-      if (val.empty()) {
-        // Don't incorporate missing values.
-        // TODO(thomaswc): Allow the user to specify other values that mean
-        // missing data.  ("missing", "NA", "nan", etc.).
-        continue;
-      }
-
-      // Don't allow non-printable characters in val.
-      for (const char c: val) {
-        if (!std::isprint(c)) {
-          printf("Found non-printable character with ascii value %d on line "
-                 "%d of column %s in value `%s`.\n",
-                 (int) c, i + 2, col_name.c_str(), val.c_str());
-          std::exit(1);
-        }
-      }
-
-      const RelationVariant& rv = gendb->hirm->get_relation(col_name);
-      ObservationVariant ov;
-      std::visit([&](const auto &r) { ov = r->from_string(val); }, rv);
-      row_values[col_name] = ov;
-    }
+    std::map<std::string, ObservationVariant> row_values =
+        make_row(*gendb, df, i);
     // Incorporate into the gendb with new_rows_have_unique_entities=true.
     // TODO(emilyaf): Consider using new_rows_have_unique_entities=false
     // after entity transitions are allowed and numeric stability issues
@@ -54,6 +68,18 @@ void incorporate_observations(std::mt19937* prng,
   }
 }
 
+double logp_observations(std::mt19937* prng,
+                         const GenDB& gendb,
+                         const DataFrame& df,
+                         int num_samples) {
+  int num_rows = df.data.begin()->second.size();
+  std::vector<std::map<std::string, ObservationVariant>> rows;
+  for (int i = 0; i < num_rows; i++) {
+    rows.push_back(make_row(gendb, df, i));
+  }
+  return gendb.logp(prng, rows, num_samples);
+}
+
 // Sample a single "row" into *query_values.  A value is sampled into
 // (*query_values)[f] for every query field in the schema.
 void make_pclean_sample(
@@ -61,9 +87,7 @@ void make_pclean_sample(
     std::map<std::string, std::string> *query_values) {
   for (const auto& [name, query_field] : gendb->schema.query.fields) {
     T_items entities = gendb->sample_entities_relation(
-        prng, gendb->schema.query.record_class,
-        query_field.class_path.begin(), query_field.class_path.end(),
-        class_item);
+        prng, query_field.name, class_item);
 
     (*query_values)[query_field.name] = gendb->hirm->sample_and_incorporate_relation(
         prng, query_field.name, entities);
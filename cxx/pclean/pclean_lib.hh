@@ -18,6 +18,13 @@ void incorporate_observations(std::mt19937* prng,
                               GenDB *gendb,
                               const DataFrame& df);
 
+// Returns the log probability of the rows of df under the GenDB, without
+// incorporating them.  Each row is scored as a new record; see GenDB::logp.
+double logp_observations(std::mt19937* prng,
+                         const GenDB& gendb,
+                         const DataFrame& df,
+                         int num_samples = 10);
+
 // Return a dataframe of num_samples samples from the GenDB.
 // All existing rows added to gendb should have ids < start_row.
 DataFrame make_pclean_samples(int num_samples, int start_row, GenDB *gendb,
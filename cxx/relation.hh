@@ -11,6 +11,7 @@
 
 #include "distributions/get_distribution.hh"
 #include "domain.hh"
+#include "thread_pool.hh"
 #include "util_hash.hh"
 
 typedef std::vector<T_item> T_items;
@@ -53,6 +54,11 @@ class Relation {
       std::mt19937* prng, const T_items& items,
       const ValueType& value) const = 0;
 
+  // Samples from the cluster (distribution) indexed by z (or the prior, if
+  // there is no cluster at z).
+  virtual ValueType sample_at_cluster(std::mt19937* prng,
+                                      const std::vector<int>& z) const = 0;
+
   // Samples from the cluster (distribution) that contains items.
   virtual ValueType sample_at_items(std::mt19937* prng,
                                     const T_items& items) const = 0;
@@ -66,7 +72,7 @@ class Relation {
   virtual void cleanup_data(const T_items& items) = 0;
 
   // Removes any clusters (and their distribution models) that have no data
-  // incorporated.
+  // incorporated, and has the others forget_unincorporated.
   virtual void cleanup_clusters() = 0;
 
   // Incorporates items and value into an existing cluster.
@@ -83,14 +89,19 @@ class Relation {
                                                std::vector<int> tables,
                                                std::mt19937* prng) = 0;
 
-  // Updates the cluster assignment of item.
-  virtual void set_cluster_assignment_gibbs(const Domain& domain,
-                                            const T_item& item, int table,
-                                            std::mt19937* prng) = 0;
+  // Updates the cluster assignment of item.  Clusters left empty are removed
+  // unless keep_empty_clusters, in which case they are kept, with their
+  // hyperparameters, until the next cleanup_clusters.
+  virtual void set_cluster_assignment_gibbs(
+      const Domain& domain, const T_item& item, int table, std::mt19937* prng,
+      bool keep_empty_clusters = false) = 0;
 
-  // Gibbs kernel for cluster hparams.
+  // Gibbs kernel for cluster hparams.  The clusters are transitioned
+  // concurrently on the threads of pool, if it is not null; the result does
+  // not depend on the number of threads.
   virtual void transition_cluster_hparams(std::mt19937* prng,
-                                          int num_theta_steps) = 0;
+                                          int num_theta_steps,
+                                          ThreadPool* pool = nullptr) = 0;
 
   // Accessor/convenience methods, mostly for subclass members that can't be
   // accessed through the base class.
@@ -0,0 +1,90 @@
+// Copyright 2024
+// See LICENSE.txt
+
+// Measures the overhead of a string_normal relation, whose clusters are
+// DistributionAdapter<double>s, over a native normal relation on the same
+// values.  Each round incorporates every item, computes the approximate Gibbs
+// data probability of each item at every table (including a new one), and
+// then unincorporates every item.
+//
+// Usage, from the cxx directory:
+//   ./string_normal_benchmark [number of items] [number of distinct values]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "clean_relation.hh"
+#include "distributions/get_distribution.hh"
+#include "domain.hh"
+
+namespace {
+
+const int kRepeats = 20;
+const int kTables = 5;
+
+template <typename T>
+double ns_per_item(const std::string& spec, const std::vector<T>& values,
+                   double* sink) {
+  std::mt19937 prng(10);
+  Domain domain("D");
+  for (size_t i = 0; i < values.size(); ++i) {
+    domain.incorporate(&prng, i, i % kTables);
+  }
+  CleanRelation<T> relation("R", DistributionSpec(spec), {&domain});
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < kRepeats; ++r) {
+    for (size_t i = 0; i < values.size(); ++i) {
+      relation.incorporate(&prng, {int(i)}, values[i]);
+    }
+    for (size_t i = 0; i < values.size(); ++i) {
+      for (int t = 0; t <= kTables; ++t) {
+        *sink += relation.logp_gibbs_approx(domain, i, t, &prng);
+      }
+    }
+    for (size_t i = 0; i < values.size(); ++i) {
+      relation.unincorporate({int(i)});
+    }
+  }
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / (kRepeats * values.size());
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int num_items = argc > 1 ? std::atoi(argv[1]) : 2000;
+  int num_distinct = argc > 2 ? std::atoi(argv[2]) : 200;
+
+  std::mt19937 prng(10);
+  std::normal_distribution<double> normal(50.0, 10.0);
+  std::vector<std::string> distinct;
+  for (int i = 0; i < num_distinct; ++i) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.2f", normal(prng));
+    distinct.push_back(buf);
+  }
+  std::vector<std::string> strings;
+  std::vector<double> doubles;
+  std::uniform_int_distribution<int> pick(0, num_distinct - 1);
+  for (int i = 0; i < num_items; ++i) {
+    strings.push_back(distinct[pick(prng)]);
+    doubles.push_back(std::stod(strings.back()));
+  }
+
+  double sink = 0.0;
+  double native_ns = ns_per_item("normal", doubles, &sink);
+  double adapted_ns = ns_per_item("string_normal", strings, &sink);
+
+  printf("%d items with %d distinct values, %d tables\n", num_items,
+         num_distinct, kTables);
+  printf("normal:        %10.1f ns per item\n", native_ns);
+  printf("string_normal: %10.1f ns per item (%.2fx)\n", adapted_ns,
+         adapted_ns / native_ns);
+  printf("(checksum %g)\n", sink);
+  return 0;
+}
@@ -8,6 +8,7 @@
 #include "util_hash.hh"
 #include "util_io.hh"
 #include "util_math.hh"
+#include "distributions/beta_bernoulli.hh"
 
 int main(int argc, char** argv) {
   srand(1);
@@ -144,9 +145,9 @@ int main(int argc, char** argv) {
     }
     // Check relations agree.
     for (const auto& [r, rm_var] : irm->relations) {
-      auto rx = reinterpret_cast<CleanRelation<bool>*>(
+      auto rx = as_clean_relation<BetaBernoulli>(
           std::get<Relation<bool>*>(irx->relations.at(r)));
-      auto rm = reinterpret_cast<CleanRelation<bool>*>(
+      auto rm = as_clean_relation<BetaBernoulli>(
           std::get<Relation<bool>*>(rm_var));
       assert(rm->data == rx->data);
       assert(rm->data_r == rx->data_r);
@@ -18,6 +18,7 @@
 #include "util_hash.hh"
 #include "util_io.hh"
 #include "util_math.hh"
+#include "distributions/beta_bernoulli.hh"
 
 int main(int argc, char** argv) {
   srand(1);
@@ -108,7 +109,7 @@ int main(int argc, char** argv) {
   std::string path_clusters = "assets/animals.binary.irm";
   to_txt(path_clusters, irm3, encoding);
 
-  auto rel = reinterpret_cast<CleanRelation<bool>*>(
+  auto rel = as_clean_relation<BetaBernoulli>(
       std::get<Relation<bool>*>(irm3.relations.at("has")));
   auto& enc = std::get<0>(encoding);
   auto lp0 = rel->logp({enc["animal"]["tail"], enc["animal"]["bat"]}, 0, &prng);
@@ -135,9 +136,9 @@ int main(int argc, char** argv) {
     assert(d3->crp.alpha == d4->crp.alpha);
   }
   for (const auto& r : {"has"}) {
-    auto r3 = reinterpret_cast<CleanRelation<bool>*>(
+    auto r3 = as_clean_relation<BetaBernoulli>(
         std::get<Relation<bool>*>(irm3.relations.at(r)));
-    auto r4 = reinterpret_cast<CleanRelation<bool>*>(
+    auto r4 = as_clean_relation<BetaBernoulli>(
         std::get<Relation<bool>*>(irm4.relations.at(r)));
     assert(r3->data == r4->data);
     assert(r3->data_r == r4->data_r);
@@ -0,0 +1,72 @@
+// Copyright 2024
+// Apache License, Version 2.0, refer to LICENSE.txt
+
+#include "thread_pool.hh"
+
+ThreadPool::ThreadPool(int num_threads) {
+  for (int i = 1; i < num_threads; ++i) {
+    workers.emplace_back([this]() { worker_loop(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  work_ready.notify_all();
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+}
+
+void ThreadPool::parallel_for(size_t n, const std::function<void(size_t)>& f) {
+  if (workers.empty() || n <= 1) {
+    for (size_t i = 0; i < n; ++i) {
+      f(i);
+    }
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    task = &f;
+    num_tasks = n;
+    next_task = 0;
+    num_busy = workers.size();
+    ++generation;
+  }
+  work_ready.notify_all();
+  run_tasks();
+  std::unique_lock<std::mutex> lock(mutex);
+  work_done.wait(lock, [this]() { return num_busy == 0; });
+  task = nullptr;
+}
+
+void ThreadPool::worker_loop() {
+  uint64_t finished_generation = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      work_ready.wait(lock, [&]() {
+        return stopping || generation != finished_generation;
+      });
+      if (stopping) {
+        return;
+      }
+      finished_generation = generation;
+    }
+    run_tasks();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--num_busy == 0) {
+        work_done.notify_one();
+      }
+    }
+  }
+}
+
+void ThreadPool::run_tasks() {
+  for (size_t i = next_task++; i < num_tasks; i = next_task++) {
+    (*task)(i);
+  }
+}
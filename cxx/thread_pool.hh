@@ -0,0 +1,55 @@
+// Copyright 2024
+// Apache License, Version 2.0, refer to LICENSE.txt
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads that share the iterations of parallel_for.  The
+// thread calling parallel_for works alongside the pool's own threads, so a
+// pool of size 1 has no threads of its own and runs everything inline.
+class ThreadPool {
+ public:
+  // Values of num_threads less than 1 are treated as 1.
+  explicit ThreadPool(int num_threads);
+
+  ~ThreadPool();
+
+  int size() const { return workers.size() + 1; }
+
+  // Calls f(i) for every i in [0, n) and returns once all of the calls have
+  // finished.  The calls are made from several threads at once, in no
+  // particular order.  parallel_for must not be called from within f.
+  void parallel_for(size_t n, const std::function<void(size_t)>& f);
+
+  // Disable copying.
+  ThreadPool& operator=(const ThreadPool&) = delete;
+  ThreadPool(const ThreadPool&) = delete;
+
+ private:
+  void worker_loop();
+
+  // Makes calls to *task until none are left.
+  void run_tasks();
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable work_ready;
+  std::condition_variable work_done;
+  // The current parallel_for; generation counts them, so that a worker can
+  // tell a new call from the one it has finished.
+  const std::function<void(size_t)>* task = nullptr;
+  size_t num_tasks = 0;
+  std::atomic<size_t> next_task = 0;
+  uint64_t generation = 0;
+  // The number of workers that have not finished the current call.
+  size_t num_busy = 0;
+  bool stopping = false;
+};
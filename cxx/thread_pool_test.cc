@@ -0,0 +1,35 @@
+// Apache License, Version 2.0, refer to LICENSE.txt
+
+#define BOOST_TEST_MODULE test ThreadPool
+
+#include "thread_pool.hh"
+
+#include <atomic>
+#include <boost/test/included/unit_test.hpp>
+#include <vector>
+
+BOOST_AUTO_TEST_CASE(test_parallel_for) {
+  ThreadPool pool(4);
+  BOOST_TEST(pool.size() == 4);
+  std::vector<int> calls(1000, 0);
+  pool.parallel_for(calls.size(), [&](size_t i) { ++calls[i]; });
+  for (int c : calls) {
+    BOOST_TEST(c == 1);
+  }
+
+  // The pool can be reused, including for calls with fewer tasks than
+  // threads.
+  std::atomic<int> total = 0;
+  for (int n = 0; n < 20; ++n) {
+    pool.parallel_for(n, [&](size_t i) { total += i; });
+  }
+  BOOST_TEST(total == 1140);
+}
+
+BOOST_AUTO_TEST_CASE(test_single_thread) {
+  ThreadPool pool(0);
+  BOOST_TEST(pool.size() == 1);
+  std::vector<size_t> order;
+  pool.parallel_for(5, [&](size_t i) { order.push_back(i); });
+  BOOST_TEST(order == std::vector<size_t>({0, 1, 2, 3, 4}));
+}
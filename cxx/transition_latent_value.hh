@@ -4,13 +4,20 @@
 #pragma once
 
 #include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
 #include <random>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
 
 #include "emissions/base.hh"
+#include "latent_value_proposals.hh"
 #include "noisy_relation.hh"
 #include "relation.hh"
+#include "thread_pool.hh"
 
 typedef int T_item;
 typedef std::vector<T_item> T_items;
@@ -27,9 +34,17 @@ using T_noisy_observations =
 // the same before/after the call to this method.
 template <typename ValueType>
 void transition_latent_value(
-    std::mt19937* prng, T_items base_items, Relation<ValueType>* base_relation,
-    std::unordered_map<std::string, NoisyRelation<ValueType>*>
-        noisy_relations) {
+    std::mt19937* prng, const T_items& base_items,
+    Relation<ValueType>* base_relation,
+    const std::unordered_map<std::string, NoisyRelation<ValueType>*>&
+        noisy_relations,
+    const LatentValueProposalOptions& options = {}) {
+  std::unique_ptr<BaseClusterValues<ValueType>> base_cluster_values;
+  if (options.num_nearest > 0) {
+    base_cluster_values =
+        std::make_unique<BaseClusterValues<ValueType>>(*base_relation);
+  }
+
   // We incorporate to/unincorporate from clusters themselves rather than
   // relations. Empty clusters are not deleted, because observations will be
   // re-incorporated to them.
@@ -37,35 +52,12 @@ void transition_latent_value(
       unincorporate_and_store_values(base_items, base_relation,
                                      noisy_relations);
 
-  std::vector<ValueType> all_noisy_observations;
-  for (const auto& [name, obs] : noisy_observations) {
-    for (const auto& [items, v] : obs) {
-      all_noisy_observations.push_back(v);
-    }
-  }
-
-  // Candidates for the next latent value are the clean proposals from each
-  // cluster in each noisy relation.
-  // TODO(emilyaf): Discuss/consider alternatives to generating proposals for
-  // the latent values.
-  std::vector<ValueType> latent_value_candidates;
-  for (auto [name, rel] : noisy_relations) {
-    for (const auto& [i, em] : rel->get_emission_clusters()) {
-      auto candidate = em->propose_clean(all_noisy_observations, prng);
-      // The candidate returned by propose_clean might not be in the support
-      // of the distribution (i.e., assigned zero probability).  So we use
-      // the base_relation's nearest method to get the closest value with
-      // > 0 probability.  A better solution would involve rewritting the
-      // propose_clean methods to take the base_relation's Distribution as
-      // a parameter.
-      candidate = base_relation->nearest(prng, candidate, base_items);
-      latent_value_candidates.push_back(candidate);
-    }
-  }
+  std::vector<ValueType> latent_value_candidates = propose_latent_values(
+      prng, base_items, noisy_observations, base_relation, noisy_relations,
+      options, base_cluster_values.get());
 
   std::vector<double> logpx = latent_values_incremental_logp(
-      base_items, latent_value_candidates, noisy_observations, base_relation,
-      noisy_relations);
+      latent_value_candidates, noisy_observations, noisy_relations);
 
   choose_and_incorporate_value(prng, base_items, latent_value_candidates, logpx,
                                noisy_observations, base_relation,
@@ -76,68 +68,166 @@ void transition_latent_value(
 // since values are unincorporated directly from their clusters.
 template <typename ValueType>
 T_noisy_observations<ValueType> unincorporate_and_store_values(
-    T_items base_items, Relation<ValueType>* base_relation,
-    std::unordered_map<std::string, NoisyRelation<ValueType>*>
+    const T_items& base_items, Relation<ValueType>* base_relation,
+    const std::unordered_map<std::string, NoisyRelation<ValueType>*>&
         noisy_relations) {
   base_relation->unincorporate_from_cluster(base_items);
 
   // Unincorporate all noisy observations from clusters and store the noisy
   // values.
+  // base_to_noisy_items is only searched, not inserted into, so that items
+  // with disjoint clusters can be unincorporated concurrently.
   T_noisy_observations<ValueType> noisy_observations;
-  for (auto [name, rel] : noisy_relations) {
-    noisy_observations[name] = {};
-    for (const T_items& items : rel->base_to_noisy_items[base_items]) {
+  for (const auto& [name, rel] : noisy_relations) {
+    auto& obs = noisy_observations[name];
+    auto it = rel->base_to_noisy_items.find(base_items);
+    if (it == rel->base_to_noisy_items.end()) {
+      continue;
+    }
+    for (const T_items& items : it->second) {
       const ValueType& v = rel->get_value(items);
       rel->unincorporate_from_cluster(items);
-      noisy_observations[name][items] = v;
+      obs[items] = v;
     }
   }
   return noisy_observations;
 }
 
+// Candidates for the next latent value of base_items, given their noisy
+// observations.  In order, they are the consensus of the noisy observations
+// (if options.consensus), the options.num_nearest values nearest to that
+// consensus in base_cluster_values (which may be null if options.num_nearest
+// is 0), and the clean proposals of the emission clusters of the noisy
+// relations, starting with the clusters of the noisy observations.
+// Candidates are distinct, and no more proposals are made once
+// options.max_candidates is reached.  The relations are not modified.
+template <typename ValueType>
+std::vector<ValueType> propose_latent_values(
+    std::mt19937* prng, const T_items& base_items,
+    const T_noisy_observations<ValueType>& noisy_observations,
+    Relation<ValueType>* base_relation,
+    const std::unordered_map<std::string, NoisyRelation<ValueType>*>&
+        noisy_relations,
+    const LatentValueProposalOptions& options = {},
+    const BaseClusterValues<ValueType>* base_cluster_values = nullptr) {
+  std::vector<ValueType> all_noisy_observations;
+  for (const auto& [name, obs] : noisy_observations) {
+    for (const auto& [items, v] : obs) {
+      all_noisy_observations.push_back(v);
+    }
+  }
+
+  std::vector<ValueType> latent_value_candidates;
+  std::unordered_set<ValueType> seen;
+  auto full = [&]() {
+    return options.max_candidates > 0 &&
+           std::ssize(latent_value_candidates) >= options.max_candidates;
+  };
+  // The candidate might not be in the support of the distribution (i.e.,
+  // assigned zero probability).  So we use the base_relation's nearest method
+  // to get the closest value with > 0 probability.  A better solution would
+  // involve rewritting the propose_clean methods to take the base_relation's
+  // Distribution as a parameter.
+  auto add_candidate = [&](const ValueType& candidate) {
+    if (full()) {
+      return;
+    }
+    ValueType v = base_relation->nearest(prng, candidate, base_items);
+    if (seen.insert(v).second) {
+      latent_value_candidates.push_back(v);
+    }
+  };
+
+  if (!all_noisy_observations.empty() &&
+      (options.consensus || options.num_nearest > 0)) {
+    ValueType consensus = consensus_value(all_noisy_observations);
+    if (options.consensus) {
+      add_candidate(consensus);
+    }
+    if (options.num_nearest > 0) {
+      std::vector<ValueType> nearest;
+      base_cluster_values->nearest(
+          base_relation->get_cluster_assignment(base_items), consensus,
+          options.num_nearest, &nearest);
+      for (const ValueType& v : nearest) {
+        add_candidate(v);
+      }
+    }
+  }
+
+  // TODO(emilyaf): Discuss/consider alternatives to generating proposals for
+  // the latent values.
+  std::unordered_map<std::string, std::set<std::vector<int>>> own_clusters;
+  for (const auto& [name, rel] : noisy_relations) {
+    for (const auto& [items, v] : noisy_observations.at(name)) {
+      own_clusters[name].insert(rel->get_cluster_assignment(items));
+    }
+  }
+  for (const auto& [name, rel] : noisy_relations) {
+    for (const std::vector<int>& z : own_clusters[name]) {
+      if (full()) {
+        return latent_value_candidates;
+      }
+      add_candidate(rel->get_emission_cluster(z)->propose_clean(
+          all_noisy_observations, prng));
+    }
+  }
+  for (const auto& [name, rel] : noisy_relations) {
+    for (const auto& [z, em] : rel->get_emission_clusters()) {
+      if (full()) {
+        return latent_value_candidates;
+      }
+      if (!own_clusters[name].contains(z)) {
+        add_candidate(em->propose_clean(all_noisy_observations, prng));
+      }
+    }
+  }
+  return latent_value_candidates;
+}
+
 // This function assumes that the latent/noisy observations corresponding to
 // base_items have been removed from their clusters in
 // base_relation/noisy_relations (and returns base_relation/noisy_relations in
-// this state as well).
+// this state as well).  The returned values are the changes in the noisy
+// relations' logp_score from incorporating the noisy observations with each
+// candidate latent value as their base value.  Only the emission clusters of
+// the noisy observations change, so only their scores are computed.
 template <typename ValueType>
 std::vector<double> latent_values_incremental_logp(
-    T_items base_items, std::vector<ValueType> latent_values,
-    T_noisy_observations<ValueType> noisy_observations,
-    Relation<ValueType>* base_relation,
-    std::unordered_map<std::string, NoisyRelation<ValueType>*>
+    const std::vector<ValueType>& latent_values,
+    const T_noisy_observations<ValueType>& noisy_observations,
+    const std::unordered_map<std::string, NoisyRelation<ValueType>*>&
         noisy_relations) {
-  // Compute logp_score of the noisy relations without the observations of
-  // this attribute.
-  double baseline_logp_score = 0.;
-  for (auto [name, rel] : noisy_relations) {
-    baseline_logp_score += rel->logp_score();
+  // The noisy observations of base_items, grouped by emission cluster.
+  struct ClusterObservations {
+    NoisyRelation<ValueType>* rel;
+    std::vector<int> z;
+    std::vector<ValueType> values;
+  };
+  std::vector<ClusterObservations> touched_clusters;
+  for (const auto& [name, rel] : noisy_relations) {
+    std::map<std::vector<int>, std::vector<ValueType>> values_by_cluster;
+    for (const auto& [items, v] : noisy_observations.at(name)) {
+      values_by_cluster[rel->get_cluster_assignment(items)].push_back(v);
+    }
+    for (auto& [z, values] : values_by_cluster) {
+      touched_clusters.push_back({rel, z, std::move(values)});
+    }
   }
 
   std::vector<double> logpx;
+  logpx.reserve(latent_values.size());
+  std::vector<std::pair<ValueType, ValueType>> pairs;
   for (const ValueType& v : latent_values) {
-    // Incorporate the latent/noisy values for this candidate.
-    base_relation->incorporate_to_cluster(base_items, v);
-    for (auto& [name, rel] : noisy_relations) {
-      for (const T_items& items : rel->base_to_noisy_items.at(base_items)) {
-        rel->incorporate_to_cluster(items,
-                                    noisy_observations.at(name).at(items));
+    double logp = 0.;
+    for (const ClusterObservations& c : touched_clusters) {
+      pairs.clear();
+      for (const ValueType& x : c.values) {
+        pairs.emplace_back(v, x);
       }
+      logp += c.rel->emission_cluster_logp_score_delta(c.z, pairs);
     }
-
-    // Compute the incremental logp_score of the noisy relations.
-    double candidate_logp_score = 0.;
-    for (const auto& [name, rel] : noisy_relations) {
-      candidate_logp_score += rel->logp_score();
-    }
-    logpx.push_back(candidate_logp_score - baseline_logp_score);
-
-    // Unincorporate the latent/noisy values for this candidate.
-    for (auto& [name, rel] : noisy_relations) {
-      for (const T_items& items : rel->base_to_noisy_items.at(base_items)) {
-        rel->unincorporate_from_cluster(items);
-      }
-    }
-    base_relation->unincorporate_from_cluster(base_items);
+    logpx.push_back(logp);
   }
   return logpx;
 }
@@ -148,23 +238,134 @@ std::vector<double> latent_values_incremental_logp(
 // base_relation/noisy_relations to a valid state.
 template <typename ValueType>
 void choose_and_incorporate_value(
-    std::mt19937* prng, T_items base_items,
-    std::vector<ValueType> latent_value_candidates, std::vector<double> logpx,
-    T_noisy_observations<ValueType> noisy_observations,
+    std::mt19937* prng, const T_items& base_items,
+    const std::vector<ValueType>& latent_value_candidates,
+    const std::vector<double>& logpx,
+    const T_noisy_observations<ValueType>& noisy_observations,
     Relation<ValueType>* base_relation,
-    std::unordered_map<std::string, NoisyRelation<ValueType>*>
+    const std::unordered_map<std::string, NoisyRelation<ValueType>*>&
         noisy_relations) {
   // Sample a new latent value.
   ValueType new_latent_value = latent_value_candidates[log_choice(logpx, prng)];
 
-  // Incorporate the new estimate of the latent value.
-  base_relation->incorporate_to_cluster(base_items, new_latent_value);
-  // Base relation needs to be updated manually since incorporate_to_cluster
-  // operates only on the underlying clusters.
+  // Restore the old latent value and the noisy observations to their
+  // clusters, then replace the old value with the new one through
+  // update_value, which keeps the clusters and the relations' data
+  // (including the base values of the noisy relations' emissions) in sync.
+  const ValueType old_latent_value = base_relation->get_value(base_items);
+  base_relation->incorporate_to_cluster(base_items, old_latent_value);
+  for (const auto& [name, rel] : noisy_relations) {
+    for (const auto& [items, v] : noisy_observations.at(name)) {
+      rel->incorporate_to_cluster(items, v);
+    }
+  }
   base_relation->update_value(base_items, new_latent_value);
-  for (auto& [name, rel] : noisy_relations) {
-    for (const T_items& items : rel->base_to_noisy_items.at(base_items)) {
-      rel->incorporate_to_cluster(items, noisy_observations.at(name).at(items));
+  for (const auto& [name, rel] : noisy_relations) {
+    for (const auto& [items, v] : noisy_observations.at(name)) {
+      rel->update_value(items, v);
+    }
+  }
+}
+
+// Splits the indices of base_items_list into rounds, such that no two items
+// in a round share a cluster of base_relation or of a noisy relation.  Items
+// that share a cluster are put in rounds in the order of base_items_list.
+template <typename ValueType>
+std::vector<std::vector<size_t>> conflict_free_rounds(
+    const std::vector<T_items>& base_items_list,
+    Relation<ValueType>* base_relation,
+    const std::unordered_map<std::string, NoisyRelation<ValueType>*>&
+        noisy_relations) {
+  typedef std::pair<const void*, std::vector<int>> T_cluster;
+  // The first round after the last one with an item in each cluster.
+  std::map<T_cluster, size_t> next_round;
+  std::vector<std::vector<size_t>> rounds;
+  std::vector<T_cluster> clusters;
+  for (size_t i = 0; i < base_items_list.size(); ++i) {
+    const T_items& base_items = base_items_list[i];
+    clusters.clear();
+    clusters.emplace_back(base_relation,
+                          base_relation->get_cluster_assignment(base_items));
+    for (const auto& [name, rel] : noisy_relations) {
+      auto it = rel->base_to_noisy_items.find(base_items);
+      if (it == rel->base_to_noisy_items.end()) {
+        continue;
+      }
+      for (const T_items& items : it->second) {
+        clusters.emplace_back(rel, rel->get_cluster_assignment(items));
+      }
+    }
+    size_t round = 0;
+    for (const T_cluster& c : clusters) {
+      auto it = next_round.find(c);
+      if (it != next_round.end()) {
+        round = std::max(round, it->second);
+      }
+    }
+    for (const T_cluster& c : clusters) {
+      next_round[c] = round + 1;
+    }
+    if (round == rounds.size()) {
+      rounds.emplace_back();
+    }
+    rounds[round].push_back(i);
+  }
+  return rounds;
+}
+
+// Transitions the latent value of each of base_items_list, as
+// transition_latent_value does, using the threads of pool.  The items of each
+// round of conflict_free_rounds are transitioned concurrently.  Each item
+// gets its own PRNG, seeded from prng in the order of base_items_list, so the
+// result does not depend on the size of pool.  The values nearest to the
+// consensus (see LatentValueProposalOptions) are taken from the base relation
+// as it was before the call.
+template <typename ValueType>
+void transition_latent_values(
+    std::mt19937* prng, const std::vector<T_items>& base_items_list,
+    Relation<ValueType>* base_relation,
+    const std::unordered_map<std::string, NoisyRelation<ValueType>*>&
+        noisy_relations,
+    ThreadPool* pool, const LatentValueProposalOptions& options = {}) {
+  std::unique_ptr<BaseClusterValues<ValueType>> base_cluster_values;
+  if (options.num_nearest > 0) {
+    base_cluster_values =
+        std::make_unique<BaseClusterValues<ValueType>>(*base_relation);
+  }
+  std::vector<std::vector<size_t>> rounds =
+      conflict_free_rounds(base_items_list, base_relation, noisy_relations);
+  std::vector<std::mt19937::result_type> seeds(base_items_list.size());
+  for (auto& seed : seeds) {
+    seed = (*prng)();
+  }
+
+  for (const std::vector<size_t>& round : rounds) {
+    std::vector<std::mt19937> prngs;
+    prngs.reserve(round.size());
+    for (size_t i : round) {
+      prngs.emplace_back(seeds[i]);
     }
+    std::vector<T_noisy_observations<ValueType>> noisy_observations(
+        round.size());
+    std::vector<std::vector<ValueType>> candidates(round.size());
+    // Unincorporating and incorporating only modify an item's own clusters,
+    // but the proposals read every emission cluster, so they are made while
+    // no cluster is being modified.
+    pool->parallel_for(round.size(), [&](size_t j) {
+      noisy_observations[j] = unincorporate_and_store_values(
+          base_items_list[round[j]], base_relation, noisy_relations);
+    });
+    pool->parallel_for(round.size(), [&](size_t j) {
+      candidates[j] = propose_latent_values(
+          &prngs[j], base_items_list[round[j]], noisy_observations[j],
+          base_relation, noisy_relations, options, base_cluster_values.get());
+    });
+    pool->parallel_for(round.size(), [&](size_t j) {
+      std::vector<double> logpx = latent_values_incremental_logp(
+          candidates[j], noisy_observations[j], noisy_relations);
+      choose_and_incorporate_value(&prngs[j], base_items_list[round[j]],
+                                   candidates[j], logpx, noisy_observations[j],
+                                   base_relation, noisy_relations);
+    });
   }
 }
@@ -4,13 +4,17 @@
 
 #include "transition_latent_value.hh"
 
+#include <algorithm>
 #include <boost/test/included/unit_test.hpp>
 #include <random>
+#include <set>
 #include <vector>
 
 #include "clean_relation.hh"
 #include "distributions/get_distribution.hh"
+#include "distributions/normal.hh"
 #include "domain.hh"
+#include "thread_pool.hh"
 
 namespace tt = boost::test_tools;
 
@@ -141,3 +145,225 @@ BOOST_AUTO_TEST_CASE(test_transition_latent_value_propose_clean_is_zeroprob) {
   BOOST_TEST(NR1.get_value(base_items) == "h5ll0");
   BOOST_TEST(NR2.get_value(base_items) == "123?");
 }
+
+BOOST_AUTO_TEST_CASE(test_latent_values_incremental_logp) {
+  std::mt19937 prng;
+  Domain D1("D1");
+  Domain D2("D2");
+  DistributionSpec base_spec("normal");
+  EmissionSpec em_spec("gaussian");
+
+  CleanRelation<double> base_relation("base", base_spec, {&D1});
+  base_relation.incorporate(&prng, {0}, 1.2);
+  base_relation.incorporate(&prng, {1}, 0.8);
+
+  NoisyRelation<double> NR1("NR1", em_spec, {&D1, &D2}, &base_relation);
+  NR1.incorporate(&prng, {0, 0}, 1.1);
+  NR1.incorporate(&prng, {0, 1}, 1.4);
+  NR1.incorporate(&prng, {0, 2}, 0.9);
+  NR1.incorporate(&prng, {1, 0}, 0.7);
+  std::unordered_map<std::string, NoisyRelation<double>*> noisy_relations = {
+      {"NR1", &NR1}};
+
+  T_noisy_observations<double> noisy_observations =
+      unincorporate_and_store_values({0}, &base_relation, noisy_relations);
+  std::vector<double> candidates = {1.1, 1.2, 5.0};
+  std::vector<double> logpx = latent_values_incremental_logp(
+      candidates, noisy_observations, noisy_relations);
+
+  // Each candidate's score is the change in NR1's score from incorporating
+  // the noisy observations with the candidate as their base value.
+  double baseline = NR1.logp_score();
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    for (const auto& [items, v] : noisy_observations.at("NR1")) {
+      NR1.emission_relation.incorporate_to_cluster(
+          items, std::make_pair(candidates[i], v));
+    }
+    BOOST_TEST(logpx[i] == NR1.logp_score() - baseline, tt::tolerance(1e-9));
+    for (const auto& [items, v] : noisy_observations.at("NR1")) {
+      NR1.emission_relation.clusters.at(NR1.get_cluster_assignment(items))
+          ->unincorporate(std::make_pair(candidates[i], v));
+    }
+  }
+  // A candidate far from the noisy observations scores lower.
+  BOOST_TEST(logpx[2] < logpx[0]);
+  BOOST_TEST(logpx[2] < logpx[1]);
+
+  choose_and_incorporate_value(&prng, {0}, candidates, logpx,
+                               noisy_observations, &base_relation,
+                               noisy_relations);
+  size_t chosen = std::find(candidates.begin(), candidates.end(),
+                            base_relation.get_value({0})) -
+                  candidates.begin();
+  BOOST_TEST(chosen < candidates.size());
+  BOOST_TEST(NR1.logp_score() == baseline + logpx[chosen], tt::tolerance(1e-9));
+}
+
+BOOST_AUTO_TEST_CASE(test_transition_latent_value_updates_clusters) {
+  std::mt19937 prng;
+  Domain D1("D1");
+  Domain D2("D2");
+  DistributionSpec base_spec("normal");
+  EmissionSpec em_spec("gaussian");
+
+  CleanRelation<double> base_relation("base", base_spec, {&D1});
+  base_relation.incorporate(&prng, {0}, 3.0);
+  base_relation.incorporate(&prng, {1}, 0.8);
+
+  NoisyRelation<double> NR1("NR1", em_spec, {&D1, &D2}, &base_relation);
+  NR1.incorporate(&prng, {0, 0}, 1.1);
+  NR1.incorporate(&prng, {0, 1}, 1.0);
+
+  transition_latent_value(&prng, {0}, &base_relation, {{"NR1", &NR1}});
+  double new_value = base_relation.get_value({0});
+  BOOST_TEST(new_value != 3.0);
+
+  // The clusters of both relations hold exactly the current values.
+  double n = 0.0;
+  double sum = 0.0;
+  for (const auto& [z, cluster] : base_relation.clusters) {
+    Normal* normal = dynamic_cast<Normal*>(cluster);
+    n += normal->N;
+    sum += normal->N * normal->mean;
+  }
+  BOOST_TEST(n == 2.0);
+  BOOST_TEST(sum == new_value + 0.8, tt::tolerance(1e-9));
+  for (const auto& [items, pair] : NR1.emission_relation.get_data()) {
+    BOOST_TEST(pair.first == new_value);
+  }
+}
+
+// A base relation of normal values with gaussian noisy observations, built
+// the same way every time.
+struct NoisyNormalModel {
+  Domain D1{"D1"};
+  Domain D2{"D2"};
+  CleanRelation<double> base{"base", DistributionSpec("normal"), {&D1}};
+  NoisyRelation<double> noisy{"noisy", EmissionSpec("gaussian"), {&D1, &D2},
+                              &base};
+
+  NoisyNormalModel() {
+    std::mt19937 prng(1);
+    std::normal_distribution<double> noise(0., 0.5);
+    for (int i = 0; i < 12; ++i) {
+      base.incorporate(&prng, {i}, i % 3);
+      for (int j = 0; j < 3; ++j) {
+        noisy.incorporate(&prng, {i, j}, i % 3 + noise(prng));
+      }
+    }
+  }
+};
+
+BOOST_AUTO_TEST_CASE(test_conflict_free_rounds) {
+  NoisyNormalModel m;
+  std::vector<T_items> base_items_list;
+  for (int i = 0; i < 12; ++i) {
+    base_items_list.push_back({i});
+  }
+  std::vector<std::vector<size_t>> rounds = conflict_free_rounds(
+      base_items_list, &m.base, {{"noisy", &m.noisy}});
+
+  std::vector<int> num_rounds(base_items_list.size(), 0);
+  for (const std::vector<size_t>& round : rounds) {
+    // No two items of a round share a cluster, although the noisy
+    // observations of one item may.
+    std::set<std::vector<int>> base_clusters;
+    std::set<std::vector<int>> noisy_clusters;
+    for (size_t i : round) {
+      ++num_rounds[i];
+      BOOST_TEST(base_clusters
+                     .insert(m.base.get_cluster_assignment(base_items_list[i]))
+                     .second);
+      std::set<std::vector<int>> item_clusters;
+      for (const T_items& items :
+           m.noisy.base_to_noisy_items.at(base_items_list[i])) {
+        item_clusters.insert(m.noisy.get_cluster_assignment(items));
+      }
+      for (const std::vector<int>& z : item_clusters) {
+        BOOST_TEST(noisy_clusters.insert(z).second);
+      }
+    }
+  }
+  for (int n : num_rounds) {
+    BOOST_TEST(n == 1);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_transition_latent_values_threads) {
+  NoisyNormalModel m1;
+  NoisyNormalModel m4;
+  std::vector<T_items> base_items_list;
+  for (int i = 0; i < 12; ++i) {
+    base_items_list.push_back({i});
+  }
+
+  std::mt19937 prng1(5);
+  ThreadPool pool1(1);
+  transition_latent_values(&prng1, base_items_list, &m1.base,
+                           {{"noisy", &m1.noisy}}, &pool1);
+  std::mt19937 prng4(5);
+  ThreadPool pool4(4);
+  transition_latent_values(&prng4, base_items_list, &m4.base,
+                           {{"noisy", &m4.noisy}}, &pool4);
+
+  // The result does not depend on the number of threads.
+  int num_changed = 0;
+  for (const T_items& items : base_items_list) {
+    BOOST_TEST(m1.base.get_value(items) == m4.base.get_value(items));
+    num_changed += m1.base.get_value(items) != items[0] % 3;
+  }
+  BOOST_TEST(num_changed > 0);
+  BOOST_TEST(m1.base.logp_score() == m4.base.logp_score());
+  BOOST_TEST(m1.noisy.logp_score() == m4.noisy.logp_score());
+  BOOST_TEST(m4.base.get_data().size() == 12);
+  BOOST_TEST(m4.noisy.get_data().size() == 36);
+}
+
+BOOST_AUTO_TEST_CASE(test_propose_latent_values) {
+  std::mt19937 prng;
+  Domain D1("D1");
+  Domain D2("D2");
+  CleanRelation<std::string> base_relation("base", DistributionSpec("bigram"),
+                                           {&D1});
+  base_relation.incorporate(&prng, {0}, "apple");
+  base_relation.incorporate(&prng, {1}, "apricot");
+  NoisyRelation<std::string> NR1("NR1", EmissionSpec("bigram"), {&D1, &D2},
+                                 &base_relation);
+  NR1.incorporate(&prng, {0, 0}, "aple");
+  NR1.incorporate(&prng, {0, 1}, "apple");
+  NR1.incorporate(&prng, {0, 2}, "appel");
+  NR1.incorporate(&prng, {0, 3}, "apple");
+  NR1.incorporate(&prng, {1, 0}, "aprikot");
+  std::unordered_map<std::string, NoisyRelation<std::string>*>
+      noisy_relations = {{"NR1", &NR1}};
+
+  BaseClusterValues<std::string> base_cluster_values(base_relation);
+  T_noisy_observations<std::string> noisy_observations =
+      unincorporate_and_store_values({0}, &base_relation, noisy_relations);
+  LatentValueProposalOptions options;
+  options.consensus = true;
+  options.num_nearest = 2;
+  std::vector<std::string> candidates =
+      propose_latent_values(&prng, {0}, noisy_observations, &base_relation,
+                            noisy_relations, options, &base_cluster_values);
+
+  // The consensus of the noisy observations comes first, and the candidates
+  // are distinct.
+  BOOST_TEST(candidates[0] == "apple");
+  std::set<std::string> distinct(candidates.begin(), candidates.end());
+  BOOST_TEST(distinct.size() == candidates.size());
+
+  // No more candidates are proposed than the maximum.
+  options.max_candidates = 1;
+  candidates =
+      propose_latent_values(&prng, {0}, noisy_observations, &base_relation,
+                            noisy_relations, options, &base_cluster_values);
+  BOOST_TEST(candidates == std::vector<std::string>({"apple"}));
+
+  std::vector<double> logpx = latent_values_incremental_logp(
+      candidates, noisy_observations, noisy_relations);
+  choose_and_incorporate_value(&prng, {0}, candidates, logpx,
+                               noisy_observations, &base_relation,
+                               noisy_relations);
+  BOOST_TEST(base_relation.get_value({0}) == "apple");
+}
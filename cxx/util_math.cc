@@ -4,12 +4,91 @@
 #include "util_math.hh"
 
 #include <algorithm>
+#include <cassert>
 #include <cmath>
+#include <limits>
+#include <numbers>
 #include <random>
 
+double log_gamma(double x) {
+  int sign;
+  return lgamma_r(x, &sign);
+}
+
 // http://matlab.izmiran.ru/help/techdoc/ref/betaln.html
 double lbeta(double z, double w) {
-  return lgamma(z) + lgamma(w) - lgamma(z + w);
+  return log_gamma(z) + log_gamma(w) - log_gamma(z + w);
+}
+
+namespace {
+
+// log I_nu(x) from the power series
+//   I_nu(x) = (x/2)^nu sum_k (x^2/4)^k / (k! Gamma(nu + k + 1)),
+// whose terms stay representable for moderate x.
+double log_bessel_i_series(double nu, double x) {
+  const double y = 0.25 * x * x;
+  double term = 1.0;
+  double sum = 1.0;
+  for (int k = 1; term > sum * 1e-17; ++k) {
+    term *= y / (k * (k + nu));
+    sum += term;
+  }
+  return nu * std::log(0.5 * x) - log_gamma(nu + 1.0) + std::log(sum);
+}
+
+// log I_nu(x) from the first terms of Debye's uniform asymptotic expansion
+// (Abramowitz and Stegun 9.7.7), accurate to about 1e-9 for nu >= 30.
+double log_bessel_i_uniform(double nu, double x) {
+  const double z = x / nu;
+  const double s = std::sqrt(1.0 + z * z);
+  const double p = 1.0 / s;
+  const double p2 = p * p;
+  const double u1 = p * (3.0 - 5.0 * p2) / 24.0;
+  const double u2 = p2 * (81.0 + p2 * (-462.0 + p2 * 385.0)) / 1152.0;
+  const double u3 =
+      p * p2 *
+      (30375.0 + p2 * (-369603.0 + p2 * (765765.0 - p2 * 425425.0))) /
+      414720.0;
+  const double u4 =
+      p2 * p2 *
+      (4465125.0 +
+       p2 * (-94121676.0 +
+             p2 * (349922430.0 + p2 * (-446185740.0 + p2 * 185910725.0)))) /
+      39813120.0;
+  const double inv_nu = 1.0 / nu;
+  return nu * (s + std::log(z / (1.0 + s))) -
+         0.5 * std::log(2.0 * std::numbers::pi * nu) - 0.5 * std::log(s) +
+         std::log1p(inv_nu * (u1 + inv_nu * (u2 + inv_nu * (u3 + inv_nu * u4))));
+}
+
+}  // namespace
+
+double log_bessel_i(double nu, double x) {
+  assert(nu >= 0.0 && x >= 0.0);
+  if (x == 0.0) {
+    return nu == 0.0 ? 0.0 : -std::numeric_limits<double>::infinity();
+  }
+  const double kMaxSeriesX = 20.0;
+  const double kMinUniformNu = 30.0;
+  if (x <= kMaxSeriesX) {
+    return log_bessel_i_series(nu, x);
+  }
+  if (nu >= kMinUniformNu) {
+    return log_bessel_i_uniform(nu, x);
+  }
+  // For small orders and large x, start from the uniform expansion at
+  // kMinUniformNu and run the recurrence I_{n-1} = I_{n+1} + (2n/x) I_n down
+  // to nu, which is stable in that direction.  It is carried out on the
+  // ratios q_n = I_n / I_{n-1}, whose product stays in range.
+  const double top = nu + std::ceil(kMinUniformNu - nu);
+  const double log_i_top = log_bessel_i_uniform(top, x);
+  double q = std::exp(log_bessel_i_uniform(top + 1.0, x) - log_i_top);
+  double ratio = 1.0;
+  for (double n = top; n > nu; n -= 1.0) {
+    q = 1.0 / (2.0 * n / x + q);
+    ratio *= q;
+  }
+  return log_i_top - std::log(ratio);
 }
 
 std::vector<double> linspace(double start, double stop, int num,
@@ -108,3 +187,19 @@ int sample_from_logps(const std::vector<double>& log_probs,
   std::discrete_distribution<int> dd(weights.begin(), weights.end());
   return dd(*prng);
 }
+
+int sample_from_logps_skipping_nans(const std::vector<double>& log_probs,
+                                    std::mt19937* prng) {
+  std::vector<double> finite_logps;
+  std::vector<int> indices;
+  for (int i = 0; i < std::ssize(log_probs); ++i) {
+    if (!std::isnan(log_probs[i])) {
+      finite_logps.push_back(log_probs[i]);
+      indices.push_back(i);
+    }
+  }
+  if (indices.empty()) {
+    return -1;
+  }
+  return indices[sample_from_logps(finite_logps, prng)];
+}
@@ -6,8 +6,17 @@
 #include <random>
 #include <vector>
 
+// lgamma(x), but via lgamma_r, which doesn't write the global signgam, so it
+// may be called from several threads at once.
+double log_gamma(double x);
+
 double lbeta(double z, double w);
 
+// log I_nu(x), where I_nu is the modified Bessel function of the first kind,
+// for nu >= 0 and x >= 0.  Unlike std::log(std::cyl_bessel_i(nu, x)), this
+// doesn't overflow for large x or underflow for large nu.
+double log_bessel_i(double nu, double x);
+
 std::vector<double> linspace(double start, double stop, int num, bool endpoint);
 std::vector<double> log_linspace(double start, double stop, int num,
                                  bool endpoint);
@@ -22,3 +31,8 @@ std::vector<std::vector<int>> product(
 
 // Given a vector of log probabilities, return a sample.
 int sample_from_logps(const std::vector<double>& log_probs, std::mt19937* prng);
+
+// Like sample_from_logps, but entries that are nan are never sampled. Returns
+// -1 if every entry is nan.
+int sample_from_logps_skipping_nans(const std::vector<double>& log_probs,
+                                    std::mt19937* prng);
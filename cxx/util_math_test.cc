@@ -48,6 +48,27 @@ BOOST_AUTO_TEST_CASE(test_lbeta) {
   BOOST_CHECK_CLOSE(lbeta(5, 6), lbeta(4, 6) + log(4. / (4 + 6)), 1e-6);
 }
 
+BOOST_AUTO_TEST_CASE(test_log_bessel_i) {
+  for (double nu : {0.0, 1.0, 2.0, 7.0, 29.0, 30.0, 45.0, 120.0}) {
+    for (double x : {1e-3, 0.5, 3.0, 19.0, 21.0, 80.0, 300.0}) {
+      double expected = std::log(std::cyl_bessel_i(nu, x));
+      if (expected > -700.0) {
+        BOOST_TEST(log_bessel_i(nu, x) == expected, tt::tolerance(1e-8));
+      }
+    }
+  }
+  BOOST_TEST(log_bessel_i(0.0, 0.0) == 0.0);
+  BOOST_TEST(std::isinf(log_bessel_i(3.0, 0.0)));
+  BOOST_TEST(std::isfinite(log_bessel_i(120.0, 1e-3)));
+
+  // std::cyl_bessel_i overflows here; I_0(x) ~ e^x / sqrt(2 pi x).
+  double x = 5000.0;
+  BOOST_TEST(log_bessel_i(0.0, x) ==
+                 x - 0.5 * std::log(2.0 * std::numbers::pi * x) +
+                     std::log1p(1.0 / (8.0 * x) + 9.0 / (128.0 * x * x)),
+             tt::tolerance(1e-12));
+}
+
 BOOST_AUTO_TEST_CASE(test_linspace) {
   check_linspace(0., 0.2, 3, true, /*log_space=*/false);
   check_linspace(0., 0.2, 3, false, /*log_space=*/false);
@@ -131,6 +152,17 @@ BOOST_AUTO_TEST_CASE(test_sample_from_logps_all_small) {
   BOOST_TEST(0 == sample_from_logps(logps, &prng));
 }
 
+BOOST_AUTO_TEST_CASE(test_sample_from_logps_skipping_nans) {
+  std::mt19937 prng;
+  std::vector<double> logps = {std::nan(""), -20.0, std::nan(""), 5.0};
+  for (int i = 0; i < 10; ++i) {
+    int j = sample_from_logps_skipping_nans(logps, &prng);
+    BOOST_TEST((j == 1 || j == 3));
+  }
+  std::vector<double> all_nan = {std::nan(""), std::nan("")};
+  BOOST_TEST(sample_from_logps_skipping_nans(all_nan, &prng) == -1);
+}
+
 BOOST_AUTO_TEST_CASE(test_sample_from_logps) {
   std::vector<double> probs = {0.3, 0.1, 0.05, 0.1, 0.24, 0.11, 0., 0.1};
   std::vector<double> logps;